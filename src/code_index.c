@@ -0,0 +1,550 @@
+#define _GNU_SOURCE
+#include "code_index.h"
+#include "hash.h"
+#include "buffer.h"
+#include "map.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+
+// ============================================================================
+// Tokens
+// ============================================================================
+
+typedef enum {
+    TOKEN_IDENT,                   // Identifier or keyword
+    TOKEN_STRING,                  // String or character literal, quotes included
+    TOKEN_OTHER,                   // Number, operator or punctuation
+    TOKEN_NEWLINE                  // One or more line breaks
+} TokenKind;
+
+typedef struct Token {
+    TokenKind kind;
+    const char* text;              // Points into the source
+    size_t len;
+} Token;
+
+typedef struct TokenList {
+    Token* items;
+    size_t count;
+    size_t capacity;
+} TokenList;
+
+static void push_token(TokenList* list, TokenKind kind, const char* text, size_t len) {
+    // Line breaks separate statements; how many there are does not matter
+    if (kind == TOKEN_NEWLINE && (list->count == 0 || list->items[list->count - 1].kind == TOKEN_NEWLINE)) {
+        return;
+    }
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 256;
+        list->items = rebuild_realloc(list->items, list->capacity * sizeof(Token));
+    }
+    list->items[list->count++] = (Token){kind, text, len};
+}
+
+static bool is_ident_start(char c) {
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+static bool is_ident_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+// Split UMKA source into tokens, dropping comments and whitespace
+// Returns false on an unterminated comment or literal
+static bool tokenize(const char* src, size_t len, TokenList* out) {
+    size_t i = 0;
+    while (i < len) {
+        char c = src[i];
+        if (c == '\n') {
+            push_token(out, TOKEN_NEWLINE, src + i, 1);
+            i++;
+        } else if (isspace((unsigned char)c)) {
+            i++;
+        } else if (c == '/' && i + 1 < len && src[i + 1] == '/') {
+            while (i < len && src[i] != '\n') i++;
+        } else if (c == '/' && i + 1 < len && src[i + 1] == '*') {
+            const char* end = memmem(src + i + 2, len - i - 2, "*/", 2);
+            if (!end) return false;
+            if (memchr(src + i, '\n', (size_t)(end - src) - i)) {
+                push_token(out, TOKEN_NEWLINE, src + i, 1);
+            }
+            i = (size_t)(end - src) + 2;
+        } else if (c == '"' || c == '\'') {
+            size_t start = i++;
+            while (i < len && src[i] != c) {
+                if (src[i] == '\n') return false;
+                i += (src[i] == '\\') ? 2 : 1;
+            }
+            if (i >= len) return false;
+            i++;
+            push_token(out, TOKEN_STRING, src + start, i - start);
+        } else if (is_ident_start(c)) {
+            size_t start = i;
+            while (i < len && is_ident_char(src[i])) i++;
+            push_token(out, TOKEN_IDENT, src + start, i - start);
+        } else if (isdigit((unsigned char)c)) {
+            size_t start = i;
+            while (i < len && (is_ident_char(src[i]) || src[i] == '.')) i++;
+            push_token(out, TOKEN_OTHER, src + start, i - start);
+        } else if (c == ':' && i + 1 < len && src[i + 1] == ':') {
+            push_token(out, TOKEN_OTHER, src + i, 2);
+            i += 2;
+        } else {
+            push_token(out, TOKEN_OTHER, src + i, 1);
+            i++;
+        }
+    }
+    return true;
+}
+
+static bool token_is(const Token* t, const char* text) {
+    size_t len = strlen(text);
+    return t->kind != TOKEN_STRING && t->kind != TOKEN_NEWLINE && t->len == len &&
+           memcmp(t->text, text, len) == 0;
+}
+
+static int depth_change(const Token* t) {
+    if (t->kind != TOKEN_OTHER || t->len != 1) return 0;
+    switch (t->text[0]) {
+        case '(': case '[': case '{': return 1;
+        case ')': case ']': case '}': return -1;
+        default: return 0;
+    }
+}
+
+// Index just past the bracket that closes the one at open, or count
+static size_t skip_group(const TokenList* tokens, size_t open, size_t end) {
+    int depth = 0;
+    for (size_t i = open; i < end; i++) {
+        depth += depth_change(&tokens->items[i]);
+        if (depth == 0) return i + 1;
+    }
+    return end;
+}
+
+// ============================================================================
+// Index
+// ============================================================================
+
+// A top-level declaration
+typedef struct Decl {
+    size_t begin;                  // First token
+    size_t end;                    // One past the last token
+    Hash hash;                     // Normalized tokens
+    size_t* refs;                  // Declarations it names
+    size_t ref_count;
+    size_t* modules;               // Imports it uses
+    size_t module_count;
+} Decl;
+
+// Link in the list of declarations sharing a name
+typedef struct NameRef {
+    size_t decl;
+    size_t next;                   // Index + 1 of the next link, 0 at the end
+} NameRef;
+
+typedef struct Module {
+    char* alias;                   // Name the build file refers to it by
+    Hash hash;
+} Module;
+
+struct CodeIndex {
+    bool whole_file;               // Did not tokenize: hash the file as a whole
+    Hash file_hash;
+    Decl* decls;
+    size_t decl_count;
+    NameRef* name_refs;
+    size_t name_ref_count;
+    Map* names;                    // name -> index + 1 of the first NameRef
+    Module* modules;
+    size_t module_count;
+};
+
+static char* token_dup(const Token* t) {
+    char* s = rebuild_malloc(t->len + 1);
+    memcpy(s, t->text, t->len);
+    s[t->len] = '\0';
+    return s;
+}
+
+static void add_name(CodeIndex* index, const Token* name, size_t decl) {
+    index->name_refs = rebuild_realloc(index->name_refs, (index->name_ref_count + 1) * sizeof(NameRef));
+    char* key = token_dup(name);
+    index->name_refs[index->name_ref_count] = (NameRef){decl, (size_t)(uintptr_t)map_get(index->names, key)};
+    index->name_ref_count++;
+    map_set(index->names, key, (void*)(uintptr_t)index->name_ref_count);
+    rebuild_free(key);
+}
+
+// Names declared by an identifier list: a, b, c
+static size_t add_name_list(CodeIndex* index, const TokenList* tokens, size_t i, size_t end, size_t decl) {
+    while (i < end && tokens->items[i].kind == TOKEN_IDENT) {
+        add_name(index, &tokens->items[i], decl);
+        if (i + 2 < end && token_is(&tokens->items[i + 1], ",")) {
+            i += 2;
+        } else {
+            return i + 1;
+        }
+    }
+    return i;
+}
+
+// Names declared by type, const or var, alone or grouped in ( ... )
+static void add_decl_names(CodeIndex* index, const TokenList* tokens, size_t i, size_t end, size_t decl) {
+    if (i >= end || !token_is(&tokens->items[i], "(")) {
+        add_name_list(index, tokens, i, end, decl);
+        return;
+    }
+
+    size_t close = skip_group(tokens, i, end);
+    bool item_start = true;
+    int depth = 0;
+    for (size_t k = i + 1; k + 1 < close; k++) {
+        const Token* t = &tokens->items[k];
+        if (depth == 0 && item_start && t->kind == TOKEN_IDENT) {
+            k = add_name_list(index, tokens, k, close - 1, decl) - 1;
+            item_start = false;
+            continue;
+        }
+        depth += depth_change(t);
+        if (depth == 0 && (t->kind == TOKEN_NEWLINE || token_is(t, ";"))) {
+            item_start = true;
+        }
+    }
+}
+
+static void add_module(CodeIndex* index, const char* build_dir, const Token* alias, const Token* path,
+                       CodeModuleHashFn module_hash, void* user_data) {
+    char* rel = rebuild_malloc(path->len - 1);
+    memcpy(rel, path->text + 1, path->len - 2);
+    rel[path->len - 2] = '\0';
+
+    char* full = NULL;
+    if (rel[0] == '/' || !build_dir) {
+        full = rebuild_strdup(rel);
+    } else if (asprintf(&full, "%s/%s", build_dir, rel) < 0) {
+        full = NULL;
+    }
+
+    // Without an alias the module is known by its file name
+    char* name;
+    if (alias) {
+        name = token_dup(alias);
+    } else {
+        const char* base = strrchr(rel, '/');
+        name = rebuild_strdup(base ? base + 1 : rel);
+        char* ext = strrchr(name, '.');
+        if (ext) *ext = '\0';
+    }
+
+    Hash hash;
+    bool hashed = full && (module_hash ? module_hash(full, &hash, user_data) : hash_file(full, &hash));
+    if (!hashed) {
+        // Built in (std.um) or missing: the path is all there is to go on
+        LOG_DEBUG("Cannot hash imported module %s, using its path", rel);
+        hash_data(rel, strlen(rel), &hash);
+    }
+
+    index->modules = rebuild_realloc(index->modules, (index->module_count + 1) * sizeof(Module));
+    index->modules[index->module_count++] = (Module){name, hash};
+    rebuild_free(full);
+    rebuild_free(rel);
+}
+
+// import "a.um", import b = "b.um", or either grouped in ( ... )
+static void add_imports(CodeIndex* index, const TokenList* tokens, size_t i, size_t end, const char* build_dir,
+                        CodeModuleHashFn module_hash, void* user_data) {
+    for (; i < end; i++) {
+        const Token* t = &tokens->items[i];
+        if (t->kind != TOKEN_STRING || t->len < 2) continue;
+
+        const Token* alias = NULL;
+        if (i >= 2 && token_is(&tokens->items[i - 1], "=") && tokens->items[i - 2].kind == TOKEN_IDENT) {
+            alias = &tokens->items[i - 2];
+        }
+        add_module(index, build_dir, alias, t, module_hash, user_data);
+    }
+}
+
+static bool decl_start(const TokenList* tokens, size_t i, bool* is_import) {
+    const Token* t = &tokens->items[i];
+    *is_import = token_is(t, "import");
+    if (*is_import || token_is(t, "fn") || token_is(t, "type") || token_is(t, "const") || token_is(t, "var")) {
+        return true;
+    }
+    // Short variable declaration: name := value
+    return t->kind == TOKEN_IDENT && i + 2 < tokens->count && token_is(&tokens->items[i + 1], ":") &&
+           token_is(&tokens->items[i + 2], "=");
+}
+
+// Hash a declaration's tokens, one space between tokens on a line
+static void hash_decl(const TokenList* tokens, Decl* decl) {
+    Buffer* buf = buffer_create(0);
+    for (size_t i = decl->begin; i < decl->end; i++) {
+        const Token* t = &tokens->items[i];
+        if (t->kind == TOKEN_NEWLINE) {
+            if (i + 1 < decl->end) buffer_append_char(buf, '\n');
+            continue;
+        }
+        if (i > decl->begin && tokens->items[i - 1].kind != TOKEN_NEWLINE) {
+            buffer_append_char(buf, ' ');
+        }
+        buffer_append(buf, t->text, t->len);
+    }
+    hash_data(buffer_data(buf), buffer_size(buf), &decl->hash);
+    buffer_free(buf);
+}
+
+static size_t find_module(const CodeIndex* index, const Token* alias) {
+    for (size_t m = 0; m < index->module_count; m++) {
+        const char* name = index->modules[m].alias;
+        if (strlen(name) == alias->len && memcmp(name, alias->text, alias->len) == 0) return m;
+    }
+    return SIZE_MAX;
+}
+
+// Record the declarations and modules a declaration names
+// seen is scratch space of decl_count + module_count entries
+static void resolve_refs(CodeIndex* index, const TokenList* tokens, size_t d, size_t* seen) {
+    Decl* decl = &index->decls[d];
+    size_t stamp = d + 1;
+
+    for (size_t i = decl->begin; i < decl->end; i++) {
+        const Token* t = &tokens->items[i];
+        if (t->kind != TOKEN_IDENT) continue;
+        if (i > decl->begin && token_is(&tokens->items[i - 1], "::")) continue;  // Member of a module
+
+        if (i + 1 < decl->end && token_is(&tokens->items[i + 1], "::")) {
+            size_t m = find_module(index, t);
+            if (m != SIZE_MAX && seen[index->decl_count + m] != stamp) {
+                seen[index->decl_count + m] = stamp;
+                decl->modules = rebuild_realloc(decl->modules, (decl->module_count + 1) * sizeof(size_t));
+                decl->modules[decl->module_count++] = m;
+            }
+            continue;
+        }
+
+        char* name = token_dup(t);
+        size_t link = (size_t)(uintptr_t)map_get(index->names, name);
+        rebuild_free(name);
+        for (; link; link = index->name_refs[link - 1].next) {
+            size_t target = index->name_refs[link - 1].decl;
+            if (target == d || seen[target] == stamp) continue;
+            seen[target] = stamp;
+            decl->refs = rebuild_realloc(decl->refs, (decl->ref_count + 1) * sizeof(size_t));
+            decl->refs[decl->ref_count++] = target;
+        }
+    }
+}
+
+static bool build_index(CodeIndex* index, const TokenList* tokens, const char* build_dir,
+                        CodeModuleHashFn module_hash, void* user_data) {
+    // Split the file at declarations that start a top-level statement
+    int depth = 0;
+    bool statement_start = true;
+    bool in_import = false;
+    size_t import_begin = 0;
+    Decl* current = NULL;
+
+    for (size_t i = 0; i <= tokens->count; i++) {
+        bool is_import = false;
+        bool starts = i == tokens->count ||
+                      (depth == 0 && statement_start && decl_start(tokens, i, &is_import));
+        if (starts) {
+            if (current) current->end = i;
+            if (in_import) add_imports(index, tokens, import_begin, i, build_dir, module_hash, user_data);
+            current = NULL;
+            in_import = is_import;
+            import_begin = i;
+            if (i == tokens->count) break;
+            if (!is_import) {
+                index->decls = rebuild_realloc(index->decls, (index->decl_count + 1) * sizeof(Decl));
+                current = &index->decls[index->decl_count++];
+                memset(current, 0, sizeof(Decl));
+                current->begin = i;
+            }
+        }
+
+        const Token* t = &tokens->items[i];
+        depth += depth_change(t);
+        if (depth < 0) return false;
+        statement_start = depth == 0 && (t->kind == TOKEN_NEWLINE || token_is(t, ";"));
+    }
+    if (depth != 0) return false;
+
+    // What each declaration declares
+    for (size_t d = 0; d < index->decl_count; d++) {
+        Decl* decl = &index->decls[d];
+        size_t i = decl->begin;
+        const Token* keyword = &tokens->items[i];
+        hash_decl(tokens, decl);
+
+        if (token_is(keyword, "fn")) {
+            i++;
+            if (i < decl->end && token_is(&tokens->items[i], "(")) {
+                i = skip_group(tokens, i, decl->end);  // Method receiver
+            }
+            if (i < decl->end && tokens->items[i].kind == TOKEN_IDENT) {
+                add_name(index, &tokens->items[i], d);
+            }
+        } else if (token_is(keyword, "type") || token_is(keyword, "const") || token_is(keyword, "var")) {
+            add_decl_names(index, tokens, i + 1, decl->end, d);
+        } else {
+            add_name(index, keyword, d);
+        }
+    }
+
+    // ... and what it refers to
+    size_t* seen = rebuild_calloc(index->decl_count + index->module_count + 1, sizeof(size_t));
+    for (size_t d = 0; d < index->decl_count; d++) {
+        resolve_refs(index, tokens, d, seen);
+    }
+    rebuild_free(seen);
+    return true;
+}
+
+static char* read_source(const char* path, size_t* len) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        LOG_ERROR("Failed to open build file: %s", path);
+        return NULL;
+    }
+
+    Buffer* buf = buffer_create(0);
+    char chunk[8192];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        buffer_append(buf, chunk, n);
+    }
+    bool ok = !ferror(file);
+    fclose(file);
+
+    char* src = ok ? buffer_to_string(buf) : NULL;
+    *len = buffer_size(buf);
+    buffer_free(buf);
+    if (!ok) LOG_ERROR("Failed to read build file: %s", path);
+    return src;
+}
+
+CodeIndex* code_index_create(const char* path, CodeModuleHashFn module_hash, void* user_data) {
+    if (!path) return NULL;
+
+    size_t len;
+    char* src = read_source(path, &len);
+    if (!src) return NULL;
+
+    CodeIndex* index = rebuild_calloc(1, sizeof(CodeIndex));
+    index->names = map_create(0);
+    hash_data(src, len, &index->file_hash);
+
+    char* build_dir = rebuild_strdup(path);
+    char* slash = strrchr(build_dir, '/');
+    if (slash) {
+        *slash = '\0';
+    } else {
+        rebuild_free(build_dir);
+        build_dir = NULL;
+    }
+
+    TokenList tokens = {0};
+    if (!tokenize(src, len, &tokens) || !build_index(index, &tokens, build_dir, module_hash, user_data)) {
+        LOG_WARN("Cannot split %s into declarations; any change to it invalidates every recipe", path);
+        index->whole_file = true;
+    } else {
+        LOG_DEBUG("Indexed %zu declarations and %zu imports in %s", index->decl_count, index->module_count, path);
+    }
+
+    rebuild_free(tokens.items);
+    rebuild_free(build_dir);
+    rebuild_free(src);
+    return index;
+}
+
+void code_index_free(CodeIndex* index) {
+    if (!index) return;
+
+    for (size_t d = 0; d < index->decl_count; d++) {
+        rebuild_free(index->decls[d].refs);
+        rebuild_free(index->decls[d].modules);
+    }
+    for (size_t m = 0; m < index->module_count; m++) {
+        rebuild_free(index->modules[m].alias);
+    }
+    rebuild_free(index->decls);
+    rebuild_free(index->name_refs);
+    rebuild_free(index->modules);
+    map_free(index->names, NULL);
+    rebuild_free(index);
+}
+
+static int compare_hashes(const void* a, const void* b) {
+    return memcmp(a, b, sizeof(Hash));
+}
+
+bool code_index_function_hash(const CodeIndex* index, const char* fn_name, Hash* out) {
+    if (!index || !fn_name || !out) return false;
+
+    if (index->whole_file) {
+        Buffer* buf = buffer_create(0);
+        buffer_append(buf, &index->file_hash, sizeof(Hash));
+        buffer_append_str(buf, fn_name);
+        hash_data(buffer_data(buf), buffer_size(buf), out);
+        buffer_free(buf);
+        return true;
+    }
+
+    size_t link = (size_t)(uintptr_t)map_get(index->names, fn_name);
+    if (!link) return false;
+
+    // Everything reachable from the function's declaration
+    bool* reached = rebuild_calloc(index->decl_count + index->module_count + 1, sizeof(bool));
+    size_t* stack = rebuild_malloc((index->decl_count + 1) * sizeof(size_t));
+    size_t top = 0;
+    for (; link; link = index->name_refs[link - 1].next) {
+        size_t d = index->name_refs[link - 1].decl;
+        if (!reached[d]) {
+            reached[d] = true;
+            stack[top++] = d;
+        }
+    }
+    while (top > 0) {
+        const Decl* decl = &index->decls[stack[--top]];
+        for (size_t r = 0; r < decl->ref_count; r++) {
+            if (!reached[decl->refs[r]]) {
+                reached[decl->refs[r]] = true;
+                stack[top++] = decl->refs[r];
+            }
+        }
+        for (size_t m = 0; m < decl->module_count; m++) {
+            reached[index->decl_count + decl->modules[m]] = true;
+        }
+    }
+    rebuild_free(stack);
+
+    // Sorted, so the order of declarations in the file does not matter
+    Hash* hashes = rebuild_malloc((index->decl_count + index->module_count + 1) * sizeof(Hash));
+    size_t decl_hashes = 0;
+    for (size_t d = 0; d < index->decl_count; d++) {
+        if (reached[d]) hashes[decl_hashes++] = index->decls[d].hash;
+    }
+    qsort(hashes, decl_hashes, sizeof(Hash), compare_hashes);
+    size_t count = decl_hashes;
+    for (size_t m = 0; m < index->module_count; m++) {
+        if (reached[index->decl_count + m]) hashes[count++] = index->modules[m].hash;
+    }
+    qsort(hashes + decl_hashes, count - decl_hashes, sizeof(Hash), compare_hashes);
+
+    Buffer* buf = buffer_create(count * sizeof(Hash) + sizeof(uint64_t));
+    uint64_t n = decl_hashes;
+    buffer_append(buf, &n, sizeof(n));
+    buffer_append(buf, hashes, count * sizeof(Hash));
+    hash_data(buffer_data(buf), buffer_size(buf), out);
+    buffer_free(buf);
+
+    rebuild_free(hashes);
+    rebuild_free(reached);
+    return true;
+}
@@ -0,0 +1,42 @@
+#ifndef REBUILD_CODE_INDEX_H
+#define REBUILD_CODE_INDEX_H
+
+#include "common.h"
+#include <stdbool.h>
+
+// Per-function hashes of a build file's recipe code
+//
+// The build file is split into its top-level declarations (functions,
+// methods, types, constants, variables), each hashed from its tokens so
+// comments, indentation and blank lines do not count. A function's hash
+// covers its own declaration, every declaration it names, transitively, and
+// the imported modules it uses (alias::name). Editing one recipe therefore
+// changes the hash of that recipe and of those that call it, and nothing
+// else; moving declarations around changes nothing.
+//
+// Names are matched without scoping, so a local that shadows a global
+// still depends on it. That only ever costs a spurious rebuild.
+//
+// An index is read-only once created and safe to query from any thread.
+
+typedef struct CodeIndex CodeIndex;
+
+// Hash an imported module (path resolved relative to the build file)
+// Returns false if the module cannot be read; its path is hashed instead
+typedef bool (*CodeModuleHashFn)(const char* path, Hash* out, void* user_data);
+
+// Index the build file at path, hashing each module it imports with
+// module_hash (NULL: hash the module file)
+// A file that does not tokenize is indexed as a whole: every function then
+// hashes to the whole file plus its name
+// Returns NULL if the file cannot be read
+CodeIndex* code_index_create(const char* path, CodeModuleHashFn module_hash, void* user_data);
+
+// Free an index
+void code_index_free(CodeIndex* index);
+
+// Hash of the code function fn_name runs
+// Returns false if the build file declares no such function
+bool code_index_function_hash(const CodeIndex* index, const char* fn_name, Hash* out);
+
+#endif // REBUILD_CODE_INDEX_H
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "common.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -6,12 +7,17 @@
 #include <time.h>
 
 // Logging with timestamp and level
+// Safe to call from worker threads: each message is written under the
+// stderr stream lock so lines from concurrent recipes never interleave
 void rebuild_log(const char* level, const char* fmt, ...) {
     // Get current time
     time_t now = time(NULL);
-    struct tm* tm_info = localtime(&now);
+    struct tm tm_info;
+    localtime_r(&now, &tm_info);
     char time_buf[32];
-    strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", tm_info);
+    strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", &tm_info);
+
+    flockfile(stderr);
 
     // Print timestamp and level
     fprintf(stderr, "[%s] %s: ", time_buf, level);
@@ -24,6 +30,8 @@ void rebuild_log(const char* level, const char* fmt, ...) {
 
     fprintf(stderr, "\n");
     fflush(stderr);
+
+    funlockfile(stderr);
 }
 
 // Memory allocation wrappers with error checking
@@ -0,0 +1,519 @@
+#define _GNU_SOURCE
+#include "gc.h"
+#include "hash.h"
+#include "map.h"
+#include "set.h"
+#include "objects.h"
+#include "trace_pack.h"
+#include <uv.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define GC_LOCK_FILE "gc.lock"     // Held while collecting; its mtime is the last run
+#define HEX_LEN 64
+
+// An object file in objects/
+typedef struct ObjectInfo {
+    uint64_t bytes;                // Space it takes on disk
+    uint64_t mtime_ns;             // Stored, or last stored again
+    size_t refs;                   // References from the variants being kept
+} ObjectInfo;
+
+// A trace variant and the objects its output tree refers to
+typedef struct GcVariant {
+    TracePackVariant v;
+    ObjectInfo** objects;          // Only those present in objects/
+    size_t object_count;
+    bool dropped;
+} GcVariant;
+
+typedef struct KeepContext {
+    const Set* dropped;            // variant_id of the variants to drop
+    uint64_t cutoff_ns;
+} KeepContext;
+
+static uint64_t now_ns(void) {
+    uv_timespec64_t now;
+    if (uv_clock_gettime(UV_CLOCK_REALTIME, &now) != 0) {
+        return 0;
+    }
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t stat_mtime_ns(const struct stat* st) {
+    return (uint64_t)st->st_mtim.tv_sec * 1000000000ULL + (uint64_t)st->st_mtim.tv_nsec;
+}
+
+static void to_hex(const uint8_t* bytes, size_t len, char* out) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; i++) {
+        out[2 * i] = digits[bytes[i] >> 4];
+        out[2 * i + 1] = digits[bytes[i] & 15];
+    }
+    out[2 * len] = '\0';
+}
+
+// "<key hex>-<inputs hex>": names one variant of one request key
+static void variant_id(const TracePackVariant* v, char out[HEX_LEN + 18]) {
+    to_hex(v->request_key.bytes, sizeof(v->request_key.bytes), out);
+    snprintf(out + HEX_LEN, 18, "-%016llx", (unsigned long long)v->inputs);
+}
+
+// ============================================================================
+// Temporary directories
+// ============================================================================
+
+static int remove_entry(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+    (void)st;
+    (void)type;
+    (void)ftw;
+    if (remove(path) != 0 && errno != ENOENT) {
+        LOG_WARN("Failed to remove %s: %s", path, strerror(errno));
+    }
+    return 0;
+}
+
+// Whether tmp/<name> belongs to a rebuild process that is gone
+// Names are <target>_<time>_<pid> (storage_get_tmp_dir)
+static bool tmp_dir_orphaned(const char* name) {
+    const char* sep = strrchr(name, '_');
+    if (!sep || sep == name) {
+        return false;
+    }
+    char* end = NULL;
+    errno = 0;
+    long pid = strtol(sep + 1, &end, 10);
+    if (errno != 0 || end == sep + 1 || *end != '\0' || pid <= 0) {
+        return false;
+    }
+    const char* time_sep = sep - 1;
+    while (time_sep > name && *time_sep != '_') time_sep--;
+    if (*time_sep != '_' || time_sep + 1 == sep) {
+        return false;
+    }
+
+    if ((pid_t)pid == getpid()) {
+        return false;
+    }
+    return kill((pid_t)pid, 0) != 0 && errno == ESRCH;
+}
+
+static size_t remove_orphaned_tmp_dirs(Storage* s) {
+    DIR* d = opendir(s->tmp_dir);
+    if (!d) {
+        return 0;
+    }
+
+    size_t removed = 0;
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.' || !tmp_dir_orphaned(entry->d_name)) {
+            continue;
+        }
+        char* path = NULL;
+        if (asprintf(&path, "%s/%s", s->tmp_dir, entry->d_name) < 0) {
+            break;
+        }
+        nftw(path, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+        if (access(path, F_OK) != 0) {
+            removed++;
+        }
+        rebuild_free(path);
+    }
+    closedir(d);
+    return removed;
+}
+
+// ============================================================================
+// Objects
+// ============================================================================
+
+// Index every object in objects/ by hex name; *total_bytes receives their size
+// Interrupted writes (name.XXXXXX) older than cutoff_ns are removed
+static bool scan_objects(Storage* s, Map* objects, uint64_t cutoff_ns, uint64_t* total_bytes) {
+    DIR* top = opendir(s->objects_dir);
+    if (!top) {
+        LOG_ERROR("Failed to read %s: %s", s->objects_dir, strerror(errno));
+        return false;
+    }
+
+    bool ok = true;
+    struct dirent* shard;
+    while (ok && (shard = readdir(top)) != NULL) {
+        if (strlen(shard->d_name) != 2 || shard->d_name[0] == '.') {
+            continue;
+        }
+        char* shard_dir = NULL;
+        if (asprintf(&shard_dir, "%s/%s", s->objects_dir, shard->d_name) < 0) {
+            ok = false;
+            break;
+        }
+        int dir_fd = open(shard_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR* d = dir_fd >= 0 ? fdopendir(dir_fd) : NULL;
+        if (!d && dir_fd >= 0) {
+            close(dir_fd);
+        }
+        rebuild_free(shard_dir);
+        if (!d) {
+            continue;
+        }
+
+        struct dirent* entry;
+        while (ok && (entry = readdir(d)) != NULL) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+            struct stat st;
+            if (fstatat(dirfd(d), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode)) {
+                continue;
+            }
+
+            size_t len = strlen(entry->d_name);
+            if (len != HEX_LEN - 2) {
+                // A write_atomically temporary that was never renamed
+                if (len == HEX_LEN - 2 + 7 && entry->d_name[HEX_LEN - 2] == '.' &&
+                    stat_mtime_ns(&st) < cutoff_ns) {
+                    unlinkat(dirfd(d), entry->d_name, 0);
+                }
+                continue;
+            }
+
+            ObjectInfo* info = (ObjectInfo*)rebuild_calloc(1, sizeof(ObjectInfo));
+            char hex[HEX_LEN + 1];
+            snprintf(hex, sizeof(hex), "%s%s", shard->d_name, entry->d_name);
+            if (!info || map_set(objects, hex, info) != REBUILD_OK) {
+                rebuild_free(info);
+                ok = false;
+                break;
+            }
+            info->bytes = (uint64_t)st.st_blocks * 512;
+            info->mtime_ns = stat_mtime_ns(&st);
+            *total_bytes += info->bytes;
+        }
+        closedir(d);
+    }
+    closedir(top);
+    return ok;
+}
+
+// Look up the objects of each variant's output tree and count references
+static bool resolve_variant_objects(Storage* s, Map* objects, GcVariant* variants, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        GcVariant* gv = &variants[i];
+        size_t hash_count = 0;
+        Hash* hashes = objects_tree_objects(s, &gv->v.output_tree_hash, &hash_count);
+        if (!hashes) {
+            continue;  // Outputs already gone: a restore would miss anyway
+        }
+
+        gv->objects = (ObjectInfo**)rebuild_malloc(hash_count * sizeof(ObjectInfo*));
+        if (!gv->objects) {
+            rebuild_free(hashes);
+            return false;
+        }
+        for (size_t j = 0; j < hash_count; j++) {
+            char hex[HEX_LEN + 1];
+            to_hex(hashes[j].bytes, sizeof(hashes[j].bytes), hex);
+            ObjectInfo* info = (ObjectInfo*)map_get(objects, hex);
+            if (info) {
+                info->refs++;
+                gv->objects[gv->object_count++] = info;
+            }
+        }
+        rebuild_free(hashes);
+    }
+    return true;
+}
+
+typedef struct RemoveContext {
+    Storage* storage;
+    uint64_t cutoff_ns;
+    size_t removed;
+    uint64_t bytes_left;
+} RemoveContext;
+
+static bool remove_unreferenced(const char* hex, void* value, void* user_data) {
+    ObjectInfo* info = (ObjectInfo*)value;
+    RemoveContext* ctx = (RemoveContext*)user_data;
+    if (info->refs > 0 || info->mtime_ns >= ctx->cutoff_ns) {
+        ctx->bytes_left += info->bytes;
+        return true;
+    }
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%.2s/%s", ctx->storage->objects_dir, hex, hex + 2);
+
+    // A build may have stored it again since the scan
+    struct stat st;
+    if (lstat(path, &st) == 0 && stat_mtime_ns(&st) < ctx->cutoff_ns && unlink(path) == 0) {
+        ctx->removed++;
+    } else {
+        ctx->bytes_left += info->bytes;
+    }
+    return true;
+}
+
+typedef struct Unreferenced {
+    uint64_t cutoff_ns;
+    uint64_t bytes;
+} Unreferenced;
+
+static bool sum_unreferenced(const char* hex, void* value, void* user_data) {
+    (void)hex;
+    const ObjectInfo* info = (const ObjectInfo*)value;
+    Unreferenced* sum = (Unreferenced*)user_data;
+    if (info->refs == 0 && info->mtime_ns < sum->cutoff_ns) {
+        sum->bytes += info->bytes;
+    }
+    return true;
+}
+
+static void free_object_info(void* value) {
+    rebuild_free(value);
+}
+
+// ============================================================================
+// Traces
+// ============================================================================
+
+static int compare_used(const void* a, const void* b) {
+    const GcVariant* x = *(const GcVariant* const*)a;
+    const GcVariant* y = *(const GcVariant* const*)b;
+    return x->v.used_ns < y->v.used_ns ? -1 : x->v.used_ns > y->v.used_ns;
+}
+
+static bool keep_variant(const TracePackVariant* v, void* user_data) {
+    const KeepContext* ctx = (const KeepContext*)user_data;
+
+    // Recorded or hit again since it was listed: a build is using it
+    if (v->used_ns >= ctx->cutoff_ns) {
+        return true;
+    }
+    char id[HEX_LEN + 18];
+    variant_id(v, id);
+    return !set_has(ctx->dropped, id);
+}
+
+// Bytes the pack's segment files take
+static uint64_t pack_bytes(Storage* s) {
+    char* dir = NULL;
+    if (asprintf(&dir, "%s/packs", s->base_dir) < 0) {
+        return 0;
+    }
+    DIR* d = opendir(dir);
+    uint64_t bytes = 0;
+    struct dirent* entry;
+    while (d && (entry = readdir(d)) != NULL) {
+        struct stat st;
+        size_t len = strlen(entry->d_name);
+        if (len > 4 && strcmp(entry->d_name + len - 4, ".seg") == 0 &&
+            fstatat(dirfd(d), entry->d_name, &st, 0) == 0) {
+            bytes += (uint64_t)st.st_blocks * 512;
+        }
+    }
+    if (d) closedir(d);
+    rebuild_free(dir);
+    return bytes;
+}
+
+// Trace files under traces/ were imported when the pack was created and
+// are not read while it is attached
+static void remove_trace_files(Storage* s) {
+    DIR* d = opendir(s->traces_dir);
+    if (!d) {
+        return;
+    }
+    struct dirent* shard;
+    while ((shard = readdir(d)) != NULL) {
+        if (strlen(shard->d_name) != 2 || shard->d_name[0] == '.') {
+            continue;
+        }
+        char* path = NULL;
+        if (asprintf(&path, "%s/%s", s->traces_dir, shard->d_name) < 0) {
+            break;
+        }
+        nftw(path, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+        rebuild_free(path);
+    }
+    closedir(d);
+}
+
+// Drop variants to meet the budget, then delete unreferenced objects
+static bool collect_store(Storage* s, uint64_t budget_bytes, uint64_t cutoff_ns, GcStats* stats) {
+    Map* objects = map_create(4096);
+    uint64_t object_bytes = 0;
+    TracePackVariant* listed = NULL;
+    size_t count = 0;
+    GcVariant* variants = NULL;
+    GcVariant** order = NULL;
+    Set* dropped = NULL;
+
+    bool ok = objects && scan_objects(s, objects, cutoff_ns, &object_bytes) &&
+              trace_pack_list(s->trace_pack, &listed, &count);
+    if (ok) {
+        variants = (GcVariant*)rebuild_calloc(count + 1, sizeof(GcVariant));
+        order = (GcVariant**)rebuild_malloc((count + 1) * sizeof(GcVariant*));
+        dropped = set_create(0);
+        ok = variants && order && dropped;
+    }
+    for (size_t i = 0; ok && i < count; i++) {
+        variants[i].v = listed[i];
+        order[i] = &variants[i];
+    }
+    // Objects are only deleted once every reference is known
+    bool resolved = ok && resolve_variant_objects(s, objects, variants, count);
+    ok = resolved;
+    if (!ok) {
+        LOG_ERROR("Garbage collection failed to read the store");
+    }
+
+    uint64_t trace_bytes = 0;
+    for (size_t i = 0; ok && i < count; i++) {
+        trace_bytes += variants[i].v.size;
+    }
+    stats->bytes_before = object_bytes + trace_bytes;
+
+    // What the budget has to hold: everything but objects nothing refers to
+    Unreferenced unreferenced = { cutoff_ns, 0 };
+    if (ok) {
+        map_iterate(objects, sum_unreferenced, &unreferenced);
+    }
+    uint64_t kept_bytes = stats->bytes_before - unreferenced.bytes;
+
+    // Least recently used first
+    if (ok && budget_bytes > 0 && kept_bytes > budget_bytes) {
+        qsort(order, count, sizeof(GcVariant*), compare_used);
+        for (size_t i = 0; i < count && kept_bytes > budget_bytes; i++) {
+            GcVariant* gv = order[i];
+            if (gv->v.used_ns >= cutoff_ns) {
+                LOG_WARN("Cache stays over budget: everything left was used in the last hour");
+                break;
+            }
+            char id[HEX_LEN + 18];
+            variant_id(&gv->v, id);
+            if (set_add(dropped, id) != REBUILD_OK) {
+                break;
+            }
+            gv->dropped = true;
+            stats->variants_dropped++;
+            kept_bytes -= gv->v.size;
+            for (size_t j = 0; j < gv->object_count; j++) {
+                ObjectInfo* info = gv->objects[j];
+                if (--info->refs == 0 && info->mtime_ns < cutoff_ns) {
+                    kept_bytes -= info->bytes;
+                }
+            }
+        }
+    }
+
+    // Rewrite the pack to drop variants, or when most of it is records
+    // that were replaced since
+    if (ok && (stats->variants_dropped > 0 || pack_bytes(s) > 2 * trace_bytes + (1u << 20))) {
+        KeepContext keep = { dropped, cutoff_ns };
+        if (!trace_pack_rewrite(s->trace_pack, keep_variant, &keep)) {
+            // The variants are still there, and so must their objects be
+            for (size_t i = 0; i < count; i++) {
+                for (size_t j = 0; variants[i].dropped && j < variants[i].object_count; j++) {
+                    variants[i].objects[j]->refs++;
+                }
+            }
+            stats->variants_dropped = 0;
+            ok = false;
+        }
+    }
+
+    if (resolved) {
+        RemoveContext remove = { s, cutoff_ns, 0, 0 };
+        map_iterate(objects, remove_unreferenced, &remove);
+        stats->objects_removed = remove.removed;
+        stats->bytes_after = remove.bytes_left + trace_bytes;
+        for (size_t i = 0; i < count; i++) {
+            if (variants[i].dropped) stats->bytes_after -= variants[i].v.size;
+        }
+    }
+    if (ok) {
+        remove_trace_files(s);
+    }
+
+    for (size_t i = 0; variants && i < count; i++) {
+        rebuild_free(variants[i].objects);
+    }
+    rebuild_free(variants);
+    rebuild_free(order);
+    rebuild_free(listed);
+    set_free(dropped);
+    map_free(objects, free_object_info);
+    return ok;
+}
+
+// ============================================================================
+// Public API
+// ============================================================================
+
+static char* lock_path(const Storage* s) {
+    char* path = NULL;
+    if (asprintf(&path, "%s/%s", s->base_dir, GC_LOCK_FILE) < 0) {
+        return NULL;
+    }
+    return path;
+}
+
+bool gc_collect(Storage* s, uint64_t budget_bytes, GcStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (!s) {
+        return false;
+    }
+
+    // One collector at a time
+    char* path = lock_path(s);
+    int lock_fd = path ? open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644) : -1;
+    rebuild_free(path);
+    if (lock_fd < 0) {
+        LOG_ERROR("Failed to open the garbage collection lock: %s", strerror(errno));
+        return false;
+    }
+    if (flock(lock_fd, LOCK_EX | LOCK_NB) != 0) {
+        LOG_INFO("Another process is collecting garbage");
+        close(lock_fd);
+        return true;
+    }
+
+    uint64_t now = now_ns();
+    uint64_t cutoff_ns = now > GC_GRACE_PERIOD ? now - GC_GRACE_PERIOD : 0;
+
+    stats->tmp_dirs_removed = remove_orphaned_tmp_dirs(s);
+
+    bool ok = true;
+    if (s->trace_pack) {
+        ok = collect_store(s, budget_bytes, cutoff_ns, stats);
+    } else {
+        LOG_WARN("No trace pack: only temporary directories were collected");
+    }
+
+    // Its mtime tells gc_due when this ran
+    futimens(lock_fd, NULL);
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+    return ok;
+}
+
+bool gc_due(const Storage* s) {
+    if (!s) {
+        return false;
+    }
+    char* path = lock_path(s);
+    struct stat st;
+    bool due = !path || stat(path, &st) != 0 || time(NULL) - st.st_mtime >= GC_AUTO_INTERVAL;
+    rebuild_free(path);
+    return due;
+}
@@ -0,0 +1,48 @@
+#ifndef REBUILD_GC_H
+#define REBUILD_GC_H
+
+#include "common.h"
+#include "storage.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Garbage collection of the storage directory
+//
+// The trace variants in the trace pack are the roots: each keeps the
+// manifest and objects of the output tree it restores. When traces and
+// objects take more than the size budget, the least recently used variants
+// (recorded or last a cache hit) are dropped until the rest fits, and the
+// objects no remaining variant refers to are deleted. Temporary directories
+// of rebuild processes that are gone, interrupted writes into objects/ and
+// the trace files the pack was seeded from go too.
+//
+// Collection is safe while builds run. Nothing used within GC_GRACE_PERIOD
+// is dropped or deleted: a build's new objects are that young until its
+// trace is saved, and storing an object that is already there refreshes
+// its mtime. A build that still loses a race (restoring a variant dropped a
+// moment before) finds an object missing, leaves its outputs alone and
+// runs the recipe.
+
+#define GC_GRACE_PERIOD (3600ULL * 1000000000ULL)  // Keep what was used in the last hour, ns
+#define GC_AUTO_INTERVAL 3600                      // Collect after builds at most hourly, s
+
+typedef struct GcStats {
+    uint64_t bytes_before;     // Traces and objects before collecting
+    uint64_t bytes_after;      // ... and after
+    size_t variants_dropped;   // Trace variants dropped to meet the budget
+    size_t objects_removed;    // Objects no trace refers to any more
+    size_t tmp_dirs_removed;   // tmp/ directories of processes that are gone
+} GcStats;
+
+// Collect garbage in s, dropping traces until traces and objects fit in
+// budget_bytes (0: drop no traces, delete only what nothing refers to)
+// Without a trace pack attached only temporary directories are removed.
+// Returns immediately (true) if another process is collecting
+// Returns false if the store could not be read; stats is filled in either way
+bool gc_collect(Storage* s, uint64_t budget_bytes, GcStats* stats);
+
+// Whether gc_collect has not run on s within GC_AUTO_INTERVAL
+bool gc_due(const Storage* s);
+
+#endif // REBUILD_GC_H
@@ -1,12 +1,30 @@
+#define _GNU_SOURCE
 #include "hash.h"
-#include "../vendor/blake2/blake2.h"
+#include "hash_cache.h"
+#include "buffer.h"
+#include "hash_blake2.h"
+#include "io_ring.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
+#include <stdint.h>
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <uv.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#endif
 
 // Compare two hashes for equality
 bool hash_equal(const Hash* a, const Hash* b) {
@@ -79,79 +97,917 @@ void hash_combine(Hash* dest, const Hash* src) {
     }
 }
 
-// Hash file contents using BLAKE2b
-bool hash_file(const char* path, Hash* out) {
-    if (path == NULL || out == NULL) {
+// Stat identity of an open file, as used by the hash cache
+static bool file_cache_key(int fd, HashCacheKey* key) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
         return false;
     }
+    key->dev = (uint64_t)st.st_dev;
+    key->ino = (uint64_t)st.st_ino;
+    key->size = (uint64_t)st.st_size;
+    key->mtime_ns = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + (uint64_t)st.st_mtim.tv_nsec;
+    key->ctime_ns = (uint64_t)st.st_ctim.tv_sec * 1000000000ULL + (uint64_t)st.st_ctim.tv_nsec;
+    return true;
+}
 
-    FILE* file = fopen(path, "rb");
-    if (file == NULL) {
-        LOG_WARN("Failed to open file for hashing: %s", path);
+// How file contents are read, by size
+#define READ_BUFFER_SIZE (64 * 1024)       // Stack buffer; smaller files take one read
+#define MMAP_MIN_SIZE (4 * 1024 * 1024)    // Larger files are mapped instead of read
+
+// BLAKE2b or BLAKE2bp, as the file's size and scheme call for
+typedef struct FileHasher {
+    bool parallel;
+    blake2b_state serial_state;
+    HashBlake2bp parallel_state;
+} FileHasher;
+
+// Start hashing a file of size bytes as scheme does
+static bool file_hasher_init(FileHasher* h, uint64_t size, HashScheme scheme) {
+    h->parallel = size >= HASH_PARALLEL_MIN && scheme == HASH_SCHEME_BLAKE2BP;
+    if (h->parallel) {
+        hash_blake2bp_init(&h->parallel_state, 32);
+        return true;
+    }
+    return blake2b_init(&h->serial_state, 32) == 0;
+}
+
+static void file_hasher_update(FileHasher* h, const void* data, size_t len) {
+    if (h->parallel) {
+        hash_blake2bp_update(&h->parallel_state, data, len);
+    } else {
+        hash_blake2b_update(&h->serial_state, data, len);
+    }
+}
+
+static void file_hasher_final(FileHasher* h, Hash* out) {
+    if (h->parallel) {
+        hash_blake2bp_final(&h->parallel_state, out->bytes);
+    } else {
+        hash_blake2b_final(&h->serial_state, out->bytes);
+    }
+}
+
+// The hash cache holds current-scheme hashes; a large file's hash under an
+// older scheme is kept with the scheme in the top byte of its size
+static HashCacheKey scheme_cache_key(const HashCacheKey* key, HashScheme scheme) {
+    HashCacheKey cache_key = *key;
+    if (key->size >= HASH_PARALLEL_MIN && scheme != HASH_SCHEME_CURRENT) {
+        cache_key.size |= (uint64_t)(scheme + 1) << 56;
+    }
+    return cache_key;
+}
+
+// A file truncated while it is mapped faults with SIGBUS on the missing
+// pages. The thread hashing a mapping jumps back out instead of dying
+static _Thread_local sigjmp_buf* t_sigbus_jump = NULL;
+static uv_once_t g_sigbus_once = UV_ONCE_INIT;
+
+static void on_sigbus(int sig) {
+    if (t_sigbus_jump != NULL) {
+        siglongjmp(*t_sigbus_jump, 1);
+    }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void install_sigbus_handler(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigbus;
+    sa.sa_flags = SA_NODEFER;      // Still deliverable after jumping out
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGBUS, &sa, NULL);
+}
+
+// Hash a mapped file; returns false if it shrank under the mapping
+static bool hash_mapping(const void* map, size_t size, FileHasher* h) {
+    uv_once(&g_sigbus_once, install_sigbus_handler);
+
+    sigjmp_buf jump;
+    if (sigsetjmp(jump, 0) != 0) {
+        t_sigbus_jump = NULL;
+        return false;
+    }
+    t_sigbus_jump = &jump;
+    file_hasher_update(h, map, size);
+    t_sigbus_jump = NULL;
+    return true;
+}
+
+// Hash an open file's contents as scheme does, closing it
+// Files of up to READ_BUFFER_SIZE take one read, larger ones are read in
+// READ_BUFFER_SIZE pieces with sequential readahead, and from MMAP_MIN_SIZE
+// on they are mapped (MADV_SEQUENTIAL) and hashed in place
+// Unchanged files are answered from the hash cache without being read
+static bool hash_open_file(int fd, const char* path, HashScheme scheme, Hash* out) {
+    if (scheme != HASH_SCHEME_BLAKE2B && scheme != HASH_SCHEME_BLAKE2BP) {
+        close(fd);
+        LOG_WARN("Unknown hash scheme %d for %s", (int)scheme, path);
         return false;
     }
 
+    HashCacheKey key = {0};
+    bool cacheable = file_cache_key(fd, &key);
+    HashCacheKey cache_key = scheme_cache_key(&key, scheme);
+    if (cacheable && hash_cache_lookup(&cache_key, out)) {
+        close(fd);
+        return true;
+    }
+
     // Initialize BLAKE2b state for 32-byte output
-    blake2b_state state;
-    if (blake2b_init(&state, 32) != 0) {
-        fclose(file);
+    FileHasher hasher;
+    if (!file_hasher_init(&hasher, cacheable ? key.size : 0, scheme)) {
+        close(fd);
         LOG_ERROR("Failed to initialize BLAKE2b");
         return false;
     }
 
-    // Read and hash file in chunks
-    unsigned char buffer[8192];
-    size_t bytes_read;
+    // Map a large file; any bytes appended since the fstat are read below
+    bool ok = true;
+    bool mappable = cacheable && key.size >= MMAP_MIN_SIZE && (uint64_t)(size_t)key.size == key.size;
+    void* map = mappable ? mmap(NULL, (size_t)key.size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if (map != MAP_FAILED) {
+        madvise(map, (size_t)key.size, MADV_SEQUENTIAL);
+        ok = hash_mapping(map, (size_t)key.size, &hasher) &&
+             lseek(fd, (off_t)key.size, SEEK_SET) >= 0;
+        munmap(map, (size_t)key.size);
+    } else if (!cacheable || key.size > READ_BUFFER_SIZE) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
 
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
-        if (blake2b_update(&state, buffer, bytes_read) != 0) {
-            fclose(file);
-            LOG_ERROR("Failed to update BLAKE2b hash");
-            return false;
+    // Read and hash the rest in chunks; a file that fits the buffer
+    // needs no second read to find its end
+    unsigned char buffer[READ_BUFFER_SIZE];
+    uint64_t total = 0;
+    while (ok) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            ok = n == 0;
+            break;
+        }
+        file_hasher_update(&hasher, buffer, (size_t)n);
+        total += (uint64_t)n;
+        if (cacheable && key.size < sizeof(buffer) && total == key.size) {
+            break;
         }
     }
 
     // Check for read errors
-    if (ferror(file)) {
-        fclose(file);
+    if (!ok) {
+        close(fd);
         LOG_WARN("Error reading file: %s", path);
         return false;
     }
 
-    fclose(file);
+    // Only remember the hash if nothing changed while we read
+    HashCacheKey after;
+    cacheable = cacheable && file_cache_key(fd, &after) &&
+                memcmp(&key, &after, sizeof(key)) == 0;
+
+    close(fd);
 
     // Finalize hash
-    if (blake2b_final(&state, out->bytes, 32) != 0) {
-        LOG_ERROR("Failed to finalize BLAKE2b hash");
+    file_hasher_final(&hasher, out);
+
+    if (cacheable) {
+        hash_cache_store(&cache_key, out);
+    }
+
+    return true;
+}
+
+// Hash file contents with the current scheme
+bool hash_file(const char* path, Hash* out) {
+    return hash_file_scheme(path, HASH_SCHEME_CURRENT, out);
+}
+
+bool hash_file_scheme(const char* path, HashScheme scheme, Hash* out) {
+    if (path == NULL || out == NULL) {
+        return false;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_WARN("Failed to open file for hashing: %s", path);
+        return false;
+    }
+    return hash_open_file(fd, path, scheme, out);
+}
+
+// Hash the contents of file name in the directory open as dir_fd
+static bool hash_file_at(int dir_fd, const char* name, HashScheme scheme, Hash* out) {
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_WARN("Failed to open file for hashing: %s", name);
+        return false;
+    }
+    return hash_open_file(fd, name, scheme, out);
+}
+
+// Ask the kernel to start reading a file that is about to be hashed
+// Only files below the mmap size: larger ones are read sequentially with
+// readahead anyway, and queueing all of one up front would hold up the
+// small files behind it
+void hash_prefetch(const char* path) {
+    if (path == NULL) {
+        return;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size < MMAP_MIN_SIZE) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    }
+    close(fd);
+}
+
+// Batched hashing on io_uring
+//
+// Each slot takes a file through statx (answered from the hash cache when
+// unchanged), openat and reads, with one operation in flight at a time.
+// Reads alternate between two buffers: a chunk that has arrived is hashed
+// while the next read is already queued. Every pass hashes the chunks that
+// arrived, at most one per file, as one WorkPool batch. Files the ring
+// does not handle (errors, non-regular files, mapped sizes) are hashed
+// with hash_file_at afterwards. Once the batch stops (a file did not hash
+// to its expected hash), no file is started and those in flight are dropped
+#define BATCH_SLOTS 32                 // Files in flight
+#define BATCH_MIN 8                    // Fewer files do not repay setting up a ring
+
+typedef struct HashBatch {
+    int dir_fd;
+    const char* const* names;
+    size_t count;
+    HashScheme scheme;
+    const Hash* expected;          // Or NULL
+    atomic_bool stop;              // A file failed or did not match expected
+    Hash* out;
+    bool* ok;
+    WorkPool* pool;
+    IoRing* ring;
+    unsigned in_flight;
+    size_t next;                   // Next file to start
+    struct BatchSlot* slots;
+    size_t slot_count;
+    struct BatchChunk* chunks;     // This pass's, one per slot at most
+    size_t chunk_count;
+    size_t* deferred;              // Files left to hash_file_at
+    size_t deferred_count;
+} HashBatch;
+
+// Record whether file i was hashed; with expected hashes, a failure or a
+// mismatch stops the batch
+static void batch_done(HashBatch* b, size_t i, bool ok) {
+    b->ok[i] = ok;
+    if (b->expected && (!ok || !hash_equal(&b->out[i], &b->expected[i]))) {
+        atomic_store(&b->stop, true);
+    }
+}
+
+#ifdef __linux__
+
+typedef enum {
+    SLOT_IDLE,
+    SLOT_STAT,
+    SLOT_OPEN,
+    SLOT_READ,
+    SLOT_DONE,                     // Read to the end, its last chunk queued
+} SlotStep;
+
+typedef struct BatchSlot {
+    SlotStep step;
+    size_t index;                  // Of the file in the batch
+    int fd;
+    struct statx stx;
+    HashCacheKey key;
+    HashCacheKey cache_key;
+    FileHasher hasher;
+    uint64_t offset;               // Of the next read
+    unsigned reads;                // Reads queued so far
+    uint8_t* buffers[2];           // Allocated on first use
+} BatchSlot;
+
+// A chunk read, to be hashed into its slot's file
+typedef struct BatchChunk {
+    BatchSlot* slot;
+    const uint8_t* data;
+    size_t len;
+} BatchChunk;
+
+#define STATX_NEEDED (STATX_TYPE | STATX_MODE | STATX_INO | STATX_SIZE | STATX_MTIME | STATX_CTIME)
+
+static bool batch_queue(HashBatch* b, BatchSlot* s, IoRingOp* op) {
+    op->user_data = (uint64_t)(s - b->slots);
+    if (!io_ring_queue(b->ring, op)) {
         return false;
     }
+    b->in_flight++;
+    return true;
+}
+
+// Take the slot's next file, if any is left, and queue its statx
+static void batch_start(HashBatch* b, BatchSlot* s) {
+    while (b->next < b->count && !atomic_load(&b->stop)) {
+        s->index = b->next++;
+        s->step = SLOT_STAT;
+        s->fd = -1;
+        IoRingOp op = {
+            .opcode = IO_RING_STATX,
+            .fd = b->dir_fd,
+            .addr = (uint64_t)(uintptr_t)b->names[s->index],
+            .off = (uint64_t)(uintptr_t)&s->stx,
+            .len = STATX_NEEDED,
+        };
+        if (batch_queue(b, s, &op)) {
+            return;
+        }
+        b->deferred[b->deferred_count++] = s->index;
+    }
+    s->step = SLOT_IDLE;
+}
+
+// Leave the slot's file to hash_file_at and start the next
+static void batch_defer(HashBatch* b, BatchSlot* s) {
+    if (s->fd >= 0) {
+        close(s->fd);
+        s->fd = -1;
+    }
+    b->deferred[b->deferred_count++] = s->index;
+    batch_start(b, s);
+}
 
+static bool batch_read(HashBatch* b, BatchSlot* s) {
+    uint8_t** buffer = &s->buffers[s->reads & 1];
+    if (*buffer == NULL) {
+        *buffer = rebuild_malloc(READ_BUFFER_SIZE);
+    }
+    uint64_t left = s->key.size - s->offset;
+    IoRingOp op = {
+        .opcode = IO_RING_READ,
+        .fd = s->fd,
+        .off = s->offset,
+        .addr = (uint64_t)(uintptr_t)*buffer,
+        .len = left < READ_BUFFER_SIZE ? (uint32_t)left : READ_BUFFER_SIZE,
+    };
+    if (!batch_queue(b, s, &op)) {
+        return false;
+    }
+    s->reads++;
     return true;
 }
 
+// Drop the slot's file once the batch has stopped
+static void batch_drop(BatchSlot* s) {
+    if (s->fd >= 0) {
+        close(s->fd);
+        s->fd = -1;
+    }
+    s->step = SLOT_IDLE;
+}
+
+// Move a slot on once its operation completed with result res
+static void batch_step(HashBatch* b, BatchSlot* s, int32_t res) {
+    if (atomic_load(&b->stop)) {
+        if (s->step == SLOT_OPEN && res >= 0) {
+            close(res);
+        }
+        batch_drop(s);
+        return;
+    }
+
+    switch (s->step) {
+        case SLOT_STAT: {
+            const struct statx* stx = &s->stx;
+            if (res < 0 || (stx->stx_mask & STATX_NEEDED) != STATX_NEEDED ||
+                !S_ISREG(stx->stx_mode) || stx->stx_size >= MMAP_MIN_SIZE) {
+                batch_defer(b, s);
+                return;
+            }
+            s->key.dev = (uint64_t)makedev(stx->stx_dev_major, stx->stx_dev_minor);
+            s->key.ino = stx->stx_ino;
+            s->key.size = stx->stx_size;
+            s->key.mtime_ns = (uint64_t)stx->stx_mtime.tv_sec * 1000000000ULL + stx->stx_mtime.tv_nsec;
+            s->key.ctime_ns = (uint64_t)stx->stx_ctime.tv_sec * 1000000000ULL + stx->stx_ctime.tv_nsec;
+            s->cache_key = scheme_cache_key(&s->key, b->scheme);
+            if (hash_cache_lookup(&s->cache_key, &b->out[s->index])) {
+                batch_done(b, s->index, true);
+                batch_start(b, s);
+                return;
+            }
+
+            s->step = SLOT_OPEN;
+            IoRingOp op = {
+                .opcode = IO_RING_OPENAT,
+                .fd = b->dir_fd,
+                .addr = (uint64_t)(uintptr_t)b->names[s->index],
+                .flags = O_RDONLY | O_CLOEXEC,
+            };
+            if (!file_hasher_init(&s->hasher, s->key.size, b->scheme) || !batch_queue(b, s, &op)) {
+                batch_defer(b, s);
+            }
+            return;
+        }
+
+        case SLOT_OPEN:
+            if (res < 0) {
+                batch_defer(b, s);
+                return;
+            }
+            s->fd = res;
+            s->offset = 0;
+            s->reads = 0;
+            s->step = s->key.size == 0 ? SLOT_DONE : SLOT_READ;
+            if (s->step == SLOT_READ && !batch_read(b, s)) {
+                batch_defer(b, s);
+            }
+            return;
+
+        case SLOT_READ:
+            // A file that shrank since its statx reads short
+            if (res <= 0) {
+                batch_defer(b, s);
+                return;
+            }
+            b->chunks[b->chunk_count++] = (BatchChunk){
+                .slot = s,
+                .data = s->buffers[(s->reads - 1) & 1],
+                .len = (size_t)res,
+            };
+            s->offset += (uint64_t)res;
+            if (s->offset == s->key.size) {
+                s->step = SLOT_DONE;
+            } else if (!batch_read(b, s)) {
+                b->chunk_count--;
+                batch_defer(b, s);
+            }
+            return;
+
+        case SLOT_IDLE:
+        case SLOT_DONE:
+            return;
+    }
+}
+
+// Hash one chunk read this pass (WorkPoolTask)
+static bool hash_batch_chunk(size_t index, void* ctx) {
+    HashBatch* b = (HashBatch*)ctx;
+    const BatchChunk* c = &b->chunks[index];
+    file_hasher_update(&c->slot->hasher, c->data, c->len);
+    return true;
+}
+
+// Finish a file read to its end; one that changed while it was read is
+// left to hash_file_at
+static void batch_finish(HashBatch* b, BatchSlot* s) {
+    if (atomic_load(&b->stop)) {
+        batch_drop(s);
+        return;
+    }
+    HashCacheKey after;
+    if (!file_cache_key(s->fd, &after) || memcmp(&s->key, &after, sizeof(after)) != 0) {
+        batch_defer(b, s);
+        return;
+    }
+    close(s->fd);
+    s->fd = -1;
+    file_hasher_final(&s->hasher, &b->out[s->index]);
+    hash_cache_store(&s->cache_key, &b->out[s->index]);
+    batch_done(b, s->index, true);
+    batch_start(b, s);
+}
+
+// Run the batch through the ring until every file is hashed or deferred
+// Returns false if the ring failed, with operations possibly still in flight
+static bool batch_run(HashBatch* b) {
+    for (size_t i = 0; i < b->slot_count; i++) {
+        b->slots[i].fd = -1;
+        batch_start(b, &b->slots[i]);
+    }
+
+    while (b->in_flight > 0) {
+        if (!io_ring_submit(b->ring, 1)) {
+            LOG_WARN("io_uring submission failed: %s", strerror(errno));
+            for (size_t i = 0; i < b->slot_count; i++) {
+                BatchSlot* s = &b->slots[i];
+                if (s->step != SLOT_IDLE) {
+                    if (s->fd >= 0) close(s->fd);
+                    b->deferred[b->deferred_count++] = s->index;
+                }
+            }
+            while (b->next < b->count) {
+                b->deferred[b->deferred_count++] = b->next++;
+            }
+            return false;
+        }
+
+        b->chunk_count = 0;
+        uint64_t slot;
+        int32_t res;
+        while (io_ring_complete(b->ring, &slot, &res)) {
+            b->in_flight--;
+            batch_step(b, &b->slots[slot], res);
+        }
+
+        // Send the next reads off before hashing what arrived
+        if (b->chunk_count > 0) {
+            io_ring_submit(b->ring, 0);
+            work_pool_run(b->pool, b->chunk_count, hash_batch_chunk, b);
+        }
+        for (size_t i = 0; i < b->slot_count; i++) {
+            if (b->slots[i].step == SLOT_DONE) {
+                batch_finish(b, &b->slots[i]);
+            }
+        }
+    }
+    return true;
+}
+
+#endif // __linux__
+
+// Hash deferred[index] with hash_file_at (WorkPoolTask)
+static bool hash_batch_file(size_t index, void* ctx) {
+    HashBatch* b = (HashBatch*)ctx;
+    if (atomic_load(&b->stop)) {
+        return false;
+    }
+    size_t i = b->deferred[index];
+    batch_done(b, i, hash_file_at(b->dir_fd, b->names[i], b->scheme, &b->out[i]));
+    return !atomic_load(&b->stop);
+}
+
+bool hash_files_at(int dir_fd, const char* const* names, size_t count, HashScheme scheme,
+                   const Hash* expected, WorkPool* pool, Hash* out, bool* ok) {
+    if (count == 0) {
+        return true;
+    }
+
+    HashBatch b = {
+        .dir_fd = dir_fd,
+        .names = names,
+        .count = count,
+        .scheme = scheme,
+        .expected = expected,
+        .out = out,
+        .ok = ok,
+        .pool = pool,
+        .deferred = rebuild_malloc(sizeof(size_t) * count),
+    };
+    atomic_init(&b.stop, false);
+    for (size_t i = 0; i < count; i++) {
+        ok[i] = false;
+    }
+
+#ifdef __linux__
+    bool known_scheme = scheme == HASH_SCHEME_BLAKE2B || scheme == HASH_SCHEME_BLAKE2BP;
+    b.slot_count = count < BATCH_SLOTS ? count : BATCH_SLOTS;
+    b.ring = known_scheme && count >= BATCH_MIN ? io_ring_create((unsigned)b.slot_count) : NULL;
+#endif
+    if (b.ring != NULL) {
+#ifdef __linux__
+        b.slots = rebuild_calloc(b.slot_count, sizeof(BatchSlot));
+        b.chunks = rebuild_malloc(sizeof(BatchChunk) * b.slot_count);
+        bool drained = batch_run(&b);
+        io_ring_free(b.ring);
+        if (!atomic_load(&b.stop)) {
+            LOG_DEBUG("Hashed %zu of %zu files through io_uring", count - b.deferred_count, count);
+        }
+        // After a failure the kernel may yet write into the slots; leave them
+        for (size_t i = 0; drained && i < b.slot_count; i++) {
+            rebuild_free(b.slots[i].buffers[0]);
+            rebuild_free(b.slots[i].buffers[1]);
+        }
+        if (drained) {
+            rebuild_free(b.slots);
+        }
+        rebuild_free(b.chunks);
+#endif
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            b.deferred[i] = i;
+        }
+        b.deferred_count = count;
+    }
+
+    work_pool_run(pool, b.deferred_count, hash_batch_file, &b);
+    rebuild_free(b.deferred);
+
+    bool all = !atomic_load(&b.stop);
+    for (size_t i = 0; i < count; i++) {
+        all = all && ok[i];
+    }
+    return all;
+}
+
 // Hash arbitrary data using BLAKE2b
 void hash_data(const void* data, size_t len, Hash* out) {
     if (data == NULL || out == NULL) {
         return;
     }
 
-    // Use the simple BLAKE2b API for one-shot hashing
-    // blake2b(output, output_len, input, input_len, key, key_len)
-    if (blake2b(out->bytes, 32, data, len, NULL, 0) != 0) {
+    blake2b_state state;
+    if (blake2b_init(&state, 32) != 0) {
         LOG_ERROR("Failed to hash data with BLAKE2b");
         memset(out->bytes, 0, sizeof(out->bytes));
+        return;
     }
+    hash_blake2b_update(&state, data, len);
+    hash_blake2b_final(&state, out->bytes);
 }
 
-// Helper function to compare directory entries for qsort
-static int compare_dirent_names(const void* a, const void* b) {
-    const struct dirent** da = (const struct dirent**)a;
-    const struct dirent** db = (const struct dirent**)b;
-    return strcmp((*da)->d_name, (*db)->d_name);
+#define NS_PER_SEC 1000000000ULL
+#define TREE_DOMAIN "rebuild-tree-v1"   // Directory hashes never equal a file's
+
+// Entry types in a directory's hash
+#define TREE_FILE 'f'
+#define TREE_EXEC 'x'
+#define TREE_DIR 'd'
+
+// A directory, hashed
+typedef struct TreeNode {
+    Hash hash;                     // Merkle hash of its entries
+    Hash signature;                // Stat identities of everything below it
+    uint64_t newest_ns;            // Latest mtime or ctime below it
+    bool complete;                 // Every entry below it could be hashed
+} TreeNode;
+
+// One entry of a directory being hashed
+typedef struct TreeEntry {
+    const char* name;              // In the directory's name arena
+    size_t name_offset;            // ... while the arena still grows
+    struct stat st;
+    bool ok;                       // Stat'ed (and, once hashed, hashed)
+    Hash content;                  // Regular files
+    TreeNode node;                 // Directories
+} TreeEntry;
+
+// A directory being hashed
+// Its subdirectories are walked as a WorkPool batch over the entry indices
+// in jobs, and its files, when they need reading, hashed as one batch
+typedef struct TreeDir {
+    const char* path;              // For messages
+    int fd;                        // The open directory
+    TreeEntry* entries;
+    size_t* jobs;
+    WorkPool* pool;
+    bool contents;                 // Hash contents too, not just signatures
+} TreeDir;
+
+static uint64_t timespec_ns(const struct timespec* ts) {
+    return (uint64_t)ts->tv_sec * NS_PER_SEC + (uint64_t)ts->tv_nsec;
+}
+
+static uint64_t stat_newest_ns(const struct stat* st) {
+    uint64_t mtime = timespec_ns(&st->st_mtim);
+    uint64_t ctime = timespec_ns(&st->st_ctim);
+    return mtime > ctime ? mtime : ctime;
+}
+
+static char entry_type(const struct stat* st) {
+    if (S_ISDIR(st->st_mode)) return TREE_DIR;
+    return (st->st_mode & S_IXUSR) ? TREE_EXEC : TREE_FILE;
+}
+
+static int compare_entry_names(const void* a, const void* b) {
+    return strcmp(((const TreeEntry*)a)->name, ((const TreeEntry*)b)->name);
+}
+
+// Length-prefixed name, so no two listings serialize alike
+static void update_name(blake2b_state* state, const char* name) {
+    uint32_t len = (uint32_t)strlen(name);
+    uint8_t prefix[4] = { len & 0xff, (len >> 8) & 0xff, (len >> 16) & 0xff, (len >> 24) & 0xff };
+    hash_blake2b_update(state, prefix, sizeof(prefix));
+    hash_blake2b_update(state, name, len);
+}
+
+static bool hash_dir(int fd, const char* path, const struct stat* st, WorkPool* pool, bool contents,
+                     TreeNode* out);
+
+// Read a directory's files and subdirectories, sorted by name
+// d_type spares the stat of subdirectories (their open fd is stat'ed
+// instead) and of entries that are neither. Names go into one arena
+// Returns the number of entries
+static size_t read_entries(DIR* dir, const char* path, Buffer* names, TreeEntry** out, bool* complete) {
+    size_t count = 0;
+    size_t capacity = 64;
+    TreeEntry* entries = rebuild_malloc(sizeof(TreeEntry) * capacity);
+    int fd = dirfd(dir);
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char* name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+
+        struct stat st;
+        memset(&st, 0, sizeof(st));
+        switch (entry->d_type) {
+            case DT_DIR:
+                st.st_mode = S_IFDIR;
+                break;
+            case DT_REG:
+            case DT_LNK:
+            case DT_UNKNOWN:
+                // Symlinks are followed
+                if (fstatat(fd, name, &st, entry->d_type == DT_REG ? AT_SYMLINK_NOFOLLOW : 0) != 0) {
+                    LOG_DEBUG("Skipping unhashable entry: %s/%s", path, name);
+                    *complete = false;  // A dangling link may come to point somewhere
+                    continue;
+                }
+                break;
+            default:
+                continue;
+        }
+        if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) {
+            continue;
+        }
+
+        if (count >= capacity) {
+            capacity *= 2;
+            entries = rebuild_realloc(entries, sizeof(TreeEntry) * capacity);
+        }
+        entries[count].name_offset = buffer_size(names);
+        entries[count].st = st;
+        entries[count].ok = true;
+        buffer_append(names, name, strlen(name) + 1);
+        count++;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        entries[i].name = buffer_data(names) + entries[i].name_offset;
+    }
+    qsort(entries, count, sizeof(TreeEntry), compare_entry_names);
+
+    *out = entries;
+    return count;
+}
+
+// Hash subdirectory jobs[index] (WorkPoolTask)
+static bool walk_subdir(size_t index, void* ctx) {
+    TreeDir* dir = (TreeDir*)ctx;
+    TreeEntry* e = &dir->entries[dir->jobs[index]];
+
+    int fd = openat(dir->fd, e->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    e->ok = fd >= 0 && fstat(fd, &e->st) == 0;
+    if (e->ok) {
+        // Only messages use the path, so a truncated one will do
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir->path, e->name);
+        e->ok = hash_dir(fd, path, &e->st, dir->pool, dir->contents, &e->node);
+    } else {
+        LOG_DEBUG("Skipping unhashable entry: %s/%s", dir->path, e->name);
+        if (fd >= 0) close(fd);
+    }
+    return true;  // One unreadable subdirectory does not stop the others
+}
+
+// Queue the entries whose type matches want_dir in jobs
+// Returns how many were queued
+static size_t queue_entries(TreeDir* dir, size_t count, bool want_dir) {
+    size_t jobs = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (dir->entries[i].ok && S_ISDIR(dir->entries[i].st.st_mode) == want_dir) {
+            dir->jobs[jobs++] = i;
+        }
+    }
+    return jobs;
+}
+
+// Hash the directory's files, as one batch
+static void hash_entry_files(TreeDir* dir, size_t count) {
+    size_t files = queue_entries(dir, count, false);
+    const char** names = rebuild_malloc(sizeof(char*) * (files + 1));
+    Hash* hashes = rebuild_malloc(sizeof(Hash) * (files + 1));
+    bool* ok = rebuild_malloc(sizeof(bool) * (files + 1));
+    for (size_t i = 0; i < files; i++) {
+        names[i] = dir->entries[dir->jobs[i]].name;
+    }
+
+    hash_files_at(dir->fd, names, files, HASH_SCHEME_CURRENT, NULL, dir->pool, hashes, ok);
+    for (size_t i = 0; i < files; i++) {
+        TreeEntry* e = &dir->entries[dir->jobs[i]];
+        e->ok = ok[i];
+        e->content = hashes[i];
+        if (!e->ok) {
+            LOG_DEBUG("Skipping unhashable entry: %s/%s", dir->path, e->name);
+        }
+    }
+
+    rebuild_free(names);
+    rebuild_free(hashes);
+    rebuild_free(ok);
+}
+
+// Hash the directory open as fd (which this closes) as a Merkle tree: its
+// entries in name order, each as type, length-prefixed name and the hash
+// of its contents. Subdirectories are walked in parallel on pool
+// A subtree whose signature is unchanged is answered from the hash cache
+// without reading any of its files. Without contents, only the signature
+// (and newest_ns) is taken
+static bool hash_dir(int fd, const char* path, const struct stat* st, WorkPool* pool, bool contents,
+                     TreeNode* out) {
+    DIR* handle = fdopendir(fd);
+    if (handle == NULL) {
+        LOG_WARN("Failed to open directory: %s", path);
+        close(fd);
+        return false;
+    }
+
+    out->complete = true;
+    out->newest_ns = stat_newest_ns(st);
+
+    Buffer* names = buffer_create(4096);
+    TreeEntry* entries = NULL;
+    size_t count = read_entries(handle, path, names, &entries, &out->complete);
+
+    TreeDir dir = {
+        .path = path,
+        .fd = dirfd(handle),
+        .entries = entries,
+        .jobs = rebuild_malloc(sizeof(size_t) * (count + 1)),
+        .pool = pool,
+        .contents = contents,
+    };
+    work_pool_run(pool, queue_entries(&dir, count, true), walk_subdir, &dir);
+
+    // Signature: the directory's own identity plus each entry's
+    blake2b_state state;
+    blake2b_init(&state, 32);
+    uint64_t self[4] = { (uint64_t)st->st_dev, (uint64_t)st->st_ino,
+                         timespec_ns(&st->st_mtim), timespec_ns(&st->st_ctim) };
+    hash_blake2b_update(&state, self, sizeof(self));
+    for (size_t i = 0; i < count; i++) {
+        const TreeEntry* e = &entries[i];
+        if (!e->ok) {
+            out->complete = false;
+            continue;
+        }
+        char type = entry_type(&e->st);
+        update_name(&state, e->name);
+        hash_blake2b_update(&state, &type, 1);
+        if (type == TREE_DIR) {
+            hash_blake2b_update(&state, e->node.signature.bytes, sizeof(e->node.signature.bytes));
+            if (e->node.newest_ns > out->newest_ns) out->newest_ns = e->node.newest_ns;
+            out->complete = out->complete && e->node.complete;
+        } else {
+            uint64_t id[5] = { (uint64_t)e->st.st_dev, (uint64_t)e->st.st_ino, (uint64_t)e->st.st_size,
+                               timespec_ns(&e->st.st_mtim), timespec_ns(&e->st.st_ctim) };
+            hash_blake2b_update(&state, id, sizeof(id));
+            if (stat_newest_ns(&e->st) > out->newest_ns) out->newest_ns = stat_newest_ns(&e->st);
+        }
+    }
+    hash_blake2b_final(&state, out->signature.bytes);
+
+    bool cached = !contents || hash_cache_lookup_tree((uint64_t)st->st_dev, (uint64_t)st->st_ino,
+                                                      &out->signature, &out->hash);
+    if (!cached) {
+        hash_entry_files(&dir, count);
+
+        blake2b_init(&state, 32);
+        hash_blake2b_update(&state, TREE_DOMAIN, sizeof(TREE_DOMAIN));
+        for (size_t i = 0; i < count; i++) {
+            const TreeEntry* e = &entries[i];
+            if (!e->ok) {
+                out->complete = false;
+                continue;
+            }
+            char type = entry_type(&e->st);
+            const Hash* content = type == TREE_DIR ? &e->node.hash : &e->content;
+            hash_blake2b_update(&state, &type, 1);
+            update_name(&state, e->name);
+            hash_blake2b_update(&state, content->bytes, sizeof(content->bytes));
+        }
+        hash_blake2b_final(&state, out->hash.bytes);
+
+        // Racily clean, as for files: nothing below may have changed in
+        // the last second, or a write in the same tick could go unnoticed
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        if (out->complete && out->newest_ns + NS_PER_SEC <= timespec_ns(&now)) {
+            hash_cache_store_tree((uint64_t)st->st_dev, (uint64_t)st->st_ino, &out->signature, &out->hash);
+        }
+    }
+
+    closedir(handle);
+    rebuild_free(dir.jobs);
+    rebuild_free(entries);
+    buffer_free(names);
+    return true;
 }
 
 // Hash a directory tree recursively
 bool hash_tree(const char* path, Hash* out) {
+    return hash_tree_parallel(path, out, NULL);
+}
+
+// Hash a directory tree, walking subdirectories on pool
+bool hash_tree_parallel(const char* path, Hash* out, WorkPool* pool) {
     if (path == NULL || out == NULL) {
         return false;
     }
@@ -174,73 +1030,39 @@ bool hash_tree(const char* path, Hash* out) {
         return false;
     }
 
-    // Open directory
-    DIR* dir = opendir(path);
-    if (dir == NULL) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0) {
         LOG_WARN("Failed to open directory: %s", path);
+        if (fd >= 0) close(fd);
         return false;
     }
 
-    // Read all directory entries (excluding . and ..)
-    struct dirent** entries = NULL;
-    int entry_count = 0;
-    int entry_capacity = 64;
-    entries = rebuild_malloc(sizeof(struct dirent*) * entry_capacity);
-
-    struct dirent* entry;
-    while ((entry = readdir(dir)) != NULL) {
-        // Skip . and ..
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
-        }
-
-        // Resize array if needed
-        if (entry_count >= entry_capacity) {
-            entry_capacity *= 2;
-            entries = rebuild_realloc(entries, sizeof(struct dirent*) * entry_capacity);
-        }
-
-        // Copy directory entry
-        entries[entry_count] = rebuild_malloc(sizeof(struct dirent));
-        memcpy(entries[entry_count], entry, sizeof(struct dirent));
-        entry_count++;
+    TreeNode node;
+    if (!hash_dir(fd, path, &st, pool, true, &node)) {
+        return false;
     }
+    *out = node.hash;
+    return true;
+}
 
-    closedir(dir);
-
-    // Sort entries by name for deterministic ordering
-    if (entry_count > 0) {
-        qsort(entries, entry_count, sizeof(struct dirent*), compare_dirent_names);
+// Stat signature of a directory tree, walked as hash_tree walks it
+bool hash_tree_signature(const char* path, Hash* signature, uint64_t* newest_ns) {
+    if (path == NULL || signature == NULL || newest_ns == NULL) {
+        return false;
     }
 
-    // Initialize result hash to zero
-    memset(out->bytes, 0, sizeof(out->bytes));
-
-    // Hash each entry
-    for (int i = 0; i < entry_count; i++) {
-        // Build full path
-        size_t path_len = strlen(path) + strlen(entries[i]->d_name) + 2;
-        char* full_path = rebuild_malloc(path_len);
-        snprintf(full_path, path_len, "%s/%s", path, entries[i]->d_name);
-
-        // Hash the entry name first (for directory structure)
-        Hash name_hash;
-        hash_data(entries[i]->d_name, strlen(entries[i]->d_name), &name_hash);
-        hash_combine(out, &name_hash);
-
-        // Hash the entry contents (recursively for directories)
-        Hash entry_hash;
-        if (hash_tree(full_path, &entry_hash)) {
-            hash_combine(out, &entry_hash);
-        } else {
-            LOG_DEBUG("Skipping unhashable entry: %s", full_path);
-        }
-
-        rebuild_free(full_path);
-        rebuild_free(entries[i]);
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        return false;
     }
 
-    rebuild_free(entries);
-
+    TreeNode node;
+    if (!hash_dir(fd, path, &st, NULL, false, &node)) {
+        return false;
+    }
+    *signature = node.signature;
+    *newest_ns = node.newest_ns;
     return true;
 }
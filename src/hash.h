@@ -2,6 +2,7 @@
 #define REBUILD_HASH_H
 
 #include "common.h"
+#include "pool.h"
 #include <stdbool.h>
 #include <stddef.h>
 
@@ -20,16 +21,66 @@ bool hash_from_hex(const char* hex, Hash* out);
 // Result is stored in dest
 void hash_combine(Hash* dest, const Hash* src);
 
+// How file contents are hashed. Traces record the scheme their hashes were
+// taken with, so a new scheme leaves existing caches valid
+typedef enum {
+    HASH_SCHEME_BLAKE2B = 0,   // BLAKE2b-256 of every file
+    HASH_SCHEME_BLAKE2BP = 1,  // BLAKE2bp-256 of regular files of HASH_PARALLEL_MIN
+                               // bytes or more, BLAKE2b-256 of the rest
+} HashScheme;
+
+#define HASH_SCHEME_CURRENT HASH_SCHEME_BLAKE2BP
+#define HASH_PARALLEL_MIN (1024 * 1024)
+
 // Hash a file's contents
+// Small files take a single read, large ones are mapped; a file that
+// shrinks while it is being hashed fails like an I/O error
 // Returns true on success, false on I/O error
 bool hash_file(const char* path, Hash* out);
 
+// Hash a file's contents the way scheme does (hash_file: the current one)
+// Returns false on I/O error or an unknown scheme
+bool hash_file_scheme(const char* path, HashScheme scheme, Hash* out);
+
+// Hash a batch of files the way scheme does: names are relative to the
+// directory open as dir_fd (AT_FDCWD for paths), out[i] and ok[i] receive
+// each file's hash and success
+// On Linux the stats, opens and reads go through an io_uring ring, many
+// files at a time, with the chunks read hashed on pool. Without io_uring
+// (or with REBUILD_IO_URING=0), each file is hashed as one pool task
+// With expected (may be NULL), the batch stops at the first file that can
+// not be hashed or does not hash to expected[i]: no further file is started
+// and files still being read are dropped, their ok[i] left false
+// Returns true if every file was hashed (and matched expected)
+bool hash_files_at(int dir_fd, const char* const* names, size_t count, HashScheme scheme,
+                   const Hash* expected, WorkPool* pool, Hash* out, bool* ok);
+
+// Start reading a file into the page cache in the background, ahead of
+// hashing it (posix_fadvise WILLNEED). Errors are ignored
+void hash_prefetch(const char* path);
+
 // Hash arbitrary data
 void hash_data(const void* data, size_t len, Hash* out);
 
 // Hash a directory tree recursively
-// Computes a hash that includes all file contents and directory structure
+// A Merkle hash: each directory hashes its entries in name order as type
+// (file, executable, directory), length-prefixed name and content hash, so
+// any rename, move or duplicated file changes it. Subtrees whose stat
+// signature is unchanged come from the hash cache without being reread
+// Entries that are neither files nor directories (after following
+// symlinks), or that can not be read, are left out
 // Returns true on success, false on I/O error
 bool hash_tree(const char* path, Hash* out);
 
+// hash_tree, walking subdirectories and reading changed files on pool
+// Directories are read through their fds (openat, fstatat) with d_type
+// sparing most stats. pool may be NULL to hash on the calling thread
+bool hash_tree_parallel(const char* path, Hash* out, WorkPool* pool);
+
+// Stat signature of a directory tree, without reading any file: a hash of
+// the stat identity of the directory and of every entry hash_tree would
+// hash below it. newest_ns receives the latest mtime or ctime among them
+// Returns false if path can not be opened as a directory
+bool hash_tree_signature(const char* path, Hash* signature, uint64_t* newest_ns);
+
 #endif // REBUILD_HASH_H
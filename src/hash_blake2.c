@@ -0,0 +1,572 @@
+#define _GNU_SOURCE
+#include "hash_blake2.h"
+#include "common.h"
+#include "../vendor/blake2/blake2-impl.h"
+#include <uv.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define HASH_BLAKE2_X86 1
+#include <immintrin.h>
+#endif
+
+#define BLOCK BLAKE2B_BLOCKBYTES
+#define LEAVES 4
+#define STRIPE (LEAVES * BLOCK)
+
+static const uint64_t IV[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+    0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+    0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+};
+
+static const uint8_t SIGMA[12][16] = {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+    { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+    {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+    {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+    {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+    { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+    { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+    {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+    { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 },
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+};
+
+// Compress one block into h with counter t and finalization flags f
+typedef void (*CompressFn)(uint64_t h[8], const uint8_t* block, const uint64_t t[2], const uint64_t f[2]);
+
+// Compress stripes of four blocks into the four leaves, block i of each
+// stripe into leaf i; none of them is a leaf's last block
+typedef void (*CompressStripesFn)(blake2b_state leaves[LEAVES], const uint8_t* in, size_t stripes);
+
+static void increment_counter(blake2b_state* state, uint64_t inc) {
+    state->t[0] += inc;
+    state->t[1] += (state->t[0] < inc);
+}
+
+// ============================================================================
+// Portable backend (the reference compression function)
+// ============================================================================
+
+#define G(r, i, a, b, c, d)                          \
+    do {                                             \
+        a = a + b + m[SIGMA[r][2 * i + 0]];          \
+        d = rotr64(d ^ a, 32);                       \
+        c = c + d;                                   \
+        b = rotr64(b ^ c, 24);                       \
+        a = a + b + m[SIGMA[r][2 * i + 1]];          \
+        d = rotr64(d ^ a, 16);                       \
+        c = c + d;                                   \
+        b = rotr64(b ^ c, 63);                       \
+    } while (0)
+
+static void compress_portable(uint64_t h[8], const uint8_t* block, const uint64_t t[2], const uint64_t f[2]) {
+    uint64_t m[16];
+    uint64_t v[16];
+    for (int i = 0; i < 16; i++) {
+        m[i] = load64(block + i * sizeof(m[i]));
+    }
+    for (int i = 0; i < 8; i++) {
+        v[i] = h[i];
+        v[i + 8] = IV[i];
+    }
+    v[12] ^= t[0];
+    v[13] ^= t[1];
+    v[14] ^= f[0];
+    v[15] ^= f[1];
+
+    for (int r = 0; r < 12; r++) {
+        G(r, 0, v[0], v[4], v[8], v[12]);
+        G(r, 1, v[1], v[5], v[9], v[13]);
+        G(r, 2, v[2], v[6], v[10], v[14]);
+        G(r, 3, v[3], v[7], v[11], v[15]);
+        G(r, 4, v[0], v[5], v[10], v[15]);
+        G(r, 5, v[1], v[6], v[11], v[12]);
+        G(r, 6, v[2], v[7], v[8], v[13]);
+        G(r, 7, v[3], v[4], v[9], v[14]);
+    }
+
+    for (int i = 0; i < 8; i++) {
+        h[i] ^= v[i] ^ v[i + 8];
+    }
+}
+
+#undef G
+
+// One compression per leaf per stripe, for backends without a 4-way one
+static CompressFn g_compress = compress_portable;
+
+static void compress_stripes_serial(blake2b_state leaves[LEAVES], const uint8_t* in, size_t stripes) {
+    for (size_t s = 0; s < stripes; s++, in += STRIPE) {
+        for (int i = 0; i < LEAVES; i++) {
+            increment_counter(&leaves[i], BLOCK);
+            g_compress(leaves[i].h, in + i * BLOCK, leaves[i].t, leaves[i].f);
+        }
+    }
+}
+
+#ifdef HASH_BLAKE2_X86
+
+// ============================================================================
+// SSE4.1 backend: the state as eight rows of two words
+// ============================================================================
+
+#define SSE_ROT32(x) _mm_shuffle_epi32((x), _MM_SHUFFLE(2, 3, 0, 1))
+#define SSE_ROT24(x) _mm_shuffle_epi8((x), rot24)
+#define SSE_ROT16(x) _mm_shuffle_epi8((x), rot16)
+#define SSE_ROT63(x) _mm_xor_si128(_mm_srli_epi64((x), 63), _mm_add_epi64((x), (x)))
+
+// Half a G on both row halves: add message words, mix with rotations r1, r2
+#define SSE_HALF_G(ml, mh, R1, R2)                                                    \
+    do {                                                                              \
+        row1l = _mm_add_epi64(_mm_add_epi64(row1l, row2l), ml);                       \
+        row1h = _mm_add_epi64(_mm_add_epi64(row1h, row2h), mh);                       \
+        row4l = R1(_mm_xor_si128(row4l, row1l));                                      \
+        row4h = R1(_mm_xor_si128(row4h, row1h));                                      \
+        row3l = _mm_add_epi64(row3l, row4l);                                          \
+        row3h = _mm_add_epi64(row3h, row4h);                                          \
+        row2l = R2(_mm_xor_si128(row2l, row3l));                                      \
+        row2h = R2(_mm_xor_si128(row2h, row3h));                                      \
+    } while (0)
+
+#define SSE_MSG(a, b) _mm_set_epi64x((long long)m[s[b]], (long long)m[s[a]])
+
+__attribute__((target("sse4.1")))
+static void compress_sse41(uint64_t h[8], const uint8_t* block, const uint64_t t[2], const uint64_t f[2]) {
+    const __m128i rot24 = _mm_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10);
+    const __m128i rot16 = _mm_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+
+    uint64_t m[16];
+    memcpy(m, block, sizeof(m));
+
+    __m128i row1l = _mm_loadu_si128((const __m128i*)&h[0]);
+    __m128i row1h = _mm_loadu_si128((const __m128i*)&h[2]);
+    __m128i row2l = _mm_loadu_si128((const __m128i*)&h[4]);
+    __m128i row2h = _mm_loadu_si128((const __m128i*)&h[6]);
+    __m128i row3l = _mm_loadu_si128((const __m128i*)&IV[0]);
+    __m128i row3h = _mm_loadu_si128((const __m128i*)&IV[2]);
+    __m128i row4l = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&IV[4]),
+                                  _mm_loadu_si128((const __m128i*)t));
+    __m128i row4h = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&IV[6]),
+                                  _mm_loadu_si128((const __m128i*)f));
+    __m128i a, b;
+
+    for (int r = 0; r < 12; r++) {
+        const uint8_t* s = SIGMA[r];
+
+        // Columns
+        SSE_HALF_G(SSE_MSG(0, 2), SSE_MSG(4, 6), SSE_ROT32, SSE_ROT24);
+        SSE_HALF_G(SSE_MSG(1, 3), SSE_MSG(5, 7), SSE_ROT16, SSE_ROT63);
+
+        // Diagonals: rotate rows 2-4 left by one, two and three words
+        a = _mm_alignr_epi8(row2h, row2l, 8);
+        b = _mm_alignr_epi8(row2l, row2h, 8);
+        row2l = a;
+        row2h = b;
+        a = row3l;
+        row3l = row3h;
+        row3h = a;
+        a = _mm_alignr_epi8(row4h, row4l, 8);
+        b = _mm_alignr_epi8(row4l, row4h, 8);
+        row4l = b;
+        row4h = a;
+
+        SSE_HALF_G(SSE_MSG(8, 10), SSE_MSG(12, 14), SSE_ROT32, SSE_ROT24);
+        SSE_HALF_G(SSE_MSG(9, 11), SSE_MSG(13, 15), SSE_ROT16, SSE_ROT63);
+
+        a = _mm_alignr_epi8(row2l, row2h, 8);
+        b = _mm_alignr_epi8(row2h, row2l, 8);
+        row2l = a;
+        row2h = b;
+        a = row3l;
+        row3l = row3h;
+        row3h = a;
+        a = _mm_alignr_epi8(row4h, row4l, 8);
+        b = _mm_alignr_epi8(row4l, row4h, 8);
+        row4l = a;
+        row4h = b;
+    }
+
+    row1l = _mm_xor_si128(row1l, row3l);
+    row1h = _mm_xor_si128(row1h, row3h);
+    row2l = _mm_xor_si128(row2l, row4l);
+    row2h = _mm_xor_si128(row2h, row4h);
+    _mm_storeu_si128((__m128i*)&h[0], _mm_xor_si128(_mm_loadu_si128((const __m128i*)&h[0]), row1l));
+    _mm_storeu_si128((__m128i*)&h[2], _mm_xor_si128(_mm_loadu_si128((const __m128i*)&h[2]), row1h));
+    _mm_storeu_si128((__m128i*)&h[4], _mm_xor_si128(_mm_loadu_si128((const __m128i*)&h[4]), row2l));
+    _mm_storeu_si128((__m128i*)&h[6], _mm_xor_si128(_mm_loadu_si128((const __m128i*)&h[6]), row2h));
+}
+
+#undef SSE_MSG
+
+// ============================================================================
+// AVX2 backend: the state as four rows of four words, and BLAKE2bp stripes
+// with one leaf per lane
+// ============================================================================
+
+#define AVX_ROT32(x) _mm256_shuffle_epi32((x), _MM_SHUFFLE(2, 3, 0, 1))
+#define AVX_ROT24(x) _mm256_shuffle_epi8((x), rot24)
+#define AVX_ROT16(x) _mm256_shuffle_epi8((x), rot16)
+#define AVX_ROT63(x) _mm256_xor_si256(_mm256_srli_epi64((x), 63), _mm256_add_epi64((x), (x)))
+
+#define AVX_ROTATIONS                                                                          \
+    const __m256i rot24 = _mm256_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10, \
+                                           3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10); \
+    const __m256i rot16 = _mm256_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9, \
+                                           2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9)
+
+#define AVX_HALF_G(a, b, c, d, msg, R1, R2)                  \
+    do {                                                     \
+        a = _mm256_add_epi64(_mm256_add_epi64(a, b), msg);   \
+        d = R1(_mm256_xor_si256(d, a));                      \
+        c = _mm256_add_epi64(c, d);                          \
+        b = R2(_mm256_xor_si256(b, c));                      \
+    } while (0)
+
+#define AVX_MSG(a, b, c, d) \
+    _mm256_set_epi64x((long long)m[s[d]], (long long)m[s[c]], (long long)m[s[b]], (long long)m[s[a]])
+
+__attribute__((target("avx2")))
+static void compress_avx2(uint64_t h[8], const uint8_t* block, const uint64_t t[2], const uint64_t f[2]) {
+    AVX_ROTATIONS;
+
+    uint64_t m[16];
+    memcpy(m, block, sizeof(m));
+
+    const uint64_t counters[4] = { t[0], t[1], f[0], f[1] };
+    __m256i row1 = _mm256_loadu_si256((const __m256i*)&h[0]);
+    __m256i row2 = _mm256_loadu_si256((const __m256i*)&h[4]);
+    __m256i row3 = _mm256_loadu_si256((const __m256i*)&IV[0]);
+    __m256i row4 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)&IV[4]),
+                                    _mm256_loadu_si256((const __m256i*)counters));
+
+    for (int r = 0; r < 12; r++) {
+        const uint8_t* s = SIGMA[r];
+
+        AVX_HALF_G(row1, row2, row3, row4, AVX_MSG(0, 2, 4, 6), AVX_ROT32, AVX_ROT24);
+        AVX_HALF_G(row1, row2, row3, row4, AVX_MSG(1, 3, 5, 7), AVX_ROT16, AVX_ROT63);
+
+        row2 = _mm256_permute4x64_epi64(row2, _MM_SHUFFLE(0, 3, 2, 1));
+        row3 = _mm256_permute4x64_epi64(row3, _MM_SHUFFLE(1, 0, 3, 2));
+        row4 = _mm256_permute4x64_epi64(row4, _MM_SHUFFLE(2, 1, 0, 3));
+
+        AVX_HALF_G(row1, row2, row3, row4, AVX_MSG(8, 10, 12, 14), AVX_ROT32, AVX_ROT24);
+        AVX_HALF_G(row1, row2, row3, row4, AVX_MSG(9, 11, 13, 15), AVX_ROT16, AVX_ROT63);
+
+        row2 = _mm256_permute4x64_epi64(row2, _MM_SHUFFLE(2, 1, 0, 3));
+        row3 = _mm256_permute4x64_epi64(row3, _MM_SHUFFLE(1, 0, 3, 2));
+        row4 = _mm256_permute4x64_epi64(row4, _MM_SHUFFLE(0, 3, 2, 1));
+    }
+
+    row1 = _mm256_xor_si256(row1, row3);
+    row2 = _mm256_xor_si256(row2, row4);
+    _mm256_storeu_si256((__m256i*)&h[0], _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)&h[0]), row1));
+    _mm256_storeu_si256((__m256i*)&h[4], _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)&h[4]), row2));
+}
+
+#undef AVX_MSG
+
+// A full G on lane-parallel words, with message vectors x and y
+#define AVX_G4(a, b, c, d, x, y)                                 \
+    do {                                                         \
+        AVX_HALF_G(v[a], v[b], v[c], v[d], x, AVX_ROT32, AVX_ROT24); \
+        AVX_HALF_G(v[a], v[b], v[c], v[d], y, AVX_ROT16, AVX_ROT63); \
+    } while (0)
+
+__attribute__((target("avx2")))
+static void compress_stripes_avx2(blake2b_state leaves[LEAVES], const uint8_t* in, size_t stripes) {
+    AVX_ROTATIONS;
+
+    // Word i of every leaf's chaining value, leaf k in lane k
+    __m256i h[8];
+    for (int i = 0; i < 8; i++) {
+        h[i] = _mm256_set_epi64x((long long)leaves[3].h[i], (long long)leaves[2].h[i],
+                                 (long long)leaves[1].h[i], (long long)leaves[0].h[i]);
+    }
+
+    // The leaves have taken the same number of blocks, so share a counter
+    uint64_t t0 = leaves[0].t[0];
+    uint64_t t1 = leaves[0].t[1];
+
+    for (size_t n = 0; n < stripes; n++, in += STRIPE) {
+        // Transpose the stripe so m[w] holds word w of each leaf's block
+        __m256i m[16];
+        for (int j = 0; j < 4; j++) {
+            __m256i r0 = _mm256_loadu_si256((const __m256i*)(in + 0 * BLOCK + 32 * j));
+            __m256i r1 = _mm256_loadu_si256((const __m256i*)(in + 1 * BLOCK + 32 * j));
+            __m256i r2 = _mm256_loadu_si256((const __m256i*)(in + 2 * BLOCK + 32 * j));
+            __m256i r3 = _mm256_loadu_si256((const __m256i*)(in + 3 * BLOCK + 32 * j));
+            __m256i lo01 = _mm256_unpacklo_epi64(r0, r1);
+            __m256i hi01 = _mm256_unpackhi_epi64(r0, r1);
+            __m256i lo23 = _mm256_unpacklo_epi64(r2, r3);
+            __m256i hi23 = _mm256_unpackhi_epi64(r2, r3);
+            m[4 * j + 0] = _mm256_permute2x128_si256(lo01, lo23, 0x20);
+            m[4 * j + 1] = _mm256_permute2x128_si256(hi01, hi23, 0x20);
+            m[4 * j + 2] = _mm256_permute2x128_si256(lo01, lo23, 0x31);
+            m[4 * j + 3] = _mm256_permute2x128_si256(hi01, hi23, 0x31);
+        }
+
+        t0 += BLOCK;
+        t1 += (t0 < BLOCK);
+
+        __m256i v[16];
+        for (int i = 0; i < 8; i++) {
+            v[i] = h[i];
+            v[i + 8] = _mm256_set1_epi64x((long long)IV[i]);
+        }
+        v[12] = _mm256_set1_epi64x((long long)(IV[4] ^ t0));
+        v[13] = _mm256_set1_epi64x((long long)(IV[5] ^ t1));
+
+        for (int r = 0; r < 12; r++) {
+            const uint8_t* s = SIGMA[r];
+            AVX_G4(0, 4, 8, 12, m[s[0]], m[s[1]]);
+            AVX_G4(1, 5, 9, 13, m[s[2]], m[s[3]]);
+            AVX_G4(2, 6, 10, 14, m[s[4]], m[s[5]]);
+            AVX_G4(3, 7, 11, 15, m[s[6]], m[s[7]]);
+            AVX_G4(0, 5, 10, 15, m[s[8]], m[s[9]]);
+            AVX_G4(1, 6, 11, 12, m[s[10]], m[s[11]]);
+            AVX_G4(2, 7, 8, 13, m[s[12]], m[s[13]]);
+            AVX_G4(3, 4, 9, 14, m[s[14]], m[s[15]]);
+        }
+
+        for (int i = 0; i < 8; i++) {
+            h[i] = _mm256_xor_si256(h[i], _mm256_xor_si256(v[i], v[i + 8]));
+        }
+    }
+
+    for (int i = 0; i < 8; i++) {
+        uint64_t lanes[4];
+        _mm256_storeu_si256((__m256i*)lanes, h[i]);
+        for (int k = 0; k < LEAVES; k++) {
+            leaves[k].h[i] = lanes[k];
+        }
+    }
+    for (int k = 0; k < LEAVES; k++) {
+        leaves[k].t[0] = t0;
+        leaves[k].t[1] = t1;
+    }
+}
+
+#undef AVX_G4
+
+#endif // HASH_BLAKE2_X86
+
+// ============================================================================
+// Backend selection
+// ============================================================================
+
+static CompressStripesFn g_compress_stripes = compress_stripes_serial;
+static const char* g_backend_name = "portable";
+static uv_once_t g_backend_once = UV_ONCE_INIT;
+
+static bool use_backend(HashBackend backend) {
+#ifdef HASH_BLAKE2_X86
+    __builtin_cpu_init();
+    if (backend == HASH_BACKEND_AUTO) {
+        backend = __builtin_cpu_supports("avx2") ? HASH_BACKEND_AVX2 :
+                  __builtin_cpu_supports("sse4.1") ? HASH_BACKEND_SSE41 :
+                  HASH_BACKEND_PORTABLE;
+    }
+    if (backend == HASH_BACKEND_AVX2 && __builtin_cpu_supports("avx2")) {
+        g_compress = compress_avx2;
+        g_compress_stripes = compress_stripes_avx2;
+        g_backend_name = "avx2";
+        return true;
+    }
+    if (backend == HASH_BACKEND_SSE41 && __builtin_cpu_supports("sse4.1")) {
+        g_compress = compress_sse41;
+        g_compress_stripes = compress_stripes_serial;
+        g_backend_name = "sse41";
+        return true;
+    }
+#endif
+    if (backend == HASH_BACKEND_AUTO || backend == HASH_BACKEND_PORTABLE) {
+        g_compress = compress_portable;
+        g_compress_stripes = compress_stripes_serial;
+        g_backend_name = "portable";
+        return true;
+    }
+    return false;
+}
+
+static void select_backend(void) {
+    const char* name = getenv("REBUILD_HASH_BACKEND");
+    HashBackend backend = HASH_BACKEND_AUTO;
+    if (name != NULL && name[0] != '\0') {
+        if (strcmp(name, "portable") == 0) {
+            backend = HASH_BACKEND_PORTABLE;
+        } else if (strcmp(name, "sse41") == 0) {
+            backend = HASH_BACKEND_SSE41;
+        } else if (strcmp(name, "avx2") == 0) {
+            backend = HASH_BACKEND_AVX2;
+        } else {
+            LOG_WARN("Unknown REBUILD_HASH_BACKEND '%s', using the default", name);
+        }
+    }
+    if (!use_backend(backend)) {
+        LOG_WARN("This CPU does not support hash backend '%s', using the default", name);
+        use_backend(HASH_BACKEND_AUTO);
+    }
+    LOG_DEBUG("Hashing with the %s BLAKE2b backend", g_backend_name);
+}
+
+static void ensure_backend(void) {
+    uv_once(&g_backend_once, select_backend);
+}
+
+bool hash_blake2_set_backend(HashBackend backend) {
+    ensure_backend();
+    return use_backend(backend);
+}
+
+const char* hash_blake2_backend_name(void) {
+    ensure_backend();
+    return g_backend_name;
+}
+
+// ============================================================================
+// BLAKE2b
+// ============================================================================
+
+// The last block is held back until final, which must know which it is
+void hash_blake2b_update(blake2b_state* state, const void* in, size_t len) {
+    ensure_backend();
+    const uint8_t* p = in;
+    if (len == 0) {
+        return;
+    }
+
+    size_t left = state->buflen;
+    size_t fill = BLOCK - left;
+    if (len > fill) {
+        state->buflen = 0;
+        memcpy(state->buf + left, p, fill);
+        increment_counter(state, BLOCK);
+        g_compress(state->h, state->buf, state->t, state->f);
+        p += fill;
+        len -= fill;
+        while (len > BLOCK) {
+            increment_counter(state, BLOCK);
+            g_compress(state->h, p, state->t, state->f);
+            p += BLOCK;
+            len -= BLOCK;
+        }
+    }
+    memcpy(state->buf + state->buflen, p, len);
+    state->buflen += len;
+}
+
+void hash_blake2b_final(blake2b_state* state, uint8_t* out) {
+    ensure_backend();
+    increment_counter(state, state->buflen);
+    if (state->last_node) {
+        state->f[1] = (uint64_t)-1;
+    }
+    state->f[0] = (uint64_t)-1;
+    memset(state->buf + state->buflen, 0, BLOCK - state->buflen);
+    g_compress(state->h, state->buf, state->t, state->f);
+
+    uint8_t digest[BLAKE2B_OUTBYTES];
+    for (int i = 0; i < 8; i++) {
+        store64(digest + i * sizeof(state->h[i]), state->h[i]);
+    }
+    memcpy(out, digest, state->outlen);
+}
+
+// ============================================================================
+// BLAKE2bp
+// ============================================================================
+
+// Parameter block of a BLAKE2bp node, as blake2bp-ref.c sets it up
+static void init_node(blake2b_state* state, size_t outlen, uint32_t offset, uint8_t depth) {
+    blake2b_param param;
+    memset(&param, 0, sizeof(param));
+    param.digest_length = (uint8_t)outlen;
+    param.fanout = LEAVES;
+    param.depth = 2;
+    store32(&param.node_offset, offset);
+    param.node_depth = depth;
+    param.inner_length = BLAKE2B_OUTBYTES;
+    blake2b_init_param(state, &param);
+}
+
+void hash_blake2bp_init(HashBlake2bp* state, size_t outlen) {
+    ensure_backend();
+    for (int i = 0; i < LEAVES; i++) {
+        init_node(&state->leaves[i], outlen, (uint32_t)i, 0);
+        state->leaves[i].outlen = BLAKE2B_OUTBYTES;
+    }
+    state->leaves[LEAVES - 1].last_node = 1;
+    state->buflen = 0;
+    state->outlen = outlen;
+}
+
+// A stripe can be compressed once every leaf has input after it: more than
+// three blocks beyond the stripe's end
+#define STRIPE_DONE (STRIPE + (LEAVES - 1) * BLOCK)
+
+void hash_blake2bp_update(HashBlake2bp* state, const void* in, size_t len) {
+    const uint8_t* p = in;
+
+    // Top up held-back input first; it always starts on a stripe
+    if (state->buflen > 0) {
+        size_t take = sizeof(state->buf) - state->buflen;
+        if (take > len) take = len;
+        memcpy(state->buf + state->buflen, p, take);
+        state->buflen += take;
+        p += take;
+        len -= take;
+        if (state->buflen <= STRIPE_DONE) {
+            return;
+        }
+
+        g_compress_stripes(state->leaves, state->buf, 1);
+        state->buflen -= STRIPE;
+        memmove(state->buf, state->buf + STRIPE, state->buflen);
+        if (len == 0) {
+            return;
+        }
+
+        // The buffer was full, so exactly one stripe is left in it
+        if (STRIPE + len <= STRIPE_DONE) {
+            memcpy(state->buf + state->buflen, p, len);
+            state->buflen += len;
+            return;
+        }
+        g_compress_stripes(state->leaves, state->buf, 1);
+        state->buflen = 0;
+    }
+
+    // Whole stripes straight from the input, holding back the tail
+    if (len > STRIPE_DONE) {
+        size_t stripes = (len - STRIPE_DONE + STRIPE - 1) / STRIPE;
+        g_compress_stripes(state->leaves, p, stripes);
+        p += stripes * STRIPE;
+        len -= stripes * STRIPE;
+    }
+    memcpy(state->buf, p, len);
+    state->buflen = len;
+}
+
+void hash_blake2bp_final(HashBlake2bp* state, uint8_t* out) {
+    // Each leaf takes its blocks of the held-back input, the last one final
+    uint8_t digests[LEAVES][BLAKE2B_OUTBYTES];
+    for (int i = 0; i < LEAVES; i++) {
+        for (size_t offset = (size_t)i * BLOCK; offset < state->buflen; offset += STRIPE) {
+            size_t left = state->buflen - offset;
+            hash_blake2b_update(&state->leaves[i], state->buf + offset, left < BLOCK ? left : BLOCK);
+        }
+        hash_blake2b_final(&state->leaves[i], digests[i]);
+    }
+
+    blake2b_state root;
+    init_node(&root, state->outlen, 0, 1);
+    root.last_node = 1;
+    hash_blake2b_update(&root, digests, sizeof(digests));
+    hash_blake2b_final(&root, out);
+}
@@ -0,0 +1,57 @@
+#ifndef REBUILD_HASH_BLAKE2_H
+#define REBUILD_HASH_BLAKE2_H
+
+#include "../vendor/blake2/blake2.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// BLAKE2b and BLAKE2bp with the compression function picked for this CPU
+//
+// Drop-in replacements for the vendored reference update/final, bit-exact
+// with blake2b-ref.c and blake2bp-ref.c. The compression function runs with
+// AVX2 or SSE4.1 when cpuid reports them, and BLAKE2bp compresses its four
+// leaves side by side. The backend is chosen once, on first use; set
+// REBUILD_HASH_BACKEND to portable, sse41 or avx2 to override it.
+
+typedef enum {
+    HASH_BACKEND_AUTO,      // The fastest the CPU supports
+    HASH_BACKEND_PORTABLE,  // Plain C, as the reference implementation
+    HASH_BACKEND_SSE41,
+    HASH_BACKEND_AVX2,
+} HashBackend;
+
+// Use backend for all later hashing (AUTO: the fastest the CPU supports)
+// Returns false, changing nothing, if the CPU lacks it
+// Not thread-safe: call before hashing starts
+bool hash_blake2_set_backend(HashBackend backend);
+
+// Name of the backend in use ("portable", "sse41" or "avx2")
+const char* hash_blake2_backend_name(void);
+
+// Feed len bytes into a state set up with blake2b_init or blake2b_init_param
+void hash_blake2b_update(blake2b_state* state, const void* in, size_t len);
+
+// Finish the hash, writing state->outlen bytes to out
+void hash_blake2b_final(blake2b_state* state, uint8_t* out);
+
+// BLAKE2bp: four BLAKE2b leaves over interleaved 128-byte blocks, and a root
+// hashing their digests. Up to two stripes (four blocks) of input are held
+// back until it is known that more follows them
+typedef struct {
+    blake2b_state leaves[4];
+    uint8_t buf[2 * 4 * BLAKE2B_BLOCKBYTES];
+    size_t buflen;
+    size_t outlen;
+} HashBlake2bp;
+
+// Start an unkeyed BLAKE2bp hash with outlen (1-64) bytes of output
+void hash_blake2bp_init(HashBlake2bp* state, size_t outlen);
+
+// Feed len bytes into the hash
+void hash_blake2bp_update(HashBlake2bp* state, const void* in, size_t len);
+
+// Finish the hash, writing outlen bytes to out
+void hash_blake2bp_final(HashBlake2bp* state, uint8_t* out);
+
+#endif // REBUILD_HASH_BLAKE2_H
@@ -0,0 +1,288 @@
+#define _GNU_SOURCE
+#include "hash_cache.h"
+#include <uv.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define HASH_CACHE_MAGIC "RBHC"
+#define HASH_CACHE_VERSION 3           // 2: large files under HASH_SCHEME_BLAKE2BP, 3: tagged entries
+#define HASH_CACHE_FILE "hashcache"
+#define HASH_CACHE_SLOTS (1u << 17)    // 10 MiB file, allocated sparsely
+#define HASH_CACHE_PROBE 8             // Slots searched per key
+#define NS_PER_SEC 1000000000ULL
+#define TAG_SHIFT 56                   // Top byte of HashCacheKey.size
+
+typedef struct HashCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t reserved[13];
+} HashCacheHeader;
+
+typedef struct HashCacheSlot {
+    HashCacheKey key;
+    uint8_t hash[32];
+    uint64_t check;                    // Checksum of key and hash; 0 = empty
+} HashCacheSlot;
+
+_Static_assert(sizeof(HashCacheHeader) == 64, "hash cache header must stay 64 bytes");
+_Static_assert(sizeof(HashCacheSlot) == 80, "hash cache slot must stay 80 bytes");
+
+static void* g_map = NULL;             // Header followed by the slots
+static size_t g_map_size = 0;
+static HashCacheSlot* g_slots = NULL;
+static uint32_t g_mask = 0;
+static bool g_persistent = false;
+static uv_once_t g_memo_once = UV_ONCE_INIT;
+static atomic_uint_fast64_t g_hits;
+static atomic_uint_fast64_t g_misses;
+
+static size_t table_size(uint32_t slots) {
+    return sizeof(HashCacheHeader) + (size_t)slots * sizeof(HashCacheSlot);
+}
+
+static void use_map(void* map, size_t size, bool persistent) {
+    g_map = map;
+    g_map_size = size;
+    g_slots = (HashCacheSlot*)((char*)map + sizeof(HashCacheHeader));
+    g_mask = HASH_CACHE_SLOTS - 1;
+    g_persistent = persistent;
+}
+
+// Anonymous table used until (or instead of) the persistent one
+static void create_memo(void) {
+    if (g_map) return;
+    size_t size = table_size(HASH_CACHE_SLOTS);
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        LOG_WARN("Failed to allocate hash cache: %s", strerror(errno));
+        return;
+    }
+    use_map(map, size, false);
+}
+
+static void ensure_table(void) {
+    uv_once(&g_memo_once, create_memo);
+}
+
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static uint64_t slot_checksum(const HashCacheKey* key, const uint8_t hash[32]) {
+    uint64_t words[9] = { key->dev, key->ino, key->size, key->mtime_ns, key->ctime_ns };
+    memcpy(&words[5], hash, 32);
+
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+    for (size_t i = 0; i < ARRAY_SIZE(words); i++) {
+        h = mix64(h ^ words[i]) + i;
+    }
+    return h ? h : 1;
+}
+
+static uint32_t slot_index(const HashCacheKey* key) {
+    return (uint32_t)mix64(key->dev * 0x100000001b3ULL ^ key->ino) & g_mask;
+}
+
+// Whether a slot holds the entry for key's inode and tag, current or stale
+static bool same_entry(const HashCacheKey* slot, const HashCacheKey* key) {
+    return slot->dev == key->dev && slot->ino == key->ino &&
+           slot->size >> TAG_SHIFT == key->size >> TAG_SHIFT;
+}
+
+// Copy a slot out and verify it; false if empty or torn
+static bool read_slot(uint32_t index, HashCacheSlot* out) {
+    memcpy(out, &g_slots[index], sizeof(HashCacheSlot));
+    return out->check != 0 && out->check == slot_checksum(&out->key, out->hash);
+}
+
+bool hash_cache_open(const char* dir) {
+    if (dir == NULL) return false;
+
+    char path[4096];
+    if (snprintf(path, sizeof(path), "%s/%s", dir, HASH_CACHE_FILE) >= (int)sizeof(path)) {
+        return false;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_WARN("Failed to open hash cache %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    // Serialize creation and format checks between processes
+    if (flock(fd, LOCK_EX) != 0) {
+        LOG_WARN("Failed to lock hash cache %s: %s", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    size_t size = table_size(HASH_CACHE_SLOTS);
+    HashCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    ssize_t n = pread(fd, &header, sizeof(header), 0);
+
+    bool valid = n == (ssize_t)sizeof(header) &&
+                 memcmp(header.magic, HASH_CACHE_MAGIC, 4) == 0 &&
+                 header.version == HASH_CACHE_VERSION &&
+                 header.slot_count == HASH_CACHE_SLOTS;
+    if (!valid) {
+        // New or incompatible: start over with an empty (sparse) table
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, HASH_CACHE_MAGIC, 4);
+        header.version = HASH_CACHE_VERSION;
+        header.slot_count = HASH_CACHE_SLOTS;
+        if (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t)size) != 0 ||
+            pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+            LOG_WARN("Failed to initialize hash cache %s: %s", path, strerror(errno));
+            flock(fd, LOCK_UN);
+            close(fd);
+            return false;
+        }
+    }
+
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    flock(fd, LOCK_UN);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LOG_WARN("Failed to map hash cache %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    // No other thread may be using the cache yet
+    ensure_table();
+    if (g_map) {
+        munmap(g_map, g_map_size);
+    }
+    use_map(map, size, true);
+
+    LOG_DEBUG("Hash cache mapped from %s", path);
+    return true;
+}
+
+void hash_cache_close(void) {
+    ensure_table();
+    if (!g_map) return;
+
+    LOG_DEBUG("Hash cache: %llu hits, %llu misses%s",
+              (unsigned long long)atomic_load(&g_hits),
+              (unsigned long long)atomic_load(&g_misses),
+              g_persistent ? "" : " (in-process only)");
+
+    munmap(g_map, g_map_size);
+    g_map = NULL;
+    g_slots = NULL;
+    g_map_size = 0;
+    g_persistent = false;
+}
+
+bool hash_cache_lookup(const HashCacheKey* key, Hash* out) {
+    if (key == NULL || out == NULL) return false;
+    ensure_table();
+    if (!g_slots) return false;
+
+    uint32_t start = slot_index(key);
+    for (uint32_t i = 0; i < HASH_CACHE_PROBE; i++) {
+        HashCacheSlot slot;
+        if (!read_slot((start + i) & g_mask, &slot)) continue;
+        if (!same_entry(&slot.key, key)) continue;
+
+        // The entry is cached; its contents must still be the hashed ones
+        if (memcmp(&slot.key, key, sizeof(HashCacheKey)) != 0) break;
+
+        memcpy(out->bytes, slot.hash, sizeof(out->bytes));
+        atomic_fetch_add(&g_hits, 1);
+        return true;
+    }
+
+    atomic_fetch_add(&g_misses, 1);
+    return false;
+}
+
+// Store a hash, reusing the slot of the key's entry
+static void write_slot(const HashCacheKey* key, const Hash* hash) {
+    // Reuse this entry's slot, else an empty one, else evict by key
+    uint32_t start = slot_index(key);
+    uint64_t tag = key->size >> TAG_SHIFT;
+    uint32_t target = (start + (uint32_t)(mix64(key->ino ^ tag) % HASH_CACHE_PROBE)) & g_mask;
+    bool have_empty = false;
+    for (uint32_t i = 0; i < HASH_CACHE_PROBE; i++) {
+        uint32_t index = (start + i) & g_mask;
+        HashCacheSlot slot;
+        if (!read_slot(index, &slot)) {
+            if (!have_empty) {
+                target = index;
+                have_empty = true;
+            }
+            continue;
+        }
+        if (same_entry(&slot.key, key)) {
+            target = index;
+            break;
+        }
+    }
+
+    HashCacheSlot slot;
+    slot.key = *key;
+    memcpy(slot.hash, hash->bytes, sizeof(slot.hash));
+    slot.check = slot_checksum(key, slot.hash);
+    memcpy(&g_slots[target], &slot, sizeof(slot));
+}
+
+void hash_cache_store(const HashCacheKey* key, const Hash* hash) {
+    if (key == NULL || hash == NULL) return;
+    ensure_table();
+    if (!g_slots) return;
+
+    // Racily clean: a write in the same tick could keep this signature
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t now_ns = (uint64_t)now.tv_sec * NS_PER_SEC + (uint64_t)now.tv_nsec;
+    if (key->mtime_ns + NS_PER_SEC > now_ns || key->ctime_ns + NS_PER_SEC > now_ns) {
+        return;
+    }
+
+    write_slot(key, hash);
+}
+
+// A directory's slot: its inode, with the signature in place of the stat
+// fields. The tag byte stays clear, so each directory has one entry
+static HashCacheKey tree_key(uint64_t dev, uint64_t ino, const Hash* signature) {
+    HashCacheKey key;
+    key.dev = dev;
+    key.ino = ino;
+    memcpy(&key.size, signature->bytes, sizeof(uint64_t));
+    key.size &= ((uint64_t)1 << TAG_SHIFT) - 1;
+    memcpy(&key.mtime_ns, signature->bytes + 8, sizeof(uint64_t));
+    memcpy(&key.ctime_ns, signature->bytes + 16, sizeof(uint64_t));
+    return key;
+}
+
+bool hash_cache_lookup_tree(uint64_t dev, uint64_t ino, const Hash* signature, Hash* out) {
+    if (signature == NULL) return false;
+    HashCacheKey key = tree_key(dev, ino, signature);
+    return hash_cache_lookup(&key, out);
+}
+
+void hash_cache_store_tree(uint64_t dev, uint64_t ino, const Hash* signature, const Hash* hash) {
+    if (signature == NULL || hash == NULL) return;
+    ensure_table();
+    if (!g_slots) return;
+
+    HashCacheKey key = tree_key(dev, ino, signature);
+    write_slot(&key, hash);
+}
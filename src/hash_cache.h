@@ -0,0 +1,65 @@
+#ifndef REBUILD_HASH_CACHE_H
+#define REBUILD_HASH_CACHE_H
+
+#include "common.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// HashCache remembers content hashes of files by their stat identity
+//
+// hash_file consults it before reading a file, so hashing the same
+// unchanged file again - within one build or in a later one - costs a
+// fstat instead of a full read. Entries are keyed by (dev, inode, size,
+// mtime_ns) and also carry ctime_ns, which users can not set back.
+//
+// The table lives in an mmap'd file under the storage directory and is
+// shared by every rebuild process using that storage; until it is opened
+// (and when it can not be) an anonymous mapping serves as an in-process
+// memo. Each slot carries a checksum over its contents, so a slot torn
+// by concurrent writers reads as a miss rather than a wrong hash.
+//
+// Files changed within the last second are never cached: a later write in
+// the same timestamp tick could leave their signature unchanged.
+//
+// Directories share the table: hash_tree keeps each subtree's hash under
+// the directory's inode and a signature of the stat identities below it.
+//
+// The top byte of a key's size is a tag: keys for one inode that differ in
+// it (a file's hash under an older scheme) are separate entries, each
+// replaced only when its own contents change.
+
+// Stat identity of a file's contents
+typedef struct HashCacheKey {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    uint64_t mtime_ns;
+    uint64_t ctime_ns;
+} HashCacheKey;
+
+// Map the persistent table in dir (created if missing)
+// Replaces the in-process memo; call before any worker thread hashes
+// Returns false if the table can not be mapped (the memo stays in use)
+bool hash_cache_open(const char* dir);
+
+// Unmap the table; later lookups miss and stores are dropped
+void hash_cache_close(void);
+
+// Look up the hash recorded for key
+// Returns true and fills out on a hit
+bool hash_cache_lookup(const HashCacheKey* key, Hash* out);
+
+// Record the hash of a file whose contents had identity key
+// Ignored if the file changed too recently to trust its signature
+void hash_cache_store(const HashCacheKey* key, const Hash* hash);
+
+// Look up the tree hash recorded for directory (dev, ino) with signature
+// Returns true and fills out on a hit
+bool hash_cache_lookup_tree(uint64_t dev, uint64_t ino, const Hash* signature, Hash* out);
+
+// Record a directory's tree hash under its signature
+// Unlike hash_cache_store this trusts the caller to have left out subtrees
+// that changed too recently
+void hash_cache_store_tree(uint64_t dev, uint64_t ino, const Hash* signature, const Hash* hash);
+
+#endif // REBUILD_HASH_CACHE_H
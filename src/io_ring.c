@@ -0,0 +1,220 @@
+#define _GNU_SOURCE
+#include "io_ring.h"
+#include "common.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define PROBE_OPS 256
+
+static const uint8_t kernel_ops[] = {
+    [IO_RING_STATX] = IORING_OP_STATX,
+    [IO_RING_OPENAT] = IORING_OP_OPENAT,
+    [IO_RING_READ] = IORING_OP_READ,
+};
+
+struct IoRing {
+    int fd;
+    void* rings;                   // SQ and CQ rings, one mapping
+    size_t rings_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    unsigned* sq_head;             // Advanced by the kernel
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned* sq_array;
+    unsigned unsubmitted;          // Queued since the last io_uring_enter
+
+    unsigned* cq_head;
+    unsigned* cq_tail;             // Advanced by the kernel
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+};
+
+static unsigned load_acquire(const unsigned* p) {
+    return atomic_load_explicit((_Atomic unsigned*)p, memory_order_acquire);
+}
+
+static void store_release(unsigned* p, unsigned value) {
+    atomic_store_explicit((_Atomic unsigned*)p, value, memory_order_release);
+}
+
+// Whether the kernel knows every operation in kernel_ops
+static bool probe_ops(int fd) {
+    size_t size = sizeof(struct io_uring_probe) + PROBE_OPS * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = rebuild_calloc(1, size);
+    bool ok = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, PROBE_OPS) == 0;
+    for (size_t i = 0; ok && i < sizeof(kernel_ops); i++) {
+        uint8_t op = kernel_ops[i];
+        ok = op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    }
+    rebuild_free(probe);
+    return ok;
+}
+
+IoRing* io_ring_create(unsigned entries) {
+    const char* env = getenv("REBUILD_IO_URING");
+    if (env != NULL && strcmp(env, "0") == 0) {
+        return NULL;
+    }
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+        LOG_DEBUG("io_uring unavailable: %s", strerror(errno));
+        return NULL;
+    }
+    // One mapping for both rings (5.4), and completions never dropped (5.5)
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP) ||
+        !probe_ops(fd)) {
+        LOG_DEBUG("io_uring lacks features or opcodes, not using it");
+        close(fd);
+        return NULL;
+    }
+
+    IoRing* ring = rebuild_calloc(1, sizeof(IoRing));
+    ring->fd = fd;
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->rings_size = sq_size > cq_size ? sq_size : cq_size;
+    ring->rings = mmap(NULL, ring->rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       fd, IORING_OFF_SQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_SQES);
+    if (ring->rings == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        LOG_DEBUG("Failed to map io_uring: %s", strerror(errno));
+        if (ring->rings != MAP_FAILED) munmap(ring->rings, ring->rings_size);
+        if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+        close(fd);
+        rebuild_free(ring);
+        return NULL;
+    }
+
+    char* base = (char*)ring->rings;
+    ring->sq_head = (unsigned*)(base + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(base + params.sq_off.tail);
+    ring->sq_mask = *(unsigned*)(base + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_array = (unsigned*)(base + params.sq_off.array);
+    ring->cq_head = (unsigned*)(base + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(base + params.cq_off.tail);
+    ring->cq_mask = *(unsigned*)(base + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(base + params.cq_off.cqes);
+
+    // Submission entries are used in ring order, so the index array is fixed
+    for (unsigned i = 0; i < ring->sq_entries; i++) {
+        ring->sq_array[i] = i;
+    }
+    return ring;
+}
+
+void io_ring_free(IoRing* ring) {
+    if (ring == NULL) {
+        return;
+    }
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->rings, ring->rings_size);
+    close(ring->fd);
+    rebuild_free(ring);
+}
+
+bool io_ring_queue(IoRing* ring, const IoRingOp* op) {
+    unsigned tail = *ring->sq_tail;
+    if (tail - load_acquire(ring->sq_head) >= ring->sq_entries) {
+        return false;
+    }
+
+    struct io_uring_sqe* sqe = &ring->sqes[tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = kernel_ops[op->opcode];
+    sqe->fd = op->fd;
+    sqe->off = op->off;
+    sqe->addr = op->addr;
+    sqe->len = op->len;
+    sqe->open_flags = op->flags;   // Shares its union with statx_flags and rw_flags
+    sqe->user_data = op->user_data;
+
+    store_release(ring->sq_tail, tail + 1);
+    ring->unsubmitted++;
+    return true;
+}
+
+bool io_ring_submit(IoRing* ring, unsigned wait_nr) {
+    for (;;) {
+        unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+        long n = syscall(__NR_io_uring_enter, ring->fd, ring->unsubmitted, wait_nr, flags, NULL, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        ring->unsubmitted -= (unsigned)n;
+        // A signal may end the wait early; go back to waiting
+        unsigned ready = load_acquire(ring->cq_tail) - *ring->cq_head;
+        if (ring->unsubmitted == 0 && ready >= wait_nr) {
+            return true;
+        }
+    }
+}
+
+bool io_ring_complete(IoRing* ring, uint64_t* user_data, int32_t* res) {
+    unsigned head = *ring->cq_head;
+    if (head == load_acquire(ring->cq_tail)) {
+        return false;
+    }
+    const struct io_uring_cqe* cqe = &ring->cqes[head & ring->cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    store_release(ring->cq_head, head + 1);
+    return true;
+}
+
+#else // !HAVE_IO_URING
+
+IoRing* io_ring_create(unsigned entries) {
+    (void)entries;
+    return NULL;
+}
+
+void io_ring_free(IoRing* ring) {
+    (void)ring;
+}
+
+bool io_ring_queue(IoRing* ring, const IoRingOp* op) {
+    (void)ring;
+    (void)op;
+    return false;
+}
+
+bool io_ring_submit(IoRing* ring, unsigned wait_nr) {
+    (void)ring;
+    (void)wait_nr;
+    return false;
+}
+
+bool io_ring_complete(IoRing* ring, uint64_t* user_data, int32_t* res) {
+    (void)ring;
+    (void)user_data;
+    (void)res;
+    return false;
+}
+
+#endif // HAVE_IO_URING
@@ -0,0 +1,56 @@
+#ifndef REBUILD_IO_RING_H
+#define REBUILD_IO_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// IoRing - a minimal io_uring submission/completion ring
+//
+// Just enough of io_uring for batched file reads, on the raw system calls
+// (no liburing). A ring belongs to one thread. Where io_uring is missing
+// (not Linux, an old kernel, a seccomp filter) or REBUILD_IO_URING=0 is
+// set, io_ring_create returns NULL and callers do their I/O themselves.
+
+typedef struct IoRing IoRing;
+
+// The operations a ring takes, as the io_uring opcodes of the same names
+typedef enum {
+    IO_RING_STATX,
+    IO_RING_OPENAT,
+    IO_RING_READ,
+} IoRingOpcode;
+
+// An operation to submit; fields as in struct io_uring_sqe
+typedef struct IoRingOp {
+    IoRingOpcode opcode;
+    int32_t fd;
+    uint64_t off;                  // Offset, or address of struct statx for STATX
+    uint64_t addr;                 // Buffer or path
+    uint32_t len;                  // Buffer length, or statx mask
+    uint32_t flags;                // open_flags / statx_flags
+    uint64_t user_data;            // Handed back with the completion
+} IoRingOp;
+
+// Set up a ring with room for entries operations in flight
+// Returns NULL if io_uring is unavailable, or the kernel lacks any of the
+// operations (STATX, OPENAT and READ arrived in 5.6)
+IoRing* io_ring_create(unsigned entries);
+
+// Close the ring; operations still in flight are cancelled
+void io_ring_free(IoRing* ring);
+
+// Queue an operation for the next io_ring_submit
+// Returns false if the submission queue is full
+bool io_ring_queue(IoRing* ring, const IoRingOp* op);
+
+// Submit queued operations and wait until at least wait_nr have completed
+// Returns false on failure (errno set)
+bool io_ring_submit(IoRing* ring, unsigned wait_nr);
+
+// Take the next completion: user_data of its operation and its result
+// (as the system call would return it, or -errno)
+// Returns false if none is ready
+bool io_ring_complete(IoRing* ring, uint64_t* user_data, int32_t* res);
+
+#endif // REBUILD_IO_RING_H
@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+#include "jobserver.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct Jobserver {
+    int read_fd;                   // Private non-blocking reader of the token pipe
+    int write_fd;                  // Writer used to return tokens
+    bool owns_write_fd;            // write_fd was opened here (fifo)
+    int pipe_fds[2];               // Inheritable pipe created as a server, or -1
+    bool client;                   // Tokens belong to a parent jobserver
+    char* held;                    // Token bytes taken and not yet returned
+    int held_count;
+    int held_capacity;
+    uv_poll_t poll;                // Readability watcher on read_fd
+    bool poll_init;
+    JobserverReadyCallback callback;
+    void* user_data;
+};
+
+// Open a non-blocking reader with its own file description
+// O_NONBLOCK on an inherited descriptor would also change it for every other
+// process sharing the pipe, so go through /proc when possible
+static int open_private_reader(int fd) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    int reader = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (reader >= 0) return reader;
+
+    reader = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (reader < 0) return -1;
+    int flags = fcntl(reader, F_GETFL);
+    if (flags < 0 || fcntl(reader, F_SETFL, flags | O_NONBLOCK) < 0) {
+        close(reader);
+        return -1;
+    }
+    return reader;
+}
+
+static Jobserver* jobserver_alloc(void) {
+    Jobserver* js = (Jobserver*)rebuild_calloc(1, sizeof(Jobserver));
+    if (!js) return NULL;
+    js->read_fd = -1;
+    js->write_fd = -1;
+    js->pipe_fds[0] = -1;
+    js->pipe_fds[1] = -1;
+    return js;
+}
+
+static void jobserver_close_fds(Jobserver* js) {
+    if (js->read_fd >= 0) close(js->read_fd);
+    if (js->pipe_fds[0] >= 0) close(js->pipe_fds[0]);
+    if (js->pipe_fds[1] >= 0) close(js->pipe_fds[1]);
+    if (js->owns_write_fd && js->write_fd >= 0) close(js->write_fd);
+}
+
+// Find the jobserver option in MAKEFLAGS
+// Returns a copy of its value (e.g. "3,4" or "fifo:/tmp/x"), or NULL
+static char* find_jobserver_auth(const char* makeflags) {
+    static const char* const options[] = { "--jobserver-auth=", "--jobserver-fds=" };
+    const char* value = NULL;
+
+    // The last occurrence wins, as in make
+    for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+        const char* p = makeflags;
+        while ((p = strstr(p, options[i])) != NULL) {
+            p += strlen(options[i]);
+            if (!value || p > value) value = p;
+        }
+    }
+    if (!value) return NULL;
+
+    size_t len = strcspn(value, " \t");
+    char* copy = (char*)rebuild_malloc(len + 1);
+    if (!copy) return NULL;
+    memcpy(copy, value, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+static Jobserver* connect_client(const char* auth) {
+    Jobserver* js = jobserver_alloc();
+    if (!js) return NULL;
+    js->client = true;
+
+    if (strncmp(auth, "fifo:", 5) == 0) {
+        // Open the reader first so opening the writer never blocks
+        js->read_fd = open(auth + 5, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (js->read_fd >= 0) {
+            js->write_fd = open(auth + 5, O_WRONLY | O_CLOEXEC);
+            js->owns_write_fd = true;
+        }
+    } else {
+        int read_fd = -1;
+        int write_fd = -1;
+        if (sscanf(auth, "%d,%d", &read_fd, &write_fd) == 2 &&
+            read_fd >= 0 && write_fd >= 0 &&
+            fcntl(read_fd, F_GETFD) >= 0 && fcntl(write_fd, F_GETFD) >= 0) {
+            js->read_fd = open_private_reader(read_fd);
+            js->write_fd = write_fd;
+        }
+    }
+
+    if (js->read_fd < 0 || js->write_fd < 0) {
+        jobserver_close_fds(js);
+        rebuild_free(js);
+        return NULL;
+    }
+
+    LOG_INFO("Using jobserver from MAKEFLAGS: %s", auth);
+    return js;
+}
+
+// Advertise our jobserver to child processes through MAKEFLAGS
+static bool export_makeflags(int jobs, int read_fd, int write_fd) {
+    const char* old = getenv("MAKEFLAGS");
+    char flags[128];
+    snprintf(flags, sizeof(flags), "-j%d --jobserver-auth=%d,%d", jobs, read_fd, write_fd);
+
+    if (!old || !*old) {
+        return setenv("MAKEFLAGS", flags, 1) == 0;
+    }
+
+    // Options must come before any " -- VAR=value" overrides
+    const char* overrides = strstr(old, " -- ");
+    size_t prefix_len = overrides ? (size_t)(overrides - old) : strlen(old);
+    size_t size = strlen(old) + strlen(flags) + 2;
+    char* value = (char*)rebuild_malloc(size);
+    if (!value) return false;
+    snprintf(value, size, "%.*s %s%s", (int)prefix_len, old, flags, overrides ? overrides : "");
+
+    bool ok = setenv("MAKEFLAGS", value, 1) == 0;
+    rebuild_free(value);
+    return ok;
+}
+
+static Jobserver* create_server(int jobs) {
+    Jobserver* js = jobserver_alloc();
+    if (!js) return NULL;
+
+    // Children inherit both ends, so no O_CLOEXEC and no O_NONBLOCK here
+    if (pipe(js->pipe_fds) != 0) {
+        LOG_WARN("Failed to create jobserver pipe: %s", strerror(errno));
+        rebuild_free(js);
+        return NULL;
+    }
+    js->write_fd = js->pipe_fds[1];
+    js->read_fd = open_private_reader(js->pipe_fds[0]);
+    if (js->read_fd < 0) {
+        jobserver_close_fds(js);
+        rebuild_free(js);
+        return NULL;
+    }
+
+    // We hold the implicit token; the pipe carries the other jobs - 1
+    for (int i = 1; i < jobs; i++) {
+        if (write(js->write_fd, "+", 1) != 1) {
+            LOG_WARN("Failed to fill jobserver pipe: %s", strerror(errno));
+            break;
+        }
+    }
+
+    if (!export_makeflags(jobs, js->pipe_fds[0], js->pipe_fds[1])) {
+        LOG_WARN("Failed to export MAKEFLAGS; child builds will not share job slots");
+    }
+
+    LOG_DEBUG("Jobserver started with %d tokens (fds %d,%d)", jobs - 1, js->pipe_fds[0], js->pipe_fds[1]);
+    return js;
+}
+
+Jobserver* jobserver_connect(int jobs) {
+    const char* makeflags = getenv("MAKEFLAGS");
+    char* auth = makeflags ? find_jobserver_auth(makeflags) : NULL;
+
+    if (auth) {
+        Jobserver* js = connect_client(auth);
+        if (js) {
+            rebuild_free(auth);
+            return js;
+        }
+        // Like make, carry on with our own slots when the parent's pipe is gone
+        LOG_WARN("Jobserver in MAKEFLAGS is not available (%s); using -j%d", auth, jobs);
+        rebuild_free(auth);
+    }
+
+    return create_server(jobs);
+}
+
+bool jobserver_is_client(const Jobserver* js) {
+    return js && js->client;
+}
+
+bool jobserver_try_acquire(Jobserver* js) {
+    if (!js) return false;
+
+    if (js->held_count == js->held_capacity) {
+        int capacity = js->held_capacity ? js->held_capacity * 2 : 16;
+        char* held = (char*)rebuild_realloc(js->held, (size_t)capacity);
+        if (!held) return false;
+        js->held = held;
+        js->held_capacity = capacity;
+    }
+
+    char token;
+    ssize_t n;
+    do {
+        n = read(js->read_fd, &token, 1);
+    } while (n < 0 && errno == EINTR);
+    if (n != 1) return false;
+
+    js->held[js->held_count++] = token;
+    return true;
+}
+
+void jobserver_release(Jobserver* js) {
+    if (!js || js->held_count == 0) return;
+
+    char token = js->held[--js->held_count];
+    ssize_t n;
+    do {
+        n = write(js->write_fd, &token, 1);
+    } while (n < 0 && errno == EINTR);
+    if (n != 1) {
+        LOG_WARN("Failed to return jobserver token: %s", strerror(errno));
+    }
+}
+
+int jobserver_tokens_held(const Jobserver* js) {
+    return js ? js->held_count : 0;
+}
+
+static void on_jobserver_readable(uv_poll_t* handle, int status, int events) {
+    (void)status;
+    (void)events;
+    Jobserver* js = (Jobserver*)handle->data;
+
+    uv_poll_stop(&js->poll);
+    if (js->callback) {
+        js->callback(js->user_data);
+    }
+}
+
+void jobserver_wait(Jobserver* js, uv_loop_t* loop, JobserverReadyCallback callback, void* user_data) {
+    if (!js || !loop) return;
+
+    if (!js->poll_init) {
+        if (uv_poll_init(loop, &js->poll, js->read_fd) != 0) {
+            LOG_WARN("Failed to watch jobserver pipe");
+            return;
+        }
+        js->poll.data = js;
+        js->poll_init = true;
+    }
+
+    js->callback = callback;
+    js->user_data = user_data;
+    uv_poll_start(&js->poll, UV_READABLE, on_jobserver_readable);
+}
+
+static void on_jobserver_poll_closed(uv_handle_t* handle) {
+    Jobserver* js = (Jobserver*)handle->data;
+    jobserver_close_fds(js);
+    rebuild_free(js);
+}
+
+void jobserver_free(Jobserver* js) {
+    if (!js) return;
+
+    while (js->held_count > 0) {
+        jobserver_release(js);
+    }
+    rebuild_free(js->held);
+    js->held = NULL;
+
+    // The descriptor must stay open until the watcher is closed
+    if (js->poll_init) {
+        uv_close((uv_handle_t*)&js->poll, on_jobserver_poll_closed);
+    } else {
+        jobserver_close_fds(js);
+        rebuild_free(js);
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef REBUILD_JOBSERVER_H
+#define REBUILD_JOBSERVER_H
+
+#include "common.h"
+#include <uv.h>
+#include <stdbool.h>
+
+// GNU make jobserver - shares one pool of job tokens across a process tree
+//
+// Every process in the tree owns one implicit token; each additional job
+// it runs concurrently needs a token byte read from the jobserver and
+// written back when the job ends. rebuild joins the jobserver named in
+// MAKEFLAGS (--jobserver-auth=R,W or --jobserver-auth=fifo:PATH) when it
+// runs under make, and otherwise creates one with jobs-1 tokens and
+// advertises it in MAKEFLAGS so make, ninja and cargo started through
+// sys() draw from the same pool.
+
+typedef struct Jobserver Jobserver;
+
+// Called on the loop thread when a token may have become available
+typedef void (*JobserverReadyCallback)(void* user_data);
+
+// Join the jobserver advertised in MAKEFLAGS, or create one for jobs slots
+// Creating a server exports MAKEFLAGS to this process's environment, so it
+// must run before any thread or child process is started
+// Returns NULL if neither is possible (the build then runs unthrottled)
+Jobserver* jobserver_connect(int jobs);
+
+// True if the tokens come from a parent process's jobserver
+bool jobserver_is_client(const Jobserver* js);
+
+// Take one more token without blocking
+// The jobserver keeps the token until jobserver_release gives it back
+// Returns false if none is available right now
+bool jobserver_try_acquire(Jobserver* js);
+
+// Give back one held token
+void jobserver_release(Jobserver* js);
+
+// Number of tokens currently held (in addition to the implicit one)
+int jobserver_tokens_held(const Jobserver* js);
+
+// Invoke callback once the token pipe becomes readable (loop thread only)
+// Calling again before it fires replaces the callback
+void jobserver_wait(Jobserver* js, uv_loop_t* loop, JobserverReadyCallback callback, void* user_data);
+
+// Free the jobserver (loop thread only)
+// Closes its loop handle; the loop must run once more to finish the close
+void jobserver_free(Jobserver* js);
+
+#endif // REBUILD_JOBSERVER_H
@@ -12,6 +12,8 @@
 #define _GNU_SOURCE
 #include "common.h"
 #include "storage.h"
+#include "hash_cache.h"
+#include "gc.h"
 #include "tool.h"
 #include "umka_bridge.h"
 #include "scheduler.h"
@@ -30,28 +32,203 @@
 static void print_usage(const char* program_name);
 static void print_version(void);
 static char* find_build_file(void);
+static bool parse_jobs(const char* value, int* out_jobs);
+static bool parse_schedule(const char* value, SchedulePolicy* out_policy);
+static bool parse_limit(const char* value, char* out_class, size_t class_size, int* out_limit);
+static bool parse_size_kb(const char* value, uint64_t* out_kb);
+static void log_gc_stats(const GcStats* stats);
+static int run_gc_command(const char* program_name, int argc, char** argv);
+
+// Most --limit options accepted on one command line
+#define MAX_CLASS_LIMITS 64
 
 /**
  * Print usage information to stderr
  */
 static void print_usage(const char* program_name) {
-    fprintf(stderr, "Usage: %s [OPTIONS] <target>\n", program_name);
+    fprintf(stderr, "Usage: %s [OPTIONS] <target>...\n", program_name);
+    fprintf(stderr, "       %s gc [--cache-budget SIZE]\n", program_name);
     fprintf(stderr, "\n");
-    fprintf(stderr, "Build a target defined in BUILD.um\n");
+    fprintf(stderr, "Build targets defined in BUILD.um\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  -h, --help       Show this help message and exit\n");
+    fprintf(stderr, "  --cache-budget SIZE\n");
+    fprintf(stderr, "                   After the build, collect garbage (at most hourly) and\n");
+    fprintf(stderr, "                   drop the least recently used traces and outputs until\n");
+    fprintf(stderr, "                   the cache fits in SIZE (default: $REBUILD_CACHE_BUDGET)\n");
+    fprintf(stderr, "  -j, --jobs N     Run up to N recipes in parallel (default: CPU count)\n");
+    fprintf(stderr, "  -k, --keep-going Keep building targets that do not depend on a failure\n");
+    fprintf(stderr, "  --limit CLASS=N  Run at most N recipes of resource CLASS at once (repeatable)\n");
+    fprintf(stderr, "  --memory-budget SIZE\n");
+    fprintf(stderr, "                   Start recipes only while their recorded peak RSS fits\n");
+    fprintf(stderr, "                   in SIZE (e.g. 16G, 512M; default: no budget)\n");
+    fprintf(stderr, "  --schedule=MODE  Order ready recipes: critical-path (default) or fifo\n");
     fprintf(stderr, "  --version        Show version information and exit\n");
     fprintf(stderr, "\n");
+    fprintf(stderr, "Under make, sys() processes take job slots from the jobserver in MAKEFLAGS;\n");
+    fprintf(stderr, "otherwise child make, ninja and cargo builds share rebuild's -j slots.\n");
+    fprintf(stderr, "\n");
     fprintf(stderr, "Arguments:\n");
-    fprintf(stderr, "  target           Name of the target to build\n");
+    fprintf(stderr, "  target           Name of a target to build, or a pattern: shell wildcards\n");
+    fprintf(stderr, "                   (*, ?, [...]) or a trailing ... (lib/... is lib and every\n");
+    fprintf(stderr, "                   target under it, ... is every target); everything after\n");
+    fprintf(stderr, "                   -- is a target (rebuild -- gc builds a target named gc)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Commands:\n");
+    fprintf(stderr, "  gc               Remove temporary directories of finished builds and\n");
+    fprintf(stderr, "                   outputs no trace refers to; with a cache budget, also\n");
+    fprintf(stderr, "                   drop the least recently used traces to fit it\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Examples:\n");
     fprintf(stderr, "  %s my_app        Build 'my_app' target\n", program_name);
+    fprintf(stderr, "  %s -j 8 my_app   Build 'my_app' with 8 parallel jobs\n", program_name);
+    fprintf(stderr, "  %s lib/... app   Build app and every target under lib/ in one run\n", program_name);
+    fprintf(stderr, "  %s -j 64 --limit link=4 my_app\n", program_name);
+    fprintf(stderr, "                   Build with 64 jobs but at most 4 concurrent links\n");
+    fprintf(stderr, "  %s gc --cache-budget 20G\n", program_name);
+    fprintf(stderr, "                   Shrink the cache to 20 GiB\n");
     fprintf(stderr, "  %s --help        Show this help\n", program_name);
     fprintf(stderr, "\n");
 }
 
+/**
+ * Parse a -j/--jobs value
+ * Returns false if value is not a positive integer
+ */
+static bool parse_jobs(const char* value, int* out_jobs) {
+    if (!value || !*value) return false;
+
+    char* end = NULL;
+    errno = 0;
+    long jobs = strtol(value, &end, 10);
+    if (errno != 0 || *end != '\0' || jobs < 1 || jobs > 4096) {
+        return false;
+    }
+
+    *out_jobs = (int)jobs;
+    return true;
+}
+
+/**
+ * Parse a --schedule value
+ * Returns false if value names no known policy
+ */
+static bool parse_schedule(const char* value, SchedulePolicy* out_policy) {
+    if (!value) return false;
+
+    if (strcmp(value, "critical-path") == 0) {
+        *out_policy = SCHEDULE_CRITICAL_PATH;
+    } else if (strcmp(value, "fifo") == 0) {
+        *out_policy = SCHEDULE_FIFO;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Parse a --limit value of the form CLASS=N
+ * Returns false if the class is empty or too long, or N is not a positive integer
+ */
+static bool parse_limit(const char* value, char* out_class, size_t class_size, int* out_limit) {
+    if (!value) return false;
+
+    const char* eq = strchr(value, '=');
+    if (!eq || eq == value || (size_t)(eq - value) >= class_size) return false;
+
+    if (!parse_jobs(eq + 1, out_limit)) return false;
+
+    memcpy(out_class, value, (size_t)(eq - value));
+    out_class[eq - value] = '\0';
+    return true;
+}
+
+/**
+ * Parse a size such as 512M or 16G (K, M, G, T are powers of 1024;
+ * a plain number is bytes)
+ * Returns false if value is not a positive size
+ */
+static bool parse_size_kb(const char* value, uint64_t* out_kb) {
+    if (!value || !*value) return false;
+
+    char* end = NULL;
+    errno = 0;
+    unsigned long long size = strtoull(value, &end, 10);
+    if (errno != 0 || end == value || size == 0) return false;
+
+    uint64_t kb;
+    switch (*end) {
+        case '\0': kb = (size + 1023) / 1024; break;
+        case 'K': case 'k': kb = size; break;
+        case 'M': case 'm': kb = size * 1024; break;
+        case 'G': case 'g': kb = size * 1024 * 1024; break;
+        case 'T': case 't': kb = size * 1024 * 1024 * 1024; break;
+        default: return false;
+    }
+    if (*end && end[1] != '\0' && strcmp(end + 1, "B") != 0 && strcmp(end + 1, "iB") != 0) {
+        return false;
+    }
+
+    *out_kb = kb;
+    return true;
+}
+
+/**
+ * Report what garbage collection did
+ */
+static void log_gc_stats(const GcStats* stats) {
+    LOG_INFO("Garbage collection: %.1f MiB -> %.1f MiB (%zu trace variants dropped, "
+             "%zu objects and %zu temporary directories removed)",
+             (double)stats->bytes_before / (1024.0 * 1024.0), (double)stats->bytes_after / (1024.0 * 1024.0),
+             stats->variants_dropped, stats->objects_removed, stats->tmp_dirs_removed);
+}
+
+/**
+ * rebuild gc [--cache-budget SIZE]: collect garbage in the storage directory
+ * Returns the process exit code
+ */
+static int run_gc_command(const char* program_name, int argc, char** argv) {
+    uint64_t budget_kb = 0;
+    const char* value = getenv("REBUILD_CACHE_BUDGET");
+    if (value && *value && !parse_size_kb(value, &budget_kb)) {
+        fprintf(stderr, "Error: Invalid REBUILD_CACHE_BUDGET: %s\n", value);
+        return 1;
+    }
+
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            print_usage(program_name);
+            return 0;
+        } else if (strcmp(argv[i], "--cache-budget") == 0 || strncmp(argv[i], "--cache-budget=", 15) == 0) {
+            // Accept "--cache-budget SIZE" and "--cache-budget=SIZE"
+            value = argv[i][14] == '=' ? argv[i] + 15 : ((i + 1 < argc) ? argv[++i] : NULL);
+            if (!parse_size_kb(value, &budget_kb)) {
+                fprintf(stderr, "Error: Invalid cache budget: %s\n\n", value ? value : "(missing)");
+                print_usage(program_name);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Error: Unknown gc argument: %s\n\n", argv[i]);
+            print_usage(program_name);
+            return 1;
+        }
+    }
+
+    Storage* storage = storage_init();
+    if (!storage) {
+        LOG_ERROR("Failed to initialize storage subsystem");
+        return REBUILD_ERROR_IO;
+    }
+    storage_use_trace_pack(storage);
+
+    GcStats stats;
+    bool ok = gc_collect(storage, budget_kb * 1024, &stats);
+    log_gc_stats(&stats);
+    storage_free(storage);
+    return ok ? 0 : REBUILD_ERROR_IO;
+}
+
 /**
  * Print version information to stdout
  */
@@ -130,7 +307,16 @@ int main(int argc, char** argv) {
     void* umka = NULL;
     TargetRegistry* registry = NULL;
     char* build_file = NULL;
-    char* target_name = NULL;
+    int target_arg_count = 0;
+    const char** targets = NULL;
+    size_t target_count = 0;
+    int jobs = (int)uv_available_parallelism();
+    SchedulePolicy policy = SCHEDULE_CRITICAL_PATH;
+    const char* limits[MAX_CLASS_LIMITS];
+    int limit_count = 0;
+    uint64_t memory_budget_kb = 0;
+    uint64_t cache_budget_kb = 0;
+    bool keep_going = false;
 
     // Parse command line arguments
     if (argc < 2) {
@@ -139,6 +325,16 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    if (strcmp(argv[1], "gc") == 0) {
+        return run_gc_command(argv[0], argc - 2, argv + 2);
+    }
+
+    const char* cache_budget = getenv("REBUILD_CACHE_BUDGET");
+    if (cache_budget && *cache_budget && !parse_size_kb(cache_budget, &cache_budget_kb)) {
+        fprintf(stderr, "Error: Invalid REBUILD_CACHE_BUDGET: %s\n", cache_budget);
+        return 1;
+    }
+
     // Handle options
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
@@ -147,32 +343,86 @@ int main(int argc, char** argv) {
         } else if (strcmp(argv[i], "--version") == 0) {
             print_version();
             return 0;
+        } else if (strcmp(argv[i], "-k") == 0 || strcmp(argv[i], "--keep-going") == 0) {
+            keep_going = true;
+        } else if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0 ||
+                   strncmp(argv[i], "-j", 2) == 0 || strncmp(argv[i], "--jobs=", 7) == 0) {
+            // Accept "-j N", "-jN", "--jobs N" and "--jobs=N"
+            const char* value = NULL;
+            if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) {
+                value = (i + 1 < argc) ? argv[++i] : NULL;
+            } else if (argv[i][1] == 'j') {
+                value = argv[i] + 2;
+            } else {
+                value = argv[i] + 7;
+            }
+            if (!parse_jobs(value, &jobs)) {
+                fprintf(stderr, "Error: Invalid job count: %s\n\n", value ? value : "(missing)");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--schedule") == 0 || strncmp(argv[i], "--schedule=", 11) == 0) {
+            // Accept "--schedule MODE" and "--schedule=MODE"
+            const char* value = argv[i][10] == '=' ? argv[i] + 11 : ((i + 1 < argc) ? argv[++i] : NULL);
+            if (!parse_schedule(value, &policy)) {
+                fprintf(stderr, "Error: Invalid schedule: %s\n\n", value ? value : "(missing)");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--limit") == 0 || strncmp(argv[i], "--limit=", 8) == 0) {
+            // Accept "--limit CLASS=N" and "--limit=CLASS=N"
+            const char* value = argv[i][7] == '=' ? argv[i] + 8 : ((i + 1 < argc) ? argv[++i] : NULL);
+            char resource_class[128];
+            int limit;
+            if (!parse_limit(value, resource_class, sizeof(resource_class), &limit)) {
+                fprintf(stderr, "Error: Invalid limit: %s (expected CLASS=N)\n\n", value ? value : "(missing)");
+                print_usage(argv[0]);
+                return 1;
+            }
+            if (limit_count == MAX_CLASS_LIMITS) {
+                fprintf(stderr, "Error: Too many --limit options\n");
+                return 1;
+            }
+            limits[limit_count++] = value;
+        } else if (strcmp(argv[i], "--memory-budget") == 0 || strncmp(argv[i], "--memory-budget=", 16) == 0) {
+            // Accept "--memory-budget SIZE" and "--memory-budget=SIZE"
+            const char* value = argv[i][15] == '=' ? argv[i] + 16 : ((i + 1 < argc) ? argv[++i] : NULL);
+            if (!parse_size_kb(value, &memory_budget_kb)) {
+                fprintf(stderr, "Error: Invalid memory budget: %s\n\n", value ? value : "(missing)");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cache-budget") == 0 || strncmp(argv[i], "--cache-budget=", 15) == 0) {
+            // Accept "--cache-budget SIZE" and "--cache-budget=SIZE"
+            const char* value = argv[i][14] == '=' ? argv[i] + 15 : ((i + 1 < argc) ? argv[++i] : NULL);
+            if (!parse_size_kb(value, &cache_budget_kb)) {
+                fprintf(stderr, "Error: Invalid cache budget: %s\n\n", value ? value : "(missing)");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--") == 0) {
+            while (++i < argc) {
+                argv[1 + target_arg_count++] = argv[i];
+            }
         } else if (argv[i][0] == '-') {
             fprintf(stderr, "Error: Unknown option: %s\n\n", argv[i]);
             print_usage(argv[0]);
             return 1;
         } else {
-            // First non-option argument is the target
-            if (!target_name) {
-                target_name = argv[i];
-            } else {
-                fprintf(stderr, "Error: Multiple targets specified: %s and %s\n",
-                        target_name, argv[i]);
-                fprintf(stderr, "Only one target can be built at a time\n\n");
-                print_usage(argv[0]);
-                return 1;
-            }
+            // Non-option arguments are targets; move them to argv[1...]
+            // as getopt does (never past i, so nothing unread is overwritten)
+            argv[1 + target_arg_count++] = argv[i];
         }
     }
 
-    if (!target_name) {
+    if (target_arg_count == 0) {
         fprintf(stderr, "Error: No target specified\n\n");
         print_usage(argv[0]);
         return 1;
     }
 
     LOG_INFO("Rebuild build system v%s", REBUILD_VERSION);
-    LOG_INFO("Building target: %s", target_name);
+    LOG_INFO("Building %s%s (%d jobs)", argv[1], target_arg_count > 1 ? " and more" : "", jobs);
 
     // Step 1: Initialize storage subsystem
     LOG_DEBUG("Initializing storage...");
@@ -184,6 +434,12 @@ int main(int argc, char** argv) {
     }
     LOG_INFO("Storage initialized at: %s", storage->base_dir);
 
+    // Share content hashes of unchanged files with earlier and concurrent builds
+    hash_cache_open(storage->base_dir);
+
+    // Look traces up in one indexed pack rather than one file per trace
+    storage_use_trace_pack(storage);
+
     // Step 2: Initialize tool manager
     LOG_DEBUG("Initializing tool manager...");
     tool_mgr = tool_manager_create();
@@ -216,10 +472,19 @@ int main(int argc, char** argv) {
     // Set tool manager in scheduler
     scheduler->tools = tool_mgr;
 
+    // Size the worker pool before any recipe is queued
+    scheduler_set_jobs(scheduler, jobs);
+    scheduler_set_schedule(scheduler, policy);
+    scheduler_set_memory_budget(scheduler, memory_budget_kb);
+    scheduler_set_keep_going(scheduler, keep_going);
+
+    // Share process slots with a parent make, or offer them to child builds
+    scheduler_set_jobserver(scheduler, jobserver_connect(jobs));
+
     // Set up UMKA bridge callbacks for scheduler integration
     UmkaBridgeCallbacks callbacks;
     callbacks.depend_on = scheduler_on_depend_request;
-    callbacks.sys = NULL;  // sys callback uses scheduler_execute_sys directly
+    callbacks.sys = NULL;  // sys() goes through scheduler_start_sys from the bridge
     umka_bridge_set_callbacks(&callbacks);
 
     LOG_DEBUG("Scheduler created");
@@ -243,7 +508,9 @@ int main(int argc, char** argv) {
     }
 
     // Store UMKA instance in scheduler for recipe execution
+    // Additional worker VMs compile the same file on demand
     scheduler->umka = umka;
+    scheduler_set_build_file(scheduler, build_file);
     LOG_DEBUG("BUILD.um loaded successfully");
 
     // Create target registry and register targets
@@ -283,20 +550,33 @@ int main(int argc, char** argv) {
         goto cleanup;
     }
 
+    // Command-line class limits override those set in BUILD.um
+    for (int i = 0; i < limit_count; i++) {
+        char resource_class[128];
+        int limit;
+        parse_limit(limits[i], resource_class, sizeof(resource_class), &limit);
+        target_registry_set_class_limit(registry, resource_class, limit);
+    }
+
     // Store registry in scheduler
     scheduler->registry = registry;
     LOG_INFO("Registered targets successfully");
 
-    // Step 6: Validate that target exists
-    // Note: For now, we rely on scheduler_build to validate the target.
-    // In a more advanced implementation, we could scan the UMKA script
-    // for target definitions here.
+    // Step 6: Expand target patterns
+    // Plain names are passed through; scheduler_build_targets reports
+    // targets that do not exist
+    err = target_registry_expand(registry, (const char* const*)argv + 1, (size_t)target_arg_count,
+                                 &targets, &target_count);
+    if (err != REBUILD_OK) {
+        exit_code = err;
+        goto cleanup;
+    }
 
-    // Step 7: Build the target
-    LOG_INFO("Starting build...");
-    err = scheduler_build(scheduler, target_name);
+    // Step 7: Build all targets in one scheduler run
+    LOG_INFO("Starting build of %zu target(s)...", target_count);
+    err = scheduler_build_targets(scheduler, targets, target_count);
     if (err != REBUILD_OK) {
-        LOG_ERROR("Failed to initiate build for target: %s", target_name);
+        LOG_ERROR("Failed to initiate build");
         exit_code = err;
         goto cleanup;
     }
@@ -305,7 +585,7 @@ int main(int argc, char** argv) {
     LOG_DEBUG("Running scheduler event loop...");
     err = scheduler_run(scheduler);
     if (err != REBUILD_OK) {
-        LOG_ERROR("Build failed for target: %s", target_name);
+        LOG_ERROR("Build failed");
         if (scheduler->target_error) {
             LOG_ERROR("Failed target: %s", scheduler->target_error);
         }
@@ -314,10 +594,12 @@ int main(int argc, char** argv) {
     }
 
     // Build succeeded
-    LOG_INFO("Build succeeded: %s", target_name);
-    const char* output_path = scheduler_get_completed(scheduler, target_name);
-    if (output_path) {
-        LOG_INFO("Output available at: %s", output_path);
+    for (size_t i = 0; i < target_count; i++) {
+        LOG_INFO("Build succeeded: %s", targets[i]);
+        const char* output_path = scheduler_get_completed(scheduler, targets[i]);
+        if (output_path) {
+            LOG_INFO("Output available at: %s", output_path);
+        }
     }
 
 cleanup:
@@ -331,6 +613,8 @@ cleanup:
         rebuild_free(build_file);
     }
 
+    rebuild_free(targets);
+
     // Free UMKA instance if loaded
     // Note: UMKA cleanup is handled by scheduler_free
 
@@ -350,8 +634,16 @@ cleanup:
     // Cleanup UMKA bridge
     umka_bridge_cleanup();
 
+    // Keep the cache within its budget; this build's traces are saved by now
+    if (storage && cache_budget_kb > 0 && gc_due(storage)) {
+        GcStats stats;
+        gc_collect(storage, cache_budget_kb * 1024, &stats);
+        log_gc_stats(&stats);
+    }
+
     // Free storage (last, as scheduler may need it during cleanup)
     if (storage) {
+        hash_cache_close();
         storage_free(storage);
     }
 
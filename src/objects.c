@@ -0,0 +1,645 @@
+#define _GNU_SOURCE
+#include "objects.h"
+#include "hash.h"
+#include "buffer.h"
+#include "set.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+// Manifest entry modes (as in git trees)
+#define MODE_FILE "100644"
+#define MODE_EXEC "100755"
+#define MODE_LINK "120000"
+#define MODE_DIR "040000"
+#define MODE_LEN 6
+#define HEX_LEN 64
+
+#define COPY_CHUNK (64 * 1024)
+
+// ============================================================================
+// Copying
+// ============================================================================
+
+static bool write_all(int fd, const void* data, size_t len, off_t offset) {
+    const char* p = (const char*)data;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return true;
+}
+
+// Copy all of src into the empty file dst
+static bool copy_contents(int src, int dst) {
+#ifdef FICLONE
+    // Share the source's extents: no data is copied (btrfs, XFS, ...)
+    if (ioctl(dst, FICLONE, src) == 0) {
+        return true;
+    }
+#endif
+
+    struct stat st;
+    if (fstat(src, &st) != 0) {
+        return false;
+    }
+    off_t done = 0;
+
+#ifdef __linux__
+    // Let the kernel copy (and the file system, where it can do it in place)
+    while (done < st.st_size) {
+        loff_t in = done;
+        loff_t out = done;
+        ssize_t n = copy_file_range(src, &in, dst, &out, (size_t)(st.st_size - done), 0);
+        if (n <= 0) {
+            break;  // Not supported here (e.g. across file systems); copy the rest below
+        }
+        done += n;
+    }
+#endif
+
+    char* buf = (char*)rebuild_malloc(COPY_CHUNK);
+    if (!buf) {
+        return false;
+    }
+    bool ok = true;
+    for (;;) {
+        ssize_t n = pread(src, buf, COPY_CHUNK, done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            ok = n == 0;
+            break;
+        }
+        if (!write_all(dst, buf, (size_t)n, done)) {
+            ok = false;
+            break;
+        }
+        done += n;
+    }
+    rebuild_free(buf);
+    return ok;
+}
+
+typedef bool (*FillFn)(int fd, void* ctx);
+
+typedef struct Bytes {
+    const void* data;
+    size_t len;
+} Bytes;
+
+static bool fill_from_fd(int fd, void* ctx) {
+    return copy_contents(*(int*)ctx, fd);
+}
+
+static bool fill_from_bytes(int fd, void* ctx) {
+    Bytes* bytes = (Bytes*)ctx;
+    return write_all(fd, bytes->data, bytes->len, 0);
+}
+
+// Create path through a temporary file in the same directory, so nobody
+// ever sees it half written
+static bool write_atomically(const char* path, mode_t mode, FillFn fill, void* ctx) {
+    size_t len = strlen(path) + 8;
+    char* tmp = (char*)rebuild_malloc(len);
+    if (!tmp) {
+        return false;
+    }
+    snprintf(tmp, len, "%s.XXXXXX", path);
+
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    if (fd < 0) {
+        LOG_ERROR("Failed to create %s: %s", tmp, strerror(errno));
+        rebuild_free(tmp);
+        return false;
+    }
+
+    bool ok = fill(fd, ctx) && fchmod(fd, mode) == 0;
+    ok = close(fd) == 0 && ok;
+    if (ok && rename(tmp, path) != 0) {
+        LOG_ERROR("Failed to rename %s: %s", tmp, strerror(errno));
+        ok = false;
+    }
+    if (!ok) {
+        unlink(tmp);
+    }
+    rebuild_free(tmp);
+    return ok;
+}
+
+// Read a whole (small) file
+static Buffer* read_whole_file(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    Buffer* buf = fstat(fd, &st) == 0 ? buffer_create((size_t)st.st_size + 1) : NULL;
+    char chunk[4096];
+    while (buf) {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n == 0) break;
+        if (n < 0 || buffer_append(buf, chunk, (size_t)n) != REBUILD_OK) {
+            buffer_free(buf);
+            buf = NULL;
+        }
+    }
+    close(fd);
+    return buf;
+}
+
+// An object that is already there is marked used now (its mtime), so the
+// garbage collector leaves it alone until the trace referring to it is saved
+static bool object_present(const char* path) {
+    return utimensat(AT_FDCWD, path, NULL, 0) == 0 || access(path, F_OK) == 0;
+}
+
+// ============================================================================
+// Storing
+// ============================================================================
+
+// Store bytes (a manifest or a link target) as an object
+static bool store_bytes(Storage* s, const void* data, size_t len, Hash* out) {
+    hash_data(data, len, out);
+    char* path = storage_get_object_path(s, out);
+    if (!path) {
+        return false;
+    }
+
+    Bytes bytes = { data, len };
+    bool ok = object_present(path) || write_atomically(path, 0444, fill_from_bytes, &bytes);
+    rebuild_free(path);
+    return ok;
+}
+
+// Store a file as an object; out receives its content hash
+static bool store_file(Storage* s, const char* path, const struct stat* st, Hash* out) {
+    if (!hash_file(path, out)) {
+        return false;
+    }
+    char* object_path = storage_get_object_path(s, out);
+    if (!object_path) {
+        return false;
+    }
+
+    // Unchanged outputs are already there
+    if (object_present(object_path)) {
+        rebuild_free(object_path);
+        return true;
+    }
+
+    bool ok = false;
+    int src = open(path, O_RDONLY | O_CLOEXEC);
+    if (src >= 0) {
+        ok = write_atomically(object_path, 0444, fill_from_fd, &src);
+
+        // An object must hold exactly what its name says
+        struct stat after;
+        if (ok && (fstat(src, &after) != 0 || after.st_size != st->st_size ||
+                   after.st_mtim.tv_sec != st->st_mtim.tv_sec ||
+                   after.st_mtim.tv_nsec != st->st_mtim.tv_nsec)) {
+            LOG_WARN("Output changed while being stored: %s", path);
+            unlink(object_path);
+            ok = false;
+        }
+        close(src);
+    }
+    rebuild_free(object_path);
+    return ok;
+}
+
+typedef struct TreeWalk {
+    Storage* storage;          // NULL to only hash
+    Buffer* manifest;
+    bool ok;
+} TreeWalk;
+
+// "a/b" (or just b when a is NULL); NULL on allocation failure
+static char* join_path(const char* a, const char* b) {
+    if (!a) {
+        return rebuild_strdup(b);
+    }
+    size_t len = strlen(a) + strlen(b) + 2;
+    char* path = (char*)rebuild_malloc(len);
+    if (path) {
+        snprintf(path, len, "%s/%s", a, b);
+    }
+    return path;
+}
+
+static int keep_entry(const struct dirent* entry) {
+    return strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0;
+}
+
+static int compare_entries(const struct dirent** a, const struct dirent** b) {
+    return strcmp((*a)->d_name, (*b)->d_name);
+}
+
+static void append_entry(TreeWalk* w, const char* mode, const Hash* hash, const char* rel) {
+    char* hex = hash_to_hex(hash);
+    if (!hex ||
+        buffer_append_str(w->manifest, mode) != REBUILD_OK ||
+        buffer_append_char(w->manifest, ' ') != REBUILD_OK ||
+        buffer_append_str(w->manifest, hex) != REBUILD_OK ||
+        buffer_append_char(w->manifest, ' ') != REBUILD_OK ||
+        buffer_append_str(w->manifest, rel) != REBUILD_OK ||
+        buffer_append_char(w->manifest, '\n') != REBUILD_OK) {
+        w->ok = false;
+    }
+    rebuild_free(hex);
+}
+
+// Add the entries below dir to the manifest (rel: dir's path in the tree)
+static bool walk_tree(TreeWalk* w, const char* dir, const char* rel) {
+    struct dirent** entries = NULL;
+    int count = scandir(dir, &entries, keep_entry, compare_entries);
+    if (count < 0) {
+        LOG_WARN("Failed to read output directory %s: %s", dir, strerror(errno));
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const char* name = entries[i]->d_name;
+        char* full = join_path(dir, name);
+        char* child = join_path(rel, name);
+        if (strchr(name, '\n')) {
+            LOG_WARN("Not storing output with a newline in its name: %s/%s", dir, name);
+        } else if (!full || !child) {
+            w->ok = false;
+        } else {
+            struct stat st;
+            Hash hash;
+            if (lstat(full, &st) != 0) {
+                w->ok = false;
+            } else if (S_ISDIR(st.st_mode)) {
+                memset(&hash, 0, sizeof(hash));
+                append_entry(w, MODE_DIR, &hash, child);
+                if (!walk_tree(w, full, child)) w->ok = false;
+            } else if (S_ISREG(st.st_mode)) {
+                bool hashed = w->storage ? store_file(w->storage, full, &st, &hash) : hash_file(full, &hash);
+                if (hashed) {
+                    append_entry(w, (st.st_mode & S_IXUSR) ? MODE_EXEC : MODE_FILE, &hash, child);
+                } else {
+                    w->ok = false;
+                }
+            } else if (S_ISLNK(st.st_mode)) {
+                char target[4096];
+                ssize_t len = readlink(full, target, sizeof(target));
+                if (len < 0 || (size_t)len >= sizeof(target)) {
+                    w->ok = false;
+                } else if (w->storage) {
+                    if (store_bytes(w->storage, target, (size_t)len, &hash)) {
+                        append_entry(w, MODE_LINK, &hash, child);
+                    } else {
+                        w->ok = false;
+                    }
+                } else {
+                    hash_data(target, (size_t)len, &hash);
+                    append_entry(w, MODE_LINK, &hash, child);
+                }
+            } else {
+                LOG_DEBUG("Skipping special file in outputs: %s", full);
+            }
+        }
+        rebuild_free(full);
+        rebuild_free(child);
+        free(entries[i]);
+    }
+    free(entries);
+    return true;
+}
+
+// Build dir's manifest; storage NULL only hashes
+static Buffer* build_manifest(Storage* storage, const char* dir, bool* ok) {
+    TreeWalk w = { .storage = storage, .manifest = buffer_create(1024), .ok = true };
+    if (!w.manifest) {
+        return NULL;
+    }
+    if (!walk_tree(&w, dir, NULL)) {
+        buffer_free(w.manifest);
+        return NULL;
+    }
+    *ok = w.ok;
+    return w.manifest;
+}
+
+bool objects_store_tree(Storage* s, const char* dir, Hash* tree_hash) {
+    if (!s || !dir || !tree_hash) {
+        return false;
+    }
+
+    bool ok = false;
+    Buffer* manifest = build_manifest(s, dir, &ok);
+    if (!manifest) {
+        return false;
+    }
+    ok = store_bytes(s, buffer_data(manifest), buffer_size(manifest), tree_hash) && ok;
+    buffer_free(manifest);
+    return ok;
+}
+
+bool objects_hash_tree(const char* dir, Hash* tree_hash) {
+    if (!dir || !tree_hash) {
+        return false;
+    }
+
+    bool ok = false;
+    Buffer* manifest = build_manifest(NULL, dir, &ok);
+    if (!manifest) {
+        return false;
+    }
+    hash_data(buffer_data(manifest), buffer_size(manifest), tree_hash);
+    buffer_free(manifest);
+    return ok;
+}
+
+// ============================================================================
+// Restoring
+// ============================================================================
+
+// Remove a file, link or whole directory tree
+static bool remove_path(const char* path) {
+    struct stat st;
+    if (lstat(path, &st) != 0) {
+        return errno == ENOENT;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        return unlink(path) == 0;
+    }
+
+    struct dirent** entries = NULL;
+    int count = scandir(path, &entries, keep_entry, NULL);
+    bool ok = count >= 0;
+    for (int i = 0; i < count; i++) {
+        char* child = ok ? join_path(path, entries[i]->d_name) : NULL;
+        ok = child && remove_path(child);
+        rebuild_free(child);
+        free(entries[i]);
+    }
+    free(entries);
+    return ok && rmdir(path) == 0;
+}
+
+// mkdir -p
+static bool make_directories(const char* path) {
+    char* tmp = rebuild_strdup(path);
+    if (!tmp) {
+        return false;
+    }
+    bool ok = true;
+    for (char* p = tmp + 1; ok; p++) {
+        if (*p == '/' || *p == '\0') {
+            char c = *p;
+            *p = '\0';
+            ok = mkdir(tmp, 0755) == 0 || errno == EEXIST;
+            *p = c;
+            if (c == '\0') break;
+        }
+    }
+    rebuild_free(tmp);
+    return ok;
+}
+
+// Bring one manifest entry back at full
+static bool restore_entry(Storage* s, const char* mode, const Hash* hash, const char* full) {
+    struct stat st;
+    bool exists = lstat(full, &st) == 0;
+
+    if (strcmp(mode, MODE_DIR) == 0) {
+        if (exists && S_ISDIR(st.st_mode)) {
+            return true;
+        }
+        return (!exists || remove_path(full)) && mkdir(full, 0755) == 0;
+    }
+
+    char* object_path = storage_get_object_path(s, hash);
+    if (!object_path) {
+        return false;
+    }
+
+    bool ok = false;
+    if (strcmp(mode, MODE_LINK) == 0) {
+        Buffer* target = read_whole_file(object_path);
+        if (target && buffer_append_char(target, '\0') == REBUILD_OK) {
+            char current[4096];
+            ssize_t len = exists && S_ISLNK(st.st_mode) ? readlink(full, current, sizeof(current) - 1) : -1;
+            if (len >= 0) current[len] = '\0';
+            ok = (len >= 0 && strcmp(current, buffer_data(target)) == 0) ||
+                 ((!exists || remove_path(full)) && symlink(buffer_data(target), full) == 0);
+        }
+        buffer_free(target);
+    } else {
+        bool exec = strcmp(mode, MODE_EXEC) == 0;
+        Hash current;
+        if (exists && S_ISREG(st.st_mode) && ((st.st_mode & S_IXUSR) != 0) == exec &&
+            hash_file(full, &current) && hash_equal(&current, hash)) {
+            ok = true;  // Still intact
+        } else {
+            int src = open(object_path, O_RDONLY | O_CLOEXEC);
+            if (src < 0) {
+                LOG_DEBUG("Object missing from the store: %s", object_path);
+            } else {
+                ok = (!exists || S_ISREG(st.st_mode) || remove_path(full)) &&
+                     write_atomically(full, exec ? 0755 : 0644, fill_from_fd, &src);
+                close(src);
+            }
+        }
+    }
+    rebuild_free(object_path);
+    return ok;
+}
+
+// Remove everything below dir that the tree does not have
+static bool prune_tree(const char* dir, const char* rel, const Set* wanted) {
+    struct dirent** entries = NULL;
+    int count = scandir(dir, &entries, keep_entry, NULL);
+    if (count < 0) {
+        return false;
+    }
+
+    bool ok = true;
+    for (int i = 0; i < count; i++) {
+        char* full = ok ? join_path(dir, entries[i]->d_name) : NULL;
+        char* child = ok ? join_path(rel, entries[i]->d_name) : NULL;
+        struct stat st;
+        if (!full || !child) {
+            ok = false;
+        } else if (!set_has(wanted, child)) {
+            ok = remove_path(full);
+        } else if (lstat(full, &st) == 0 && S_ISDIR(st.st_mode)) {
+            ok = prune_tree(full, child, wanted);
+        }
+        rebuild_free(full);
+        rebuild_free(child);
+        free(entries[i]);
+    }
+    free(entries);
+    return ok;
+}
+
+// A manifest path must stay inside the output directory
+static bool safe_relative_path(const char* rel) {
+    if (rel[0] == '\0' || rel[0] == '/') {
+        return false;
+    }
+    for (const char* p = rel; *p; ) {
+        const char* end = strchr(p, '/');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len == 0 || (len == 1 && p[0] == '.') || (len == 2 && p[0] == '.' && p[1] == '.')) {
+            return false;
+        }
+        p += len + (end ? 1 : 0);
+    }
+    return true;
+}
+
+typedef struct ManifestEntry {
+    const char* mode;
+    Hash hash;
+    const char* rel;
+} ManifestEntry;
+
+// Read the manifest of a stored tree and split it into entries (pointing
+// into *manifest, which the caller frees along with the entries)
+// Returns NULL if the manifest is missing or malformed
+static ManifestEntry* read_manifest(Storage* s, const Hash* tree_hash, Buffer** manifest, size_t* count) {
+    char* path = storage_get_object_path(s, tree_hash);
+    Buffer* buf = path ? read_whole_file(path) : NULL;
+    rebuild_free(path);
+    *manifest = buf;
+    *count = 0;
+    if (!buf || buffer_append_char(buf, '\0') != REBUILD_OK) {
+        return NULL;
+    }
+
+    size_t lines = 0;
+    for (const char* p = buffer_data(buf); *p; p++) {
+        lines += *p == '\n';
+    }
+    ManifestEntry* entries = (ManifestEntry*)rebuild_malloc((lines + 1) * sizeof(ManifestEntry));
+    if (!entries) {
+        return NULL;
+    }
+
+    // Lines are "<mode> <hex hash> <path>\n"; parents come before children
+    char* line = (char*)buffer_data(buf);
+    while (*line) {
+        char* end = strchr(line, '\n');
+        if (!end || (size_t)(end - line) < MODE_LEN + HEX_LEN + 3 ||
+            line[MODE_LEN] != ' ' || line[MODE_LEN + 1 + HEX_LEN] != ' ') {
+            rebuild_free(entries);
+            return NULL;
+        }
+        *end = '\0';
+        line[MODE_LEN] = '\0';
+        line[MODE_LEN + 1 + HEX_LEN] = '\0';
+        ManifestEntry* e = &entries[(*count)++];
+        e->mode = line;
+        e->rel = line + MODE_LEN + HEX_LEN + 2;
+        if (!hash_from_hex(line + MODE_LEN + 1, &e->hash) || !safe_relative_path(e->rel)) {
+            rebuild_free(entries);
+            return NULL;
+        }
+        line = end + 1;
+    }
+    return entries;
+}
+
+bool objects_restore_tree(Storage* s, const Hash* tree_hash, const char* dir) {
+    if (!s || !tree_hash || !dir) {
+        return false;
+    }
+
+    // Untouched since it was stored: nothing to do
+    Hash current;
+    if (objects_hash_tree(dir, &current) && hash_equal(&current, tree_hash)) {
+        return true;
+    }
+
+    Buffer* manifest = NULL;
+    size_t count = 0;
+    ManifestEntry* entries = read_manifest(s, tree_hash, &manifest, &count);
+    if (!entries) {
+        if (manifest) {
+            LOG_WARN("Corrupt output manifest for %s", dir);
+        } else {
+            LOG_DEBUG("Output tree not in the store: %s", dir);
+        }
+        buffer_free(manifest);
+        return false;
+    }
+
+    // A tree with objects missing (e.g. collected as garbage) is left alone
+    bool ok = true;
+    for (size_t i = 0; i < count && ok; i++) {
+        if (strcmp(entries[i].mode, MODE_DIR) == 0) continue;
+        char* object_path = storage_get_object_path(s, &entries[i].hash);
+        ok = object_path && access(object_path, F_OK) == 0;
+        if (!ok) {
+            LOG_DEBUG("Object missing from the store: %s", object_path ? object_path : "?");
+        }
+        rebuild_free(object_path);
+    }
+
+    Set* wanted = ok ? set_create(64) : NULL;
+    ok = wanted && make_directories(dir);
+    for (size_t i = 0; i < count && ok; i++) {
+        char* full = join_path(dir, entries[i].rel);
+        ok = full && set_add(wanted, entries[i].rel) == REBUILD_OK &&
+             restore_entry(s, entries[i].mode, &entries[i].hash, full);
+        if (!ok) {
+            LOG_DEBUG("Failed to restore output %s", full);
+        }
+        rebuild_free(full);
+    }
+
+    if (ok) {
+        ok = prune_tree(dir, NULL, wanted);
+    }
+    if (ok) {
+        LOG_INFO("Restored outputs from the store: %s", dir);
+    }
+
+    set_free(wanted);
+    rebuild_free(entries);
+    buffer_free(manifest);
+    return ok;
+}
+
+Hash* objects_tree_objects(Storage* s, const Hash* tree_hash, size_t* count) {
+    *count = 0;
+    if (!s || !tree_hash) {
+        return NULL;
+    }
+
+    Buffer* manifest = NULL;
+    size_t entry_count = 0;
+    ManifestEntry* entries = read_manifest(s, tree_hash, &manifest, &entry_count);
+    Hash* objects = entries ? (Hash*)rebuild_malloc((entry_count + 1) * sizeof(Hash)) : NULL;
+    if (objects) {
+        objects[(*count)++] = *tree_hash;
+        for (size_t i = 0; i < entry_count; i++) {
+            if (strcmp(entries[i].mode, MODE_DIR) != 0) {
+                objects[(*count)++] = entries[i].hash;
+            }
+        }
+    }
+    rebuild_free(entries);
+    buffer_free(manifest);
+    return objects;
+}
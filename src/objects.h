@@ -0,0 +1,46 @@
+#ifndef REBUILD_OBJECTS_H
+#define REBUILD_OBJECTS_H
+
+#include "common.h"
+#include "storage.h"
+#include <stdbool.h>
+
+// Objects - recipe outputs in the content-addressed store (objects/)
+//
+// Every file of an output directory is stored as an object named by its
+// content hash. The directory itself is described by a manifest, a text
+// object with one line per entry, sorted by path:
+//
+//     100644 <hash> path/to/file      (100755: executable)
+//     120000 <hash> path/to/link      (object holds the link target)
+//     040000 <zero> path/to/dir
+//
+// The hash of the manifest is the output tree hash a trace records, so a
+// cache hit can bring back the exact tree from the store. Files are copied
+// in and out by reflink where the file system supports it, else by
+// copy_file_range, else by read and write. Hard links are never used: a
+// recipe that rewrites its output in place would change the stored object.
+
+// Store every entry of dir and its manifest; tree_hash receives the
+// manifest's hash
+// Returns false on I/O error (tree_hash is still set if dir could be read)
+bool objects_store_tree(Storage* s, const char* dir, Hash* tree_hash);
+
+// Compute the tree hash of dir without storing anything
+// Returns false if dir can not be read
+bool objects_hash_tree(const char* dir, Hash* tree_hash);
+
+// Make dir match the stored tree: missing or changed entries are copied
+// from the store, entries not in the tree are removed
+// Does nothing if dir already has this tree hash
+// Leaves dir alone and returns false if the manifest or an object is
+// missing; returns false on I/O error
+bool objects_restore_tree(Storage* s, const Hash* tree_hash, const char* dir);
+
+// The objects a stored tree refers to: its manifest, then the object of
+// every file and link (duplicates included)
+// *count receives the number of hashes; caller frees the array
+// Returns NULL if the manifest is missing or malformed
+Hash* objects_tree_objects(Storage* s, const Hash* tree_hash, size_t* count);
+
+#endif // REBUILD_OBJECTS_H
@@ -0,0 +1,165 @@
+#define _GNU_SOURCE
+#include "pool.h"
+#include <uv.h>
+#include <stdlib.h>
+
+typedef struct WorkBatch {
+    WorkPoolTask task;
+    void* ctx;
+    size_t count;
+    size_t next;                   // Next index to hand out
+    int in_flight;                 // Tasks running right now
+    bool cancelled;                // A task returned false
+    bool linked;                   // Still on the pool's list of open batches
+    uv_cond_t done;                // Signalled when the last task finishes
+    struct WorkBatch* next_batch;
+} WorkBatch;
+
+struct WorkPool {
+    uv_mutex_t lock;
+    uv_cond_t work_ready;          // A batch with unclaimed indices was added
+    WorkBatch* batches;            // Batches with indices left to hand out
+    bool stopping;
+    uv_thread_t* threads;
+    int thread_count;
+};
+
+// Drop a batch from the open list (caller holds pool->lock)
+static void unlink_batch(WorkPool* pool, WorkBatch* batch) {
+    if (!batch->linked) return;
+    for (WorkBatch** p = &pool->batches; *p; p = &(*p)->next_batch) {
+        if (*p == batch) {
+            *p = batch->next_batch;
+            break;
+        }
+    }
+    batch->linked = false;
+}
+
+// Claim the next index of a batch (caller holds pool->lock)
+static bool claim_index(WorkPool* pool, WorkBatch* batch, size_t* index) {
+    if (batch->cancelled || batch->next >= batch->count) return false;
+    *index = batch->next++;
+    batch->in_flight++;
+    if (batch->next >= batch->count) {
+        unlink_batch(pool, batch);
+    }
+    return true;
+}
+
+// Run one claimed task and record its outcome; returns with pool->lock held
+static void run_claimed(WorkPool* pool, WorkBatch* batch, size_t index) {
+    uv_mutex_unlock(&pool->lock);
+    bool ok = batch->task(index, batch->ctx);
+    uv_mutex_lock(&pool->lock);
+
+    if (!ok) {
+        batch->cancelled = true;
+        unlink_batch(pool, batch);
+    }
+    if (--batch->in_flight == 0 && (batch->cancelled || batch->next >= batch->count)) {
+        uv_cond_signal(&batch->done);
+    }
+}
+
+static void pool_thread(void* arg) {
+    WorkPool* pool = (WorkPool*)arg;
+
+    uv_mutex_lock(&pool->lock);
+    while (!pool->stopping) {
+        WorkBatch* batch = pool->batches;
+        size_t index;
+        if (!batch || !claim_index(pool, batch, &index)) {
+            uv_cond_wait(&pool->work_ready, &pool->lock);
+            continue;
+        }
+        run_claimed(pool, batch, index);
+    }
+    uv_mutex_unlock(&pool->lock);
+}
+
+WorkPool* work_pool_create(int threads) {
+    if (threads < 1) return NULL;
+
+    WorkPool* pool = (WorkPool*)rebuild_calloc(1, sizeof(WorkPool));
+    if (!pool) return NULL;
+    pool->threads = (uv_thread_t*)rebuild_calloc((size_t)threads, sizeof(uv_thread_t));
+    if (!pool->threads || uv_mutex_init(&pool->lock) != 0) {
+        rebuild_free(pool->threads);
+        rebuild_free(pool);
+        return NULL;
+    }
+    uv_cond_init(&pool->work_ready);
+
+    for (int i = 0; i < threads; i++) {
+        if (uv_thread_create(&pool->threads[i], pool_thread, pool) != 0) {
+            LOG_WARN("Started only %d of %d pool threads", i, threads);
+            break;
+        }
+        pool->thread_count++;
+    }
+
+    if (pool->thread_count == 0) {
+        work_pool_free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void work_pool_free(WorkPool* pool) {
+    if (!pool) return;
+
+    uv_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    uv_cond_broadcast(&pool->work_ready);
+    uv_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->thread_count; i++) {
+        uv_thread_join(&pool->threads[i]);
+    }
+
+    uv_cond_destroy(&pool->work_ready);
+    uv_mutex_destroy(&pool->lock);
+    rebuild_free(pool->threads);
+    rebuild_free(pool);
+}
+
+bool work_pool_run(WorkPool* pool, size_t count, WorkPoolTask task, void* ctx) {
+    if (!task) return false;
+
+    // Nothing to share: run inline
+    if (!pool || count < 2) {
+        for (size_t i = 0; i < count; i++) {
+            if (!task(i, ctx)) return false;
+        }
+        return true;
+    }
+
+    WorkBatch batch = {
+        .task = task,
+        .ctx = ctx,
+        .count = count,
+    };
+    uv_cond_init(&batch.done);
+
+    uv_mutex_lock(&pool->lock);
+    batch.next_batch = pool->batches;
+    pool->batches = &batch;
+    batch.linked = true;
+    uv_cond_broadcast(&pool->work_ready);
+
+    // Help with our own batch, then wait for the tasks still running
+    size_t index;
+    while (claim_index(pool, &batch, &index)) {
+        run_claimed(pool, &batch, index);
+    }
+    while (batch.in_flight > 0) {
+        uv_cond_wait(&batch.done, &pool->lock);
+    }
+    unlink_batch(pool, &batch);
+    bool ok = !batch.cancelled;
+    uv_mutex_unlock(&pool->lock);
+
+    uv_cond_destroy(&batch.done);
+    return ok;
+}
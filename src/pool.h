@@ -0,0 +1,34 @@
+#ifndef REBUILD_POOL_H
+#define REBUILD_POOL_H
+
+#include "common.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// WorkPool - fans small blocking jobs (stat, hash) out over its own threads
+//
+// It is separate from the libuv thread pool on purpose: its callers (cache
+// checks, recipes) already run on libuv workers, and waiting there for more
+// libuv work could deadlock. Several callers may run batches at once; the
+// calling thread always works on its own batch too, so a batch finishes
+// even when every pool thread is busy elsewhere.
+
+typedef struct WorkPool WorkPool;
+
+// Run item index of a batch; return false to cancel the rest of the batch
+typedef bool (*WorkPoolTask)(size_t index, void* ctx);
+
+// Start a pool with the given number of threads
+// Returns NULL on failure (work_pool_run then runs batches inline)
+WorkPool* work_pool_create(int threads);
+
+// Stop the threads and free the pool; no batch may be running
+void work_pool_free(WorkPool* pool);
+
+// Run task for indices 0..count-1 and wait for them
+// Once any task returns false no further index is started; tasks already
+// running finish. pool may be NULL to run the batch on the calling thread.
+// Returns true if every task ran and returned true
+bool work_pool_run(WorkPool* pool, size_t count, WorkPoolTask task, void* ctx);
+
+#endif // REBUILD_POOL_H
@@ -0,0 +1,335 @@
+#define _GNU_SOURCE
+#include "process.h"
+#include "buffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+// posix_spawn_file_actions_addchdir_np appeared in glibc 2.29
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+#define REBUILD_HAVE_SPAWN_CHDIR 1
+#else
+#define REBUILD_HAVE_SPAWN_CHDIR 0
+#endif
+
+// A running child process
+typedef struct Process {
+    ProcessManager* mgr;
+    pid_t pid;
+    uv_pipe_t out_pipe;            // Parent end of the child's stdout
+    uv_pipe_t err_pipe;            // Parent end of the child's stderr
+    Buffer* out_buf;
+    Buffer* err_buf;
+    int open_streams;              // Pipes not yet closed
+    bool exited;                   // Reaped by wait4()
+    int status;                    // Raw wait status
+    struct rusage usage;           // Resource usage from wait4()
+    ProcessExitCallback on_exit;
+    void* user_data;
+    struct Process* next;          // Running list
+} Process;
+
+struct ProcessManager {
+    uv_loop_t* loop;
+    uv_signal_t sigchld;           // Reaps exited children
+    Process* running;              // Loop thread only
+    char read_buf[64 * 1024];      // Shared read buffer (reads are serialized on the loop)
+};
+
+// ============================================================================
+// Results
+// ============================================================================
+
+void process_result_free(ProcessResult* result) {
+    if (!result) return;
+
+    rebuild_free(result->stdout_data);
+    rebuild_free(result->stderr_data);
+    rebuild_free(result);
+}
+
+uint64_t rusage_cpu_time_us(const struct rusage* usage) {
+    if (!usage) return 0;
+
+    uint64_t user = (uint64_t)usage->ru_utime.tv_sec * 1000000 + (uint64_t)usage->ru_utime.tv_usec;
+    uint64_t sys = (uint64_t)usage->ru_stime.tv_sec * 1000000 + (uint64_t)usage->ru_stime.tv_usec;
+    return user + sys;
+}
+
+// Result for a process that could not be started
+static ProcessResult* spawn_failure_result(const char* program, int err) {
+    ProcessResult* result = rebuild_calloc(1, sizeof(ProcessResult));
+    result->exit_code = 127;
+    result->stdout_data = rebuild_strdup("");
+
+    char msg[512];
+    snprintf(msg, sizeof(msg), "Failed to execute %s: %s\n", program, strerror(err));
+    result->stderr_data = rebuild_strdup(msg);
+    return result;
+}
+
+// ============================================================================
+// Process lifecycle (loop thread)
+// ============================================================================
+
+static void running_remove(ProcessManager* mgr, Process* proc) {
+    Process** link = &mgr->running;
+    while (*link && *link != proc) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = proc->next;
+    }
+
+    // Nothing left to reap; do not keep the loop alive for SIGCHLD
+    if (!mgr->running) {
+        uv_unref((uv_handle_t*)&mgr->sigchld);
+    }
+}
+
+// Deliver the result once the child has exited and both streams are closed
+static void process_maybe_finish(Process* proc) {
+    if (!proc->exited || proc->open_streams > 0) return;
+
+    ProcessResult* result = rebuild_calloc(1, sizeof(ProcessResult));
+    if (WIFEXITED(proc->status)) {
+        result->exit_code = WEXITSTATUS(proc->status);
+    } else {
+        result->exit_code = -1;
+        result->term_signal = WIFSIGNALED(proc->status) ? WTERMSIG(proc->status) : 0;
+    }
+    result->stdout_data = buffer_to_string(proc->out_buf);
+    result->stderr_data = buffer_to_string(proc->err_buf);
+    result->usage = proc->usage;
+
+    LOG_DEBUG("Process %d finished with exit code %d", (int)proc->pid, result->exit_code);
+
+    running_remove(proc->mgr, proc);
+    buffer_free(proc->out_buf);
+    buffer_free(proc->err_buf);
+
+    ProcessExitCallback on_exit = proc->on_exit;
+    void* user_data = proc->user_data;
+    rebuild_free(proc);
+
+    on_exit(result, user_data);
+}
+
+static void on_pipe_closed(uv_handle_t* handle) {
+    Process* proc = (Process*)handle->data;
+    proc->open_streams--;
+    process_maybe_finish(proc);
+}
+
+static void on_pipe_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+    (void)suggested_size;
+    Process* proc = (Process*)handle->data;
+    buf->base = proc->mgr->read_buf;
+    buf->len = sizeof(proc->mgr->read_buf);
+}
+
+static void on_pipe_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+    Process* proc = (Process*)stream->data;
+
+    if (nread > 0) {
+        Buffer* out = (stream == (uv_stream_t*)&proc->out_pipe) ? proc->out_buf : proc->err_buf;
+        buffer_append(out, buf->base, (size_t)nread);
+    } else if (nread < 0) {
+        // EOF or read error: the stream is done either way
+        if (nread != UV_EOF) {
+            LOG_WARN("Error reading from process %d: %s", (int)proc->pid, uv_strerror((int)nread));
+        }
+        uv_close((uv_handle_t*)stream, on_pipe_closed);
+    }
+}
+
+static void on_sigchld(uv_signal_t* handle, int signum) {
+    (void)signum;
+    ProcessManager* mgr = (ProcessManager*)handle->data;
+
+    // SIGCHLD coalesces, so poll every running child
+    Process* proc = mgr->running;
+    while (proc) {
+        Process* next = proc->next;
+        if (!proc->exited) {
+            pid_t r = wait4(proc->pid, &proc->status, WNOHANG, &proc->usage);
+            if (r == proc->pid) {
+                proc->exited = true;
+                process_maybe_finish(proc);
+            }
+        }
+        proc = next;
+    }
+}
+
+// Start the child with stdin from /dev/null and stdout/stderr on the given fds
+static int spawn_child(const char* const* args, const char* cwd, int out_fd, int err_fd,
+                       pid_t* out_pid) {
+#if !REBUILD_HAVE_SPAWN_CHDIR
+    if (cwd) {
+        // No way to set the working directory through posix_spawn: fork/exec
+        pid_t pid = fork();
+        if (pid < 0) return errno;
+        if (pid == 0) {
+            int devnull = open("/dev/null", O_RDONLY);
+            if (devnull >= 0) dup2(devnull, STDIN_FILENO);
+            dup2(out_fd, STDOUT_FILENO);
+            dup2(err_fd, STDERR_FILENO);
+            if (chdir(cwd) != 0) _exit(127);
+            execvp(args[0], (char* const*)args);
+            _exit(127);
+        }
+        *out_pid = pid;
+        return 0;
+    }
+#endif
+
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    int err = posix_spawn_file_actions_init(&actions);
+    if (err != 0) return err;
+    err = posix_spawnattr_init(&attr);
+    if (err != 0) {
+        posix_spawn_file_actions_destroy(&actions);
+        return err;
+    }
+
+    // dup2 clears O_CLOEXEC on the targets; every other pipe end is close-on-exec
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, err_fd, STDERR_FILENO);
+#if REBUILD_HAVE_SPAWN_CHDIR
+    if (cwd) {
+        posix_spawn_file_actions_addchdir_np(&actions, cwd);
+    }
+#endif
+
+    // Children start with default dispositions and nothing blocked,
+    // whatever libuv installed in this process
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigfillset(&signals);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    err = posix_spawnp(out_pid, args[0], &actions, &attr, (char* const*)args, environ);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return err;
+}
+
+void process_spawn(ProcessManager* mgr, const char* const* args, const char* cwd,
+                   ProcessExitCallback on_exit, void* user_data) {
+    if (!mgr || !args || !args[0] || !on_exit) {
+        if (on_exit) on_exit(spawn_failure_result("(null)", EINVAL), user_data);
+        return;
+    }
+
+    int out_fds[2];
+    int err_fds[2];
+    if (pipe2(out_fds, O_CLOEXEC) != 0) {
+        on_exit(spawn_failure_result(args[0], errno), user_data);
+        return;
+    }
+    if (pipe2(err_fds, O_CLOEXEC) != 0) {
+        int err = errno;
+        close(out_fds[0]);
+        close(out_fds[1]);
+        on_exit(spawn_failure_result(args[0], err), user_data);
+        return;
+    }
+
+    pid_t pid = 0;
+    int err = spawn_child(args, cwd, out_fds[1], err_fds[1], &pid);
+
+    // The child holds its own copies of the write ends
+    close(out_fds[1]);
+    close(err_fds[1]);
+
+    if (err != 0) {
+        close(out_fds[0]);
+        close(err_fds[0]);
+        LOG_ERROR("Failed to spawn %s: %s", args[0], strerror(err));
+        on_exit(spawn_failure_result(args[0], err), user_data);
+        return;
+    }
+
+    LOG_DEBUG("Spawned process %d: %s", (int)pid, args[0]);
+
+    Process* proc = rebuild_calloc(1, sizeof(Process));
+    proc->mgr = mgr;
+    proc->pid = pid;
+    proc->out_buf = buffer_create(1024);
+    proc->err_buf = buffer_create(1024);
+    proc->open_streams = 2;
+    proc->on_exit = on_exit;
+    proc->user_data = user_data;
+
+    proc->next = mgr->running;
+    mgr->running = proc;
+    uv_ref((uv_handle_t*)&mgr->sigchld);
+
+    // Drain both streams concurrently so a full stderr pipe can not stall the child
+    uv_pipe_t* pipes[2] = { &proc->out_pipe, &proc->err_pipe };
+    int fds[2] = { out_fds[0], err_fds[0] };
+    for (int i = 0; i < 2; i++) {
+        uv_pipe_init(mgr->loop, pipes[i], 0);
+        pipes[i]->data = proc;
+        int rc = uv_pipe_open(pipes[i], fds[i]);
+        if (rc == 0) {
+            rc = uv_read_start((uv_stream_t*)pipes[i], on_pipe_alloc, on_pipe_read);
+        }
+        if (rc != 0) {
+            LOG_WARN("Failed to read output of process %d: %s", (int)pid, uv_strerror(rc));
+            uv_close((uv_handle_t*)pipes[i], on_pipe_closed);
+        }
+    }
+}
+
+// ============================================================================
+// Manager
+// ============================================================================
+
+ProcessManager* process_manager_create(uv_loop_t* loop) {
+    if (!loop) return NULL;
+
+    ProcessManager* mgr = rebuild_calloc(1, sizeof(ProcessManager));
+    if (!mgr) return NULL;
+    mgr->loop = loop;
+
+    uv_signal_init(loop, &mgr->sigchld);
+    mgr->sigchld.data = mgr;
+    if (uv_signal_start(&mgr->sigchld, on_sigchld, SIGCHLD) != 0) {
+        LOG_ERROR("Failed to watch SIGCHLD");
+        uv_close((uv_handle_t*)&mgr->sigchld, NULL);
+        uv_run(loop, UV_RUN_NOWAIT);
+        rebuild_free(mgr);
+        return NULL;
+    }
+    uv_unref((uv_handle_t*)&mgr->sigchld);
+
+    return mgr;
+}
+
+void process_manager_free(ProcessManager* mgr) {
+    if (!mgr) return;
+
+    if (mgr->running) {
+        LOG_WARN("Freeing process manager with processes still running");
+    }
+
+    uv_close((uv_handle_t*)&mgr->sigchld, NULL);
+    uv_run(mgr->loop, UV_RUN_NOWAIT);
+
+    rebuild_free(mgr);
+}
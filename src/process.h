@@ -0,0 +1,51 @@
+#ifndef REBUILD_PROCESS_H
+#define REBUILD_PROCESS_H
+
+#include "common.h"
+#include <uv.h>
+#include <sys/resource.h>
+
+// Process engine - runs child processes asynchronously on the libuv loop
+//
+// Children are started with posix_spawn (a vfork-style clone on glibc, so
+// spawning does not copy the parent's page tables), stdout and stderr are
+// drained concurrently through uv_pipe_t readers, and exits are reaped with
+// wait4() from a SIGCHLD watcher so resource usage is available per process.
+
+// Result of a finished process
+typedef struct ProcessResult {
+    int exit_code;           // Exit status, 127 if it could not be started, -1 if killed
+    int term_signal;         // Signal that terminated the process, or 0
+    char* stdout_data;       // Captured stdout (NUL-terminated, owned)
+    char* stderr_data;       // Captured stderr (NUL-terminated, owned)
+    struct rusage usage;     // Resource usage reported by wait4()
+} ProcessResult;
+
+// Called on the loop thread once the process has exited and both streams hit EOF
+// The callback takes ownership of result (free with process_result_free)
+typedef void (*ProcessExitCallback)(ProcessResult* result, void* user_data);
+
+typedef struct ProcessManager ProcessManager;
+
+// Create a process manager bound to a loop
+// Installs the SIGCHLD watcher; must be called on the loop thread
+ProcessManager* process_manager_create(uv_loop_t* loop);
+
+// Free the manager
+// Must be called on the loop thread with no processes running
+void process_manager_free(ProcessManager* mgr);
+
+// Start a process (loop thread only)
+// args is a NULL-terminated argv; args[0] is looked up in PATH
+// cwd may be NULL to inherit the current directory
+// on_exit is always invoked exactly once, also when the spawn itself fails
+void process_spawn(ProcessManager* mgr, const char* const* args, const char* cwd,
+                   ProcessExitCallback on_exit, void* user_data);
+
+// Free a process result
+void process_result_free(ProcessResult* result);
+
+// User plus system CPU time recorded in usage, in microseconds
+uint64_t rusage_cpu_time_us(const struct rusage* usage);
+
+#endif // REBUILD_PROCESS_H
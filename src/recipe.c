@@ -1,4 +1,7 @@
+#define _GNU_SOURCE
+
 #include "recipe.h"
+#include "process.h"
 #include <string.h>
 #include <stdlib.h>
 
@@ -66,6 +69,26 @@ Recipe* recipe_create(const char* target_name) {
     r->fiber = NULL;
     r->user_data = NULL;
     r->start_time = 0;
+    r->wait_count = 0;
+    r->heap_index = -1;
+    r->seq = 0;
+    r->estimate_ms = 0;
+    r->priority = 0;
+    r->holds_class_slot = false;
+    r->cpu_time_us = 0;
+    r->peak_rss_kb = 0;
+    r->predicted_rss_kb = 0;
+    r->reserved_rss_kb = 0;
+    r->cache_checked = false;
+    r->cache_checking = false;
+    r->has_output_hash = false;
+    r->lane = -1;
+    r->fiber_id = 0;
+    r->dep_failed = false;
+    r->failed_dep = NULL;
+    r->sys_running = false;
+    r->sys_args = NULL;
+    r->sys_result = NULL;
 
     LOG_DEBUG("Created recipe for target: %s", target_name);
 
@@ -94,6 +117,15 @@ void recipe_free(Recipe* r) {
     set_free(r->declared_deps);
     set_free(r->pending_deps);
 
+    // Free an unstarted sys() command and an uncollected result
+    if (r->sys_args) {
+        for (char** arg = r->sys_args; *arg; arg++) {
+            rebuild_free(*arg);
+        }
+        rebuild_free(r->sys_args);
+    }
+    process_result_free(r->sys_result);
+
     // Note: fiber and user_data are owned by scheduler, not freed here
 
     rebuild_free(r);
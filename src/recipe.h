@@ -27,6 +27,27 @@ typedef struct Recipe {
     void* fiber;               // UMKA fiber handle (opaque pointer for now)
     void* user_data;           // For scheduler use (e.g., waiters list)
     uint64_t start_time;       // Start timestamp (milliseconds since epoch)
+    int wait_count;            // Dependencies requested but not yet complete (scheduler lock)
+    int heap_index;            // Position in the ready heap, -1 if not queued (scheduler lock)
+    uint64_t seq;              // Order in which the recipe became ready (scheduler lock)
+    uint64_t estimate_ms;      // Duration recorded by the last trace, 0 if unknown (scheduler lock)
+    uint64_t priority;         // Estimated critical path through this recipe, ms (scheduler lock)
+    bool holds_class_slot;     // Counted against its resource class limit (loop thread)
+    uint64_t cpu_time_us;      // User + sys CPU of the recipe and its processes (scheduler lock)
+    uint64_t peak_rss_kb;      // Largest resident set of its processes (scheduler lock)
+    uint64_t predicted_rss_kb; // Peak RSS recorded by the last trace, 0 if unknown (scheduler lock)
+    uint64_t reserved_rss_kb;  // Share of the memory budget it holds (loop thread)
+    bool cache_checked;        // Request key computed and cache consulted
+    bool cache_checking;       // Cache check running on the thread pool (loop thread)
+    Hash output_hash;          // Output tree hash, valid once has_output_hash is set
+    bool has_output_hash;      // Set when built or taken from the cache, before COMPLETE
+    int lane;                  // Worker VM holding this recipe's fiber (-1 until started)
+    int fiber_id;              // Fiber id within the lane's UMKA driver
+    bool dep_failed;           // A requested dependency failed or can never complete
+    const char* failed_dep;    // Name of that dependency (owned by its recipe), or NULL
+    bool sys_running;          // A sys() process is in flight (scheduler lock)
+    char** sys_args;           // argv of the sys() call waiting for a process slot (owned)
+    struct ProcessResult* sys_result; // Finished sys() result not yet collected (scheduler lock)
 } Recipe;
 
 // Create a new recipe for the given target
@@ -59,7 +80,7 @@ bool recipe_has_dependency(Recipe* r, const char* dep_path);
 
 // Compute the request key (cache key) for this recipe
 // Combines:
-//   - recipe_code_hash: Hash of the recipe function bytecode
+//   - recipe_code_hash: Hash of the recipe function's code (see code_index.h)
 //   - target_name: The target being built
 //   - declared_deps: All declared dependencies (in sorted order for determinism)
 // The computed hash is stored in r->request_key
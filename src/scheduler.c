@@ -5,23 +5,29 @@
  * - Dynamic dependency discovery (recipes can request dependencies during execution)
  * - Suspending execution (recipes suspend when waiting for dependencies)
  * - Content-addressed caching (via constructive traces)
- * - Async I/O via libuv (Phase 3+)
+ * - Parallel execution on the libuv thread pool
  *
- * PHASE 1+2 IMPLEMENTATION (Current):
- * - Synchronous recipe execution (simplified from full async)
- * - Focus on correctness over maximum parallelism
- * - Proper trace checking and caching
- * - Foundation for future async parallelism
+ * CURRENT IMPLEMENTATION:
+ * - Up to `jobs` recipes execute concurrently via uv_queue_work
+ * - Each job slot ("lane") owns its own UMKA instance (a VM is single-threaded)
+ *   compiled with a generated driver that runs recipe functions as UMKA fibers
+ * - depend_on() and sys() yield the recipe's fiber; the recipe is resumed at
+ *   the same point, on the same lane, once the dependency or process is done
+ * - The loop thread owns dispatch; completions arrive via after_work callbacks
+ *   and workers wake the loop with uv_async when they make recipes ready
+ * - sys() hands the command to the process engine (process.c); at most `jobs`
+ *   processes run at once, so suspended recipes can not flood the machine
+ * - A runtime error discards the lane's VM; other recipes suspended in it
+ *   start over from the top
  *
- * PHASE 3+ ENHANCEMENTS (Future):
- * - Parallel recipe execution via libuv thread pool
- * - Async process spawning with uv_spawn
- * - Async file I/O for hashing and trace validation
- * - Maximum parallelism across independent recipes
+ * - Cache checks run on the libuv thread pool, so independent recipes are
+ *   checked concurrently; each trace's dependencies are stat'ed and rehashed
+ *   in parallel on a separate WorkPool, stopping at the first mismatch
  *
  * ARCHITECTURE:
  * - Recipes: Tracked in a map, keyed by target name
- * - Ready Queue: Recipes ready to execute (FIFO)
+ * - Ready Queue: Recipes ready to execute, a heap ordered longest estimated
+ *   critical path first (or FIFO with --schedule=fifo)
  * - Waiting Map: Maps targets to recipes waiting on them
  * - Completed Map: Maps targets to their output paths
  * - Storage: Content-addressed trace and output storage
@@ -33,8 +39,17 @@
  *
  * When a recipe calls depend_on():
  * 1. If dependency is complete, return output path immediately
- * 2. If dependency is pending, suspend recipe and queue dependency
+ * 2. If dependency is pending, queue it and yield the recipe's fiber
  * 3. When dependency completes, resume all waiting recipes
+ *
+ * LOCKING:
+ * sched->lock guards recipes, completed, waiting, ready_queue, active_count and
+ * the per-recipe wait_count/heap_index/priority fields, as well as
+ * output_hash/has_output_hash, which cache checks on workers read for a
+ * dependency, and estimate_ms/predicted_rss_kb, which they fill in from the
+ * recipe's stored trace. Recipe state transitions happen on
+ * the loop thread, except while a recipe is RUNNING, when only its worker
+ * touches it.
  */
 
 #define _GNU_SOURCE
@@ -42,14 +57,16 @@
 #include "scheduler.h"
 #include "target.h"
 #include "trace.h"
+#include "trace_pack.h"
+#include "objects.h"
 #include "hash.h"
 #include "set.h"
 #include "buffer.h"
 #include "umka_bridge.h"
+#include "process.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/wait.h>
 #include <unistd.h>
 #include <errno.h>
 #include <sys/stat.h>
@@ -128,6 +145,111 @@ static bool queue_is_empty(const Queue* q) {
     return !q || q->size == 0;
 }
 
+// ============================================================================
+// Ready heap: recipes ordered by scheduling policy
+// ============================================================================
+
+struct RecipeHeap {
+    Recipe** items;
+    size_t size;
+    size_t capacity;
+    SchedulePolicy policy;
+};
+
+// True if a should be dispatched before b
+static bool heap_before(const RecipeHeap* h, const Recipe* a, const Recipe* b) {
+    if (h->policy == SCHEDULE_CRITICAL_PATH && a->priority != b->priority) {
+        return a->priority > b->priority;
+    }
+    return a->seq < b->seq;
+}
+
+static void heap_swap(RecipeHeap* h, size_t i, size_t j) {
+    Recipe* tmp = h->items[i];
+    h->items[i] = h->items[j];
+    h->items[j] = tmp;
+    h->items[i]->heap_index = (int)i;
+    h->items[j]->heap_index = (int)j;
+}
+
+static void heap_sift_up(RecipeHeap* h, size_t i) {
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!heap_before(h, h->items[i], h->items[parent])) break;
+        heap_swap(h, i, parent);
+        i = parent;
+    }
+}
+
+static void heap_sift_down(RecipeHeap* h, size_t i) {
+    for (;;) {
+        size_t best = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        if (left < h->size && heap_before(h, h->items[left], h->items[best])) best = left;
+        if (right < h->size && heap_before(h, h->items[right], h->items[best])) best = right;
+        if (best == i) break;
+        heap_swap(h, i, best);
+        i = best;
+    }
+}
+
+static RecipeHeap* heap_create(SchedulePolicy policy) {
+    RecipeHeap* h = (RecipeHeap*)rebuild_calloc(1, sizeof(RecipeHeap));
+    if (h) {
+        h->policy = policy;
+    }
+    return h;
+}
+
+static void heap_free(RecipeHeap* h) {
+    if (!h) return;
+    rebuild_free(h->items);
+    rebuild_free(h);
+}
+
+static bool heap_push(RecipeHeap* h, Recipe* recipe) {
+    if (!h || !recipe) return false;
+
+    if (h->size == h->capacity) {
+        size_t capacity = h->capacity ? h->capacity * 2 : 64;
+        Recipe** items = (Recipe**)rebuild_realloc(h->items, capacity * sizeof(Recipe*));
+        if (!items) return false;
+        h->items = items;
+        h->capacity = capacity;
+    }
+
+    h->items[h->size] = recipe;
+    recipe->heap_index = (int)h->size;
+    h->size++;
+    heap_sift_up(h, h->size - 1);
+    return true;
+}
+
+static Recipe* heap_pop(RecipeHeap* h) {
+    if (!h || h->size == 0) return NULL;
+
+    Recipe* top = h->items[0];
+    h->size--;
+    if (h->size > 0) {
+        h->items[0] = h->items[h->size];
+        h->items[0]->heap_index = 0;
+        heap_sift_down(h, 0);
+    }
+    top->heap_index = -1;
+    return top;
+}
+
+// Restore heap order after a queued recipe's priority went up
+static void heap_increased(RecipeHeap* h, Recipe* recipe) {
+    if (!h || recipe->heap_index < 0) return;
+    heap_sift_up(h, (size_t)recipe->heap_index);
+}
+
+static bool heap_is_empty(const RecipeHeap* h) {
+    return !h || h->size == 0;
+}
+
 // ============================================================================
 // Waiter list for tracking recipes waiting on dependencies
 // ============================================================================
@@ -172,23 +294,14 @@ static bool waiter_list_add(WaiterList* list, Recipe* recipe) {
     return true;
 }
 
+// Resume every waiter (caller holds sched->lock)
 static void waiter_list_notify_all(WaiterList* list, Scheduler* sched, const char* dep_output_path) {
     if (!list) return;
 
     WaiterNode* node = list->head;
     while (node) {
-        Recipe* waiter = node->recipe;
-
-        // Remove this dependency from pending set
-        if (waiter->pending_deps) {
-            // We need to track which dependency completed - store in recipe's user_data
-            // For now, just mark recipe as ready if no more pending deps
-            // Note: This is simplified - full implementation would track specific deps
-        }
-
-        // Resume the recipe
-        scheduler_resume_recipe(sched, waiter, dep_output_path);
-
+        // Resume the recipe; it becomes ready once its last dependency is done
+        scheduler_resume_recipe(sched, node->recipe, dep_output_path);
         node = node->next;
     }
 }
@@ -199,6 +312,7 @@ static void waiter_list_notify_all(WaiterList* list, Scheduler* sched, const cha
 
 // Callback for adding dependencies to trace
 typedef struct {
+    Scheduler* sched;
     Trace* trace;
     size_t added_count;
 } AddDepsContext;
@@ -209,6 +323,29 @@ static bool add_dep_to_trace_callback(const char* dep_path, void* user_data) {
         return true;  // Continue iteration
     }
 
+    // A target dependency is recorded with the hash of what it produced, so
+    // a rebuild of it that yields the same output leaves this trace valid
+    uv_mutex_lock(&ctx->sched->lock);
+    Recipe* dep = (Recipe*)map_get(ctx->sched->recipes, dep_path);
+    bool have_output = dep && dep->state == RECIPE_COMPLETE && dep->has_output_hash;
+    Hash output_hash;
+    if (have_output) {
+        output_hash = dep->output_hash;
+    }
+    uv_mutex_unlock(&ctx->sched->lock);
+
+    if (dep) {
+        if (!have_output) {
+            LOG_WARN("No output hash for target dependency: %s", dep_path);
+        } else if (trace_add_target_dependency(ctx->trace, dep_path, &output_hash)) {
+            ctx->added_count++;
+            LOG_DEBUG("Added target dependency to trace: %s", dep_path);
+        } else {
+            LOG_WARN("Failed to add dependency to trace: %s", dep_path);
+        }
+        return true;  // Continue iteration
+    }
+
     // Check if dependency is a file or directory
     struct stat st;
     if (stat(dep_path, &st) != 0) {
@@ -216,13 +353,18 @@ static bool add_dep_to_trace_callback(const char* dep_path, void* user_data) {
         return true;  // Continue iteration
     }
 
+    // Take the signature before hashing, so a write that lands while we
+    // read leaves a signature that no longer matches
+    StatSignature sig;
+    bool have_sig = stat_signature_get(dep_path, &sig);
+
     // Hash the dependency (file or directory tree)
     Hash dep_hash;
     bool hash_success;
 
     if (S_ISDIR(st.st_mode)) {
         // Directory: use hash_tree() for deterministic recursive hashing
-        hash_success = hash_tree(dep_path, &dep_hash);
+        hash_success = hash_tree_parallel(dep_path, &dep_hash, ctx->sched->validate_pool);
         if (hash_success) {
             LOG_DEBUG("Hashed directory dependency: %s", dep_path);
         }
@@ -239,7 +381,7 @@ static bool add_dep_to_trace_callback(const char* dep_path, void* user_data) {
 
     if (hash_success) {
         // Add to trace
-        if (trace_add_dependency(ctx->trace, dep_path, &dep_hash)) {
+        if (trace_add_dependency_stat(ctx->trace, dep_path, &dep_hash, have_sig ? &sig : NULL)) {
             ctx->added_count++;
             LOG_DEBUG("Added dependency to trace: %s", dep_path);
         } else {
@@ -284,6 +426,28 @@ static bool ensure_directory(const char* path) {
 // Scheduler implementation
 // ============================================================================
 
+// Work item for executing one recipe on the libuv thread pool
+typedef struct RecipeWork {
+    uv_work_t req;                 // libuv work request (req.data = this)
+    Scheduler* sched;
+    Recipe* recipe;
+    SchedulerVM* vm;               // Lane whose VM runs (or holds) the recipe's fiber
+    bool start_fiber;              // Create the fiber before running it
+    UmkaFiberStatus status;        // Set by the worker
+} RecipeWork;
+
+static void scheduler_dispatch(Scheduler* sched);
+
+static void start_pending_processes(Scheduler* sched);
+static void release_admission(Scheduler* sched, Recipe* recipe);
+
+// Wakeup callback - a worker made new recipes ready or requested a process
+static void on_scheduler_wakeup(uv_async_t* handle) {
+    Scheduler* sched = (Scheduler*)handle->data;
+    start_pending_processes(sched);
+    scheduler_dispatch(sched);
+}
+
 Scheduler* scheduler_create(Storage* storage) {
     if (!storage) return NULL;
 
@@ -306,13 +470,45 @@ Scheduler* scheduler_create(Storage* storage) {
         return NULL;
     }
 
+    // Synchronization between the loop thread and workers
+    if (uv_mutex_init(&sched->lock) != 0) {
+        tool_manager_free(sched->tools);
+        rebuild_free(sched);
+        return NULL;
+    }
+    if (uv_async_init(sched->loop, &sched->wakeup, on_scheduler_wakeup) != 0) {
+        uv_mutex_destroy(&sched->lock);
+        tool_manager_free(sched->tools);
+        rebuild_free(sched);
+        return NULL;
+    }
+    sched->wakeup.data = sched;
+    // Outstanding work requests keep the loop alive, not the wakeup handle
+    uv_unref((uv_handle_t*)&sched->wakeup);
+
+    // Process engine for sys()
+    sched->procs = process_manager_create(sched->loop);
+    if (!sched->procs) {
+        uv_close((uv_handle_t*)&sched->wakeup, NULL);
+        uv_run(sched->loop, UV_RUN_NOWAIT);
+        uv_mutex_destroy(&sched->lock);
+        tool_manager_free(sched->tools);
+        rebuild_free(sched);
+        return NULL;
+    }
+
     // Create maps and queues
     sched->recipes = map_create(64);
     sched->completed = map_create(64);
     sched->waiting = map_create(64);
-    sched->ready_queue = queue_create();
-
-    if (!sched->recipes || !sched->completed || !sched->waiting || !sched->ready_queue) {
+    sched->policy = SCHEDULE_CRITICAL_PATH;
+    sched->ready_queue = heap_create(sched->policy);
+    sched->sys_queue = queue_create();
+    sched->fiber_fns = map_create(64);
+    sched->class_running = map_create(0);
+
+    if (!sched->recipes || !sched->completed || !sched->waiting || !sched->ready_queue ||
+        !sched->sys_queue || !sched->fiber_fns || !sched->class_running) {
         scheduler_free(sched);
         return NULL;
     }
@@ -322,6 +518,13 @@ Scheduler* scheduler_create(Storage* storage) {
     sched->target_error = NULL;
     sched->umka = NULL;  // Will be set when UMKA is initialized
     sched->registry = NULL;  // Will be set after BUILD.um loads
+    sched->jobs = 1;
+    sched->build_file = NULL;
+    sched->code_index = NULL;
+    sched->vms = NULL;  // Allocated on first dispatch, once jobs is final
+    sched->next_fiber_id = 0;
+    sched->procs_running = 0;
+    sched->starting_procs = false;
 
     LOG_DEBUG("Scheduler created");
     return sched;
@@ -330,6 +533,12 @@ Scheduler* scheduler_create(Storage* storage) {
 void scheduler_free(Scheduler* sched) {
     if (!sched) return;
 
+    // Close the wakeup handle first so a pending wakeup can not dispatch into
+    // freed state; the process manager runs the loop to finish the closes
+    uv_close((uv_handle_t*)&sched->wakeup, NULL);
+    jobserver_free(sched->jobserver);
+    process_manager_free(sched->procs);
+
     // Free recipes
     if (sched->recipes) {
         map_free(sched->recipes, (MapValueFreeFn)recipe_free);
@@ -345,8 +554,25 @@ void scheduler_free(Scheduler* sched) {
         map_free(sched->waiting, (MapValueFreeFn)waiter_list_free);
     }
 
-    // Free queue
-    queue_free(sched->ready_queue);
+    // No cache check is in flight once the loop has drained
+    work_pool_free(sched->validate_pool);
+
+    // Free queues
+    heap_free(sched->ready_queue);
+    queue_free(sched->sys_queue);
+
+    if (sched->class_running) {
+        map_free(sched->class_running, rebuild_free);
+    }
+
+    // Free recipe function table
+    if (sched->fiber_fns) {
+        map_free(sched->fiber_fns, NULL);
+    }
+    for (size_t i = 0; i < sched->fiber_fn_count; i++) {
+        rebuild_free(sched->fiber_fn_names[i]);
+    }
+    rebuild_free(sched->fiber_fn_names);
 
     // Free tool manager
     tool_manager_free(sched->tools);
@@ -356,13 +582,105 @@ void scheduler_free(Scheduler* sched) {
         target_registry_free(sched->registry);
     }
 
+    // Free lane VMs loaded by the scheduler (the main instance belongs to the caller)
+    if (sched->vms) {
+        for (int i = 0; i < sched->jobs; i++) {
+            if (sched->vms[i].owned && sched->vms[i].umka) {
+                umka_free_script((Umka*)sched->vms[i].umka);
+            }
+        }
+        rebuild_free(sched->vms);
+    }
+    rebuild_free(sched->build_file);
+    code_index_free(sched->code_index);
+
+    uv_mutex_destroy(&sched->lock);
+
     rebuild_free(sched);
     LOG_DEBUG("Scheduler freed");
 }
 
-Recipe* scheduler_get_recipe(Scheduler* sched, const char* target_name) {
-    if (!sched || !target_name) return NULL;
+void scheduler_set_jobs(Scheduler* sched, int jobs) {
+    if (!sched || jobs < 1 || sched->vms) return;
+
+    sched->jobs = jobs;
+
+    // Recipes run on the libuv thread pool, which is sized once from the
+    // environment when the first work item is queued (default: 4 threads)
+    if (jobs > 4 && !getenv("UV_THREADPOOL_SIZE")) {
+        char size_buf[16];
+        snprintf(size_buf, sizeof(size_buf), "%d", jobs > 1024 ? 1024 : jobs);
+        setenv("UV_THREADPOOL_SIZE", size_buf, 0);
+    }
+
+    LOG_DEBUG("Scheduler jobs set to %d", jobs);
+}
 
+// Hash a module the build file imports; a tool's module (tools/<name>.um)
+// also covers the tool binary it drives
+static bool hash_imported_module(const char* path, Hash* out, void* user_data) {
+    Scheduler* sched = (Scheduler*)user_data;
+    if (!hash_file(path, out)) return false;
+
+    // Only modules directly under a tools/ directory
+    const char* base = strrchr(path, '/');
+    if (!base) return true;
+    const char* dir = base;
+    while (dir > path && dir[-1] != '/') dir--;
+    if (strncmp(dir, "tools/", 6) != 0) return true;
+
+    char name[256];
+    snprintf(name, sizeof(name), "%s", base + 1);
+    char* ext = strrchr(name, '.');
+    if (ext) *ext = '\0';
+
+    ToolModule* tool = tool_manager_get_tool(sched->tools, name);
+    if (!tool) tool = tool_manager_load_tool(sched->tools, name);
+    if (tool) {
+        Hash parts[2] = {*out, tool->binary_hash};
+        hash_data(parts, sizeof(parts), out);
+    }
+    return true;
+}
+
+void scheduler_set_build_file(Scheduler* sched, const char* path) {
+    if (!sched || !path) return;
+
+    rebuild_free(sched->build_file);
+    sched->build_file = rebuild_strdup(path);
+
+    code_index_free(sched->code_index);
+    sched->code_index = code_index_create(path, hash_imported_module, sched);
+}
+
+void scheduler_set_jobserver(Scheduler* sched, Jobserver* jobserver) {
+    if (!sched) return;
+
+    jobserver_free(sched->jobserver);
+    sched->jobserver = jobserver;
+}
+
+void scheduler_set_keep_going(Scheduler* sched, bool keep_going) {
+    if (!sched) return;
+    sched->keep_going = keep_going;
+}
+
+void scheduler_set_memory_budget(Scheduler* sched, uint64_t budget_kb) {
+    if (!sched) return;
+    sched->memory_budget_kb = budget_kb;
+}
+
+void scheduler_set_schedule(Scheduler* sched, SchedulePolicy policy) {
+    if (!sched) return;
+
+    sched->policy = policy;
+    if (sched->ready_queue) {
+        sched->ready_queue->policy = policy;
+    }
+}
+
+// Get or create a recipe (caller holds sched->lock)
+static Recipe* get_recipe_locked(Scheduler* sched, const char* target_name) {
     // Check if recipe already exists
     Recipe* recipe = (Recipe*)map_get(sched->recipes, target_name);
     if (recipe) {
@@ -387,9 +705,24 @@ Recipe* scheduler_get_recipe(Scheduler* sched, const char* target_name) {
     return recipe;
 }
 
+Recipe* scheduler_get_recipe(Scheduler* sched, const char* target_name) {
+    if (!sched || !target_name) return NULL;
+
+    uv_mutex_lock(&sched->lock);
+    Recipe* recipe = get_recipe_locked(sched, target_name);
+    uv_mutex_unlock(&sched->lock);
+    return recipe;
+}
+
 const char* scheduler_get_completed(Scheduler* sched, const char* target_name) {
     if (!sched || !target_name) return NULL;
-    return (const char*)map_get(sched->completed, target_name);
+
+    // Completed paths are never replaced or freed before scheduler_free,
+    // so the returned pointer stays valid after the lock is released
+    uv_mutex_lock(&sched->lock);
+    const char* path = (const char*)map_get(sched->completed, target_name);
+    uv_mutex_unlock(&sched->lock);
+    return path;
 }
 
 RebuildError scheduler_mark_completed(Scheduler* sched, const char* target_name, const char* output_path) {
@@ -403,10 +736,20 @@ RebuildError scheduler_mark_completed(Scheduler* sched, const char* target_name,
         return REBUILD_ERROR_MEMORY;
     }
 
-    // Add to completed map
-    RebuildError err = map_set(sched->completed, target_name, path_copy);
-    if (err != REBUILD_OK) {
+    // Add to completed map (first completion wins; readers hold on to the old pointer)
+    uv_mutex_lock(&sched->lock);
+    RebuildError err = REBUILD_OK;
+    if (map_has(sched->completed, target_name)) {
         rebuild_free(path_copy);
+    } else {
+        err = map_set(sched->completed, target_name, path_copy);
+        if (err != REBUILD_OK) {
+            rebuild_free(path_copy);
+        }
+    }
+    uv_mutex_unlock(&sched->lock);
+
+    if (err != REBUILD_OK) {
         return err;
     }
 
@@ -414,89 +757,634 @@ RebuildError scheduler_mark_completed(Scheduler* sched, const char* target_name,
     return REBUILD_OK;
 }
 
-bool scheduler_check_cache(Scheduler* sched, Recipe* recipe) {
-    if (!sched || !recipe) return false;
+// Push a recipe onto the ready queue once (caller holds sched->lock)
+static void enqueue_locked(Scheduler* sched, Recipe* recipe) {
+    if (recipe->heap_index >= 0) return;
+    recipe->seq = ++sched->next_seq;
+    heap_push(sched->ready_queue, recipe);
+}
 
-    LOG_DEBUG("Checking cache for: %s", recipe->target_name);
+typedef struct PriorityRaise {
+    Scheduler* sched;
+    uint64_t priority;
+    int depth;
+} PriorityRaise;
 
-    // Compute request key for this recipe
-    // This includes the recipe code (function name as proxy for bytecode), target name, and dependencies
+// How far a priority increase is pushed through already-requested dependencies
+#define PRIORITY_RAISE_DEPTH 32
+
+static void raise_priority_locked(Scheduler* sched, Recipe* recipe, uint64_t waiter_priority, int depth);
+
+static bool raise_dep_priority(const char* dep_name, void* user_data) {
+    PriorityRaise* raise = (PriorityRaise*)user_data;
+    Recipe* dep = (Recipe*)map_get(raise->sched->recipes, dep_name);
+    if (dep && dep->state != RECIPE_COMPLETE && dep->state != RECIPE_FAILED) {
+        raise_priority_locked(raise->sched, dep, raise->priority, raise->depth);
+    }
+    return true;
+}
+
+// Raise a recipe's critical-path estimate to cover a waiter
+// (caller holds sched->lock). The new length flows on to dependencies it has
+// already requested; depth bounds the walk (and any dependency cycle).
+static void raise_priority_locked(Scheduler* sched, Recipe* recipe, uint64_t waiter_priority, int depth) {
+    uint64_t priority = recipe->estimate_ms + waiter_priority;
+    if (priority <= recipe->priority) return;
+
+    recipe->priority = priority;
+    heap_increased(sched->ready_queue, recipe);
+
+    if (depth <= 0 || !recipe->declared_deps) return;
+
+    PriorityRaise raise = { sched, priority, depth - 1 };
+    set_iterate(recipe->declared_deps, raise_dep_priority, &raise);
+}
+
+// Mark a recipe failed and abandon everything waiting on it
+// (caller holds sched->lock; loop thread). Suspended dependents fail right
+// away without being resumed; a dependent still running fails when it yields.
+static void fail_recipe_locked(Scheduler* sched, Recipe* recipe) {
+    recipe->state = RECIPE_FAILED;
+    sched->failed = true;
+    if (!sched->target_error) {
+        sched->target_error = recipe->target_name;
+    }
+
+    WaiterList* waiters = (WaiterList*)map_remove(sched->waiting, recipe->target_name);
+    if (!waiters) return;
+
+    for (WaiterNode* node = waiters->head; node; node = node->next) {
+        Recipe* waiter = node->recipe;
+        if (waiter->state == RECIPE_FAILED || waiter->state == RECIPE_COMPLETE) continue;
+
+        waiter->dep_failed = true;
+        if (!waiter->failed_dep) {
+            waiter->failed_dep = recipe->target_name;
+        }
+        if (waiter->state == RECIPE_SUSPENDED) {
+            LOG_ERROR("Not building %s: dependency %s failed", waiter->target_name, recipe->target_name);
+            release_admission(sched, waiter);
+            fail_recipe_locked(sched, waiter);
+        }
+    }
+    waiter_list_free(waiters);
+}
+
+// Mark a recipe complete and resume everything waiting on it (loop thread)
+static void complete_recipe(Scheduler* sched, Recipe* recipe, const char* output_path) {
+    scheduler_mark_completed(sched, recipe->target_name, output_path);
+
+    // The completed map owns a stable copy of the path for the waiters.
+    // Cache checks on workers read the state under the lock
+    uv_mutex_lock(&sched->lock);
+    recipe->state = RECIPE_COMPLETE;
+    const char* stored_path = (const char*)map_get(sched->completed, recipe->target_name);
+    WaiterList* waiters = (WaiterList*)map_remove(sched->waiting, recipe->target_name);
+    if (waiters) {
+        waiter_list_notify_all(waiters, sched, stored_path);
+        waiter_list_free(waiters);
+    }
+    uv_mutex_unlock(&sched->lock);
+}
+
+// Where a recipe's outputs live: outputs/<target>
+static void set_output_dir(Recipe* recipe) {
+    char path[256];
+    snprintf(path, sizeof(path), "outputs/%s", recipe->target_name);
+    recipe_set_output_dir(recipe, path);
+}
+
+// Compute the recipe's request key from its code, target name, and deps
+static void compute_recipe_key(Scheduler* sched, Recipe* recipe) {
+    // The code is the recipe function plus everything it calls, so editing
+    // one recipe invalidates only the traces of the recipes that run the edit
     Hash recipe_code_hash;
 
-    // Get the target from registry to get its function name
     Target* target = sched->registry ? target_registry_get(sched->registry, recipe->target_name) : NULL;
-    if (target && target->function_name) {
-        // Hash the function name as a proxy for recipe bytecode
-        // In Phase 3+, this would be actual UMKA bytecode hash
+    bool hashed = target && target->function_name &&
+                  code_index_function_hash(sched->code_index, target->function_name, &recipe_code_hash);
+    if (!hashed && target && target->function_name) {
+        // No build file (or the function is not declared in it): the name is all we have
         hash_data((const uint8_t*)target->function_name, strlen(target->function_name), &recipe_code_hash);
-    } else {
+    } else if (!hashed) {
         // Fallback: hash the target name itself
         hash_data((const uint8_t*)recipe->target_name, strlen(recipe->target_name), &recipe_code_hash);
     }
 
     // Use the recipe's compute_request_key function which combines code hash, target name, and deps
     recipe_compute_request_key(recipe, &recipe_code_hash);
+}
 
-    // Try to load trace from storage
-    Trace* trace = trace_load(&recipe->request_key, sched->storage);
-    if (!trace) {
-        LOG_DEBUG("No cached trace found for: %s", recipe->target_name);
-        return false;
+// Outcome of looking a recipe up in the cache
+typedef enum {
+    CACHE_MISS,                    // Run the recipe
+    CACHE_HIT,                     // The trace is valid; use its output
+    CACHE_WAIT                     // Valid so far; build its target dependencies, then check again
+} CacheLookup;
+
+// Compare a trace's target dependencies with what they produced in this
+// build (safe on a worker thread)
+static CacheLookup check_trace_targets(Scheduler* sched, const Trace* trace) {
+    CacheLookup outcome = CACHE_HIT;
+
+    uv_mutex_lock(&sched->lock);
+    for (size_t i = 0; i < trace->dep_count && outcome != CACHE_MISS; i++) {
+        const char* name = trace_dependency_target(trace, i);
+        if (!name) continue;
+
+        Recipe* dep = (Recipe*)map_get(sched->recipes, name);
+        if (!sched->registry || !target_registry_has(sched->registry, name)) {
+            LOG_DEBUG("Cache invalid: target dependency %s no longer exists", name);
+            outcome = CACHE_MISS;
+        } else if (!dep || dep->state == RECIPE_PENDING || dep->state == RECIPE_RUNNING ||
+                   dep->state == RECIPE_SUSPENDED) {
+            outcome = CACHE_WAIT;  // Keep looking for a mismatch among the built ones
+        } else if (dep->state == RECIPE_FAILED || !dep->has_output_hash) {
+            outcome = CACHE_MISS;
+        } else if (!hash_equal(&dep->output_hash, &trace->dep_hashes[i])) {
+            LOG_DEBUG("Cache invalid: output of target dependency %s changed", name);
+            outcome = CACHE_MISS;
+        }
+    }
+    uv_mutex_unlock(&sched->lock);
+    return outcome;
+}
+
+// Check one recorded variant of the recipe's trace (safe on a worker thread)
+static CacheLookup check_trace_variant(Scheduler* sched, Recipe* recipe, const Trace* trace) {
+    // Target dependencies first: comparing them costs no I/O
+    CacheLookup outcome = check_trace_targets(sched, trace);
+    if (outcome == CACHE_MISS) {
+        LOG_DEBUG("Cache invalid for: %s (target dependency changed)", recipe->target_name);
+        return CACHE_MISS;
     }
 
     // Validate trace dependencies
-    bool valid = trace_validate(trace);
+    if (!trace_validate_parallel(trace, sched->validate_pool)) {
+        LOG_DEBUG("Cache invalid for: %s (dependencies changed)", recipe->target_name);
+        return CACHE_MISS;
+    }
+
+    // Bring back outputs that were deleted or changed since (clean checkout)
+    if (outcome == CACHE_HIT) {
+        if (!recipe->output_dir) {
+            set_output_dir(recipe);
+        }
+        if (!objects_restore_tree(sched->storage, &trace->output_tree_hash, recipe->output_dir)) {
+            LOG_DEBUG("Cache invalid for: %s (outputs can not be restored)", recipe->target_name);
+            return CACHE_MISS;
+        }
+    }
+    return outcome;
+}
 
-    if (valid) {
-        LOG_INFO("Cache hit for: %s", recipe->target_name);
+// Take a recipe's duration and peak RSS from its newest stored trace
+// (any thread). Stale traces still tell roughly how long the recipe takes and
+// how much memory it needs. The recipe is out of the ready queue while its
+// cache is checked, and priority is estimate_ms plus its longest waiter's
+// path, so the estimate is swapped in place.
+static void note_estimates(Scheduler* sched, Recipe* recipe, const Trace* trace) {
+    uv_mutex_lock(&sched->lock);
+    recipe->priority = recipe->priority - recipe->estimate_ms + trace->wall_time_ms;
+    recipe->estimate_ms = trace->wall_time_ms;
+    recipe->predicted_rss_kb = trace->peak_rss_kb;
+    uv_mutex_unlock(&sched->lock);
+}
 
-        // Get cached output path from trace
-        // For now, we'll construct the output path from the recipe
-        // In a full implementation, this would be stored in the trace
-        char* output_path = rebuild_strdup(recipe->output_dir ? recipe->output_dir : "outputs");
+// Look for a valid trace for the recipe (safe on a worker thread)
+// Every stored variant is tried, newest first, until one matches the
+// current inputs. On a hit or wait the trace is handed to the caller in *out
+static CacheLookup lookup_cached_trace(Scheduler* sched, Recipe* recipe, Trace** out) {
+    LOG_DEBUG("Checking cache for: %s", recipe->target_name);
+    *out = NULL;
 
-        if (output_path) {
-            // Mark recipe as complete
-            recipe->state = RECIPE_COMPLETE;
-            scheduler_mark_completed(sched, recipe->target_name, output_path);
-            rebuild_free(output_path);
+    // Compute request key for this recipe
+    compute_recipe_key(sched, recipe);
+
+    // Try to load the trace variants from storage
+    Trace* variants[TRACE_PACK_VARIANTS];
+    size_t count = trace_load_variants(&recipe->request_key, sched->storage, variants, TRACE_PACK_VARIANTS);
+    if (count == 0) {
+        LOG_DEBUG("No cached trace found for: %s", recipe->target_name);
+        return CACHE_MISS;
+    }
+    note_estimates(sched, recipe, variants[0]);
+
+    CacheLookup outcome = CACHE_MISS;
+    for (size_t i = 0; i < count && outcome != CACHE_HIT; i++) {
+        CacheLookup result = check_trace_variant(sched, recipe, variants[i]);
+        if (result == CACHE_HIT || (result == CACHE_WAIT && outcome == CACHE_MISS)) {
+            if (result == CACHE_HIT && i > 0) {
+                LOG_DEBUG("Matched trace variant %zu of %zu for: %s", i + 1, count, recipe->target_name);
+            }
+            trace_free(*out);
+            *out = variants[i];
+            variants[i] = NULL;
+            outcome = result;
         }
+    }
 
-        trace_free(trace);
-        return true;
+    for (size_t i = 0; i < count; i++) {
+        trace_free(variants[i]);
+    }
+    if (outcome == CACHE_HIT) {
+        trace_touch(*out, sched->storage);
+    }
+    return outcome;
+}
+
+// Complete a recipe from its cached trace (loop thread)
+static void use_cached_result(Scheduler* sched, Recipe* recipe, const Trace* trace) {
+    LOG_INFO("Cache hit for: %s", recipe->target_name);
+    uv_mutex_lock(&sched->lock);
+    recipe->output_hash = trace->output_tree_hash;
+    recipe->has_output_hash = true;
+    uv_mutex_unlock(&sched->lock);
+
+    // The lookup restored the outputs into the recipe's output directory
+    char* output_path = rebuild_strdup(recipe->output_dir ? recipe->output_dir : "outputs");
+
+    if (output_path) {
+        // Mark recipe as complete and release anything waiting on it
+        complete_recipe(sched, recipe, output_path);
+        rebuild_free(output_path);
+    }
+}
+
+static bool wait_for_dependency_locked(Scheduler* sched, Recipe* recipe, Recipe* dep_recipe);
+
+// Build the target dependencies of a trace before deciding on it (loop
+// thread). The recipe waits like a suspended one and is checked again when
+// the last of them completes. Returns false if it has to run instead.
+static bool wait_for_trace_targets(Scheduler* sched, Recipe* recipe, const Trace* trace) {
+    bool queued = false;
+
+    uv_mutex_lock(&sched->lock);
+    for (size_t i = 0; i < trace->dep_count; i++) {
+        const char* name = trace_dependency_target(trace, i);
+        Recipe* dep = name ? get_recipe_locked(sched, name) : NULL;
+        if (!dep || dep->state == RECIPE_COMPLETE) continue;
+        if (dep == recipe || dep->state == RECIPE_FAILED) {
+            // Let the recipe run and report the problem itself
+            uv_mutex_unlock(&sched->lock);
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < trace->dep_count; i++) {
+        const char* name = trace_dependency_target(trace, i);
+        Recipe* dep = name ? (Recipe*)map_get(sched->recipes, name) : NULL;
+        if (dep && dep->state != RECIPE_COMPLETE) {
+            queued |= wait_for_dependency_locked(sched, recipe, dep);
+        }
+    }
+
+    recipe->cache_checked = false;
+    if (recipe->wait_count > 0) {
+        LOG_DEBUG("Building target dependencies of %s before using its trace", recipe->target_name);
+        recipe->state = RECIPE_SUSPENDED;
+    } else if (recipe->heap_index < 0) {
+        heap_push(sched->ready_queue, recipe);  // They completed meanwhile
+    }
+    uv_mutex_unlock(&sched->lock);
+
+    if (queued) {
+        uv_async_send(&sched->wakeup);
+    }
+    return true;
+}
+
+// Act on a cache lookup (loop thread)
+// Returns true if the recipe was completed or now waits; false if it has to run
+static bool finish_cache_check(Scheduler* sched, Recipe* recipe, CacheLookup outcome, Trace* trace) {
+    bool handled = false;
+    if (recipe->state == RECIPE_PENDING) {
+        if (outcome == CACHE_HIT) {
+            use_cached_result(sched, recipe, trace);
+            handled = true;
+        } else if (outcome == CACHE_WAIT) {
+            handled = wait_for_trace_targets(sched, recipe, trace);
+        }
+    }
+    trace_free(trace);
+    return handled;
+}
+
+bool scheduler_check_cache(Scheduler* sched, Recipe* recipe) {
+    if (!sched || !recipe) return false;
+
+    recipe->cache_checked = true;
+    Trace* trace;
+    CacheLookup outcome = lookup_cached_trace(sched, recipe, &trace);
+    return finish_cache_check(sched, recipe, outcome, trace);
+}
+
+typedef struct CacheCheckWork {
+    uv_work_t req;
+    Scheduler* sched;
+    Recipe* recipe;
+    CacheLookup outcome;
+    Trace* trace;
+} CacheCheckWork;
+
+static void cache_check_work_cb(uv_work_t* req) {
+    CacheCheckWork* work = (CacheCheckWork*)req->data;
+    work->outcome = lookup_cached_trace(work->sched, work->recipe, &work->trace);
+}
+
+static void cache_check_after_work_cb(uv_work_t* req, int status) {
+    CacheCheckWork* work = (CacheCheckWork*)req->data;
+    Scheduler* sched = work->sched;
+    Recipe* recipe = work->recipe;
+
+    recipe->cache_checking = false;
+    CacheLookup outcome = status == 0 ? work->outcome : CACHE_MISS;
+    if (finish_cache_check(sched, recipe, outcome, work->trace)) {
+        if (recipe->state == RECIPE_COMPLETE) {
+            LOG_INFO("Using cached result for: %s", recipe->target_name);
+        }
     } else {
-        LOG_DEBUG("Cache invalid for: %s (dependencies changed)", recipe->target_name);
-        trace_free(trace);
+        // Back into the ready queue with its original place in line
+        uv_mutex_lock(&sched->lock);
+        if (recipe->state == RECIPE_PENDING && recipe->heap_index < 0) {
+            heap_push(sched->ready_queue, recipe);
+        }
+        uv_mutex_unlock(&sched->lock);
+    }
+
+    rebuild_free(work);
+    scheduler_dispatch(sched);
+}
+
+// Check the cache for a ready recipe on the thread pool (loop thread)
+// The recipe leaves the ready queue until the check finishes; on a miss it
+// returns to the queue. Returns false if the check could not be queued.
+static bool start_cache_check(Scheduler* sched, Recipe* recipe) {
+    if (!sched->validate_pool) {
+        sched->validate_pool = work_pool_create(sched->jobs < 4 ? 4 : sched->jobs);
+    }
+
+    CacheCheckWork* work = (CacheCheckWork*)rebuild_calloc(1, sizeof(CacheCheckWork));
+    if (!work) return false;
+    work->sched = sched;
+    work->recipe = recipe;
+    work->req.data = work;
+
+    recipe->cache_checked = true;
+    recipe->cache_checking = true;
+    if (uv_queue_work(sched->loop, &work->req, cache_check_work_cb, cache_check_after_work_cb) != 0) {
+        recipe->cache_checking = false;
+        rebuild_free(work);
         return false;
     }
+    return true;
+}
+
+// CPU time used by the calling thread so far, in microseconds
+static uint64_t thread_cpu_time_us(void) {
+    struct rusage usage;
+#ifdef RUSAGE_THREAD
+    if (getrusage(RUSAGE_THREAD, &usage) != 0) return 0;
+#else
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#endif
+    return rusage_cpu_time_us(&usage);
+}
+
+// Charge a finished process's CPU time and peak RSS to its recipe
+// (caller holds sched->lock)
+static void account_process_usage(Recipe* recipe, const struct rusage* usage) {
+    recipe->cpu_time_us += rusage_cpu_time_us(usage);
+    // ru_maxrss is in kilobytes on Linux
+    if (usage->ru_maxrss > 0 && (uint64_t)usage->ru_maxrss > recipe->peak_rss_kb) {
+        recipe->peak_rss_kb = (uint64_t)usage->ru_maxrss;
+    }
+}
+
+// Record the trace for a successfully finished recipe
+// Runs on the worker so dependency and output hashing happen in parallel
+static void save_recipe_trace(Scheduler* sched, Recipe* recipe, uint64_t elapsed_time) {
+    Trace* trace = trace_create(&recipe->request_key);
+    if (!trace) return;
+
+    // Set performance metrics
+    trace->wall_time_ms = elapsed_time;
+    uv_mutex_lock(&sched->lock);
+    trace->cpu_time_ms = recipe->cpu_time_us / 1000;
+    trace->peak_rss_kb = recipe->peak_rss_kb;
+    uv_mutex_unlock(&sched->lock);
+
+    // Add all dependencies to trace
+    // Signatures are only trusted for changes older than this moment
+    uv_timespec64_t now;
+    if (uv_clock_gettime(UV_CLOCK_REALTIME, &now) == 0) {
+        trace->recorded_ns = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+    }
+    AddDepsContext ctx = { .sched = sched, .trace = trace, .added_count = 0 };
+    if (recipe->declared_deps) {
+        set_iterate(recipe->declared_deps, add_dep_to_trace_callback, &ctx);
+        LOG_DEBUG("Added %zu dependencies to trace for: %s", ctx.added_count, recipe->target_name);
+    }
+
+    // Store the outputs; the trace records their tree (manifest) hash
+    if (recipe->output_dir) {
+        if (!objects_store_tree(sched->storage, recipe->output_dir, &trace->output_tree_hash)) {
+            LOG_WARN("Failed to store outputs of: %s", recipe->target_name);
+            // Still record what was produced; it misses once the outputs are gone
+            if (!objects_hash_tree(recipe->output_dir, &trace->output_tree_hash)) {
+                hash_data((const uint8_t*)"", 0, &trace->output_tree_hash);
+            }
+        }
+    } else {
+        // No output directory, use empty hash
+        hash_data((const uint8_t*)"", 0, &trace->output_tree_hash);
+    }
+
+    // Dependents compare this against their traces once we complete
+    uv_mutex_lock(&sched->lock);
+    recipe->output_hash = trace->output_tree_hash;
+    recipe->has_output_hash = true;
+    uv_mutex_unlock(&sched->lock);
+
+    // Save trace to storage
+    if (!trace_save(trace, sched->storage)) {
+        LOG_WARN("Failed to save trace for: %s", recipe->target_name);
+    }
+
+    trace_free(trace);
+}
+
+// Thread pool: start or resume the recipe's fiber on its lane's VM
+static void recipe_work_cb(uv_work_t* req) {
+    RecipeWork* work = (RecipeWork*)req->data;
+    Scheduler* sched = work->sched;
+    Recipe* recipe = work->recipe;
+    SchedulerVM* vm = work->vm;
+
+    work->status = UMKA_FIBER_ERROR;
+
+    // Each lane compiles its own copy of BUILD.um plus the fiber driver on first use
+    if (!vm->umka) {
+        if (!sched->build_file) {
+            LOG_ERROR("No BUILD.um path available to load worker VM");
+            return;
+        }
+        vm->umka = umka_load_fiber_script(sched->build_file,
+                                          (const char* const*)sched->fiber_fn_names,
+                                          sched->fiber_fn_count);
+        vm->owned = true;
+        if (!vm->umka) {
+            LOG_ERROR("Failed to load worker VM for recipe: %s", recipe->target_name);
+            return;
+        }
+    }
+
+    // Set up UMKA context for this recipe on this thread
+    umka_bridge_set_context(recipe, sched, (Umka*)vm->umka);
+
+    if (work->start_fiber) {
+        // Get the target from registry (read-only once BUILD.um is loaded)
+        Target* target = target_registry_get(sched->registry, recipe->target_name);
+        intptr_t fn_slot = target ? (intptr_t)map_get(sched->fiber_fns, target->function_name) : 0;
+        if (!target || fn_slot == 0) {
+            LOG_ERROR("Target not found in registry: %s", recipe->target_name);
+            umka_bridge_clear_context();
+            return;
+        }
+
+        LOG_INFO("Executing UMKA function for target: %s -> %s",
+                 recipe->target_name, target->function_name);
+
+        // Create fiber for target function
+        if (!umka_start_recipe_fiber((Umka*)vm->umka, recipe->fiber_id, (int)(fn_slot - 1))) {
+            LOG_ERROR("Failed to create fiber for target: %s", recipe->target_name);
+            umka_bridge_clear_context();
+            return;
+        }
+    } else {
+        LOG_DEBUG("Resuming fiber for target: %s", recipe->target_name);
+    }
+
+    // Run until the recipe returns or yields in depend_on()/sys()
+    uint64_t cpu_start = thread_cpu_time_us();
+    work->status = umka_resume_recipe_fiber((Umka*)vm->umka, recipe->fiber_id);
+    uint64_t cpu_used = thread_cpu_time_us() - cpu_start;
+
+    uv_mutex_lock(&sched->lock);
+    recipe->cpu_time_us += cpu_used;
+    uv_mutex_unlock(&sched->lock);
+
+    if (work->status == UMKA_FIBER_ERROR) {
+        LOG_ERROR("Recipe execution failed: %s", recipe->target_name);
+    } else if (work->status == UMKA_FIBER_COMPLETE && !recipe->dep_failed) {
+        uint64_t elapsed_time = (uv_hrtime() / 1000000) - recipe->start_time;
+        save_recipe_trace(sched, recipe, elapsed_time);
+    }
+
+    // Clear UMKA context
+    umka_bridge_clear_context();
+}
+
+// Restart recipes whose fibers lived in a discarded VM (caller holds sched->lock)
+static bool restart_lane_recipe(const char* key, void* value, void* user_data) {
+    Recipe* recipe = (Recipe*)value;
+    int lane = *(int*)user_data;
+
+    if (recipe->lane == lane &&
+        recipe->state != RECIPE_COMPLETE && recipe->state != RECIPE_FAILED) {
+        LOG_WARN("Restarting recipe %s: its worker VM was reset", key);
+        recipe->lane = -1;
+    }
+    return true;
+}
+
+// Discard a lane's VM after a runtime error (loop thread, lane not busy)
+// UMKA can not recover from an error inside a fiber, so every recipe
+// suspended in that VM starts over from the top on its next run
+static void reset_lane(Scheduler* sched, SchedulerVM* vm) {
+    int lane = (int)(vm - sched->vms);
+
+    if (vm->owned && vm->umka) {
+        umka_free_script((Umka*)vm->umka);
+    }
+    vm->umka = NULL;
+
+    uv_mutex_lock(&sched->lock);
+    map_iterate(sched->recipes, restart_lane_recipe, &lane);
+    uv_mutex_unlock(&sched->lock);
+}
+
+// Loop thread: recipe run finished on the thread pool
+static void recipe_after_work_cb(uv_work_t* req, int status) {
+    RecipeWork* work = (RecipeWork*)req->data;
+    Scheduler* sched = work->sched;
+    Recipe* recipe = work->recipe;
+
+    work->vm->busy = false;
+    if (status != 0) {
+        work->status = UMKA_FIBER_ERROR;
+    }
+
+    if (work->status == UMKA_FIBER_SUSPENDED) {
+        // Yielded in depend_on()/sys(); resume once everything it waits on is done
+        uv_mutex_lock(&sched->lock);
+        sched->active_count--;
+        // A recipe waiting for its own process still uses the class's
+        // resources; one waiting for dependencies gives its slot up so
+        // they can take it (and cannot deadlock behind it)
+        if (!recipe->sys_running && !recipe->sys_result) {
+            release_admission(sched, recipe);
+        }
+        if (recipe->dep_failed) {
+            // Never resumed: its fiber is abandoned in the lane's VM
+            LOG_ERROR("Not building %s: dependency %s failed", recipe->target_name,
+                      recipe->failed_dep ? recipe->failed_dep : "(unknown)");
+            fail_recipe_locked(sched, recipe);
+        } else if (recipe->wait_count == 0) {
+            recipe->state = RECIPE_PENDING;
+            enqueue_locked(sched, recipe);
+        } else {
+            recipe->state = RECIPE_SUSPENDED;
+        }
+        uv_mutex_unlock(&sched->lock);
+        LOG_DEBUG("Recipe suspended: %s", recipe->target_name);
+    } else if (work->status == UMKA_FIBER_ERROR) {
+        recipe->lane = -1;
+        scheduler_on_recipe_complete(sched, recipe, false);
+        reset_lane(sched, work->vm);
+    } else {
+        if (recipe->dep_failed) {
+            LOG_ERROR("Recipe %s failed: a dependency could not be built", recipe->target_name);
+        }
+        scheduler_on_recipe_complete(sched, recipe, !recipe->dep_failed);
+    }
+
+    rebuild_free(work);
+    scheduler_dispatch(sched);
 }
 
 void scheduler_execute_recipe(Scheduler* sched, Recipe* recipe) {
     if (!sched || !recipe) return;
 
-    LOG_INFO("Executing recipe: %s", recipe->target_name);
+    bool start_fiber = recipe->lane < 0;
+    if (start_fiber) {
+        LOG_INFO("Executing recipe: %s", recipe->target_name);
+    }
 
     // Set recipe state to running
     recipe->state = RECIPE_RUNNING;
+    uv_mutex_lock(&sched->lock);
     sched->active_count++;
+    uv_mutex_unlock(&sched->lock);
 
-    // Record start time for performance tracking
-    recipe->start_time = uv_hrtime() / 1000000;  // Convert to milliseconds
-
-    // For Phase 1+2: Synchronous execution
-    // In Phase 3+, this would queue to thread pool with uv_queue_work:
-    // uv_work_t* work = malloc(sizeof(uv_work_t));
-    // work->data = recipe;
-    // uv_queue_work(sched->loop, work, worker_execute_recipe, on_worker_complete);
-
-    // Set up UMKA context for this recipe
-    umka_bridge_set_context(recipe, sched, sched->umka);
+    if (start_fiber) {
+        // Record start time for performance tracking
+        recipe->start_time = uv_hrtime() / 1000000;  // Convert to milliseconds
+    }
 
     // Create output and temp directories
     if (!recipe->output_dir) {
-        char path[256];
-        snprintf(path, sizeof(path), "outputs/%s", recipe->target_name);
-        recipe_set_output_dir(recipe, path);
+        set_output_dir(recipe);
 
         // Ensure output directory exists
         ensure_directory(recipe->output_dir);
@@ -512,111 +1400,113 @@ void scheduler_execute_recipe(Scheduler* sched, Recipe* recipe) {
     }
 
     // Execute the UMKA recipe
-    if (!sched->umka || !sched->registry) {
-        LOG_ERROR("No UMKA instance or registry available");
+    if (!sched->registry || !sched->vms) {
+        LOG_ERROR("No target registry or worker VMs available");
         scheduler_on_recipe_complete(sched, recipe, false);
         return;
     }
 
-    // Get the target from registry
-    Target* target = target_registry_get(sched->registry, recipe->target_name);
-    if (!target) {
-        LOG_ERROR("Target not found in registry: %s", recipe->target_name);
-        scheduler_on_recipe_complete(sched, recipe, false);
-        return;
+    // A started fiber can only resume in the VM that holds it; new recipes take
+    // any free lane (dispatch never exceeds jobs, so one is always free)
+    SchedulerVM* vm = NULL;
+    if (!start_fiber) {
+        vm = &sched->vms[recipe->lane];
+    } else {
+        for (int i = 0; i < sched->jobs; i++) {
+            if (!sched->vms[i].busy) {
+                vm = &sched->vms[i];
+                break;
+            }
+        }
     }
-
-    LOG_INFO("Executing UMKA function for target: %s -> %s",
-             recipe->target_name, target->function_name);
-
-    // Create fiber for target function
-    UmkaFiber fiber = umka_create_fiber(sched->umka, target->function_name);
-    if (!fiber) {
-        LOG_ERROR("Failed to create fiber for target: %s", recipe->target_name);
+    if (!vm || vm->busy) {
+        LOG_ERROR("No free worker VM for recipe: %s", recipe->target_name);
         scheduler_on_recipe_complete(sched, recipe, false);
         return;
     }
 
-    // Execute the fiber
-    UmkaFiberStatus status = umka_resume_fiber(fiber);
-
-    // Handle result
-    bool success = (status == UMKA_FIBER_COMPLETE);
-    if (!success) {
-        LOG_ERROR("Recipe execution failed: %s", recipe->target_name);
+    if (start_fiber) {
+        recipe->lane = (int)(vm - sched->vms);
+        recipe->fiber_id = ++sched->next_fiber_id;
     }
 
-    umka_free_fiber(fiber);
-    scheduler_on_recipe_complete(sched, recipe, success);
+    RecipeWork* work = (RecipeWork*)rebuild_calloc(1, sizeof(RecipeWork));
+    work->req.data = work;
+    work->sched = sched;
+    work->recipe = recipe;
+    work->vm = vm;
+    work->start_fiber = start_fiber;
+    vm->busy = true;
+
+    int err = uv_queue_work(sched->loop, &work->req, recipe_work_cb, recipe_after_work_cb);
+    if (err != 0) {
+        LOG_ERROR("Failed to queue recipe %s: %s", recipe->target_name, uv_strerror(err));
+        vm->busy = false;
+        rebuild_free(work);
+        scheduler_on_recipe_complete(sched, recipe, false);
+    }
 }
 
 void scheduler_on_recipe_complete(Scheduler* sched, Recipe* recipe, bool success) {
     if (!sched || !recipe) return;
 
+    uv_mutex_lock(&sched->lock);
     sched->active_count--;
+    uv_mutex_unlock(&sched->lock);
+    release_admission(sched, recipe);
 
     // Calculate elapsed time
     uint64_t elapsed_time = (uv_hrtime() / 1000000) - recipe->start_time;
 
     if (success) {
-        LOG_INFO("Recipe succeeded: %s (took %llu ms)", recipe->target_name,
-                 (unsigned long long)elapsed_time);
-        recipe->state = RECIPE_COMPLETE;
-
-        // Create and save trace
-        Trace* trace = trace_create(&recipe->request_key);
-        if (trace) {
-            // Set performance metrics
-            trace->wall_time_ms = elapsed_time;
-            trace->cpu_time_ms = elapsed_time;  // For Phase 1+2, use wall time
-
-            // Add all dependencies to trace
-            AddDepsContext ctx = { .trace = trace, .added_count = 0 };
-            if (recipe->declared_deps) {
-                set_iterate(recipe->declared_deps, add_dep_to_trace_callback, &ctx);
-                LOG_DEBUG("Added %zu dependencies to trace for: %s", ctx.added_count, recipe->target_name);
-            }
-
-            // Hash the output directory tree
-            if (recipe->output_dir) {
-                if (!hash_tree(recipe->output_dir, &trace->output_tree_hash)) {
-                    LOG_WARN("Failed to hash output directory tree for: %s", recipe->target_name);
-                    // Use empty hash as fallback
-                    hash_data((const uint8_t*)"", 0, &trace->output_tree_hash);
-                }
-            } else {
-                // No output directory, use empty hash
-                hash_data((const uint8_t*)"", 0, &trace->output_tree_hash);
-            }
+        uv_mutex_lock(&sched->lock);
+        uint64_t cpu_ms = recipe->cpu_time_us / 1000;
+        uint64_t peak_rss_kb = recipe->peak_rss_kb;
+        uv_mutex_unlock(&sched->lock);
+        LOG_INFO("Recipe succeeded: %s (took %llu ms, cpu %llu ms, peak RSS %llu KB)", recipe->target_name,
+                 (unsigned long long)elapsed_time, (unsigned long long)cpu_ms,
+                 (unsigned long long)peak_rss_kb);
+
+        // Mark as completed and notify waiters (the trace was saved by the worker)
+        const char* output_path = recipe->output_dir ? recipe->output_dir : "outputs";
+        complete_recipe(sched, recipe, output_path);
+    } else {
+        LOG_ERROR("Recipe failed: %s", recipe->target_name);
+        uv_mutex_lock(&sched->lock);
+        fail_recipe_locked(sched, recipe);
+        uv_mutex_unlock(&sched->lock);
+    }
+}
 
-            // Save trace to storage
-            if (!trace_save(trace, sched->storage)) {
-                LOG_WARN("Failed to save trace for: %s", recipe->target_name);
-            }
+// Make recipe wait until dep_recipe completes (caller holds sched->lock)
+// Returns true if the dependency was queued to be built
+static bool wait_for_dependency_locked(Scheduler* sched, Recipe* recipe, Recipe* dep_recipe) {
+    recipe->wait_count++;
 
-            trace_free(trace);
+    WaiterList* waiters = (WaiterList*)map_get(sched->waiting, dep_recipe->target_name);
+    if (!waiters) {
+        waiters = waiter_list_create();
+        if (waiters) {
+            map_set(sched->waiting, dep_recipe->target_name, waiters);
         }
+    }
+    if (waiters) {
+        waiter_list_add(waiters, recipe);
+    }
 
-        // Mark as completed
-        const char* output_path = recipe->output_dir ? recipe->output_dir : "outputs";
-        scheduler_mark_completed(sched, recipe->target_name, output_path);
+    // The dependency now lies on this recipe's critical path
+    raise_priority_locked(sched, dep_recipe, recipe->priority, PRIORITY_RAISE_DEPTH);
 
-        // Notify waiters
-        WaiterList* waiters = (WaiterList*)map_get(sched->waiting, recipe->target_name);
-        if (waiters) {
-            waiter_list_notify_all(waiters, sched, output_path);
-            map_remove(sched->waiting, recipe->target_name);
-            waiter_list_free(waiters);
-        }
-    } else {
-        LOG_ERROR("Recipe failed: %s", recipe->target_name);
-        recipe->state = RECIPE_FAILED;
-        sched->failed = true;
-        sched->target_error = recipe->target_name;
+    if (dep_recipe->state == RECIPE_PENDING) {
+        // Need to build it
+        LOG_DEBUG("Queuing dependency for build: %s", dep_recipe->target_name);
+        enqueue_locked(sched, dep_recipe);
+        return true;
     }
 
-    // Clear UMKA context
-    umka_bridge_clear_context();
+    // Dependency is running or suspended - it will notify us
+    LOG_DEBUG("Waiting for in-progress dependency: %s", dep_recipe->target_name);
+    return false;
 }
 
 const char* scheduler_on_depend_request(Scheduler* sched, Recipe* recipe, const char* target_name) {
@@ -627,215 +1517,460 @@ const char* scheduler_on_depend_request(Scheduler* sched, Recipe* recipe, const
     // Add to recipe's dependencies
     recipe_add_dependency(recipe, target_name);
 
+    uv_mutex_lock(&sched->lock);
+
     // Check if dependency is already completed
-    const char* completed_path = scheduler_get_completed(sched, target_name);
+    const char* completed_path = (const char*)map_get(sched->completed, target_name);
     if (completed_path) {
+        uv_mutex_unlock(&sched->lock);
         LOG_DEBUG("Dependency already completed: %s -> %s", target_name, completed_path);
         return completed_path;
     }
 
     // Get or create recipe for dependency
-    Recipe* dep_recipe = scheduler_get_recipe(sched, target_name);
+    Recipe* dep_recipe = get_recipe_locked(sched, target_name);
     if (!dep_recipe) {
+        uv_mutex_unlock(&sched->lock);
         LOG_ERROR("Failed to create recipe for dependency: %s", target_name);
         return NULL;
     }
 
-    // Check dependency state
-    if (dep_recipe->state == RECIPE_COMPLETE) {
-        // Already complete
-        const char* output = scheduler_get_completed(sched, target_name);
-        return output;
-    } else if (dep_recipe->state == RECIPE_PENDING) {
-        // Need to build it
-        LOG_DEBUG("Queuing dependency for build: %s", target_name);
+    if (dep_recipe == recipe || dep_recipe->state == RECIPE_FAILED) {
+        // Waiting on ourselves or on a failed target would never finish
+        recipe->dep_failed = true;
+        if (!recipe->failed_dep) {
+            recipe->failed_dep = dep_recipe->target_name;
+        }
+        uv_mutex_unlock(&sched->lock);
+        LOG_ERROR("Dependency %s of %s can not be satisfied", target_name, recipe->target_name);
+        return NULL;
+    }
 
-        // Suspend current recipe
-        recipe->state = RECIPE_SUSPENDED;
+    // Suspend the current recipe until the dependency completes: its fiber
+    // yields and the waiter list queues it again to resume at the same point
+    bool queued = wait_for_dependency_locked(sched, recipe, dep_recipe);
 
-        // Add current recipe to waiter list for dependency
-        WaiterList* waiters = (WaiterList*)map_get(sched->waiting, target_name);
-        if (!waiters) {
-            waiters = waiter_list_create();
-            if (waiters) {
-                map_set(sched->waiting, target_name, waiters);
-            }
+    uv_mutex_unlock(&sched->lock);
+
+    // Let the loop thread pick up the new work while this recipe yields
+    if (queued) {
+        uv_async_send(&sched->wakeup);
+    }
+
+    return NULL;  // Indicates suspension
+}
+
+void scheduler_resume_recipe(Scheduler* sched, Recipe* recipe, const char* dep_output_path) {
+    if (!sched || !recipe) return;
+
+    LOG_DEBUG("Resuming recipe: %s (dependency ready: %s)",
+              recipe->target_name, dep_output_path ? dep_output_path : "unknown");
+
+    if (recipe->wait_count > 0) {
+        recipe->wait_count--;
+    }
+
+    // A recipe that is still running is re-queued by its after_work callback;
+    // a suspended one becomes ready once the last thing it waits on completes
+    if (recipe->wait_count == 0 && recipe->state == RECIPE_SUSPENDED) {
+        recipe->state = RECIPE_PENDING;
+        enqueue_locked(sched, recipe);
+    }
+}
+
+// sys() process bound to the recipe that requested it
+typedef struct SysJob {
+    Scheduler* sched;
+    Recipe* recipe;
+} SysJob;
+
+// Loop thread: a recipe's sys() process finished
+static void on_sys_exit(ProcessResult* result, void* user_data) {
+    SysJob* job = (SysJob*)user_data;
+    Scheduler* sched = job->sched;
+    Recipe* recipe = job->recipe;
+    rebuild_free(job);
+
+    sched->procs_running--;
+
+    uv_mutex_lock(&sched->lock);
+    account_process_usage(recipe, &result->usage);
+    process_result_free(recipe->sys_result);
+    recipe->sys_result = result;
+    recipe->sys_running = false;
+    scheduler_resume_recipe(sched, recipe, NULL);
+    uv_mutex_unlock(&sched->lock);
+
+    // Start the next waiting process and resume the recipe
+    start_pending_processes(sched);
+    scheduler_dispatch(sched);
+}
+
+// Start queued sys() processes while process slots are free (loop thread)
+// A jobserver token may be free again
+static void on_jobserver_ready(void* user_data) {
+    Scheduler* sched = (Scheduler*)user_data;
+    start_pending_processes(sched);
+    scheduler_dispatch(sched);
+}
+
+static void start_pending_processes(Scheduler* sched) {
+    // A failed spawn reports its exit synchronously; let the outer call continue
+    if (sched->starting_procs) return;
+    sched->starting_procs = true;
+
+    for (;;) {
+        uv_mutex_lock(&sched->lock);
+        if (sched->procs_running >= sched->jobs || queue_is_empty(sched->sys_queue)) {
+            uv_mutex_unlock(&sched->lock);
+            break;
         }
-        if (waiters) {
-            waiter_list_add(waiters, recipe);
+
+        // The first process runs on our implicit token; every other one
+        // needs a token from the jobserver shared with parent and children
+        if (sched->jobserver &&
+            sched->procs_running > jobserver_tokens_held(sched->jobserver) &&
+            !jobserver_try_acquire(sched->jobserver)) {
+            uv_mutex_unlock(&sched->lock);
+            jobserver_wait(sched->jobserver, sched->loop, on_jobserver_ready, sched);
+            break;
         }
 
-        // Queue dependency for execution
-        queue_push(sched->ready_queue, dep_recipe);
+        Recipe* recipe = queue_pop(sched->sys_queue);
+        char** args = recipe->sys_args;
+        recipe->sys_args = NULL;
+        uv_mutex_unlock(&sched->lock);
 
-        return NULL;  // Indicates suspension
-    } else {
-        // Dependency is running or suspended - add to waiters
-        LOG_DEBUG("Waiting for in-progress dependency: %s", target_name);
+        SysJob* job = (SysJob*)rebuild_malloc(sizeof(SysJob));
+        job->sched = sched;
+        job->recipe = recipe;
+        sched->procs_running++;
 
-        recipe->state = RECIPE_SUSPENDED;
+        // The engine copies nothing it needs after the spawn returns
+        process_spawn(sched->procs, (const char* const*)args, recipe->temp_dir, on_sys_exit, job);
 
-        WaiterList* waiters = (WaiterList*)map_get(sched->waiting, target_name);
-        if (!waiters) {
-            waiters = waiter_list_create();
-            if (waiters) {
-                map_set(sched->waiting, target_name, waiters);
-            }
+        for (char** arg = args; *arg; arg++) {
+            rebuild_free(*arg);
         }
-        if (waiters) {
-            waiter_list_add(waiters, recipe);
+        rebuild_free(args);
+    }
+
+    // Hand back tokens no running process needs any more
+    if (sched->jobserver) {
+        int needed = sched->procs_running > 0 ? sched->procs_running - 1 : 0;
+        while (jobserver_tokens_held(sched->jobserver) > needed) {
+            jobserver_release(sched->jobserver);
         }
+    }
 
-        return NULL;  // Indicates suspension
+    sched->starting_procs = false;
+}
+
+bool scheduler_start_sys(Scheduler* sched, Recipe* recipe, const char** args, int argc) {
+    if (!sched || !recipe || !args || argc <= 0) return false;
+
+    // Copy the arguments: the spawn happens later on the loop thread
+    char** args_copy = (char**)rebuild_calloc((size_t)argc + 1, sizeof(char*));
+    for (int i = 0; i < argc; i++) {
+        args_copy[i] = rebuild_strdup(args[i]);
     }
+
+    uv_mutex_lock(&sched->lock);
+    process_result_free(recipe->sys_result);
+    recipe->sys_result = NULL;
+    recipe->sys_args = args_copy;
+    recipe->sys_running = true;
+    recipe->wait_count++;
+    queue_push(sched->sys_queue, recipe);
+    uv_mutex_unlock(&sched->lock);
+
+    uv_async_send(&sched->wakeup);
+    return true;
 }
 
-void scheduler_resume_recipe(Scheduler* sched, Recipe* recipe, const char* dep_output_path) {
-    if (!sched || !recipe) return;
+bool scheduler_sys_done(Scheduler* sched, Recipe* recipe) {
+    if (!sched || !recipe) return true;
 
-    LOG_DEBUG("Resuming recipe: %s (dependency ready: %s)",
-              recipe->target_name, dep_output_path ? dep_output_path : "unknown");
+    uv_mutex_lock(&sched->lock);
+    bool done = !recipe->sys_running;
+    uv_mutex_unlock(&sched->lock);
+    return done;
+}
 
-    // Change state from suspended to ready
-    if (recipe->state == RECIPE_SUSPENDED) {
-        recipe->state = RECIPE_PENDING;
+ProcessResult* scheduler_take_sys_result(Scheduler* sched, Recipe* recipe) {
+    if (!sched || !recipe) return NULL;
+
+    uv_mutex_lock(&sched->lock);
+    ProcessResult* result = recipe->sys_result;
+    recipe->sys_result = NULL;
+    uv_mutex_unlock(&sched->lock);
+    return result;
+}
+
+// Record each distinct recipe function so lane VMs can start it as a fiber
+static bool collect_fiber_fn(const char* key, void* value, void* user_data) {
+    (void)key;
+    Target* target = (Target*)value;
+    Scheduler* sched = (Scheduler*)user_data;
+
+    if (!target->function_name || map_has(sched->fiber_fns, target->function_name)) {
+        return true;
     }
 
-    // In Phase 3+, we would pass dep_output_path to the UMKA fiber
-    // For now, the dependency result is available via scheduler_get_completed()
-    (void)dep_output_path;  // Suppress unused warning for Phase 1+2
+    char** names = (char**)rebuild_realloc(sched->fiber_fn_names,
+                                           (sched->fiber_fn_count + 1) * sizeof(char*));
+    sched->fiber_fn_names = names;
+    names[sched->fiber_fn_count] = rebuild_strdup(target->function_name);
+    sched->fiber_fn_count++;
 
-    // Queue for execution
-    queue_push(sched->ready_queue, recipe);
+    // Stored as index + 1 so that NULL means unknown
+    map_set(sched->fiber_fns, target->function_name, (void*)(intptr_t)sched->fiber_fn_count);
+    return true;
 }
 
-int scheduler_execute_sys(Scheduler* sched, Recipe* recipe, const char** args, int argc,
-                          char** out_stdout, char** out_stderr) {
-    if (!sched || !recipe || !args || argc == 0) {
-        return -1;
+// Allocate the lane table once the job count is final
+static void ensure_worker_vms(Scheduler* sched) {
+    if (sched->vms || !sched->registry) return;
+
+    sched->vms = (SchedulerVM*)rebuild_calloc((size_t)sched->jobs, sizeof(SchedulerVM));
+
+    // Every lane compiles BUILD.um with a driver that can start these as fibers
+    map_iterate(sched->registry->targets, collect_fiber_fn, sched);
+}
+
+// Resource class of a recipe's target, or NULL if it has none or no limit
+static const char* limited_class(Scheduler* sched, Recipe* recipe) {
+    Target* target = sched->registry ? target_registry_get(sched->registry, recipe->target_name) : NULL;
+    if (!target || !target->resource_class) return NULL;
+    if (target_registry_get_class_limit(sched->registry, target->resource_class) <= 0) return NULL;
+    return target->resource_class;
+}
+
+// Take a slot in the recipe's resource class (loop thread)
+// Returns false if the class is at its limit
+static bool acquire_class_slot(Scheduler* sched, Recipe* recipe) {
+    if (recipe->holds_class_slot) return true;
+
+    const char* resource_class = limited_class(sched, recipe);
+    if (!resource_class) return true;
+
+    int* running = (int*)map_get(sched->class_running, resource_class);
+    if (!running) {
+        running = (int*)rebuild_calloc(1, sizeof(int));
+        if (!running || map_set(sched->class_running, resource_class, running) != REBUILD_OK) {
+            rebuild_free(running);
+            return true;
+        }
+    }
+
+    if (*running >= target_registry_get_class_limit(sched->registry, resource_class)) {
+        return false;
     }
+    (*running)++;
+    recipe->holds_class_slot = true;
+    return true;
+}
 
-    // For Phase 1+2: Synchronous execution using fork/exec
-    // In Phase 3+: Use uv_spawn for async execution
+// Give back the recipe's resource class slot, if it holds one (loop thread)
+static void release_class_slot(Scheduler* sched, Recipe* recipe) {
+    if (!recipe->holds_class_slot) return;
+    recipe->holds_class_slot = false;
 
-    LOG_DEBUG("Executing sys command: %s", args[0]);
+    const char* resource_class = limited_class(sched, recipe);
+    int* running = resource_class ? (int*)map_get(sched->class_running, resource_class) : NULL;
+    if (running && *running > 0) {
+        (*running)--;
+    }
+}
 
-    // Create pipes for stdout and stderr
-    int stdout_pipe[2];
-    int stderr_pipe[2];
+// True if the recipe's recorded peak RSS fits in what is left of the budget
+// Recipes without a recorded RSS always fit, and so does anything when no
+// memory is reserved, so a recipe larger than the budget still runs alone
+static bool memory_fits(Scheduler* sched, Recipe* recipe) {
+    if (sched->memory_budget_kb == 0 || recipe->reserved_rss_kb > 0 ||
+        recipe->predicted_rss_kb == 0 || sched->memory_reserved_kb == 0) {
+        return true;
+    }
+    return sched->memory_reserved_kb + recipe->predicted_rss_kb <= sched->memory_budget_kb;
+}
 
-    if (pipe(stdout_pipe) != 0 || pipe(stderr_pipe) != 0) {
-        LOG_ERROR("Failed to create pipes: %s", strerror(errno));
-        return -1;
+// Admit a recipe: take its resource class slot and memory share (loop thread)
+// Returns false, taking nothing, if either is not available
+static bool admit_recipe(Scheduler* sched, Recipe* recipe) {
+    if (!memory_fits(sched, recipe) || !acquire_class_slot(sched, recipe)) {
+        return false;
     }
 
-    pid_t pid = fork();
-    if (pid < 0) {
-        LOG_ERROR("Failed to fork: %s", strerror(errno));
-        close(stdout_pipe[0]);
-        close(stdout_pipe[1]);
-        close(stderr_pipe[0]);
-        close(stderr_pipe[1]);
-        return -1;
+    if (sched->memory_budget_kb > 0 && recipe->reserved_rss_kb == 0) {
+        recipe->reserved_rss_kb = recipe->predicted_rss_kb;
+        sched->memory_reserved_kb += recipe->reserved_rss_kb;
     }
+    return true;
+}
+
+// Give back everything admit_recipe took (loop thread)
+static void release_admission(Scheduler* sched, Recipe* recipe) {
+    release_class_slot(sched, recipe);
 
-    if (pid == 0) {
-        // Child process
+    sched->memory_reserved_kb -= recipe->reserved_rss_kb < sched->memory_reserved_kb ?
+                                 recipe->reserved_rss_kb : sched->memory_reserved_kb;
+    recipe->reserved_rss_kb = 0;
+}
 
-        // Redirect stdout
-        close(stdout_pipe[0]);
-        dup2(stdout_pipe[1], STDOUT_FILENO);
-        close(stdout_pipe[1]);
+// Start ready recipes until every job slot is busy (loop thread)
+static void scheduler_dispatch(Scheduler* sched) {
+    ensure_worker_vms(sched);
 
-        // Redirect stderr
-        close(stderr_pipe[0]);
-        dup2(stderr_pipe[1], STDERR_FILENO);
-        close(stderr_pipe[1]);
+    // Recipes whose lane is busy wait here and go back into the heap
+    // with their original priority and sequence number
+    Queue deferred = {0};
 
-        // Change to temp directory if available
-        if (recipe->temp_dir) {
-            chdir(recipe->temp_dir);
+    for (;;) {
+        uv_mutex_lock(&sched->lock);
+        if ((sched->failed && !sched->keep_going) || sched->active_count >= sched->jobs ||
+            heap_is_empty(sched->ready_queue)) {
+            uv_mutex_unlock(&sched->lock);
+            break;
         }
+        Recipe* recipe = heap_pop(sched->ready_queue);
+        uv_mutex_unlock(&sched->lock);
 
-        // Execute command
-        execvp(args[0], (char* const*)args);
+        // Skip anything already running, complete, failed, or being checked
+        // (the check puts it back if it misses)
+        if (!recipe || recipe->state != RECIPE_PENDING || recipe->cache_checking) {
+            continue;
+        }
 
-        // If we get here, exec failed
-        fprintf(stderr, "Failed to execute: %s\n", strerror(errno));
-        _exit(127);
-    } else {
-        // Parent process
-        close(stdout_pipe[1]);
-        close(stderr_pipe[1]);
+        // Every recipe's cache is checked before it first runs; the checks
+        // run side by side on the thread pool and do not take a job slot
+        if (recipe->lane < 0 && !recipe->cache_checked) {
+            if (start_cache_check(sched, recipe)) {
+                continue;
+            }
+            if (scheduler_check_cache(sched, recipe)) {
+                if (recipe->state == RECIPE_COMPLETE) {
+                    LOG_INFO("Using cached result for: %s", recipe->target_name);
+                }
+                continue;
+            }
+        }
 
-        // Read stdout
-        Buffer* stdout_buf = buffer_create(1024);
-        char buf[4096];
-        ssize_t n;
-        while ((n = read(stdout_pipe[0], buf, sizeof(buf))) > 0) {
-            buffer_append(stdout_buf, buf, n);
+        // A suspended fiber can only resume in the VM that holds it
+        if (recipe->lane >= 0 && sched->vms && sched->vms[recipe->lane].busy) {
+            queue_push(&deferred, recipe);
+            continue;
         }
-        close(stdout_pipe[0]);
 
-        // Read stderr
-        Buffer* stderr_buf = buffer_create(1024);
-        while ((n = read(stderr_pipe[0], buf, sizeof(buf))) > 0) {
-            buffer_append(stderr_buf, buf, n);
+        // Wait while its resource class is at its limit or it would
+        // overrun the memory budget
+        if (!admit_recipe(sched, recipe)) {
+            queue_push(&deferred, recipe);
+            continue;
         }
-        close(stderr_pipe[0]);
 
-        // Wait for child to complete
-        int status;
-        waitpid(pid, &status, 0);
+        scheduler_execute_recipe(sched, recipe);
+    }
+
+    if (!queue_is_empty(&deferred)) {
+        uv_mutex_lock(&sched->lock);
+        Recipe* recipe;
+        while ((recipe = queue_pop(&deferred)) != NULL) {
+            heap_push(sched->ready_queue, recipe);
+        }
+        uv_mutex_unlock(&sched->lock);
+    }
+}
+
+// Report recipes left waiting once no work remains (e.g. dependency cycles)
+static bool report_stuck_recipe(const char* key, void* value, void* user_data) {
+    Recipe* recipe = (Recipe*)value;
+    int* stuck = (int*)user_data;
+
+    if (recipe->state == RECIPE_SUSPENDED) {
+        LOG_ERROR("Recipe never resumed: %s (dependency cycle or unbuildable dependency)", key);
+        (*stuck)++;
+    }
+    return true;
+}
+
+static bool collect_failed_recipe(const char* key, void* value, void* user_data) {
+    (void)key;
+    Recipe* recipe = (Recipe*)value;
+    Queue* failed = (Queue*)user_data;
+
+    if (recipe->state == RECIPE_FAILED) {
+        queue_push(failed, recipe);
+    }
+    return true;
+}
+
+// List every failed recipe: first those that broke, then the dependents
+// abandoned because of them
+static void report_failures(Scheduler* sched) {
+    Queue failed = {0};
+    map_iterate(sched->recipes, collect_failed_recipe, &failed);
 
-        // Extract exit code
-        int exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    size_t broken = 0;
+    for (QueueNode* node = failed.head; node; node = node->next) {
+        if (!node->recipe->failed_dep) broken++;
+    }
 
-        // Store output if requested
-        if (out_stdout) {
-            *out_stdout = buffer_to_string(stdout_buf);
+    LOG_ERROR("Build failed: %zu recipe(s) failed, %zu not built because a dependency failed",
+              broken, failed.size - broken);
+    for (QueueNode* node = failed.head; node; node = node->next) {
+        if (!node->recipe->failed_dep) {
+            LOG_ERROR("  FAILED   %s", node->recipe->target_name);
         }
-        if (out_stderr) {
-            *out_stderr = buffer_to_string(stderr_buf);
+    }
+    for (QueueNode* node = failed.head; node; node = node->next) {
+        if (node->recipe->failed_dep) {
+            LOG_ERROR("  SKIPPED  %s (needs %s)", node->recipe->target_name, node->recipe->failed_dep);
         }
+    }
 
-        buffer_free(stdout_buf);
-        buffer_free(stderr_buf);
-
-        LOG_DEBUG("Command completed with exit code: %d", exit_code);
-        return exit_code;
+    while (queue_pop(&failed)) {
     }
 }
 
 RebuildError scheduler_build(Scheduler* sched, const char* target_name) {
-    if (!sched || !target_name) {
+    return scheduler_build_targets(sched, &target_name, 1);
+}
+
+RebuildError scheduler_build_targets(Scheduler* sched, const char* const* target_names, size_t count) {
+    if (!sched || !target_names) {
         return REBUILD_ERROR_MEMORY;
     }
 
-    LOG_INFO("Building target: %s", target_name);
+    bool queued = false;
+    for (size_t i = 0; i < count; i++) {
+        const char* target_name = target_names[i];
+        LOG_INFO("Building target: %s", target_name);
 
-    // Get or create recipe for target
-    Recipe* recipe = scheduler_get_recipe(sched, target_name);
-    if (!recipe) {
-        LOG_ERROR("Failed to create recipe for target: %s", target_name);
-        return REBUILD_ERROR_MEMORY;
-    }
+        // Get or create recipe for target
+        Recipe* recipe = scheduler_get_recipe(sched, target_name);
+        if (!recipe) {
+            LOG_ERROR("Failed to create recipe for target: %s", target_name);
+            return REBUILD_ERROR_MEMORY;
+        }
 
-    // Check if already completed
-    if (scheduler_get_completed(sched, target_name)) {
-        LOG_INFO("Target already built: %s", target_name);
-        return REBUILD_OK;
+        // Check if already completed
+        if (scheduler_get_completed(sched, target_name)) {
+            LOG_INFO("Target already built: %s", target_name);
+            continue;
+        }
+
+        // Queue recipe; dispatch checks the cache before running it
+        uv_mutex_lock(&sched->lock);
+        raise_priority_locked(sched, recipe, 0, 0);
+        enqueue_locked(sched, recipe);
+        uv_mutex_unlock(&sched->lock);
+        queued = true;
     }
 
-    // Check cache
-    if (scheduler_check_cache(sched, recipe)) {
-        LOG_INFO("Using cached result for: %s", target_name);
+    if (!queued) {
         return REBUILD_OK;
     }
 
-    // Queue recipe for execution
-    queue_push(sched->ready_queue, recipe);
-
     // Run the scheduler
     return scheduler_run(sched);
 }
@@ -843,34 +1978,26 @@ RebuildError scheduler_build(Scheduler* sched, const char* target_name) {
 RebuildError scheduler_run(Scheduler* sched) {
     if (!sched) return REBUILD_ERROR_MEMORY;
 
-    LOG_DEBUG("Starting scheduler event loop");
-
-    // Process ready queue until empty or failure
-    while (!queue_is_empty(sched->ready_queue) && !sched->failed) {
-        Recipe* recipe = queue_pop(sched->ready_queue);
-        if (!recipe) continue;
-
-        // Skip if already complete
-        if (recipe->state == RECIPE_COMPLETE) {
-            continue;
-        }
+    LOG_DEBUG("Starting scheduler event loop (%d jobs)", sched->jobs);
 
-        // Execute recipe
-        scheduler_execute_recipe(sched, recipe);
+    // Start the first batch; completions dispatch the rest from the loop
+    scheduler_dispatch(sched);
 
-        // For Phase 1+2 with synchronous execution, we process one at a time
-        // In Phase 3+, multiple recipes would run in parallel via thread pool
-    }
+    // Returns once no recipe is executing on the thread pool
+    uv_run(sched->loop, UV_RUN_DEFAULT);
 
     // Check if any recipes failed
     if (sched->failed) {
-        LOG_ERROR("Build failed: %s", sched->target_error ? sched->target_error : "unknown");
+        report_failures(sched);
         return REBUILD_ERROR_EXEC;
     }
 
-    // Wait for any pending async operations
-    // For Phase 1+2, this is a no-op since we're synchronous
-    // In Phase 3+, this would be: uv_run(sched->loop, UV_RUN_DEFAULT);
+    int stuck = 0;
+    map_iterate(sched->recipes, report_stuck_recipe, &stuck);
+    if (stuck > 0) {
+        LOG_ERROR("Build stalled with %d recipe(s) waiting on dependencies", stuck);
+        return REBUILD_ERROR_EXEC;
+    }
 
     LOG_INFO("Build completed successfully");
     return REBUILD_OK;
@@ -6,29 +6,76 @@
 #include "tool.h"
 #include "recipe.h"
 #include "map.h"
+#include "process.h"
+#include "jobserver.h"
+#include "pool.h"
+#include "code_index.h"
 #include <uv.h>
 #include <stdbool.h>
 
 // Forward declarations
 typedef struct Queue Queue;
+typedef struct RecipeHeap RecipeHeap;
 typedef struct WaiterList WaiterList;
 typedef struct TargetRegistry TargetRegistry;
 
+// Order in which ready recipes are dispatched
+typedef enum {
+    SCHEDULE_CRITICAL_PATH,        // Longest estimated remaining path first (default)
+    SCHEDULE_FIFO                  // In the order recipes became ready
+} SchedulePolicy;
+
+// UMKA instance owned by one worker slot ("lane")
+// A UMKA VM is single-threaded, so each concurrently executing recipe
+// needs its own instance of the compiled BUILD.um. Suspended recipe fibers
+// live inside the lane's VM and can only be resumed there.
+typedef struct SchedulerVM {
+    void* umka;                    // UMKA instance (NULL until first use)
+    bool owned;                    // True if loaded by the scheduler (freed with it)
+    bool busy;                     // Currently executing a recipe (loop thread only)
+} SchedulerVM;
+
 // Scheduler manages the build execution with async I/O via libuv
 // Coordinates recipe execution, dependency resolution, and caching
+//
+// Threading: recipes execute on the libuv thread pool. The loop thread owns
+// dispatch; workers reach back into the scheduler only through the public
+// functions below, which take `lock` around the shared maps and queue.
 typedef struct Scheduler {
     uv_loop_t* loop;               // libuv event loop
     Storage* storage;              // Content-addressed storage
     ToolManager* tools;            // Tool manager
     Map* recipes;                  // target_name -> Recipe*
     Map* completed;                // target_name -> output_path (char*)
-    Queue* ready_queue;            // Recipes ready to execute
+    RecipeHeap* ready_queue;       // Recipes ready to execute, ordered by policy
     Map* waiting;                  // target_name -> WaiterList*
     void* umka;                    // UMKA instance (opaque)
     struct TargetRegistry* registry; // Target registry
     int active_count;              // Number of active/running recipes
     bool failed;                   // True if any recipe has failed
+    bool keep_going;               // Keep building what does not depend on a failure (-k)
     const char* target_error;      // Name of failed target (for error reporting)
+    int jobs;                      // Maximum recipes executing concurrently (-j)
+    char* build_file;              // BUILD.um path, compiled once per worker VM
+    CodeIndex* code_index;         // Per-function hashes of build_file's code
+    SchedulerVM* vms;              // One UMKA instance per job slot
+    uv_mutex_t lock;               // Guards recipes, completed, waiting, ready_queue, active_count
+    uv_async_t wakeup;             // Workers -> loop: new recipes became ready
+    ProcessManager* procs;         // Async process engine for sys()
+    Queue* sys_queue;              // Recipes whose sys() waits for a process slot
+    int procs_running;             // Processes in flight, at most jobs (loop thread only)
+    Jobserver* jobserver;          // Token pool shared with make and children, or NULL
+    bool starting_procs;           // Inside start_pending_processes (loop thread only)
+    Map* fiber_fns;                // Recipe function name -> driver index + 1
+    char** fiber_fn_names;         // Recipe functions compiled into the fiber driver
+    size_t fiber_fn_count;         // Number of entries in fiber_fn_names
+    int next_fiber_id;             // Last fiber id handed out (loop thread only)
+    SchedulePolicy policy;         // Dispatch order for ready recipes
+    uint64_t next_seq;             // Last ready-queue sequence number (lock)
+    Map* class_running;            // Resource class -> int* recipes holding a slot (loop thread only)
+    uint64_t memory_budget_kb;     // Admit recipes while predicted RSS fits (0 = no budget)
+    uint64_t memory_reserved_kb;   // Predicted RSS of admitted recipes (loop thread only)
+    WorkPool* validate_pool;       // Threads that stat and rehash trace dependencies
 } Scheduler;
 
 // Create a new scheduler with the given storage
@@ -36,6 +83,33 @@ typedef struct Scheduler {
 // Returns NULL on allocation failure
 Scheduler* scheduler_create(Storage* storage);
 
+// Set the number of recipes that may execute concurrently
+// Must be called before the first build; also sizes the libuv thread pool
+void scheduler_set_jobs(Scheduler* sched, int jobs);
+
+// Share sys() process slots through a GNU make jobserver
+// The scheduler takes ownership of jobserver (may be NULL)
+void scheduler_set_jobserver(Scheduler* sched, Jobserver* jobserver);
+
+// Admit new recipes only while the sum of their recorded peak RSS stays
+// within budget_kb; a recipe with no recorded RSS is always admitted, as is
+// any recipe when nothing else holds memory (0 disables the budget)
+void scheduler_set_memory_budget(Scheduler* sched, uint64_t budget_kb);
+
+// Keep dispatching after a failure (-k)
+// Only the failed recipes' transitive dependents are abandoned; everything
+// else builds and is cached, and scheduler_run lists all failures at the end
+void scheduler_set_keep_going(Scheduler* sched, bool keep_going);
+
+// Set the dispatch order for ready recipes
+// Critical-path mode weights each recipe by the wall time recorded in its
+// last trace and runs the ready recipe with the longest remaining path first
+void scheduler_set_schedule(Scheduler* sched, SchedulePolicy policy);
+
+// Set the BUILD.um path used to load additional worker VMs
+// Makes a copy of path
+void scheduler_set_build_file(Scheduler* sched, const char* path);
+
 // Free scheduler and all associated resources
 // Does not free the storage (caller's responsibility)
 void scheduler_free(Scheduler* sched);
@@ -45,6 +119,12 @@ void scheduler_free(Scheduler* sched);
 // Returns REBUILD_OK on success, error code on failure
 RebuildError scheduler_build(Scheduler* sched, const char* target_name);
 
+// Build several targets in one run
+// They share one graph, so a dependency common to several is checked and
+// built once and independent targets run side by side
+// Returns REBUILD_OK if every target was built, error code otherwise
+RebuildError scheduler_build_targets(Scheduler* sched, const char* const* target_names, size_t count);
+
 // Run the event loop until all recipes complete
 // Returns REBUILD_OK if all recipes succeeded, error code if any failed
 RebuildError scheduler_run(Scheduler* sched);
@@ -69,33 +149,47 @@ RebuildError scheduler_mark_completed(Scheduler* sched, const char* target_name,
 // Loads trace from storage and validates dependencies
 // If valid, marks recipe as complete and returns true
 // If invalid or no trace, returns false
+// Blocks the caller; dispatch checks recipes on the thread pool instead
 bool scheduler_check_cache(Scheduler* sched, Recipe* recipe);
 
 // Execute a recipe (queue it for execution)
-// For Phase 1+2: executes synchronously
-// For Phase 3+: queues to thread pool
+// Starts the recipe's fiber on a free lane, or resumes it on the lane that
+// holds it, via the libuv thread pool
+// Must be called on the loop thread
 void scheduler_execute_recipe(Scheduler* sched, Recipe* recipe);
 
 // Handle recipe completion
 // Updates state, notifies waiters, queues dependent recipes
+// Must be called on the loop thread
 void scheduler_on_recipe_complete(Scheduler* sched, Recipe* recipe, bool success);
 
 // Handle depend_on() call from recipe
-// This is called when a recipe requests a dependency
+// This is called when a recipe requests a dependency (from a worker thread)
 // If dependency is ready, returns output path
-// If not ready, suspends recipe and queues dependency
+// If not ready, registers the recipe as a waiter and queues the dependency;
+// the recipe's fiber then yields until the dependency completes
 // Returns output path when ready, NULL if needs to suspend
+// (with recipe->dep_failed set if the dependency can never complete; the
+// recipe then fails as soon as it yields instead of being resumed)
 const char* scheduler_on_depend_request(Scheduler* sched, Recipe* recipe, const char* target_name);
 
 // Resume a suspended recipe after dependency is ready
-// Queues recipe for execution with dependency result
+// Queues recipe for execution once its last pending dependency completes
+// Caller must hold sched->lock
 void scheduler_resume_recipe(Scheduler* sched, Recipe* recipe, const char* dep_output_path);
 
-// Execute system command (for sys() calls)
-// For Phase 1+2: executes synchronously
-// For Phase 3+: uses uv_spawn for async execution
-// Returns exit code
-int scheduler_execute_sys(Scheduler* sched, Recipe* recipe, const char** args, int argc,
-                          char** out_stdout, char** out_stderr);
+// Start a sys() command for a recipe (called from a worker thread)
+// The process runs in the recipe's temp directory once one of the `jobs`
+// process slots is free; the recipe counts as waiting until it exits, so
+// its fiber yields and is resumed afterwards. Makes a copy of args.
+// Returns true if the command was queued
+bool scheduler_start_sys(Scheduler* sched, Recipe* recipe, const char** args, int argc);
+
+// Check whether the recipe's sys() command has finished
+bool scheduler_sys_done(Scheduler* sched, Recipe* recipe);
+
+// Take the result of the recipe's finished sys() command
+// Returns NULL if there is none; caller frees with process_result_free
+ProcessResult* scheduler_take_sys_result(Scheduler* sched, Recipe* recipe);
 
 #endif // REBUILD_SCHEDULER_H
@@ -1,6 +1,9 @@
 #define _GNU_SOURCE
 #include "storage.h"
 #include "hash.h"
+#include "trace.h"
+#include "trace_pack.h"
+#include <dirent.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -92,7 +95,7 @@ static char* get_xdg_data_home(void) {
 }
 
 Storage* storage_init(void) {
-    Storage* s = rebuild_malloc(sizeof(Storage));
+    Storage* s = rebuild_calloc(1, sizeof(Storage));
     if (!s) {
         return NULL;
     }
@@ -156,6 +159,7 @@ void storage_free(Storage* s) {
         return;
     }
 
+    trace_pack_close(s->trace_pack);
     rebuild_free(s->base_dir);
     rebuild_free(s->traces_dir);
     rebuild_free(s->objects_dir);
@@ -163,6 +167,85 @@ void storage_free(Storage* s) {
     rebuild_free(s);
 }
 
+// Copy the trace files under traces/ into the pack (s->trace_pack not set yet)
+static size_t import_trace_files(Storage* s, TracePack* pack) {
+    size_t imported = 0;
+    DIR* traces = opendir(s->traces_dir);
+    if (!traces) {
+        return 0;
+    }
+
+    struct dirent* shard;
+    while ((shard = readdir(traces)) != NULL) {
+        if (strlen(shard->d_name) != 2) {
+            continue;
+        }
+
+        char* shard_dir = NULL;
+        if (asprintf(&shard_dir, "%s/%s", s->traces_dir, shard->d_name) < 0) {
+            break;
+        }
+        DIR* d = opendir(shard_dir);
+        rebuild_free(shard_dir);
+        if (!d) {
+            continue;
+        }
+
+        struct dirent* entry;
+        while ((entry = readdir(d)) != NULL) {
+            Hash key;
+            char hex[sizeof(key.bytes) * 2 + 1];
+            if (strlen(entry->d_name) != sizeof(key.bytes) * 2 - 2) {
+                continue;  // Not a trace (e.g. a temporary file)
+            }
+            snprintf(hex, sizeof(hex), "%s%s", shard->d_name, entry->d_name);
+            if (!hash_from_hex(hex, &key)) {
+                continue;
+            }
+
+            Trace* t = trace_load(&key, s);
+            if (t && trace_pack_put(pack, t)) {
+                imported++;
+            }
+            trace_free(t);
+        }
+        closedir(d);
+    }
+    closedir(traces);
+    return imported;
+}
+
+bool storage_use_trace_pack(Storage* s) {
+    if (!s) {
+        return false;
+    }
+    if (s->trace_pack) {
+        return true;
+    }
+
+    char* packs_dir = NULL;
+    if (asprintf(&packs_dir, "%s/packs", s->base_dir) < 0) {
+        LOG_ERROR("Failed to allocate memory for packs directory path");
+        return false;
+    }
+    TracePack* pack = trace_pack_open(packs_dir);
+    rebuild_free(packs_dir);
+    if (!pack) {
+        LOG_WARN("Trace pack unavailable, using trace files");
+        return false;
+    }
+
+    if (trace_pack_count(pack) == 0) {
+        size_t imported = import_trace_files(s, pack);
+        if (imported > 0) {
+            LOG_INFO("Imported %zu trace files into the trace pack", imported);
+        }
+    }
+
+    s->trace_pack = pack;
+    return true;
+}
+
 // Helper function to build a sharded path
 // Given a hex string, returns a path like: base/ab/cdef0123...
 static char* build_sharded_path(const char* base_dir, const char* hex_hash) {
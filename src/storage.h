@@ -4,6 +4,8 @@
 #include "common.h"
 #include <stdbool.h>
 
+typedef struct TracePack TracePack;
+
 // Storage manages the XDG-based file storage for Rebuild
 // Provides content-addressed storage for traces and objects with 2-level sharding
 typedef struct Storage {
@@ -11,6 +13,7 @@ typedef struct Storage {
     char* traces_dir;    // traces/ - stores trace files by request key
     char* objects_dir;   // objects/ - stores outputs by content hash
     char* tmp_dir;       // tmp/ - temporary build directories
+    TracePack* trace_pack; // packs/ - all traces in one pack, once attached
 } Storage;
 
 // Initialize storage with XDG directories
@@ -21,6 +24,11 @@ Storage* storage_init(void);
 // Free storage resources
 void storage_free(Storage* s);
 
+// Keep traces in the trace pack under packs/ instead of one file each
+// A new pack is seeded with the traces already in traces/
+// Returns false (and keeps using trace files) if the pack can not be opened
+bool storage_use_trace_pack(Storage* s);
+
 // Get path for a trace file given its request key
 // Returns path like: traces/ab/cdef0123...
 // Caller must free the returned string
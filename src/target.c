@@ -1,7 +1,9 @@
 #include "target.h"
 #include "umka_bridge.h"
+#include "set.h"
 #include <string.h>
 #include <stdlib.h>
+#include <fnmatch.h>
 
 // Global pointer to current registry during BUILD.um loading
 // This is used by the rebuild_register_target FFI function to know
@@ -23,6 +25,14 @@ TargetRegistry* target_registry_create(void* umka) {
         return NULL;
     }
 
+    registry->class_limits = map_create(0);
+    if (!registry->class_limits) {
+        LOG_ERROR("Failed to create class limits map");
+        map_free(registry->targets, NULL);
+        rebuild_free(registry);
+        return NULL;
+    }
+
     registry->umka = umka;
 
     LOG_DEBUG("Created target registry");
@@ -45,6 +55,8 @@ void target_free(void* target_ptr) {
         rebuild_free(target->function_name);
     }
 
+    rebuild_free(target->resource_class);
+
     // Note: umka_script is owned by the registry or elsewhere, not freed here
 
     rebuild_free(target);
@@ -61,6 +73,10 @@ void target_registry_free(TargetRegistry* registry) {
         map_free(registry->targets, target_free);
     }
 
+    if (registry->class_limits) {
+        map_free(registry->class_limits, rebuild_free);
+    }
+
     rebuild_free(registry);
 
     LOG_DEBUG("Freed target registry");
@@ -96,6 +112,7 @@ RebuildError target_registry_register(TargetRegistry* registry,
     target->name = rebuild_strdup(name);
     target->function_name = rebuild_strdup(function_name);
     target->umka_script = script;
+    target->resource_class = NULL;
 
     if (!target->name || !target->function_name) {
         LOG_ERROR("Failed to duplicate target strings");
@@ -115,6 +132,66 @@ RebuildError target_registry_register(TargetRegistry* registry,
     return REBUILD_OK;
 }
 
+// Assign a target to a resource class
+RebuildError target_registry_set_class(TargetRegistry* registry, const char* name,
+                                       const char* resource_class) {
+    if (!registry || !name || !resource_class) {
+        return REBUILD_ERROR_PARSE;
+    }
+
+    Target* target = target_registry_get(registry, name);
+    if (!target) {
+        LOG_ERROR("Cannot set resource class of unknown target '%s'", name);
+        return REBUILD_ERROR_PARSE;
+    }
+
+    char* copy = rebuild_strdup(resource_class);
+    if (!copy) {
+        return REBUILD_ERROR_MEMORY;
+    }
+    rebuild_free(target->resource_class);
+    target->resource_class = copy;
+
+    LOG_DEBUG("Target %s uses resource class %s", name, resource_class);
+    return REBUILD_OK;
+}
+
+// Set the concurrency limit of a resource class
+RebuildError target_registry_set_class_limit(TargetRegistry* registry,
+                                             const char* resource_class, int limit) {
+    if (!registry || !resource_class || limit < 1) {
+        return REBUILD_ERROR_PARSE;
+    }
+
+    int* value = (int*)map_get(registry->class_limits, resource_class);
+    if (value) {
+        *value = limit;
+        return REBUILD_OK;
+    }
+
+    value = rebuild_malloc(sizeof(int));
+    if (!value) {
+        return REBUILD_ERROR_MEMORY;
+    }
+    *value = limit;
+
+    RebuildError err = map_set(registry->class_limits, resource_class, value);
+    if (err != REBUILD_OK) {
+        rebuild_free(value);
+    }
+    return err;
+}
+
+// Get the concurrency limit of a resource class
+int target_registry_get_class_limit(TargetRegistry* registry, const char* resource_class) {
+    if (!registry || !resource_class) {
+        return 0;
+    }
+
+    int* value = (int*)map_get(registry->class_limits, resource_class);
+    return value ? *value : 0;
+}
+
 // Get a target by name
 Target* target_registry_get(TargetRegistry* registry, const char* name) {
     if (!registry || !name) {
@@ -174,6 +251,140 @@ char** target_registry_list(TargetRegistry* registry, size_t* count) {
     return names;
 }
 
+// Check whether a target argument is a pattern
+bool target_is_pattern(const char* pattern) {
+    if (!pattern) {
+        return false;
+    }
+
+    size_t len = strlen(pattern);
+    if (len >= 3 && strcmp(pattern + len - 3, "...") == 0) {
+        return true;
+    }
+    return strpbrk(pattern, "*?[") != NULL;
+}
+
+// Match one target name against a pattern
+static bool target_name_matches(const char* pattern, const char* name) {
+    size_t len = strlen(pattern);
+    if (len < 3 || strcmp(pattern + len - 3, "...") != 0) {
+        return fnmatch(pattern, name, 0) == 0;
+    }
+
+    // "base/..." or "base:...": the base target and everything beneath it
+    size_t base_len = len - 3;
+    if (base_len > 0 && (pattern[base_len - 1] == '/' || pattern[base_len - 1] == ':')) {
+        base_len--;
+    }
+    if (base_len == 0) {
+        return true;
+    }
+    if (strncmp(name, pattern, base_len) != 0) {
+        return false;
+    }
+    return name[base_len] == '\0' || name[base_len] == '/' || name[base_len] == ':';
+}
+
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+// Get the targets matching a pattern
+char** target_registry_match(TargetRegistry* registry, const char* pattern, size_t* count) {
+    if (!registry || !pattern || !count) {
+        return NULL;
+    }
+
+    size_t total = 0;
+    char** names = target_registry_list(registry, &total);
+    if (!names) {
+        *count = 0;
+        return NULL;
+    }
+
+    // Keep the matches in place
+    size_t matched = 0;
+    for (size_t i = 0; i < total; i++) {
+        if (target_name_matches(pattern, names[i])) {
+            names[matched++] = names[i];
+        }
+    }
+
+    *count = matched;
+    if (matched == 0) {
+        rebuild_free(names);
+        return NULL;
+    }
+
+    qsort(names, matched, sizeof(char*), compare_names);
+    return names;
+}
+
+// Expand command-line target arguments
+RebuildError target_registry_expand(TargetRegistry* registry, const char* const* args, size_t arg_count,
+                                    const char*** out_targets, size_t* out_count) {
+    if (!registry || (!args && arg_count > 0) || !out_targets || !out_count) {
+        return REBUILD_ERROR_MEMORY;
+    }
+
+    Set* seen = set_create(0);
+    size_t capacity = arg_count > 0 ? arg_count : 1;
+    size_t count = 0;
+    const char** targets = rebuild_malloc(capacity * sizeof(char*));
+    if (!seen || !targets) {
+        set_free(seen);
+        rebuild_free(targets);
+        return REBUILD_ERROR_MEMORY;
+    }
+
+    RebuildError err = REBUILD_OK;
+    for (size_t i = 0; i < arg_count && err == REBUILD_OK; i++) {
+        size_t match_count = 1;
+        char** matches = NULL;
+        const char* const* names = &args[i];
+
+        if (target_is_pattern(args[i])) {
+            matches = target_registry_match(registry, args[i], &match_count);
+            if (!matches) {
+                LOG_ERROR("No targets match pattern: %s", args[i]);
+                err = REBUILD_ERROR_PARSE;
+                break;
+            }
+            names = (const char* const*)matches;
+            LOG_INFO("Pattern %s matches %zu target(s)", args[i], match_count);
+        }
+
+        for (size_t j = 0; j < match_count; j++) {
+            if (set_has(seen, names[j])) continue;
+            if (set_add(seen, names[j]) != REBUILD_OK) {
+                err = REBUILD_ERROR_MEMORY;
+                break;
+            }
+            if (count == capacity) {
+                capacity *= 2;
+                const char** grown = rebuild_realloc(targets, capacity * sizeof(char*));
+                if (!grown) {
+                    err = REBUILD_ERROR_MEMORY;
+                    break;
+                }
+                targets = grown;
+            }
+            targets[count++] = names[j];
+        }
+        rebuild_free(matches);
+    }
+
+    set_free(seen);
+    if (err != REBUILD_OK) {
+        rebuild_free(targets);
+        return err;
+    }
+
+    *out_targets = targets;
+    *out_count = count;
+    return REBUILD_OK;
+}
+
 // Load a BUILD.um file and register its targets
 RebuildError target_registry_load_build_file(TargetRegistry* registry, const char* path) {
     if (!registry || !path) {
@@ -251,6 +462,28 @@ void target_registry_ffi_register(const char* name, const char* function_name) {
     }
 }
 
+// FFI: rebuild_set_target_class(name, class) from register_targets()
+void target_registry_ffi_set_class(const char* name, const char* resource_class) {
+    if (!g_current_registry) {
+        LOG_ERROR("rebuild_set_target_class called with no active registry");
+        return;
+    }
+
+    target_registry_set_class(g_current_registry, name, resource_class);
+}
+
+// FFI: rebuild_set_class_limit(class, limit) from register_targets()
+void target_registry_ffi_set_class_limit(const char* resource_class, int limit) {
+    if (!g_current_registry) {
+        LOG_ERROR("rebuild_set_class_limit called with no active registry");
+        return;
+    }
+
+    if (target_registry_set_class_limit(g_current_registry, resource_class, limit) != REBUILD_OK) {
+        LOG_ERROR("Invalid limit %d for resource class '%s'", limit, resource_class ? resource_class : "(null)");
+    }
+}
+
 // Get the current registry (for FFI use)
 TargetRegistry* target_registry_get_current(void) {
     return g_current_registry;
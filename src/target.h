@@ -13,6 +13,7 @@ typedef struct Target {
     char* name;              // Target name (e.g., "rebuild", "lib:foo")
     char* function_name;     // UMKA function name (e.g., "target_rebuild")
     void* umka_script;       // UMKA script instance (actually Umka*)
+    char* resource_class;    // Resource class (e.g., "link"), or NULL
 } Target;
 
 // Target registry
@@ -20,6 +21,7 @@ typedef struct Target {
 typedef struct TargetRegistry {
     Map* targets;            // name -> Target*
     void* umka;              // UMKA instance (actually Umka*)
+    Map* class_limits;       // resource class -> int* max concurrent recipes
 } TargetRegistry;
 
 // Create a new target registry
@@ -38,6 +40,21 @@ RebuildError target_registry_register(TargetRegistry* registry,
                                      const char* function_name,
                                      void* script);
 
+// Assign a registered target to a resource class
+// Makes a copy of resource_class
+// Returns REBUILD_ERROR_PARSE if the target is not registered
+RebuildError target_registry_set_class(TargetRegistry* registry, const char* name,
+                                       const char* resource_class);
+
+// Limit how many recipes of a resource class may run at once
+// Replaces any earlier limit for the class; limit must be at least 1
+RebuildError target_registry_set_class_limit(TargetRegistry* registry,
+                                             const char* resource_class, int limit);
+
+// Get the limit of a resource class
+// Returns 0 if the class is unlimited
+int target_registry_get_class_limit(TargetRegistry* registry, const char* resource_class);
+
 // Get a target by name
 // Returns NULL if target not found
 Target* target_registry_get(TargetRegistry* registry, const char* name);
@@ -52,6 +69,24 @@ bool target_registry_has(TargetRegistry* registry, const char* name);
 // Returns NULL on allocation failure
 char** target_registry_list(TargetRegistry* registry, size_t* count);
 
+// Check whether a command-line target is a pattern rather than a name
+// Patterns use shell wildcards (*, ?, [...]) or end in "..." ("lib/..."
+// is lib itself and every target under lib/ or lib:, "..." is everything)
+bool target_is_pattern(const char* pattern);
+
+// Get the registered targets matching a pattern, sorted by name
+// Returns array of target names (caller must free the array but not the strings)
+// count is set to the number of matches; returns NULL if there are none
+char** target_registry_match(TargetRegistry* registry, const char* pattern, size_t* count);
+
+// Expand command-line target arguments into the targets to build
+// Patterns become the registered targets they match, in name order; plain
+// names pass through unchecked and duplicates are dropped. The strings are
+// owned by args or the registry, the array (*out_targets) by the caller.
+// Returns REBUILD_ERROR_PARSE if a pattern matches nothing
+RebuildError target_registry_expand(TargetRegistry* registry, const char* const* args, size_t arg_count,
+                                    const char*** out_targets, size_t* out_count);
+
 // Load a BUILD.um file and register its targets
 // The BUILD.um file should define a register_targets() function that calls
 // target(name, fn) for each target, which in turn calls rebuild_register_target()
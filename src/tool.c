@@ -149,8 +149,9 @@ ToolModule* tool_manager_load_tool(ToolManager* mgr, const char* name) {
     tool->name = rebuild_strdup(name);
     tool->binary_path = binary_path;
 
-    // Hash the binary
-    if (!hash_file(binary_path, &tool->binary_hash)) {
+    // Hash the binary; request keys cover this hash, so it keeps the
+    // original scheme and a new file hash scheme does not change every key
+    if (!hash_file_scheme(binary_path, HASH_SCHEME_BLAKE2B, &tool->binary_hash)) {
         LOG_ERROR("Failed to hash tool binary: %s", binary_path);
         tool_module_free(tool);
         return NULL;
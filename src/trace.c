@@ -1,13 +1,68 @@
+#define _GNU_SOURCE
 #include "trace.h"
 #include "hash.h"
+#include "trace_pack.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 // Magic bytes for trace file format
 #define TRACE_MAGIC "RBTR"
-#define TRACE_VERSION 1
+#define TRACE_VERSION 4
+
+// Version 4 layout (all integers little-endian, every section 8-byte aligned):
+//   0   magic "RBTR", u32 version
+//   8   request key (32), output tree hash (32)
+//   72  u64 dep_count, cpu_time_ms, wall_time_ms, peak_rss_kb, recorded_ns,
+//       strings_size, hash_scheme (0 in files from before it was recorded)
+//   128 dependency hashes        dep_count * 32
+//       stat signatures          dep_count * 5 u64
+//       path offsets             (dep_count + 1) u64 into the string blob
+//       string blob              NUL-terminated paths, strings_size bytes
+#define TRACE_HEADER_SIZE 128
+#define TRACE_SIGNATURE_SIZE 40
+
+#define NS_PER_SEC 1000000000ULL
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define TRACE_HOST_LITTLE_ENDIAN 1
+#else
+#define TRACE_HOST_LITTLE_ENDIAN 0
+#endif
+
+_Static_assert(sizeof(StatSignature) == TRACE_SIGNATURE_SIZE, "StatSignature must match the file layout");
+
+static void put_le32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void put_le64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t get_le32(const uint8_t* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) v |= (uint32_t)p[i] << (8 * i);
+    return v;
+}
+
+static uint64_t get_le64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+// True if p points into the trace's mapped file
+static bool in_map(const Trace* t, const void* p) {
+    const uint8_t* base = (const uint8_t*)t->map;
+    return base != NULL && (const uint8_t*)p >= base && (const uint8_t*)p < base + t->map_size;
+}
 
 // Allocate a new trace with the given request key
 Trace* trace_create(const Hash* request_key) {
@@ -32,6 +87,8 @@ Trace* trace_create(const Hash* request_key) {
     memset(&t->output_tree_hash, 0, sizeof(Hash));
     t->cpu_time_ms = 0;
     t->wall_time_ms = 0;
+    t->peak_rss_kb = 0;
+    t->hash_scheme = HASH_SCHEME_CURRENT;
 
     return t;
 }
@@ -42,55 +99,136 @@ void trace_free(Trace* t) {
         return;
     }
 
-    // Free each dependency path
+    // Free each dependency path (mapped and pack paths are not the trace's)
     if (t->dep_paths != NULL) {
-        for (size_t i = 0; i < t->dep_count; i++) {
-            if (t->dep_paths[i] != NULL) {
+        for (size_t i = 0; !t->shared_paths && i < t->dep_count; i++) {
+            if (t->dep_paths[i] != NULL && !in_map(t, t->dep_paths[i])) {
                 rebuild_free(t->dep_paths[i]);
             }
         }
         rebuild_free(t->dep_paths);
     }
 
-    // Free dependency hashes array
-    if (t->dep_hashes != NULL) {
+    // Free dependency hashes and signatures unless used in place
+    if (t->dep_hashes != NULL && !in_map(t, t->dep_hashes)) {
         rebuild_free(t->dep_hashes);
     }
+    if (t->dep_stats != NULL && !in_map(t, t->dep_stats)) {
+        rebuild_free(t->dep_stats);
+    }
+
+    if (t->map != NULL) {
+        munmap(t->map, t->map_size);
+    }
 
     // Free the trace itself
     rebuild_free(t);
 }
 
-// Add a dependency to the trace
-bool trace_add_dependency(Trace* t, const char* path, const Hash* hash) {
-    if (t == NULL || path == NULL || hash == NULL) {
-        LOG_ERROR("trace_add_dependency: invalid arguments");
+// Give a loaded trace arrays of its own so it can grow (copy on write)
+static bool trace_unmap(Trace* t) {
+    if (t->map == NULL && !t->shared_paths) {
+        return true;
+    }
+
+    size_t capacity = t->dep_count < 8 ? 8 : t->dep_count;
+    char** paths = (char**)rebuild_calloc(capacity, sizeof(char*));
+    Hash* hashes = (Hash*)rebuild_malloc(capacity * sizeof(Hash));
+    StatSignature* stats = (StatSignature*)rebuild_malloc(capacity * sizeof(StatSignature));
+    bool ok = paths && hashes && stats;
+    for (size_t i = 0; ok && i < t->dep_count; i++) {
+        paths[i] = rebuild_strdup(t->dep_paths[i]);
+        ok = paths[i] != NULL;
+    }
+    if (!ok) {
+        LOG_ERROR("trace_add_dependency: failed to copy mapped trace");
+        if (paths) {
+            for (size_t i = 0; i < t->dep_count; i++) rebuild_free(paths[i]);
+        }
+        rebuild_free(paths);
+        rebuild_free(hashes);
+        rebuild_free(stats);
+        return false;
+    }
+    if (t->dep_count > 0) {
+        memcpy(hashes, t->dep_hashes, t->dep_count * sizeof(Hash));
+        memcpy(stats, t->dep_stats, t->dep_count * sizeof(StatSignature));
+    }
+
+    rebuild_free(t->dep_paths);
+    if (!in_map(t, t->dep_hashes)) {
+        rebuild_free(t->dep_hashes);
+    }
+    if (!in_map(t, t->dep_stats)) {
+        rebuild_free(t->dep_stats);
+    }
+    if (t->map != NULL) {
+        munmap(t->map, t->map_size);
+    }
+    t->map = NULL;
+    t->map_size = 0;
+    t->shared_paths = false;
+
+    t->dep_paths = paths;
+    t->dep_hashes = hashes;
+    t->dep_stats = stats;
+    t->dep_capacity = capacity;
+    return true;
+}
+
+// Make room for one more dependency, doubling the arrays when full
+static bool trace_reserve(Trace* t) {
+    if (!trace_unmap(t)) {
         return false;
     }
+    if (t->dep_count < t->dep_capacity) {
+        return true;
+    }
 
-    // Grow the arrays
-    size_t new_count = t->dep_count + 1;
+    size_t capacity = t->dep_capacity ? t->dep_capacity * 2 : 8;
 
-    char** new_paths = (char**)rebuild_realloc(
-        t->dep_paths,
-        new_count * sizeof(char*)
-    );
+    char** new_paths = (char**)rebuild_realloc(t->dep_paths, capacity * sizeof(char*));
     if (new_paths == NULL) {
         LOG_ERROR("trace_add_dependency: failed to reallocate dep_paths");
         return false;
     }
     t->dep_paths = new_paths;
 
-    Hash* new_hashes = (Hash*)rebuild_realloc(
-        t->dep_hashes,
-        new_count * sizeof(Hash)
-    );
+    Hash* new_hashes = (Hash*)rebuild_realloc(t->dep_hashes, capacity * sizeof(Hash));
     if (new_hashes == NULL) {
         LOG_ERROR("trace_add_dependency: failed to reallocate dep_hashes");
         return false;
     }
     t->dep_hashes = new_hashes;
 
+    StatSignature* new_stats = (StatSignature*)rebuild_realloc(t->dep_stats, capacity * sizeof(StatSignature));
+    if (new_stats == NULL) {
+        LOG_ERROR("trace_add_dependency: failed to reallocate dep_stats");
+        return false;
+    }
+    t->dep_stats = new_stats;
+
+    t->dep_capacity = capacity;
+    return true;
+}
+
+// Add a dependency to the trace
+bool trace_add_dependency(Trace* t, const char* path, const Hash* hash) {
+    return trace_add_dependency_stat(t, path, hash, NULL);
+}
+
+// Add a dependency and its stat signature to the trace
+bool trace_add_dependency_stat(Trace* t, const char* path, const Hash* hash,
+                               const StatSignature* sig) {
+    if (t == NULL || path == NULL || hash == NULL) {
+        LOG_ERROR("trace_add_dependency: invalid arguments");
+        return false;
+    }
+
+    if (!trace_reserve(t)) {
+        return false;
+    }
+
     // Copy the path and hash
     t->dep_paths[t->dep_count] = rebuild_strdup(path);
     if (t->dep_paths[t->dep_count] == NULL) {
@@ -99,169 +237,387 @@ bool trace_add_dependency(Trace* t, const char* path, const Hash* hash) {
     }
 
     memcpy(&t->dep_hashes[t->dep_count], hash, sizeof(Hash));
+    if (sig) {
+        t->dep_stats[t->dep_count] = *sig;
+    } else {
+        memset(&t->dep_stats[t->dep_count], 0, sizeof(StatSignature));
+    }
 
-    t->dep_count = new_count;
+    t->dep_count++;
     return true;
 }
 
-// Check if all dependencies still match their recorded hashes
-bool trace_validate(const Trace* t) {
-    if (t == NULL) {
-        LOG_ERROR("trace_validate: trace is NULL");
+// Add a dependency on another target and its output hash
+bool trace_add_target_dependency(Trace* t, const char* target_name, const Hash* output_hash) {
+    if (t == NULL || target_name == NULL || output_hash == NULL) {
+        LOG_ERROR("trace_add_target_dependency: invalid arguments");
         return false;
     }
 
-    // Check each dependency
-    for (size_t i = 0; i < t->dep_count; i++) {
-        const char* path = t->dep_paths[i];
-        const Hash* expected_hash = &t->dep_hashes[i];
+    size_t len = strlen(TRACE_TARGET_PREFIX) + strlen(target_name) + 1;
+    char* entry = (char*)rebuild_malloc(len);
+    if (entry == NULL) {
+        return false;
+    }
+    snprintf(entry, len, "%s%s", TRACE_TARGET_PREFIX, target_name);
 
-        // Check if dependency exists
-        struct stat st;
-        if (stat(path, &st) != 0) {
-            LOG_DEBUG("trace_validate: dependency missing: %s", path);
-            return false;
-        }
+    bool ok = trace_add_dependency_stat(t, entry, output_hash, NULL);
+    rebuild_free(entry);
+    return ok;
+}
 
-        // Hash the dependency (file or directory tree)
-        Hash actual_hash;
-        bool hash_success;
+// Target name of a dependency, or NULL for a path
+const char* trace_dependency_target(const Trace* t, size_t i) {
+    if (t == NULL || i >= t->dep_count) {
+        return NULL;
+    }
+    const char* path = t->dep_paths[i];
+    size_t prefix_len = strlen(TRACE_TARGET_PREFIX);
+    return strncmp(path, TRACE_TARGET_PREFIX, prefix_len) == 0 ? path + prefix_len : NULL;
+}
 
-        if (S_ISDIR(st.st_mode)) {
-            // Directory: use hash_tree() for deterministic recursive hashing
-            hash_success = hash_tree(path, &actual_hash);
-            if (!hash_success) {
-                LOG_WARN("trace_validate: failed to hash directory dependency: %s", path);
-                return false;
-            }
-        } else if (S_ISREG(st.st_mode)) {
-            // Regular file: use hash_file()
-            hash_success = hash_file(path, &actual_hash);
-            if (!hash_success) {
-                LOG_WARN("trace_validate: failed to hash file dependency: %s", path);
-                return false;
-            }
-        } else {
-            LOG_WARN("trace_validate: dependency is neither file nor directory: %s", path);
-            return false;
-        }
+static uint64_t timespec_ns(const struct timespec* ts) {
+    return (uint64_t)ts->tv_sec * NS_PER_SEC + (uint64_t)ts->tv_nsec;
+}
+
+// Take the stat signature of a file or directory tree
+bool stat_signature_get(const char* path, StatSignature* out) {
+    if (path == NULL || out == NULL) {
+        return false;
+    }
+
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return false;
+    }
+
+    out->size = S_ISDIR(st.st_mode) ? 0 : (uint64_t)st.st_size;
+    out->mtime_ns = timespec_ns(&st.st_mtim);
+    out->ctime_ns = timespec_ns(&st.st_ctim);
+    out->ino = (uint64_t)st.st_ino;
+    out->dev = (uint64_t)st.st_dev;
 
-        if (!hash_equal(&actual_hash, expected_hash)) {
-            LOG_DEBUG("trace_validate: dependency changed: %s", path);
+    // A directory's tree, walked as hash_tree walks it: size holds a digest
+    // of every entry's stat identity
+    if (S_ISDIR(st.st_mode)) {
+        Hash tree;
+        uint64_t newest_ns;
+        if (!hash_tree_signature(path, &tree, &newest_ns)) {
             return false;
         }
+        memcpy(&out->size, tree.bytes, sizeof(out->size));
+        out->mtime_ns = newest_ns;
+        out->ctime_ns = newest_ns;
     }
-
-    LOG_DEBUG("trace_validate: all %zu dependencies valid", t->dep_count);
     return true;
 }
 
-// Helper function to write data to file
-static bool write_all(FILE* f, const void* data, size_t size) {
-    size_t written = fwrite(data, 1, size, f);
-    if (written != size) {
-        LOG_ERROR("write_all: failed to write %zu bytes (wrote %zu)", size, written);
+// True if a recorded signature still describes the dependency
+// Like git's racily-clean check, a change within a second of recording may
+// share a timestamp with the version that was hashed, so it is not trusted
+static bool stat_signature_matches(const StatSignature* recorded, const StatSignature* current,
+                                   uint64_t recorded_ns) {
+    static const StatSignature unknown = {0};
+    if (recorded_ns == 0 || memcmp(recorded, &unknown, sizeof(StatSignature)) == 0) {
         return false;
     }
-    return true;
+    if (memcmp(recorded, current, sizeof(StatSignature)) != 0) {
+        return false;
+    }
+
+    uint64_t racy_after = recorded_ns >= NS_PER_SEC ? (recorded_ns / NS_PER_SEC - 1) * NS_PER_SEC : 0;
+    return recorded->mtime_ns < racy_after && recorded->ctime_ns < racy_after;
 }
 
-// Save trace to disk in binary format
-bool trace_save(const Trace* t, Storage* storage) {
-    if (t == NULL || storage == NULL) {
-        LOG_ERROR("trace_save: invalid arguments");
+// What validating a dependency takes once its signature has been checked
+enum {
+    REHASH_NONE,                   // Unchanged, or a target
+    REHASH_FILE,
+    REHASH_TREE,
+};
+
+typedef struct ValidateContext {
+    const Trace* trace;
+    WorkPool* pool;                // Also walks directory dependencies
+    uint8_t* rehash;               // REHASH_* per dependency
+    size_t* pending;               // Dependencies to rehash, in order
+    atomic_bool mismatch;          // Set by the first dependency that fails
+} ValidateContext;
+
+// Check one dependency's stat signature, noting whether it needs rehashing
+// A file that does is prefetched, so its reads overlap the other checks
+static bool check_dependency(size_t i, void* user_data) {
+    ValidateContext* ctx = (ValidateContext*)user_data;
+    const Trace* t = ctx->trace;
+    const char* path = t->dep_paths[i];
+    ctx->rehash[i] = REHASH_NONE;
+
+    // Target outputs are compared by the scheduler once the target is built
+    if (trace_dependency_target(t, i) != NULL) {
+        return true;
+    }
+
+    // Check if dependency exists
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        LOG_DEBUG("trace_validate: dependency missing: %s", path);
+        atomic_store(&ctx->mismatch, true);
         return false;
     }
 
-    // Get the trace file path
-    char* trace_path = storage_get_trace_path(storage, &t->request_key);
-    if (trace_path == NULL) {
-        LOG_ERROR("trace_save: failed to get trace path");
+    // Unchanged signature: trust the recorded hash without reading
+    if (t->dep_stats) {
+        StatSignature current;
+        if (stat_signature_get(path, &current) &&
+            stat_signature_matches(&t->dep_stats[i], &current, t->recorded_ns)) {
+            return true;
+        }
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        ctx->rehash[i] = REHASH_TREE;
+    } else if (S_ISREG(st.st_mode)) {
+        ctx->rehash[i] = REHASH_FILE;
+        hash_prefetch(path);
+    } else {
+        LOG_WARN("trace_validate: dependency is neither file nor directory: %s", path);
+        atomic_store(&ctx->mismatch, true);
         return false;
     }
+    return true;
+}
 
-    // Open file for writing
-    FILE* f = fopen(trace_path, "wb");
-    if (f == NULL) {
-        LOG_ERROR("trace_save: failed to open file: %s", trace_path);
-        rebuild_free(trace_path);
+// Rehash the changed file dependencies in deps as one batch, the way their
+// recorded hashes were taken. The batch stops at the first file that does
+// not match
+static bool rehash_files(ValidateContext* ctx, const size_t* deps, size_t count) {
+    const Trace* t = ctx->trace;
+    const char** paths = (const char**)rebuild_malloc(sizeof(char*) * (count + 1));
+    Hash* expected = (Hash*)rebuild_malloc(sizeof(Hash) * (count + 1));
+    Hash* hashes = (Hash*)rebuild_malloc(sizeof(Hash) * (count + 1));
+    bool* ok = (bool*)rebuild_malloc(sizeof(bool) * (count + 1));
+    for (size_t j = 0; j < count; j++) {
+        paths[j] = t->dep_paths[deps[j]];
+        expected[j] = t->dep_hashes[deps[j]];
+    }
+
+    bool valid = hash_files_at(AT_FDCWD, paths, count, t->hash_scheme, expected, ctx->pool, hashes, ok);
+    if (!valid) {
+        atomic_store(&ctx->mismatch, true);
+        for (size_t j = 0; j < count; j++) {
+            if (ok[j] && !hash_equal(&hashes[j], &expected[j])) {
+                LOG_DEBUG("trace_validate: dependency changed: %s", paths[j]);
+                break;
+            }
+        }
+    }
+
+    rebuild_free(paths);
+    rebuild_free(expected);
+    rebuild_free(hashes);
+    rebuild_free(ok);
+    return valid;
+}
+
+// Rehash the index'th directory dependency whose signature changed
+static bool rehash_tree(size_t index, void* user_data) {
+    ValidateContext* ctx = (ValidateContext*)user_data;
+    const Trace* t = ctx->trace;
+    size_t i = ctx->pending[index];
+    const char* path = t->dep_paths[i];
+
+    // Another dependency already changed; the trace is invalid anyway
+    if (atomic_load(&ctx->mismatch)) {
         return false;
     }
 
-    bool success = true;
+    Hash actual_hash;
+    bool hash_success = hash_tree_parallel(path, &actual_hash, ctx->pool);
+    if (!hash_success) {
+        LOG_WARN("trace_validate: failed to hash directory dependency: %s", path);
+    } else if (!hash_equal(&actual_hash, &t->dep_hashes[i])) {
+        LOG_DEBUG("trace_validate: dependency changed: %s", path);
+        hash_success = false;
+    }
 
-    // Write magic bytes
-    if (!write_all(f, TRACE_MAGIC, 4)) {
-        success = false;
-        goto cleanup;
+    if (!hash_success) {
+        atomic_store(&ctx->mismatch, true);
     }
+    return hash_success;
+}
 
-    // Write version
-    uint32_t version = TRACE_VERSION;
-    if (!write_all(f, &version, sizeof(uint32_t))) {
-        success = false;
-        goto cleanup;
+// Check if all dependencies still match their recorded hashes
+bool trace_validate(const Trace* t) {
+    return trace_validate_parallel(t, NULL);
+}
+
+// Check all dependencies, spread over pool: every stat signature first,
+// then rehash those that changed, the files as one batch before the trees
+bool trace_validate_parallel(const Trace* t, WorkPool* pool) {
+    if (t == NULL) {
+        LOG_ERROR("trace_validate: trace is NULL");
+        return false;
+    }
+    if (t->dep_count == 0) {
+        return true;
     }
 
-    // Write request key
-    if (!write_all(f, &t->request_key.bytes, 32)) {
-        success = false;
-        goto cleanup;
+    ValidateContext ctx = { .trace = t, .pool = pool };
+    atomic_init(&ctx.mismatch, false);
+    ctx.rehash = (uint8_t*)rebuild_malloc(t->dep_count);
+    ctx.pending = (size_t*)rebuild_malloc(t->dep_count * sizeof(size_t));
+    bool valid = ctx.rehash && ctx.pending &&
+                 work_pool_run(pool, t->dep_count, check_dependency, &ctx);
+
+    // Trees first in pending, then files
+    size_t trees = 0;
+    for (size_t i = 0; valid && i < t->dep_count; i++) {
+        if (ctx.rehash[i] == REHASH_TREE) {
+            ctx.pending[trees++] = i;
+        }
+    }
+    size_t pending = trees;
+    for (size_t i = 0; valid && i < t->dep_count; i++) {
+        if (ctx.rehash[i] == REHASH_FILE) {
+            ctx.pending[pending++] = i;
+        }
     }
+    valid = valid && rehash_files(&ctx, ctx.pending + trees, pending - trees);
+    valid = valid && work_pool_run(pool, trees, rehash_tree, &ctx);
 
-    // Write dependency count
-    uint64_t dep_count = t->dep_count;
-    if (!write_all(f, &dep_count, sizeof(uint64_t))) {
-        success = false;
-        goto cleanup;
+    rebuild_free(ctx.rehash);
+    rebuild_free(ctx.pending);
+    if (valid) {
+        LOG_DEBUG("trace_validate: all %zu dependencies valid (%zu rehashed)", t->dep_count, pending);
     }
+    return valid;
+}
 
-    // Write each dependency
+// Size of the version 4 image of a trace; strings_size receives the blob size
+static size_t trace_image_size(const Trace* t, size_t* strings_size) {
+    size_t strings = 0;
     for (size_t i = 0; i < t->dep_count; i++) {
-        const char* path = t->dep_paths[i];
-        uint32_t path_len = (uint32_t)strlen(path);
+        strings += strlen(t->dep_paths[i]) + 1;
+    }
+    *strings_size = strings;
+    return TRACE_HEADER_SIZE +
+           t->dep_count * (sizeof(Hash) + TRACE_SIGNATURE_SIZE) +
+           (t->dep_count + 1) * sizeof(uint64_t) +
+           strings;
+}
 
-        // Write path length
-        if (!write_all(f, &path_len, sizeof(uint32_t))) {
-            success = false;
-            goto cleanup;
-        }
+// Lay the trace out in the version 4 format
+static void trace_encode(const Trace* t, uint8_t* image, size_t strings_size) {
+    uint8_t* p = image;
+    memset(p, 0, TRACE_HEADER_SIZE);
+    memcpy(p, TRACE_MAGIC, 4);
+    put_le32(p + 4, TRACE_VERSION);
+    memcpy(p + 8, t->request_key.bytes, 32);
+    memcpy(p + 40, t->output_tree_hash.bytes, 32);
+    put_le64(p + 72, t->dep_count);
+    put_le64(p + 80, t->cpu_time_ms);
+    put_le64(p + 88, t->wall_time_ms);
+    put_le64(p + 96, t->peak_rss_kb);
+    put_le64(p + 104, t->recorded_ns);
+    put_le64(p + 112, strings_size);
+    put_le64(p + 120, (uint64_t)t->hash_scheme);
+    p += TRACE_HEADER_SIZE;
+
+    for (size_t i = 0; i < t->dep_count; i++, p += sizeof(Hash)) {
+        memcpy(p, t->dep_hashes[i].bytes, sizeof(Hash));
+    }
+
+    for (size_t i = 0; i < t->dep_count; i++, p += TRACE_SIGNATURE_SIZE) {
+        const StatSignature* sig = &t->dep_stats[i];
+        put_le64(p, sig->size);
+        put_le64(p + 8, sig->mtime_ns);
+        put_le64(p + 16, sig->ctime_ns);
+        put_le64(p + 24, sig->ino);
+        put_le64(p + 32, sig->dev);
+    }
+
+    uint8_t* strings = p + (t->dep_count + 1) * sizeof(uint64_t);
+    uint64_t offset = 0;
+    for (size_t i = 0; i < t->dep_count; i++, p += sizeof(uint64_t)) {
+        size_t len = strlen(t->dep_paths[i]) + 1;
+        put_le64(p, offset);
+        memcpy(strings + offset, t->dep_paths[i], len);
+        offset += len;
+    }
+    put_le64(p, offset);
+}
 
-        // Write path
-        if (!write_all(f, path, path_len)) {
-            success = false;
-            goto cleanup;
-        }
+// Save trace to disk in binary format
+// The image is written to a temporary file and renamed over the old trace,
+// so a process that has the old one mapped keeps seeing it intact
+bool trace_save(const Trace* t, Storage* storage) {
+    if (t == NULL || storage == NULL) {
+        LOG_ERROR("trace_save: invalid arguments");
+        return false;
+    }
 
-        // Write hash
-        if (!write_all(f, &t->dep_hashes[i].bytes, 32)) {
-            success = false;
-            goto cleanup;
-        }
+    if (storage->trace_pack != NULL) {
+        return trace_pack_put(storage->trace_pack, t);
     }
 
-    // Write output tree hash
-    if (!write_all(f, &t->output_tree_hash.bytes, 32)) {
-        success = false;
-        goto cleanup;
+    // Get the trace file path
+    char* trace_path = storage_get_trace_path(storage, &t->request_key);
+    if (trace_path == NULL) {
+        LOG_ERROR("trace_save: failed to get trace path");
+        return false;
     }
 
-    // Write CPU time
-    if (!write_all(f, &t->cpu_time_ms, sizeof(uint64_t))) {
-        success = false;
-        goto cleanup;
+    size_t strings_size;
+    size_t size = trace_image_size(t, &strings_size);
+    uint8_t* image = (uint8_t*)rebuild_malloc(size);
+    size_t tmp_len = strlen(trace_path) + 8;
+    char* tmp_path = (char*)rebuild_malloc(tmp_len);
+    if (image == NULL || tmp_path == NULL) {
+        rebuild_free(image);
+        rebuild_free(tmp_path);
+        rebuild_free(trace_path);
+        return false;
     }
+    trace_encode(t, image, strings_size);
 
-    // Write wall time
-    if (!write_all(f, &t->wall_time_ms, sizeof(uint64_t))) {
+    snprintf(tmp_path, tmp_len, "%s.XXXXXX", trace_path);
+    int fd = mkstemp(tmp_path);
+    bool success = fd >= 0;
+    if (!success) {
+        LOG_ERROR("trace_save: failed to create %s: %s", tmp_path, strerror(errno));
+    }
+
+    size_t written = 0;
+    while (success && written < size) {
+        ssize_t n = write(fd, image + written, size - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            LOG_ERROR("trace_save: failed to write %s: %s", tmp_path, strerror(errno));
+            success = false;
+            break;
+        }
+        written += (size_t)n;
+    }
+
+    if (fd >= 0) {
+        // mkstemp creates 0600; traces are as readable as other storage files
+        fchmod(fd, 0644);
+        if (close(fd) != 0) success = false;
+    }
+    if (success && rename(tmp_path, trace_path) != 0) {
+        LOG_ERROR("trace_save: failed to rename %s: %s", tmp_path, strerror(errno));
         success = false;
-        goto cleanup;
+    }
+    if (!success && fd >= 0) {
+        unlink(tmp_path);
     }
 
-    LOG_INFO("trace_save: saved trace with %zu dependencies to %s", t->dep_count, trace_path);
+    if (success) {
+        LOG_INFO("trace_save: saved trace with %zu dependencies to %s", t->dep_count, trace_path);
+    }
 
-cleanup:
-    fclose(f);
+    rebuild_free(image);
+    rebuild_free(tmp_path);
     rebuild_free(trace_path);
     return success;
 }
@@ -280,64 +636,19 @@ static bool read_all(FILE* f, void* data, size_t size) {
     return true;
 }
 
-// Load trace from disk
-Trace* trace_load(const Hash* request_key, Storage* storage) {
-    if (request_key == NULL || storage == NULL) {
-        LOG_ERROR("trace_load: invalid arguments");
-        return NULL;
-    }
-
-    // Get the trace file path
-    char* trace_path = storage_get_trace_path(storage, request_key);
-    if (trace_path == NULL) {
-        LOG_ERROR("trace_load: failed to get trace path");
-        return NULL;
-    }
-
-    // Check if trace exists
-    if (!storage_trace_exists(storage, request_key)) {
-        LOG_DEBUG("trace_load: trace does not exist");
-        rebuild_free(trace_path);
-        return NULL;
-    }
-
-    // Open file for reading
-    FILE* f = fopen(trace_path, "rb");
-    if (f == NULL) {
-        LOG_ERROR("trace_load: failed to open file: %s", trace_path);
-        rebuild_free(trace_path);
-        return NULL;
-    }
-
+// Read a version 1-3 trace, stored field by field in host byte order
+// f is positioned just past the version
+static Trace* trace_load_legacy(FILE* f, uint32_t version, const Hash* request_key) {
     Trace* t = NULL;
     bool success = true;
 
-    // Read and verify magic bytes
-    char magic[4];
-    if (!read_all(f, magic, 4) || memcmp(magic, TRACE_MAGIC, 4) != 0) {
-        LOG_ERROR("trace_load: invalid magic bytes");
-        success = false;
-        goto cleanup;
-    }
-
-    // Read and verify version
-    uint32_t version;
-    if (!read_all(f, &version, sizeof(uint32_t))) {
-        success = false;
-        goto cleanup;
-    }
-    if (version != TRACE_VERSION) {
-        LOG_ERROR("trace_load: unsupported version %u", version);
-        success = false;
-        goto cleanup;
-    }
-
     // Create trace
     t = trace_create(request_key);
     if (t == NULL) {
         success = false;
         goto cleanup;
     }
+    t->hash_scheme = HASH_SCHEME_BLAKE2B;
 
     // Read request key (verify it matches)
     Hash stored_key;
@@ -395,8 +706,16 @@ Trace* trace_load(const Hash* request_key, Storage* storage) {
             goto cleanup;
         }
 
+        // Read stat signature (version 3)
+        StatSignature sig = {0};
+        if (version >= 3 && !read_all(f, &sig, sizeof(StatSignature))) {
+            rebuild_free(path);
+            success = false;
+            goto cleanup;
+        }
+
         // Add dependency
-        if (!trace_add_dependency(t, path, &hash)) {
+        if (!trace_add_dependency_stat(t, path, &hash, &sig)) {
             rebuild_free(path);
             success = false;
             goto cleanup;
@@ -423,16 +742,210 @@ Trace* trace_load(const Hash* request_key, Storage* storage) {
         goto cleanup;
     }
 
-    LOG_INFO("trace_load: loaded trace with %zu dependencies from %s", t->dep_count, trace_path);
+    // Read peak RSS (version 2)
+    if (version >= 2 && !read_all(f, &t->peak_rss_kb, sizeof(uint64_t))) {
+        success = false;
+        goto cleanup;
+    }
 
-cleanup:
-    fclose(f);
-    rebuild_free(trace_path);
+    // Read signature time (version 3)
+    if (version >= 3 && !read_all(f, &t->recorded_ns, sizeof(uint64_t))) {
+        success = false;
+        goto cleanup;
+    }
 
+cleanup:
     if (!success && t != NULL) {
         trace_free(t);
         return NULL;
     }
+    return t;
+}
+
+// Map a version 4 trace and use its arrays in place
+static Trace* trace_load_mapped(int fd, const Hash* request_key, const char* trace_path) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < TRACE_HEADER_SIZE) {
+        LOG_ERROR("trace_load: truncated trace: %s", trace_path);
+        return NULL;
+    }
 
+    size_t size = (size_t)st.st_size;
+    uint8_t* map = (uint8_t*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        LOG_ERROR("trace_load: failed to map %s: %s", trace_path, strerror(errno));
+        return NULL;
+    }
+
+    Hash stored_key;
+    memcpy(stored_key.bytes, map + 8, 32);
+    if (!hash_equal(&stored_key, request_key)) {
+        LOG_ERROR("trace_load: request key mismatch");
+        munmap(map, size);
+        return NULL;
+    }
+
+    // Check the section sizes add up before touching any of them
+    uint64_t dep_count = get_le64(map + 72);
+    uint64_t strings_size = get_le64(map + 112);
+    const uint64_t per_dep = sizeof(Hash) + TRACE_SIGNATURE_SIZE + sizeof(uint64_t);
+    size_t body = size - TRACE_HEADER_SIZE;
+    if (dep_count > body / per_dep || strings_size > body ||
+        TRACE_HEADER_SIZE + dep_count * per_dep + sizeof(uint64_t) + strings_size != size) {
+        LOG_ERROR("trace_load: corrupt trace: %s", trace_path);
+        munmap(map, size);
+        return NULL;
+    }
+
+    uint8_t* hashes = map + TRACE_HEADER_SIZE;
+    uint8_t* stats = hashes + dep_count * sizeof(Hash);
+    uint8_t* offsets = stats + dep_count * TRACE_SIGNATURE_SIZE;
+    char* strings = (char*)(offsets + (dep_count + 1) * sizeof(uint64_t));
+
+    Trace* t = trace_create(request_key);
+    if (t == NULL) {
+        munmap(map, size);
+        return NULL;
+    }
+    t->map = map;
+    t->map_size = size;
+    memcpy(t->output_tree_hash.bytes, map + 40, 32);
+    t->cpu_time_ms = get_le64(map + 80);
+    t->wall_time_ms = get_le64(map + 88);
+    t->peak_rss_kb = get_le64(map + 96);
+    t->recorded_ns = get_le64(map + 104);
+    t->hash_scheme = (HashScheme)get_le64(map + 120);
+
+    if (dep_count == 0) {
+        return t;
+    }
+    t->dep_hashes = (Hash*)hashes;
+
+    // Paths are used in place; only the pointer array is allocated
+    t->dep_paths = (char**)rebuild_malloc(dep_count * sizeof(char*));
+    if (t->dep_paths == NULL) {
+        trace_free(t);
+        return NULL;
+    }
+    uint64_t start = get_le64(offsets);
+    for (uint64_t i = 0; i < dep_count; i++) {
+        uint64_t end = get_le64(offsets + (i + 1) * sizeof(uint64_t));
+        if ((i == 0 && start != 0) || end <= start || end > strings_size || strings[end - 1] != '\0') {
+            LOG_ERROR("trace_load: corrupt path table: %s", trace_path);
+            t->dep_count = 0;
+            trace_free(t);
+            return NULL;
+        }
+        t->dep_paths[i] = strings + start;
+        start = end;
+    }
+    t->dep_count = (size_t)dep_count;
+
+#if TRACE_HOST_LITTLE_ENDIAN
+    t->dep_stats = (StatSignature*)stats;
+#else
+    t->dep_stats = (StatSignature*)rebuild_malloc(dep_count * sizeof(StatSignature));
+    if (t->dep_stats == NULL) {
+        trace_free(t);
+        return NULL;
+    }
+    for (uint64_t i = 0; i < dep_count; i++) {
+        const uint8_t* p = stats + i * TRACE_SIGNATURE_SIZE;
+        t->dep_stats[i].size = get_le64(p);
+        t->dep_stats[i].mtime_ns = get_le64(p + 8);
+        t->dep_stats[i].ctime_ns = get_le64(p + 16);
+        t->dep_stats[i].ino = get_le64(p + 24);
+        t->dep_stats[i].dev = get_le64(p + 32);
+    }
+#endif
+
+    return t;
+}
+
+// Load trace from disk
+Trace* trace_load(const Hash* request_key, Storage* storage) {
+    if (request_key == NULL || storage == NULL) {
+        LOG_ERROR("trace_load: invalid arguments");
+        return NULL;
+    }
+
+    // With a pack, its in-memory index answers misses without touching disk
+    if (storage->trace_pack != NULL) {
+        return trace_pack_get(storage->trace_pack, request_key);
+    }
+
+    // Get the trace file path
+    char* trace_path = storage_get_trace_path(storage, request_key);
+    if (trace_path == NULL) {
+        LOG_ERROR("trace_load: failed to get trace path");
+        return NULL;
+    }
+
+    // Open the trace; a missing one is the common case, not an error
+    int fd = open(trace_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            LOG_DEBUG("trace_load: trace does not exist");
+        } else {
+            LOG_ERROR("trace_load: failed to open file: %s", trace_path);
+        }
+        rebuild_free(trace_path);
+        return NULL;
+    }
+
+    // Read and verify magic bytes and version
+    uint8_t preamble[8];
+    if (pread(fd, preamble, sizeof(preamble), 0) != (ssize_t)sizeof(preamble) ||
+        memcmp(preamble, TRACE_MAGIC, 4) != 0) {
+        LOG_ERROR("trace_load: invalid magic bytes");
+        close(fd);
+        rebuild_free(trace_path);
+        return NULL;
+    }
+
+    Trace* t = NULL;
+    uint32_t version = get_le32(preamble + 4);
+    if (version == TRACE_VERSION) {
+        t = trace_load_mapped(fd, request_key, trace_path);
+        close(fd);
+    } else if (version >= 1 && version < TRACE_VERSION) {
+        FILE* f = fdopen(fd, "rb");
+        if (f == NULL || fseek(f, sizeof(preamble), SEEK_SET) != 0) {
+            LOG_ERROR("trace_load: failed to read %s", trace_path);
+            if (f) fclose(f); else close(fd);
+        } else {
+            t = trace_load_legacy(f, version, request_key);
+            fclose(f);
+        }
+    } else {
+        LOG_ERROR("trace_load: unsupported version %u", version);
+        close(fd);
+    }
+
+    if (t) {
+        LOG_INFO("trace_load: loaded trace with %zu dependencies from %s", t->dep_count, trace_path);
+    }
+    rebuild_free(trace_path);
     return t;
 }
+
+// Load all variants of a trace
+size_t trace_load_variants(const Hash* request_key, Storage* storage, Trace** out, size_t max) {
+    if (request_key == NULL || storage == NULL || out == NULL || max == 0) {
+        LOG_ERROR("trace_load_variants: invalid arguments");
+        return 0;
+    }
+
+    if (storage->trace_pack != NULL) {
+        return trace_pack_get_variants(storage->trace_pack, request_key, out, max);
+    }
+
+    out[0] = trace_load(request_key, storage);
+    return out[0] != NULL ? 1 : 0;
+}
+
+void trace_touch(const Trace* t, Storage* storage) {
+    if (t != NULL && storage != NULL && storage->trace_pack != NULL) {
+        trace_pack_touch(storage->trace_pack, t);
+    }
+}
@@ -3,20 +3,49 @@
 
 #include "common.h"
 #include "storage.h"
+#include "hash.h"
+#include "pool.h"
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+// Stat signature of a dependency, compared before rehashing it (like git's index)
+// For a directory, size is a digest of the stat identities of every entry
+// beneath it (hash_tree_signature) and both times are the newest of the
+// whole tree, so any change below it shows up
+// All zero means unknown: the dependency is always rehashed
+typedef struct StatSignature {
+    uint64_t size;             // File size (directory: digest of the tree's signature)
+    uint64_t mtime_ns;         // Modification time
+    uint64_t ctime_ns;         // Inode change time (can not be set back by users)
+    uint64_t ino;              // Inode number
+    uint64_t dev;              // Device
+} StatSignature;
+
+// Dependencies on other targets are recorded under this prefix with the
+// target's output tree hash (a file path can not be checked for them)
+#define TRACE_TARGET_PREFIX "target:"
+
 // Trace represents a constructive cache entry for a build target
 // It records dependencies, their hashes, and the output tree hash
+// A loaded trace uses its file in place: the arrays point into a read-only
+// mapping until the first trace_add_dependency copies them out
 typedef struct Trace {
     Hash request_key;          // Cache key for this trace
     size_t dep_count;          // Number of dependencies
     char** dep_paths;          // Dependency file paths
     Hash* dep_hashes;          // Content hashes of dependencies
+    StatSignature* dep_stats;  // Stat signatures taken before hashing
     Hash output_tree_hash;     // Hash of output directory tree
-    uint64_t cpu_time_ms;      // CPU time taken
+    uint64_t cpu_time_ms;      // CPU time taken (user + sys, recipe and its processes)
     uint64_t wall_time_ms;     // Wall clock time taken
+    uint64_t peak_rss_kb;      // Largest resident set of any process it ran (0 if unknown)
+    uint64_t recorded_ns;      // When the signatures were taken (realtime, ns)
+    HashScheme hash_scheme;    // How dep_hashes of files were taken
+    size_t dep_capacity;       // Allocated array slots (0 while mapped)
+    void* map;                 // Trace file the arrays point into, or NULL
+    size_t map_size;           // Length of map
+    bool shared_paths;         // dep_paths strings belong to a TracePack
 } Trace;
 
 // Allocate a new trace with the given request key
@@ -31,16 +60,65 @@ void trace_free(Trace* t);
 // Returns true on success, false on allocation failure
 bool trace_add_dependency(Trace* t, const char* path, const Hash* hash);
 
-// Check if all dependencies still match their recorded hashes (early cutoff)
+// Add a dependency along with the stat signature taken before hashing it
+// sig may be NULL (unknown); set t->recorded_ns before taking signatures
+// Returns true on success, false on allocation failure
+bool trace_add_dependency_stat(Trace* t, const char* path, const Hash* hash,
+                               const StatSignature* sig);
+
+// Add a dependency on another target, recorded with that target's
+// output tree hash. trace_validate skips these: only whoever builds the
+// target can tell whether its output is still the same (early cutoff)
+// Returns true on success, false on allocation failure
+bool trace_add_target_dependency(Trace* t, const char* target_name, const Hash* output_hash);
+
+// Target name of dependency i, or NULL if it is a file or directory
+const char* trace_dependency_target(const Trace* t, size_t i);
+
+// Take the stat signature of a file or directory tree
+// Directories are walked with lstat only; nothing is read
+// Returns false if path can not be stat'ed
+bool stat_signature_get(const char* path, StatSignature* out);
+
+// Check if all file and directory dependencies still match their recorded
+// hashes (early cutoff); target dependencies are left to the caller
+// Files are rehashed with the trace's hash_scheme
+// A dependency whose stat signature is unchanged is trusted without being
+// rehashed, unless it changed too close to recorded_ns to be sure (racy)
 // Returns true if all dependencies are valid, false if any have changed or are missing
 bool trace_validate(const Trace* t);
 
+// Like trace_validate, but checks dependencies concurrently on pool
+// (NULL runs them one by one). All stat signatures are checked before any
+// dependency is rehashed, and changed files are prefetched meanwhile. The
+// first missing or changed dependency stops the rest: no further
+// dependency is started, a changed file still being read is dropped, and a
+// directory already started skips its rehash.
+bool trace_validate_parallel(const Trace* t, WorkPool* pool);
+
 // Save trace to disk in binary format
+// With a trace pack attached to storage, the trace is appended to the pack
+// Writes the little-endian version 4 layout (header, hash array, signature
+// array, path offset table, string blob) and atomically replaces any old trace
 // Returns true on success, false on I/O error
 bool trace_save(const Trace* t, Storage* storage);
 
 // Load trace from disk
+// With a trace pack attached to storage, only the pack is consulted.
+// Version 4 traces are mapped with one mmap and used in place. Older ones are
+// read field by field: version 1 loads with peak_rss_kb = 0, and versions
+// before 3 have no stat signatures (so every dependency is rehashed once)
 // Returns NULL if trace doesn't exist or on I/O error
 Trace* trace_load(const Hash* request_key, Storage* storage);
 
+// Load every recorded variant of a trace, newest first
+// A trace pack keeps several per request key (one per set of dependency
+// hashes); a trace file holds just one
+// Stores at most max traces in out and returns how many
+size_t trace_load_variants(const Hash* request_key, Storage* storage, Trace** out, size_t max);
+
+// Note that a loaded trace gave a cache hit, for the garbage collector
+// Only traces in a trace pack keep this; for a trace file it does nothing
+void trace_touch(const Trace* t, Storage* storage);
+
 #endif // REBUILD_TRACE_H
@@ -0,0 +1,1106 @@
+#define _GNU_SOURCE
+#include "trace_pack.h"
+#include "hash.h"
+#include "map.h"
+#include "buffer.h"
+#include <uv.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PACK_MAGIC "RBTP"
+#define PACK_VERSION 1
+#define PACK_HEADER_SIZE 8
+#define PACK_LOCK_FILE "lock"
+#define PACK_COMPACT_LOCK_FILE "compact.lock"
+
+// Record types
+#define RECORD_STRING 1            // Payload: path bytes (id = ordinal in segment)
+#define RECORD_TRACE 2             // Payload: see encode_trace
+#define RECORD_ACCESS 3            // Payload: access entries, see trace_pack_touch
+
+#define RECORD_OVERHEAD 16         // u32 type, u32 length, u64 checksum
+#define TRACE_FIXED_SIZE 104       // Key, output hash, four u64 metrics, dep_count
+#define TRACE_DEP_SIZE 76          // u32 string id, hash, five u64 signature fields
+#define TRACE_SCHEME_SIZE 8        // u64 hash scheme after the deps (absent: BLAKE2b)
+#define ACCESS_ENTRY_SIZE 48       // Key, u64 inputs fingerprint, u64 time of use
+#define ACCESS_RECORD_ENTRIES 1024 // Most entries per access record
+
+#define ARENA_CHUNK_SIZE (64u << 10)
+
+// Strings live in chunks that never move, so traces can point into them
+typedef struct StringArena {
+    char** chunks;
+    size_t chunk_count;
+    size_t chunk_capacity;
+    size_t used;                   // Bytes used in the last chunk
+    size_t last_size;              // Size of the last chunk
+} StringArena;
+
+typedef struct PackSegment {
+    uint32_t number;               // File name: %08u.seg
+    int fd;
+    uint8_t* map;                  // Read-only view of [0, map_size)
+    size_t map_size;
+    uint64_t end;                  // End of the last valid record
+    const char** strings;          // String table, by id
+    uint32_t string_count;
+    uint32_t string_capacity;
+} PackSegment;
+
+typedef struct PackRecordRef {
+    uint32_t segment;              // Index into pack->segments
+    uint64_t offset;               // Record offset within the segment
+    uint64_t inputs;               // Fingerprint of the trace's dependency hashes
+    uint64_t used_ns;              // Recorded or last gave a cache hit (wall clock)
+} PackRecordRef;
+
+typedef struct PackIndexEntry {
+    Hash key;
+    bool used;
+    uint8_t older_count;           // Variants in older
+    PackRecordRef newest;          // Most recently appended variant
+    PackRecordRef* older;          // Earlier variants, newest first (NULL until needed)
+} PackIndexEntry;
+
+struct TracePack {
+    char* dir;
+    int lock_fd;                   // flock: shared to read the directory, exclusive to append
+    uv_rwlock_t lock;              // In-process: readers look up, writers append
+    uv_mutex_t touch_lock;         // Guards touches and used_ns while the lock is read-held
+    Buffer* touches;               // Access entries not appended yet
+    PackSegment* segments;         // Ordered by number; the last one is active
+    size_t segment_count;
+    size_t segment_capacity;
+    PackIndexEntry* index;
+    size_t index_capacity;         // Power of two
+    size_t index_count;
+    StringArena arena;
+    Map* active_strings;           // Path -> id + 1 in the active segment
+    uv_thread_t compactor;
+    bool compacting;
+};
+
+// ============================================================================
+// Encoding helpers
+// ============================================================================
+
+static void put_le32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void put_le64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t get_le32(const uint8_t* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) v |= (uint32_t)p[i] << (8 * i);
+    return v;
+}
+
+static uint64_t get_le64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+
+static uint64_t fnv1a(uint64_t h, const uint8_t* p, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// FNV-1a over a record's type, length and payload
+static uint64_t record_checksum(const uint8_t* record, size_t len) {
+    return fnv1a(FNV_OFFSET, record, len);
+}
+
+// Traces of one key with the same dependency hashes are the same variant
+static uint64_t inputs_fingerprint(const uint8_t* payload, uint64_t deps) {
+    uint64_t h = FNV_OFFSET;
+    for (uint64_t i = 0; i < deps; i++) {
+        h = fnv1a(h, payload + TRACE_FIXED_SIZE + i * TRACE_DEP_SIZE + 4, 32);
+    }
+    return h;
+}
+
+// The same fingerprint for a trace in memory
+static uint64_t trace_fingerprint(const Trace* t) {
+    uint64_t h = FNV_OFFSET;
+    for (size_t i = 0; i < t->dep_count; i++) {
+        h = fnv1a(h, t->dep_hashes[i].bytes, 32);
+    }
+    return h;
+}
+
+// Append a complete record (header, payload, checksum) to buf
+static bool append_record(Buffer* buf, uint32_t type, const uint8_t* payload, uint32_t len) {
+    size_t start = buffer_size(buf);
+    uint8_t header[8];
+    put_le32(header, type);
+    put_le32(header + 4, len);
+    if (buffer_append(buf, header, sizeof(header)) != REBUILD_OK ||
+        (len > 0 && buffer_append(buf, payload, len) != REBUILD_OK)) {
+        return false;
+    }
+    uint8_t check[8];
+    put_le64(check, record_checksum((const uint8_t*)buf->data + start, 8 + (size_t)len));
+    return buffer_append(buf, check, sizeof(check)) == REBUILD_OK;
+}
+
+// Add an access entry: variant (key, inputs) gave a cache hit at used_ns
+static bool add_access_entry(Buffer* entries, const Hash* key, uint64_t inputs, uint64_t used_ns) {
+    uint8_t entry[ACCESS_ENTRY_SIZE];
+    memcpy(entry, key->bytes, 32);
+    put_le64(entry + 32, inputs);
+    put_le64(entry + 40, used_ns);
+    return buffer_append(entries, entry, sizeof(entry)) == REBUILD_OK;
+}
+
+// Append access entries to buf as records of up to ACCESS_RECORD_ENTRIES
+static bool append_access_records(Buffer* buf, const Buffer* entries) {
+    const uint8_t* data = (const uint8_t*)buffer_data(entries);
+    size_t size = buffer_size(entries);
+    for (size_t off = 0; off < size; off += ACCESS_RECORD_ENTRIES * ACCESS_ENTRY_SIZE) {
+        size_t len = size - off;
+        if (len > ACCESS_RECORD_ENTRIES * ACCESS_ENTRY_SIZE) len = ACCESS_RECORD_ENTRIES * ACCESS_ENTRY_SIZE;
+        if (!append_record(buf, RECORD_ACCESS, data + off, (uint32_t)len)) return false;
+    }
+    return true;
+}
+
+// Build a trace record payload; ids[i] is the string id of dep_paths[i]
+static uint8_t* encode_trace(const Trace* t, const uint32_t* ids, uint32_t* out_len) {
+    size_t len = TRACE_FIXED_SIZE + t->dep_count * TRACE_DEP_SIZE + TRACE_SCHEME_SIZE;
+    if (len > UINT32_MAX) return NULL;
+    uint8_t* payload = (uint8_t*)rebuild_malloc(len);
+    if (!payload) return NULL;
+
+    uint8_t* p = payload;
+    memcpy(p, t->request_key.bytes, 32);
+    memcpy(p + 32, t->output_tree_hash.bytes, 32);
+    put_le64(p + 64, t->cpu_time_ms);
+    put_le64(p + 72, t->wall_time_ms);
+    put_le64(p + 80, t->peak_rss_kb);
+    put_le64(p + 88, t->recorded_ns);
+    put_le64(p + 96, t->dep_count);
+    p += TRACE_FIXED_SIZE;
+
+    for (size_t i = 0; i < t->dep_count; i++, p += TRACE_DEP_SIZE) {
+        const StatSignature* sig = &t->dep_stats[i];
+        put_le32(p, ids[i]);
+        memcpy(p + 4, t->dep_hashes[i].bytes, 32);
+        put_le64(p + 36, sig->size);
+        put_le64(p + 44, sig->mtime_ns);
+        put_le64(p + 52, sig->ctime_ns);
+        put_le64(p + 60, sig->ino);
+        put_le64(p + 68, sig->dev);
+    }
+    put_le64(p, (uint64_t)t->hash_scheme);
+
+    *out_len = (uint32_t)len;
+    return payload;
+}
+
+// ============================================================================
+// String arena and index
+// ============================================================================
+
+static const char* arena_add(StringArena* arena, const uint8_t* bytes, size_t len) {
+    if (arena->chunk_count == 0 || arena->used + len + 1 > arena->last_size) {
+        if (arena->chunk_count == arena->chunk_capacity) {
+            size_t capacity = arena->chunk_capacity ? arena->chunk_capacity * 2 : 16;
+            char** chunks = (char**)rebuild_realloc(arena->chunks, capacity * sizeof(char*));
+            if (!chunks) return NULL;
+            arena->chunks = chunks;
+            arena->chunk_capacity = capacity;
+        }
+        size_t size = len + 1 > ARENA_CHUNK_SIZE ? len + 1 : ARENA_CHUNK_SIZE;
+        char* chunk = (char*)rebuild_malloc(size);
+        if (!chunk) return NULL;
+        arena->chunks[arena->chunk_count++] = chunk;
+        arena->used = 0;
+        arena->last_size = size;
+    }
+
+    char* s = arena->chunks[arena->chunk_count - 1] + arena->used;
+    memcpy(s, bytes, len);
+    s[len] = '\0';
+    arena->used += len + 1;
+    return s;
+}
+
+static void arena_free(StringArena* arena) {
+    for (size_t i = 0; i < arena->chunk_count; i++) {
+        rebuild_free(arena->chunks[i]);
+    }
+    rebuild_free(arena->chunks);
+    memset(arena, 0, sizeof(*arena));
+}
+
+static size_t index_slot(const TracePack* pack, const Hash* key) {
+    uint64_t h;
+    memcpy(&h, key->bytes, sizeof(h));  // Request keys are already uniform
+    return (size_t)h & (pack->index_capacity - 1);
+}
+
+static PackIndexEntry* index_find(const TracePack* pack, const Hash* key) {
+    if (pack->index_capacity == 0) return NULL;
+    for (size_t i = index_slot(pack, key);; i = (i + 1) & (pack->index_capacity - 1)) {
+        PackIndexEntry* e = &pack->index[i];
+        if (!e->used) return NULL;
+        if (hash_equal(&e->key, key)) return e;
+    }
+}
+
+static bool index_grow(TracePack* pack) {
+    size_t capacity = pack->index_capacity ? pack->index_capacity * 2 : 1024;
+    PackIndexEntry* entries = (PackIndexEntry*)rebuild_calloc(capacity, sizeof(PackIndexEntry));
+    if (!entries) return false;
+
+    PackIndexEntry* old = pack->index;
+    size_t old_capacity = pack->index_capacity;
+    pack->index = entries;
+    pack->index_capacity = capacity;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (!old[i].used) continue;
+        size_t j = index_slot(pack, &old[i].key);
+        while (entries[j].used) j = (j + 1) & (capacity - 1);
+        entries[j] = old[i];
+    }
+    rebuild_free(old);
+    return true;
+}
+
+// Add a record as the newest variant of key
+// It replaces an earlier variant with the same inputs; beyond
+// TRACE_PACK_VARIANTS the oldest variant is dropped
+static bool index_put(TracePack* pack, const Hash* key, const PackRecordRef* ref) {
+    PackIndexEntry* e = index_find(pack, key);
+    if (!e) {
+        if ((pack->index_count + 1) * 4 > pack->index_capacity * 3 && !index_grow(pack)) {
+            return false;
+        }
+        size_t i = index_slot(pack, key);
+        while (pack->index[i].used) i = (i + 1) & (pack->index_capacity - 1);
+        e = &pack->index[i];
+        e->key = *key;
+        e->used = true;
+        e->newest = *ref;
+        pack->index_count++;
+        return true;
+    }
+
+    PackRecordRef kept[TRACE_PACK_VARIANTS];
+    size_t n = 0;
+    kept[n++] = *ref;
+    if (e->newest.inputs != ref->inputs) kept[n++] = e->newest;
+    for (size_t i = 0; i < e->older_count && n < TRACE_PACK_VARIANTS; i++) {
+        if (e->older[i].inputs != ref->inputs) kept[n++] = e->older[i];
+    }
+
+    if (n > 1 && !e->older) {
+        e->older = (PackRecordRef*)rebuild_malloc((TRACE_PACK_VARIANTS - 1) * sizeof(PackRecordRef));
+        if (!e->older) n = 1;  // Keep just the newest
+    }
+    e->newest = kept[0];
+    if (n > 1) memcpy(e->older, kept + 1, (n - 1) * sizeof(PackRecordRef));
+    e->older_count = (uint8_t)(n - 1);
+    return true;
+}
+
+// The variant of key recorded with the given inputs, or NULL
+static PackRecordRef* index_find_variant(const TracePack* pack, const Hash* key, uint64_t inputs) {
+    PackIndexEntry* e = index_find(pack, key);
+    if (!e) return NULL;
+    if (e->newest.inputs == inputs) return &e->newest;
+    for (size_t i = 0; i < e->older_count; i++) {
+        if (e->older[i].inputs == inputs) return &e->older[i];
+    }
+    return NULL;
+}
+
+static void index_free(PackIndexEntry* index, size_t capacity) {
+    for (size_t i = 0; i < capacity; i++) {
+        rebuild_free(index[i].older);
+    }
+    rebuild_free(index);
+}
+
+// ============================================================================
+// Segments
+// ============================================================================
+
+static char* segment_path(const char* dir, uint32_t number) {
+    size_t len = strlen(dir) + 32;
+    char* path = (char*)rebuild_malloc(len);
+    if (path) snprintf(path, len, "%s/%08u.seg", dir, number);
+    return path;
+}
+
+static bool parse_segment_name(const char* name, uint32_t* number) {
+    char* end;
+    unsigned long n = strtoul(name, &end, 10);
+    if (end == name || strcmp(end, ".seg") != 0 || n == 0 || n > UINT32_MAX) return false;
+    *number = (uint32_t)n;
+    return true;
+}
+
+static int compare_u32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Segment numbers in dir, ascending (caller frees)
+static uint32_t* list_segments(const char* dir, size_t* count) {
+    *count = 0;
+    DIR* d = opendir(dir);
+    if (!d) return NULL;
+
+    uint32_t* numbers = NULL;
+    size_t capacity = 0;
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL) {
+        uint32_t number;
+        if (!parse_segment_name(entry->d_name, &number)) continue;
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 8;
+            uint32_t* grown = (uint32_t*)rebuild_realloc(numbers, capacity * sizeof(uint32_t));
+            if (!grown) break;
+            numbers = grown;
+        }
+        numbers[(*count)++] = number;
+    }
+    closedir(d);
+
+    if (*count > 1) qsort(numbers, *count, sizeof(uint32_t), compare_u32);
+    return numbers;
+}
+
+// Map the segment's file as it is now
+static bool segment_remap(PackSegment* seg) {
+    struct stat st;
+    if (fstat(seg->fd, &st) != 0) return false;
+    size_t size = (size_t)st.st_size;
+    if (size == seg->map_size) return true;
+
+    if (seg->map) {
+        munmap(seg->map, seg->map_size);
+        seg->map = NULL;
+        seg->map_size = 0;
+    }
+    if (size == 0) return true;
+
+    void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, seg->fd, 0);
+    if (map == MAP_FAILED) return false;
+    seg->map = (uint8_t*)map;
+    seg->map_size = size;
+    return true;
+}
+
+static bool segment_add_string(TracePack* pack, PackSegment* seg, const uint8_t* bytes, uint32_t len,
+                               bool active) {
+    if (seg->string_count == seg->string_capacity) {
+        uint32_t capacity = seg->string_capacity ? seg->string_capacity * 2 : 64;
+        const char** strings = (const char**)rebuild_realloc((void*)seg->strings, capacity * sizeof(char*));
+        if (!strings) return false;
+        seg->strings = strings;
+        seg->string_capacity = capacity;
+    }
+    const char* s = arena_add(&pack->arena, bytes, len);
+    if (!s) return false;
+    if (active && pack->active_strings) {
+        map_set(pack->active_strings, s, (void*)(uintptr_t)(seg->string_count + 1));
+    }
+    seg->strings[seg->string_count++] = s;
+    return true;
+}
+
+// Read records from seg->end to the end of the mapping
+// Stops at the first incomplete or corrupt record
+static void segment_scan(TracePack* pack, uint32_t seg_index, bool active) {
+    PackSegment* seg = &pack->segments[seg_index];
+    if (seg->end == 0) {
+        if (seg->map_size < PACK_HEADER_SIZE || memcmp(seg->map, PACK_MAGIC, 4) != 0 ||
+            get_le32(seg->map + 4) != PACK_VERSION) {
+            LOG_WARN("Ignoring trace pack segment %08u: bad header", seg->number);
+            return;
+        }
+        seg->end = PACK_HEADER_SIZE;
+    }
+
+    uint64_t pos = seg->end;
+    while (pos + RECORD_OVERHEAD <= seg->map_size) {
+        const uint8_t* record = seg->map + pos;
+        uint32_t type = get_le32(record);
+        uint32_t len = get_le32(record + 4);
+        if (len > seg->map_size - pos - RECORD_OVERHEAD ||
+            get_le64(record + 8 + len) != record_checksum(record, 8 + (size_t)len)) {
+            break;
+        }
+        const uint8_t* payload = record + 8;
+
+        if (type == RECORD_STRING) {
+            if (!segment_add_string(pack, seg, payload, len, active)) break;
+        } else if (type == RECORD_TRACE) {
+            uint64_t deps = len >= TRACE_FIXED_SIZE ? get_le64(payload + 96) : UINT64_MAX;
+            if (deps > (len - TRACE_FIXED_SIZE) / TRACE_DEP_SIZE ||
+                (TRACE_FIXED_SIZE + deps * TRACE_DEP_SIZE != len &&
+                 TRACE_FIXED_SIZE + deps * TRACE_DEP_SIZE + TRACE_SCHEME_SIZE != len)) {
+                break;
+            }
+            bool ids_ok = true;
+            for (uint64_t i = 0; i < deps && ids_ok; i++) {
+                ids_ok = get_le32(payload + TRACE_FIXED_SIZE + i * TRACE_DEP_SIZE) < seg->string_count;
+            }
+            Hash key;
+            memcpy(key.bytes, payload, 32);
+            PackRecordRef ref = { seg_index, pos, inputs_fingerprint(payload, deps), get_le64(payload + 88) };
+            if (!ids_ok || !index_put(pack, &key, &ref)) break;
+        } else if (type == RECORD_ACCESS) {
+            if (len % ACCESS_ENTRY_SIZE != 0) break;
+            for (uint32_t i = 0; i < len; i += ACCESS_ENTRY_SIZE) {
+                Hash key;
+                memcpy(key.bytes, payload + i, 32);
+                PackRecordRef* ref = index_find_variant(pack, &key, get_le64(payload + i + 32));
+                uint64_t used_ns = get_le64(payload + i + 40);
+                if (ref && used_ns > ref->used_ns) ref->used_ns = used_ns;
+            }
+        }
+        // Unknown types are skipped, so later versions can add records
+
+        pos += RECORD_OVERHEAD + len;
+    }
+    seg->end = pos;
+}
+
+// Open segment number and index its records
+static bool pack_add_segment(TracePack* pack, uint32_t number, bool create) {
+    if (pack->segment_count == pack->segment_capacity) {
+        size_t capacity = pack->segment_capacity ? pack->segment_capacity * 2 : 8;
+        PackSegment* segments = (PackSegment*)rebuild_realloc(pack->segments, capacity * sizeof(PackSegment));
+        if (!segments) return false;
+        pack->segments = segments;
+        pack->segment_capacity = capacity;
+    }
+
+    char* path = segment_path(pack->dir, number);
+    if (!path) return false;
+    int fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0), 0644);
+    if (fd < 0) {
+        LOG_ERROR("Failed to open trace pack segment %s: %s", path, strerror(errno));
+        rebuild_free(path);
+        return false;
+    }
+    if (create) {
+        uint8_t header[PACK_HEADER_SIZE];
+        memcpy(header, PACK_MAGIC, 4);
+        put_le32(header + 4, PACK_VERSION);
+        if (pwrite(fd, header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+            LOG_ERROR("Failed to write trace pack segment %s: %s", path, strerror(errno));
+            close(fd);
+            unlink(path);
+            rebuild_free(path);
+            return false;
+        }
+    }
+    rebuild_free(path);
+
+    // The previous active segment is sealed; only the new one dedupes strings
+    if (pack->active_strings) {
+        map_clear(pack->active_strings, NULL);
+    }
+
+    PackSegment* seg = &pack->segments[pack->segment_count];
+    memset(seg, 0, sizeof(*seg));
+    seg->number = number;
+    seg->fd = fd;
+    pack->segment_count++;
+
+    if (!segment_remap(seg)) {
+        LOG_ERROR("Failed to map trace pack segment %08u", number);
+        return false;
+    }
+    segment_scan(pack, (uint32_t)(pack->segment_count - 1), true);
+    return true;
+}
+
+// Pick up segments and records other processes added (pack lock held)
+static bool pack_refresh(TracePack* pack) {
+    size_t count;
+    uint32_t* numbers = list_segments(pack->dir, &count);
+    uint32_t last = pack->segment_count ? pack->segments[pack->segment_count - 1].number : 0;
+
+    if (pack->segment_count > 0) {
+        PackSegment* active = &pack->segments[pack->segment_count - 1];
+        if (segment_remap(active)) {
+            segment_scan(pack, (uint32_t)(pack->segment_count - 1), true);
+        }
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < count && ok; i++) {
+        if (numbers[i] > last) {
+            ok = pack_add_segment(pack, numbers[i], false);
+        }
+    }
+    rebuild_free(numbers);
+    return ok;
+}
+
+// ============================================================================
+// Public API
+// ============================================================================
+
+static void compact_thread(void* arg) {
+    TracePack* pack = (TracePack*)arg;
+    trace_pack_compact(pack->dir);
+}
+
+TracePack* trace_pack_open(const char* dir) {
+    if (!dir) return NULL;
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        LOG_ERROR("Failed to create trace pack directory %s: %s", dir, strerror(errno));
+        return NULL;
+    }
+
+    TracePack* pack = (TracePack*)rebuild_calloc(1, sizeof(TracePack));
+    if (!pack) return NULL;
+    pack->dir = rebuild_strdup(dir);
+    pack->active_strings = map_create(256);
+    pack->touches = buffer_create(0);
+    pack->lock_fd = -1;
+    if (!pack->dir || !pack->active_strings || !pack->touches || uv_rwlock_init(&pack->lock) != 0) {
+        map_free(pack->active_strings, NULL);
+        buffer_free(pack->touches);
+        rebuild_free(pack->dir);
+        rebuild_free(pack);
+        return NULL;
+    }
+    if (uv_mutex_init(&pack->touch_lock) != 0) {
+        uv_rwlock_destroy(&pack->lock);
+        map_free(pack->active_strings, NULL);
+        buffer_free(pack->touches);
+        rebuild_free(pack->dir);
+        rebuild_free(pack);
+        return NULL;
+    }
+
+    char lock_path[4096];
+    snprintf(lock_path, sizeof(lock_path), "%s/%s", dir, PACK_LOCK_FILE);
+    pack->lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (pack->lock_fd < 0 || flock(pack->lock_fd, LOCK_SH) != 0) {
+        LOG_ERROR("Failed to lock trace pack %s: %s", dir, strerror(errno));
+        trace_pack_close(pack);
+        return NULL;
+    }
+    bool ok = pack_refresh(pack);
+    flock(pack->lock_fd, LOCK_UN);
+    if (!ok) {
+        trace_pack_close(pack);
+        return NULL;
+    }
+
+    LOG_DEBUG("Trace pack %s: %zu traces in %zu segments", dir, pack->index_count, pack->segment_count);
+
+    // Merge sealed segments while the build runs
+    if (pack->segment_count > TRACE_PACK_COMPACT_SEGMENTS &&
+        uv_thread_create(&pack->compactor, compact_thread, pack) == 0) {
+        pack->compacting = true;
+    }
+    return pack;
+}
+
+static bool pack_append(TracePack* pack, const Trace* t);
+
+void trace_pack_close(TracePack* pack) {
+    if (!pack) return;
+
+    // Keep this run's cache hits for the garbage collector
+    if (buffer_size(pack->touches) > 0 && pack->lock_fd >= 0) {
+        uv_rwlock_wrlock(&pack->lock);
+        pack_append(pack, NULL);
+        uv_rwlock_wrunlock(&pack->lock);
+    }
+
+    if (pack->compacting) {
+        uv_thread_join(&pack->compactor);
+    }
+
+    for (size_t i = 0; i < pack->segment_count; i++) {
+        PackSegment* seg = &pack->segments[i];
+        if (seg->map) munmap(seg->map, seg->map_size);
+        close(seg->fd);
+        rebuild_free((void*)seg->strings);
+    }
+    rebuild_free(pack->segments);
+    index_free(pack->index, pack->index_capacity);
+    arena_free(&pack->arena);
+    map_free(pack->active_strings, NULL);
+    buffer_free(pack->touches);
+    if (pack->lock_fd >= 0) close(pack->lock_fd);
+    uv_mutex_destroy(&pack->touch_lock);
+    uv_rwlock_destroy(&pack->lock);
+    rebuild_free(pack->dir);
+    rebuild_free(pack);
+}
+
+// Build a Trace from a record (pack lock held for reading)
+static Trace* decode_trace(const TracePack* pack, const PackRecordRef* ref) {
+    const PackSegment* seg = &pack->segments[ref->segment];
+    const uint8_t* payload = seg->map + ref->offset + 8;
+    uint32_t len = get_le32(seg->map + ref->offset + 4);
+    size_t deps = (size_t)get_le64(payload + 96);
+    size_t scheme_at = TRACE_FIXED_SIZE + deps * TRACE_DEP_SIZE;
+
+    Hash key;
+    memcpy(key.bytes, payload, 32);
+    Trace* t = trace_create(&key);
+    if (!t) return NULL;
+    memcpy(t->output_tree_hash.bytes, payload + 32, 32);
+    t->cpu_time_ms = get_le64(payload + 64);
+    t->wall_time_ms = get_le64(payload + 72);
+    t->peak_rss_kb = get_le64(payload + 80);
+    t->recorded_ns = get_le64(payload + 88);
+    t->hash_scheme = len > scheme_at ? (HashScheme)get_le64(payload + scheme_at) : HASH_SCHEME_BLAKE2B;
+    if (deps == 0) return t;
+
+    t->dep_paths = (char**)rebuild_malloc(deps * sizeof(char*));
+    t->dep_hashes = (Hash*)rebuild_malloc(deps * sizeof(Hash));
+    t->dep_stats = (StatSignature*)rebuild_malloc(deps * sizeof(StatSignature));
+    t->shared_paths = true;
+    if (!t->dep_paths || !t->dep_hashes || !t->dep_stats) {
+        trace_free(t);
+        return NULL;
+    }
+
+    const uint8_t* p = payload + TRACE_FIXED_SIZE;
+    for (size_t i = 0; i < deps; i++, p += TRACE_DEP_SIZE) {
+        t->dep_paths[i] = (char*)seg->strings[get_le32(p)];
+        memcpy(t->dep_hashes[i].bytes, p + 4, 32);
+        t->dep_stats[i].size = get_le64(p + 36);
+        t->dep_stats[i].mtime_ns = get_le64(p + 44);
+        t->dep_stats[i].ctime_ns = get_le64(p + 52);
+        t->dep_stats[i].ino = get_le64(p + 60);
+        t->dep_stats[i].dev = get_le64(p + 68);
+    }
+    t->dep_count = deps;
+    t->dep_capacity = deps;
+    return t;
+}
+
+Trace* trace_pack_get(TracePack* pack, const Hash* request_key) {
+    if (!pack || !request_key) return NULL;
+
+    uv_rwlock_rdlock(&pack->lock);
+    const PackIndexEntry* e = index_find(pack, request_key);
+    Trace* t = e ? decode_trace(pack, &e->newest) : NULL;
+    uv_rwlock_rdunlock(&pack->lock);
+    return t;
+}
+
+size_t trace_pack_get_variants(TracePack* pack, const Hash* request_key, Trace** out, size_t max) {
+    if (!pack || !request_key || !out) return 0;
+
+    size_t count = 0;
+    uv_rwlock_rdlock(&pack->lock);
+    const PackIndexEntry* e = index_find(pack, request_key);
+    for (size_t i = 0; e && i <= e->older_count && count < max; i++) {
+        Trace* t = decode_trace(pack, i == 0 ? &e->newest : &e->older[i - 1]);
+        if (t) out[count++] = t;
+    }
+    uv_rwlock_rdunlock(&pack->lock);
+    return count;
+}
+
+size_t trace_pack_count(TracePack* pack) {
+    if (!pack) return 0;
+    uv_rwlock_rdlock(&pack->lock);
+    size_t count = pack->index_count;
+    uv_rwlock_rdunlock(&pack->lock);
+    return count;
+}
+
+// Append the records for t to buf, adding new paths to the segment's table
+// next_id is the id the next string record will get; it is advanced
+static bool encode_with_strings(Map* strings, uint32_t* next_id, const Trace* t, Buffer* buf) {
+    uint32_t* ids = t->dep_count ? (uint32_t*)rebuild_malloc(t->dep_count * sizeof(uint32_t)) : NULL;
+    if (t->dep_count && !ids) return false;
+
+    bool ok = true;
+    for (size_t i = 0; i < t->dep_count && ok; i++) {
+        uintptr_t id = (uintptr_t)map_get(strings, t->dep_paths[i]);
+        if (id == 0) {
+            size_t len = strlen(t->dep_paths[i]);
+            ok = len <= UINT32_MAX &&
+                 append_record(buf, RECORD_STRING, (const uint8_t*)t->dep_paths[i], (uint32_t)len) &&
+                 map_set(strings, t->dep_paths[i], (void*)(uintptr_t)(*next_id + 1)) == REBUILD_OK;
+            id = ++*next_id;
+        }
+        ids[i] = (uint32_t)(id - 1);
+    }
+
+    uint32_t len = 0;
+    uint8_t* payload = ok ? encode_trace(t, ids, &len) : NULL;
+    ok = payload && append_record(buf, RECORD_TRACE, payload, len);
+    rebuild_free(payload);
+    rebuild_free(ids);
+    return ok;
+}
+
+static bool write_at(int fd, const void* data, size_t size, uint64_t offset) {
+    const uint8_t* p = (const uint8_t*)data;
+    while (size > 0) {
+        ssize_t n = pwrite(fd, p, size, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return true;
+}
+
+// Append the pending access entries and t (if not NULL) to the active
+// segment (pack->lock held for writing)
+static bool pack_append(TracePack* pack, const Trace* t) {
+    Buffer* buf = buffer_create(4096);
+    if (!buf) return false;
+
+    bool ok = flock(pack->lock_fd, LOCK_EX) == 0 && pack_refresh(pack);
+
+    // Start a new segment when there is none or the active one is full
+    if (ok && (pack->segment_count == 0 ||
+               pack->segments[pack->segment_count - 1].end >= TRACE_PACK_SEGMENT_SIZE)) {
+        uint32_t number = pack->segment_count ? pack->segments[pack->segment_count - 1].number + 1 : 1;
+        ok = pack_add_segment(pack, number, true);
+    }
+
+    if (ok) {
+        uint32_t seg_index = (uint32_t)(pack->segment_count - 1);
+        PackSegment* seg = &pack->segments[seg_index];
+        uint32_t next_id = seg->string_count;
+
+        // A torn tail from a crashed writer is overwritten
+        ok = append_access_records(buf, pack->touches) &&
+             (!t || encode_with_strings(pack->active_strings, &next_id, t, buf)) &&
+             ftruncate(seg->fd, (off_t)seg->end) == 0 &&
+             write_at(seg->fd, buffer_data(buf), buffer_size(buf), seg->end) &&
+             segment_remap(seg);
+        if (ok) {
+            uint64_t before = seg->end;
+            segment_scan(pack, seg_index, true);
+            ok = seg->end == before + buffer_size(buf);
+            buffer_clear(pack->touches);
+        } else {
+            // Forget ids handed out for records that were not written
+            map_clear(pack->active_strings, NULL);
+            for (uint32_t i = 0; i < seg->string_count; i++) {
+                map_set(pack->active_strings, seg->strings[i], (void*)(uintptr_t)(i + 1));
+            }
+        }
+    }
+
+    if (!ok) {
+        LOG_ERROR("Failed to append to trace pack %s: %s", pack->dir, strerror(errno));
+    }
+    flock(pack->lock_fd, LOCK_UN);
+    buffer_free(buf);
+    return ok;
+}
+
+bool trace_pack_put(TracePack* pack, const Trace* t) {
+    if (!pack || !t) return false;
+
+    uv_rwlock_wrlock(&pack->lock);
+    bool ok = pack_append(pack, t);
+    uv_rwlock_wrunlock(&pack->lock);
+    return ok;
+}
+
+void trace_pack_touch(TracePack* pack, const Trace* t) {
+    if (!pack || !t) return;
+
+    uv_timespec64_t now;
+    if (uv_clock_gettime(UV_CLOCK_REALTIME, &now) != 0) return;
+    uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+    uint64_t inputs = trace_fingerprint(t);
+
+    // Written out when the pack is next appended to or closed
+    uv_rwlock_rdlock(&pack->lock);
+    uv_mutex_lock(&pack->touch_lock);
+    PackRecordRef* ref = index_find_variant(pack, &t->request_key, inputs);
+    if (ref && now_ns > ref->used_ns + TRACE_PACK_TOUCH_INTERVAL &&
+        add_access_entry(pack->touches, &t->request_key, inputs, now_ns)) {
+        ref->used_ns = now_ns;
+    }
+    uv_mutex_unlock(&pack->touch_lock);
+    uv_rwlock_rdunlock(&pack->lock);
+}
+
+// ============================================================================
+// Compaction
+// ============================================================================
+
+static int compare_record_refs(const void* a, const void* b) {
+    const PackRecordRef* x = (const PackRecordRef*)a;
+    const PackRecordRef* y = (const PackRecordRef*)b;
+    if (x->segment != y->segment) return x->segment < y->segment ? -1 : 1;
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+// Fill in what the garbage collector sees of an indexed variant
+static void describe_variant(const TracePack* pack, const Hash* key, const PackRecordRef* ref,
+                             TracePackVariant* v) {
+    const uint8_t* record = pack->segments[ref->segment].map + ref->offset;
+    v->request_key = *key;
+    memcpy(v->output_tree_hash.bytes, record + 8 + 32, 32);
+    v->inputs = ref->inputs;
+    v->used_ns = ref->used_ns;
+    v->size = RECORD_OVERHEAD + get_le32(record + 4);
+}
+
+// Write the indexed variants of view that keep accepts (all if keep is
+// NULL) and their last use to a new segment file
+static bool write_merged(TracePack* view, const char* path, TracePackKeepFn keep, void* ctx) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+
+    // Keep the original order so the merged file reads like the log did
+    // (and rescanning it ranks the variants of each key the same way)
+    size_t total = 0;
+    for (size_t i = 0; i < view->index_capacity; i++) {
+        if (view->index[i].used) total += 1 + view->index[i].older_count;
+    }
+    PackRecordRef* live = (PackRecordRef*)rebuild_malloc((total + 1) * sizeof(PackRecordRef));
+    Map* strings = map_create(1024);
+    Buffer* buf = buffer_create(1 << 16);
+    Buffer* access = buffer_create(0);
+    bool ok = live && strings && buf && access;
+
+    size_t count = 0;
+    for (size_t i = 0; ok && i < view->index_capacity; i++) {
+        const PackIndexEntry* e = &view->index[i];
+        if (!e->used) continue;
+        for (size_t j = 0; j <= e->older_count; j++) {
+            const PackRecordRef* ref = j == 0 ? &e->newest : &e->older[j - 1];
+            TracePackVariant v;
+            describe_variant(view, &e->key, ref, &v);
+            if (!keep || keep(&v, ctx)) live[count++] = *ref;
+        }
+    }
+    if (ok && count > 1) qsort(live, count, sizeof(PackRecordRef), compare_record_refs);
+
+    uint8_t header[PACK_HEADER_SIZE];
+    memcpy(header, PACK_MAGIC, 4);
+    put_le32(header + 4, PACK_VERSION);
+    ok = ok && buffer_append(buf, header, sizeof(header)) == REBUILD_OK;
+
+    uint64_t written = 0;
+    uint32_t next_id = 0;
+    for (size_t i = 0; ok && i < count; i++) {
+        Trace* t = decode_trace(view, &live[i]);
+        ok = t && encode_with_strings(strings, &next_id, t, buf);
+        if (ok && live[i].used_ns > t->recorded_ns) {
+            ok = add_access_entry(access, &t->request_key, live[i].inputs, live[i].used_ns);
+        }
+        trace_free(t);
+
+        if (ok && buffer_size(buf) >= (1 << 16)) {
+            ok = write_at(fd, buffer_data(buf), buffer_size(buf), written);
+            written += buffer_size(buf);
+            buffer_clear(buf);
+        }
+    }
+    ok = ok && append_access_records(buf, access) && write_at(fd, buffer_data(buf), buffer_size(buf), written);
+    ok = fsync(fd) == 0 && ok;
+    ok = close(fd) == 0 && ok;
+
+    buffer_free(access);
+    buffer_free(buf);
+    map_free(strings, NULL);
+    rebuild_free(live);
+    return ok;
+}
+
+bool trace_pack_compact(const char* dir) {
+    if (!dir) return false;
+
+    // One compaction at a time per pack, across processes
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, PACK_COMPACT_LOCK_FILE);
+    int compact_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (compact_fd < 0) return false;
+    if (flock(compact_fd, LOCK_EX | LOCK_NB) != 0) {
+        close(compact_fd);
+        return true;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", dir, PACK_LOCK_FILE);
+    int lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+    // Sealed segments never change again, so they are read without the lock
+    size_t count = 0;
+    uint32_t* numbers = NULL;
+    if (lock_fd >= 0 && flock(lock_fd, LOCK_SH) == 0) {
+        numbers = list_segments(dir, &count);
+        flock(lock_fd, LOCK_UN);
+    }
+    size_t sealed = count > 0 ? count - 1 : 0;
+
+    bool ok = true;
+    if (sealed >= TRACE_PACK_COMPACT_SEGMENTS) {
+        TracePack view;
+        memset(&view, 0, sizeof(view));
+        view.dir = (char*)dir;
+        for (size_t i = 0; i < sealed && ok; i++) {
+            ok = pack_add_segment(&view, numbers[i], false);
+        }
+
+        // The merged file takes the newest sealed segment's place
+        char* target = segment_path(dir, numbers[sealed - 1]);
+        size_t tmp_len = strlen(dir) + 32;
+        char* tmp = (char*)rebuild_malloc(tmp_len);
+        ok = ok && target && tmp;
+        if (ok) {
+            snprintf(tmp, tmp_len, "%s/merge.tmp", dir);
+            ok = write_merged(&view, tmp, NULL, NULL);
+        }
+
+        if (ok && flock(lock_fd, LOCK_EX) == 0) {
+            ok = rename(tmp, target) == 0;
+            for (size_t i = 0; ok && i + 1 < sealed; i++) {
+                char* old = segment_path(dir, numbers[i]);
+                if (old) unlink(old);
+                rebuild_free(old);
+            }
+            flock(lock_fd, LOCK_UN);
+            if (ok) {
+                LOG_DEBUG("Trace pack: merged %zu segments into %08u (%zu traces)",
+                          sealed, numbers[sealed - 1], view.index_count);
+            }
+        } else if (tmp) {
+            unlink(tmp);
+        }
+
+        for (size_t i = 0; i < view.segment_count; i++) {
+            if (view.segments[i].map) munmap(view.segments[i].map, view.segments[i].map_size);
+            close(view.segments[i].fd);
+            rebuild_free((void*)view.segments[i].strings);
+        }
+        rebuild_free(view.segments);
+        index_free(view.index, view.index_capacity);
+        arena_free(&view.arena);
+        rebuild_free(target);
+        rebuild_free(tmp);
+    }
+
+    rebuild_free(numbers);
+    if (lock_fd >= 0) close(lock_fd);
+    flock(compact_fd, LOCK_UN);
+    close(compact_fd);
+    return ok;
+}
+
+bool trace_pack_list(TracePack* pack, TracePackVariant** out, size_t* count) {
+    *out = NULL;
+    *count = 0;
+    if (!pack) return false;
+
+    uv_rwlock_wrlock(&pack->lock);
+
+    // Include what other processes appended since the pack was opened
+    bool ok = flock(pack->lock_fd, LOCK_SH) == 0 && pack_refresh(pack);
+    flock(pack->lock_fd, LOCK_UN);
+
+    size_t total = 0;
+    for (size_t i = 0; i < pack->index_capacity; i++) {
+        if (pack->index[i].used) total += 1 + pack->index[i].older_count;
+    }
+    TracePackVariant* variants = ok ? (TracePackVariant*)rebuild_malloc((total + 1) * sizeof(TracePackVariant)) : NULL;
+    for (size_t i = 0; variants && i < pack->index_capacity; i++) {
+        const PackIndexEntry* e = &pack->index[i];
+        if (!e->used) continue;
+        for (size_t j = 0; j <= e->older_count; j++) {
+            describe_variant(pack, &e->key, j == 0 ? &e->newest : &e->older[j - 1], &variants[(*count)++]);
+        }
+    }
+    uv_rwlock_wrunlock(&pack->lock);
+
+    *out = variants;
+    return variants != NULL;
+}
+
+bool trace_pack_rewrite(TracePack* pack, TracePackKeepFn keep, void* ctx) {
+    if (!pack || !keep) return false;
+
+    // Wait for a running compaction (in any process) and keep others out
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", pack->dir, PACK_COMPACT_LOCK_FILE);
+    int compact_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (compact_fd < 0) return false;
+    if (flock(compact_fd, LOCK_EX) != 0) {
+        close(compact_fd);
+        return false;
+    }
+
+    uv_rwlock_wrlock(&pack->lock);
+    bool ok = flock(pack->lock_fd, LOCK_EX) == 0 && pack_refresh(pack);
+
+    // The new segment comes after all others, so other processes pick it
+    // up (and append to it) the next time they append; until then they
+    // read the old segments they have open
+    uint32_t number = pack->segment_count ? pack->segments[pack->segment_count - 1].number + 1 : 1;
+    char* target = segment_path(pack->dir, number);
+    snprintf(path, sizeof(path), "%s/merge.tmp", pack->dir);
+    ok = ok && target && write_merged(pack, path, keep, ctx) && rename(path, target) == 0;
+
+    if (ok) {
+        size_t old_keys = pack->index_count;
+        size_t old_segments = pack->segment_count;
+        for (size_t i = 0; i < pack->segment_count; i++) {
+            PackSegment* seg = &pack->segments[i];
+            char* old = segment_path(pack->dir, seg->number);
+            if (old) unlink(old);
+            rebuild_free(old);
+            if (seg->map) munmap(seg->map, seg->map_size);
+            close(seg->fd);
+            rebuild_free((void*)seg->strings);
+        }
+        pack->segment_count = 0;
+
+        // Index the new segment alone; the arena keeps the old strings,
+        // which traces handed out earlier may still point to
+        index_free(pack->index, pack->index_capacity);
+        pack->index = NULL;
+        pack->index_capacity = 0;
+        pack->index_count = 0;
+        ok = pack_add_segment(pack, number, false);
+        LOG_DEBUG("Trace pack: rewrote %zu segments into %08u (%zu of %zu keys kept)",
+                  old_segments, number, pack->index_count, old_keys);
+    } else {
+        unlink(path);
+        LOG_ERROR("Failed to rewrite trace pack %s: %s", pack->dir, strerror(errno));
+    }
+
+    flock(pack->lock_fd, LOCK_UN);
+    uv_rwlock_wrunlock(&pack->lock);
+    rebuild_free(target);
+    flock(compact_fd, LOCK_UN);
+    close(compact_fd);
+    return ok;
+}
@@ -0,0 +1,103 @@
+#ifndef REBUILD_TRACE_PACK_H
+#define REBUILD_TRACE_PACK_H
+
+#include "common.h"
+#include "trace.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// TracePack - all traces of a storage directory in a few append-only files
+//
+// One file per trace makes every cache lookup a path walk, a stat and an
+// open. A pack instead keeps traces in numbered log segments (packs/NNNNNNNN.seg)
+// and indexes every request key in memory when it is opened, so a miss is
+// answered without a system call and a hit reads from a mapped segment.
+//
+// Records are appended to the newest segment under an exclusive lock, so
+// several rebuild processes can share a pack; a process sees traces that
+// others appended after it opened the pack the next time it appends. Each
+// segment has its own string table: a dependency path is written once per
+// segment and traces refer to it by number. Segments are sealed at
+// TRACE_PACK_SEGMENT_SIZE; once several are sealed, a background thread
+// merges them into one, dropping traces that are no longer indexed.
+//
+// A key keeps up to TRACE_PACK_VARIANTS traces, one per set of dependency
+// hashes, so going back to an earlier state of the sources (another
+// branch) finds its trace again. A new trace replaces the variant with the
+// same dependency hashes, or else the oldest one once the key is full.
+//
+// For the garbage collector every variant carries the time it was last
+// used: when it was recorded, or the latest cache hit. Hits are kept in
+// memory and appended as access records with the next trace or when the
+// pack is closed, at most once per TRACE_PACK_TOUCH_INTERVAL per variant.
+//
+// Segment layout (little-endian): "RBTP", u32 version, then records of
+// u32 type, u32 length, payload, u64 checksum. A torn record at the end of
+// a segment (a crash mid-append) ends the segment and is overwritten by the
+// next append.
+
+typedef struct TracePack TracePack;
+
+#define TRACE_PACK_SEGMENT_SIZE (64u << 20)   // Seal the active segment at 64 MiB
+#define TRACE_PACK_COMPACT_SEGMENTS 4         // Merge once this many are sealed
+#define TRACE_PACK_VARIANTS 8                 // Traces kept per request key
+#define TRACE_PACK_TOUCH_INTERVAL (3600ULL * 1000000000ULL)  // Record a hit hourly at most, ns
+
+// A variant as the garbage collector sees it
+typedef struct TracePackVariant {
+    Hash request_key;
+    Hash output_tree_hash;                    // Outputs it restores (a manifest in objects/)
+    uint64_t inputs;                          // Fingerprint of its dependency hashes
+    uint64_t used_ns;                         // Recorded or last cache hit (wall clock)
+    uint32_t size;                            // Bytes its record takes in a segment
+} TracePackVariant;
+
+// Decides whether trace_pack_rewrite keeps a variant
+typedef bool (*TracePackKeepFn)(const TracePackVariant* v, void* ctx);
+
+// Open (or create) the pack in dir and index all of its traces
+// Starts background compaction if enough segments are sealed
+// Returns NULL on I/O error
+TracePack* trace_pack_open(const char* dir);
+
+// Close the pack, waiting for a running compaction to finish
+void trace_pack_close(TracePack* pack);
+
+// Look up the newest trace recorded for request_key
+// The trace's paths point into the pack's string table and stay valid until
+// the pack is closed; free the trace with trace_free
+// Returns NULL if the pack holds no trace for the key
+Trace* trace_pack_get(TracePack* pack, const Hash* request_key);
+
+// Look up every variant recorded for request_key, newest first
+// Stores at most max traces in out (free each with trace_free)
+// Returns the number stored
+size_t trace_pack_get_variants(TracePack* pack, const Hash* request_key, Trace** out, size_t max);
+
+// Append a trace as the newest variant of its key
+// Returns false on I/O error
+bool trace_pack_put(TracePack* pack, const Trace* t);
+
+// Note that t (a trace from this pack) gave a cache hit
+void trace_pack_touch(TracePack* pack, const Trace* t);
+
+// Number of request keys with a trace in the pack
+size_t trace_pack_count(TracePack* pack);
+
+// Merge the sealed segments in dir into one, keeping the indexed variants
+// Returns true if there was nothing to do or the merge succeeded
+bool trace_pack_compact(const char* dir);
+
+// List every variant in the pack, including those other processes appended
+// *out is an array of *count variants (caller frees)
+// Returns false on I/O or allocation error
+bool trace_pack_list(TracePack* pack, TracePackVariant** out, size_t* count);
+
+// Replace all segments with one holding the variants keep accepts
+// Variants appended by other processes meanwhile are offered to keep too;
+// processes that have the pack open go on reading the segments they have
+// mapped and switch to the new one on their next append
+// Returns false on I/O error (the pack is left as it was)
+bool trace_pack_rewrite(TracePack* pack, TracePackKeepFn keep, void* ctx);
+
+#endif // REBUILD_TRACE_PACK_H
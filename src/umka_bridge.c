@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <glob.h>
 #include <pthread.h>
 
@@ -146,8 +147,12 @@ static char* read_file_contents(const char* path) {
 }
 
 // Forward declarations for FFI functions
-void umka_ffi_rebuild_depend_on(void* params, void* result);
-void umka_ffi_rebuild_sys(void* params, void* result);
+void umka_ffi_rebuild_depend_request(void* params, void* result);
+void umka_ffi_rebuild_depend_request_all(void* params, void* result);
+void umka_ffi_rebuild_depend_result(void* params, void* result);
+void umka_ffi_rebuild_sys_start(void* params, void* result);
+void umka_ffi_rebuild_sys_done(void* params, void* result);
+void umka_ffi_rebuild_sys_result(void* params, void* result);
 void umka_ffi_rebuild_register_dep(void* params, void* result);
 void umka_ffi_rebuild_glob(void* params, void* result);
 void umka_ffi_rebuild_hash_file(void* params, void* result);
@@ -155,9 +160,134 @@ void umka_ffi_rebuild_depend_on_tree(void* params, void* result);
 void umka_ffi_rebuild_log_info(void* params, void* result);
 void umka_ffi_rebuild_log_debug(void* params, void* result);
 void umka_ffi_rebuild_register_target(void* params, void* result);
+void umka_ffi_rebuild_set_target_class(void* params, void* result);
+void umka_ffi_rebuild_set_class_limit(void* params, void* result);
+
+// FFI functions implemented in C
+static const struct {
+    const char* name;
+    UmkaExternFunc func;
+} ffi_functions[] = {
+    { "rebuild_depend_request",  (UmkaExternFunc)umka_ffi_rebuild_depend_request },
+    { "rebuild_depend_request_all", (UmkaExternFunc)umka_ffi_rebuild_depend_request_all },
+    { "rebuild_depend_result",   (UmkaExternFunc)umka_ffi_rebuild_depend_result },
+    { "rebuild_sys_start",       (UmkaExternFunc)umka_ffi_rebuild_sys_start },
+    { "rebuild_sys_done",        (UmkaExternFunc)umka_ffi_rebuild_sys_done },
+    { "rebuild_sys_result",      (UmkaExternFunc)umka_ffi_rebuild_sys_result },
+    { "rebuild_register_dep",    (UmkaExternFunc)umka_ffi_rebuild_register_dep },
+    { "rebuild_glob",            (UmkaExternFunc)umka_ffi_rebuild_glob },
+    { "rebuild_hash_file",       (UmkaExternFunc)umka_ffi_rebuild_hash_file },
+    { "rebuild_depend_on_tree",  (UmkaExternFunc)umka_ffi_rebuild_depend_on_tree },
+    { "rebuild_log_info",        (UmkaExternFunc)umka_ffi_rebuild_log_info },
+    { "rebuild_log_debug",       (UmkaExternFunc)umka_ffi_rebuild_log_debug },
+    { "rebuild_register_target", (UmkaExternFunc)umka_ffi_rebuild_register_target },
+    { "rebuild_set_target_class", (UmkaExternFunc)umka_ffi_rebuild_set_target_class },
+    { "rebuild_set_class_limit", (UmkaExternFunc)umka_ffi_rebuild_set_class_limit },
+};
+
+// Prepend FFI declarations directly to the source
+// This makes the functions globally available without needing imports
+static const char* ffi_decls =
+    "// Rebuild FFI declarations (automatically added)\n"
+    "fn rebuild_depend_on*(target: str): str\n"
+    "fn rebuild_depend_on_all*(targets: []str): []str\n"
+    "fn rebuild_sys*(args: []str): int\n"
+    "fn rebuild_register_dep*(path: str)\n"
+    "fn rebuild_glob*(pattern: str): []str\n"
+    "fn rebuild_hash_file*(path: str): str\n"
+    "fn rebuild_depend_on_tree*(path: str): str\n"
+    "fn rebuild_log_info*(msg: str)\n"
+    "fn rebuild_log_debug*(msg: str)\n"
+    "fn rebuild_register_target*(name: str, fn_name: str)\n"
+    "fn rebuild_set_target_class*(name: str, class: str)\n"
+    "fn rebuild_set_class_limit*(class: str, limit: int)\n\n";
+
+// Appended after the script: depend_on() and sys() are written in UMKA so they
+// can yield the recipe fiber with resume() (a C extern can not switch fibers).
+// The scheduler resumes the fiber once the dependency or process is done.
+static const char* ffi_suspend_src =
+    "\n\n// Rebuild suspending calls (automatically added)\n"
+    "fn rebuild_depend_request*(target: str): bool\n"
+    "fn rebuild_depend_request_all*(targets: []str): bool\n"
+    "fn rebuild_depend_result*(target: str): str\n"
+    "fn rebuild_sys_start*(args: []str): bool\n"
+    "fn rebuild_sys_done*(): bool\n"
+    "fn rebuild_sys_result*(): int\n"
+    "fn rebuild_depend_on*(target: str): str {\n"
+    "    for !rebuild_depend_request(target) { resume() }\n"
+    "    return rebuild_depend_result(target)\n"
+    "}\n"
+    "fn rebuild_depend_on_all*(targets: []str): []str {\n"
+    "    for !rebuild_depend_request_all(targets) { resume() }\n"
+    "    var outputs: []str = make([]str, len(targets))\n"
+    "    for i, target in targets { outputs[i] = rebuild_depend_result(target) }\n"
+    "    return outputs\n"
+    "}\n"
+    "fn rebuild_sys*(args: []str): int {\n"
+    "    if rebuild_sys_start(args) {\n"
+    "        for !rebuild_sys_done() { resume() }\n"
+    "    }\n"
+    "    return rebuild_sys_result()\n"
+    "}\n";
+
+// Check that name can be pasted into generated UMKA source
+static bool is_identifier(const char* name) {
+    if (!name || !(*name == '_' || (*name >= 'a' && *name <= 'z') || (*name >= 'A' && *name <= 'Z'))) {
+        return false;
+    }
+    for (const char* p = name; *p; p++) {
+        if (!(*p == '_' || (*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') ||
+              (*p >= '0' && *p <= '9'))) {
+            return false;
+        }
+    }
+    return true;
+}
 
-// Load and compile UMKA script
-Umka* umka_load_script(const char* path) {
+// Generate the fiber driver: starts recipe function fn_names[i] as a fiber
+// with a caller-chosen id, and resumes it until the function returns
+static char* generate_fiber_driver(const char* const* fn_names, size_t fn_count) {
+    Buffer* buf = buffer_create(1024);
+    if (!buf) return NULL;
+
+    buffer_append_str(buf,
+        "\n// Rebuild fiber driver (automatically added)\n"
+        "var rebuild_fibers: map[int]fiber\n"
+        "fn rebuild_fiber_start*(id: int, fn_index: int): bool {\n"
+        "    switch fn_index {\n");
+
+    char line[256];
+    for (size_t i = 0; i < fn_count; i++) {
+        if (!is_identifier(fn_names[i])) {
+            LOG_WARN("Skipping recipe function with invalid name: %s", fn_names[i] ? fn_names[i] : "NULL");
+            continue;
+        }
+        snprintf(line, sizeof(line), "    case %zu: rebuild_fibers[id] = make(fiber, %s)\n",
+                 i, fn_names[i]);
+        buffer_append_str(buf, line);
+    }
+
+    buffer_append_str(buf,
+        "    default: return false\n"
+        "    }\n"
+        "    return true\n"
+        "}\n"
+        "fn rebuild_fiber_resume*(id: int): bool {\n"
+        "    if !validkey(rebuild_fibers, id) { return true }\n"
+        "    f := rebuild_fibers[id]\n"
+        "    resume(f)\n"
+        "    if valid(f) { return false }\n"
+        "    delete(rebuild_fibers, id)\n"
+        "    return true\n"
+        "}\n");
+
+    char* driver = buffer_to_string(buf);
+    buffer_free(buf);
+    return driver;
+}
+
+// Load and compile a UMKA script, appending driver (may be NULL) to the source
+static Umka* load_script(const char* path, const char* driver) {
     if (!path) {
         LOG_ERROR("Cannot load UMKA script: NULL path");
         return NULL;
@@ -180,23 +310,11 @@ Umka* umka_load_script(const char* path) {
         return NULL;
     }
 
-    // Prepend FFI declarations directly to the source
-    // This makes the functions globally available without needing imports
-    const char* ffi_decls =
-        "// Rebuild FFI declarations (automatically added)\n"
-        "fn rebuild_depend_on*(target: str): str\n"
-        "fn rebuild_sys*(args: []str): int\n"
-        "fn rebuild_register_dep*(path: str)\n"
-        "fn rebuild_glob*(pattern: str): []str\n"
-        "fn rebuild_hash_file*(path: str): str\n"
-        "fn rebuild_depend_on_tree*(path: str): str\n"
-        "fn rebuild_log_info*(msg: str)\n"
-        "fn rebuild_log_debug*(msg: str)\n"
-        "fn rebuild_register_target*(name: str, fn_name: str)\n\n";
-
-    size_t new_size = strlen(ffi_decls) + strlen(original_source) + 1;
+    size_t new_size = strlen(ffi_decls) + strlen(original_source) +
+                      strlen(ffi_suspend_src) + (driver ? strlen(driver) : 0) + 1;
     char* modified_source = rebuild_malloc(new_size);
-    snprintf(modified_source, new_size, "%s%s", ffi_decls, original_source);
+    snprintf(modified_source, new_size, "%s%s%s%s", ffi_decls, original_source,
+             ffi_suspend_src, driver ? driver : "");
     rebuild_free(original_source);
 
     // Initialize UMKA with the BUILD.um file path and modified source
@@ -214,87 +332,100 @@ Umka* umka_load_script(const char* path) {
     rebuild_free(modified_source);
 
     // Register FFI functions AFTER loading but BEFORE compiling
-    if (!umkaAddFunc(umka, "rebuild_depend_on",
-                     (UmkaExternFunc)umka_ffi_rebuild_depend_on)) {
-        LOG_ERROR("Failed to register rebuild_depend_on FFI function");
-        umkaFree(umka);
-        return NULL;
+    for (size_t i = 0; i < sizeof(ffi_functions) / sizeof(ffi_functions[0]); i++) {
+        if (!umkaAddFunc(umka, ffi_functions[i].name, ffi_functions[i].func)) {
+            LOG_ERROR("Failed to register %s FFI function", ffi_functions[i].name);
+            umkaFree(umka);
+            return NULL;
+        }
     }
 
-    if (!umkaAddFunc(umka, "rebuild_sys",
-                     (UmkaExternFunc)umka_ffi_rebuild_sys)) {
-        LOG_ERROR("Failed to register rebuild_sys FFI function");
+    // Compile the script
+    if (!umkaCompile(umka)) {
+        UmkaError* error = umkaGetError(umka);
+        LOG_ERROR("Failed to compile UMKA script %s: %s (line %d)",
+                  path, error->msg, error->line);
         umkaFree(umka);
         return NULL;
     }
 
-    if (!umkaAddFunc(umka, "rebuild_register_dep",
-                     (UmkaExternFunc)umka_ffi_rebuild_register_dep)) {
-        LOG_ERROR("Failed to register rebuild_register_dep FFI function");
-        umkaFree(umka);
-        return NULL;
-    }
+    LOG_INFO("Successfully loaded and compiled UMKA script: %s", path);
 
-    if (!umkaAddFunc(umka, "rebuild_glob",
-                     (UmkaExternFunc)umka_ffi_rebuild_glob)) {
-        LOG_ERROR("Failed to register rebuild_glob FFI function");
-        umkaFree(umka);
-        return NULL;
+    // Store UMKA instance in thread-local context
+    UmkaContext* ctx = umka_bridge_get_context();
+    if (ctx) {
+        ctx->umka = umka;
     }
 
-    if (!umkaAddFunc(umka, "rebuild_hash_file",
-                     (UmkaExternFunc)umka_ffi_rebuild_hash_file)) {
-        LOG_ERROR("Failed to register rebuild_hash_file FFI function");
-        umkaFree(umka);
-        return NULL;
-    }
+    return umka;
+}
 
-    if (!umkaAddFunc(umka, "rebuild_depend_on_tree",
-                     (UmkaExternFunc)umka_ffi_rebuild_depend_on_tree)) {
-        LOG_ERROR("Failed to register rebuild_depend_on_tree FFI function");
-        umkaFree(umka);
+// Load and compile UMKA script
+Umka* umka_load_script(const char* path) {
+    return load_script(path, NULL);
+}
+
+// Load and compile UMKA script with the recipe fiber driver
+Umka* umka_load_fiber_script(const char* path, const char* const* fn_names, size_t fn_count) {
+    char* driver = generate_fiber_driver(fn_names, fn_count);
+    if (!driver) {
+        LOG_ERROR("Failed to generate fiber driver for: %s", path ? path : "NULL");
         return NULL;
     }
 
-    if (!umkaAddFunc(umka, "rebuild_log_info",
-                     (UmkaExternFunc)umka_ffi_rebuild_log_info)) {
-        LOG_ERROR("Failed to register rebuild_log_info FFI function");
-        umkaFree(umka);
-        return NULL;
+    Umka* umka = load_script(path, driver);
+    rebuild_free(driver);
+    return umka;
+}
+
+// Start recipe function fn_index as fiber id (does not run it yet)
+bool umka_start_recipe_fiber(Umka* umka, int fiber_id, int fn_index) {
+    if (!umka) return false;
+
+    UmkaFuncContext fn;
+    if (!umkaGetFunc(umka, NULL, "rebuild_fiber_start", &fn)) {
+        LOG_ERROR("UMKA instance has no fiber driver");
+        return false;
     }
 
-    if (!umkaAddFunc(umka, "rebuild_log_debug",
-                     (UmkaExternFunc)umka_ffi_rebuild_log_debug)) {
-        LOG_ERROR("Failed to register rebuild_log_debug FFI function");
-        umkaFree(umka);
-        return NULL;
+    umkaGetParam(fn.params, 0)->intVal = fiber_id;
+    umkaGetParam(fn.params, 1)->intVal = fn_index;
+
+    if (umkaCall(umka, &fn) != 0) {
+        UmkaError* error = umkaGetError(umka);
+        LOG_ERROR("Failed to start recipe fiber: %s (line %d)", error->msg, error->line);
+        return false;
     }
 
-    if (!umkaAddFunc(umka, "rebuild_register_target",
-                     (UmkaExternFunc)umka_ffi_rebuild_register_target)) {
-        LOG_ERROR("Failed to register rebuild_register_target FFI function");
-        umkaFree(umka);
-        return NULL;
+    return fn.result->intVal != 0;
+}
+
+// Run recipe fiber until it returns or yields
+UmkaFiberStatus umka_resume_recipe_fiber(Umka* umka, int fiber_id) {
+    if (!umka) return UMKA_FIBER_ERROR;
+
+    UmkaFuncContext fn;
+    if (!umkaGetFunc(umka, NULL, "rebuild_fiber_resume", &fn)) {
+        LOG_ERROR("UMKA instance has no fiber driver");
+        return UMKA_FIBER_ERROR;
     }
 
-    // Compile the script
-    if (!umkaCompile(umka)) {
+    umkaGetParam(fn.params, 0)->intVal = fiber_id;
+
+    if (umkaCall(umka, &fn) != 0) {
         UmkaError* error = umkaGetError(umka);
-        LOG_ERROR("Failed to compile UMKA script %s: %s (line %d)",
-                  path, error->msg, error->line);
-        umkaFree(umka);
-        return NULL;
+        LOG_ERROR("UMKA fiber error: %s (line %d)", error->msg, error->line);
+        return UMKA_FIBER_ERROR;
     }
 
-    LOG_INFO("Successfully loaded and compiled UMKA script: %s", path);
+    return fn.result->intVal != 0 ? UMKA_FIBER_COMPLETE : UMKA_FIBER_SUSPENDED;
+}
 
-    // Store UMKA instance in thread-local context
-    UmkaContext* ctx = umka_bridge_get_context();
-    if (ctx) {
-        ctx->umka = umka;
+// Free UMKA instance
+void umka_free_script(Umka* umka) {
+    if (umka) {
+        umkaFree(umka);
     }
-
-    return umka;
 }
 
 // Get hash of UMKA script
@@ -386,11 +517,16 @@ void umka_free_fiber(UmkaFiber fiber) {
 // FFI Function Implementations
 //
 
-// FFI: rebuild_depend_on(target_name: str): str
-void umka_ffi_rebuild_depend_on(void* params, void* result) {
+// FFI: rebuild_depend_request(target: str): bool
+// Returns true once the dependency is done; false means the caller must yield
+void umka_ffi_rebuild_depend_request(void* params, void* result) {
+    UmkaStackSlot* result_slot = umkaGetResult((UmkaStackSlot*)params, (UmkaStackSlot*)result);
+    result_slot->intVal = 1;
+
     UmkaContext* ctx = umka_bridge_get_context();
-    if (!ctx) {
-        LOG_ERROR("rebuild_depend_on: No UMKA context");
+    if (!ctx || !ctx->scheduler || !ctx->current_recipe) {
+        // Outside a recipe fiber there is nothing to yield to
+        LOG_ERROR("rebuild_depend_on: only available while executing a recipe");
         return;
     }
 
@@ -411,23 +547,82 @@ void umka_ffi_rebuild_depend_on(void* params, void* result) {
         output_path = g_callbacks.depend_on(ctx->scheduler, ctx->current_recipe, target_name);
     }
 
-    // Return output path (or NULL if dependency needs to be built)
+    // NULL means the recipe now waits on the dependency; if it can never be
+    // built the scheduler fails the recipe once it yields instead of resuming it
+    if (!output_path) {
+        result_slot->intVal = 0;
+    }
+}
+
+// FFI: rebuild_depend_request_all(targets: []str): bool
+// Requests every dependency before yielding so they all build in parallel;
+// returns true once none of them is outstanding
+void umka_ffi_rebuild_depend_request_all(void* params, void* result) {
     UmkaStackSlot* result_slot = umkaGetResult((UmkaStackSlot*)params, (UmkaStackSlot*)result);
-    if (output_path) {
-        // Convert C string to UMKA string
-        result_slot->ptrVal = umkaMakeStr(ctx->umka, output_path);
-    } else {
-        result_slot->ptrVal = NULL;
+    result_slot->intVal = 1;
+
+    UmkaContext* ctx = umka_bridge_get_context();
+    if (!ctx || !ctx->scheduler || !ctx->current_recipe) {
+        LOG_ERROR("rebuild_depend_on_all: only available while executing a recipe");
+        return;
     }
+
+    // UMKA dynamic array structure for []str
+    typedef UmkaDynArray(char*) StrArray;
+    StrArray* targets = (StrArray*)umkaGetParam((UmkaStackSlot*)params, 0);
+    int count = targets ? umkaGetDynArrayLen(targets) : 0;
+
+    LOG_DEBUG("rebuild_depend_on_all: %d targets", count);
+
+    // Register all requests first; the caller waits once for the whole batch
+    bool ready = true;
+    for (int i = 0; i < count; i++) {
+        const char* target_name = targets->data[i];
+        if (!target_name) {
+            LOG_ERROR("rebuild_depend_on_all: NULL target name at index %d", i);
+            continue;
+        }
+
+        const char* output_path = NULL;
+        if (g_callbacks.depend_on) {
+            output_path = g_callbacks.depend_on(ctx->scheduler, ctx->current_recipe, target_name);
+        }
+        if (!output_path) {
+            ready = false;
+        }
+    }
+
+    result_slot->intVal = ready;
 }
 
-// FFI: rebuild_sys(args: []str): int
-void umka_ffi_rebuild_sys(void* params, void* result) {
+// FFI: rebuild_depend_result(target: str): str
+void umka_ffi_rebuild_depend_result(void* params, void* result) {
+    UmkaContext* ctx = umka_bridge_get_context();
+    UmkaStackSlot* param_slot = umkaGetParam((UmkaStackSlot*)params, 0);
+    const char* target_name = (const char*)param_slot->ptrVal;
+
+    const char* output_path = NULL;
+    if (ctx && ctx->scheduler && target_name) {
+        output_path = scheduler_get_completed(ctx->scheduler, target_name);
+    }
+    if (!output_path) {
+        LOG_ERROR("rebuild_depend_on: dependency not available: %s", target_name ? target_name : "NULL");
+    }
+
+    // Return output path (empty if the dependency failed)
+    UmkaStackSlot* result_slot = umkaGetResult((UmkaStackSlot*)params, (UmkaStackSlot*)result);
+    result_slot->ptrVal = umkaMakeStr(ctx ? ctx->umka : NULL, output_path ? output_path : "");
+}
+
+// FFI: rebuild_sys_start(args: []str): bool
+// Returns true if the command was started and the caller must yield until done
+void umka_ffi_rebuild_sys_start(void* params, void* result) {
+    UmkaStackSlot* result_slot = umkaGetResult((UmkaStackSlot*)params, (UmkaStackSlot*)result);
+    result_slot->intVal = 0;
+
     UmkaContext* ctx = umka_bridge_get_context();
     if (!ctx || !ctx->scheduler || !ctx->current_recipe) {
         LOG_ERROR("rebuild_sys: No UMKA context");
-        UmkaStackSlot* result_slot = umkaGetResult((UmkaStackSlot*)params, (UmkaStackSlot*)result);
-        result_slot->intVal = -1;
         return;
     }
 
@@ -439,23 +634,15 @@ void umka_ffi_rebuild_sys(void* params, void* result) {
 
     if (!args_array) {
         LOG_ERROR("rebuild_sys: NULL arguments array pointer");
-        UmkaStackSlot* result_slot = umkaGetResult((UmkaStackSlot*)params, (UmkaStackSlot*)result);
-        result_slot->intVal = -1;
         return;
     }
 
     // Get array length
     int argc = umkaGetDynArrayLen(args_array);
 
-    LOG_DEBUG("rebuild_sys: args_array = %p, internal = %p, itemSize = %lld, data = %p, argc = %d",
-              args_array, args_array->internal, (long long)args_array->itemSize,
-              args_array->data, argc);
-
     if (argc <= 0 || !args_array->data) {
         LOG_ERROR("rebuild_sys: Invalid or empty arguments array (argc=%d, data=%p)",
                   argc, args_array->data);
-        UmkaStackSlot* result_slot = umkaGetResult((UmkaStackSlot*)params, (UmkaStackSlot*)result);
-        result_slot->intVal = -1;
         return;
     }
 
@@ -466,31 +653,51 @@ void umka_ffi_rebuild_sys(void* params, void* result) {
     }
     args[argc] = NULL;
 
-    LOG_DEBUG("rebuild_sys: executing command '%s' with %d args", args[0], argc);
+    LOG_DEBUG("rebuild_sys: starting command '%s' with %d args", args[0], argc);
 
-    // Execute command using scheduler
-    char* stdout_output = NULL;
-    char* stderr_output = NULL;
-    int exit_code = scheduler_execute_sys(ctx->scheduler, ctx->current_recipe,
-                                          args, argc, &stdout_output, &stderr_output);
+    // The scheduler copies the arguments and spawns the process on the loop
+    result_slot->intVal = scheduler_start_sys(ctx->scheduler, ctx->current_recipe, args, argc);
 
     rebuild_free(args);
+}
+
+// FFI: rebuild_sys_done(): bool
+void umka_ffi_rebuild_sys_done(void* params, void* result) {
+    UmkaContext* ctx = umka_bridge_get_context();
+    bool done = !ctx || !ctx->scheduler || !ctx->current_recipe ||
+                scheduler_sys_done(ctx->scheduler, ctx->current_recipe);
+
+    UmkaStackSlot* result_slot = umkaGetResult((UmkaStackSlot*)params, (UmkaStackSlot*)result);
+    result_slot->intVal = done;
+}
+
+// FFI: rebuild_sys_result(): int
+void umka_ffi_rebuild_sys_result(void* params, void* result) {
+    UmkaStackSlot* result_slot = umkaGetResult((UmkaStackSlot*)params, (UmkaStackSlot*)result);
+    result_slot->intVal = -1;
+
+    UmkaContext* ctx = umka_bridge_get_context();
+    if (!ctx || !ctx->scheduler || !ctx->current_recipe) {
+        return;
+    }
+
+    ProcessResult* proc = scheduler_take_sys_result(ctx->scheduler, ctx->current_recipe);
+    if (!proc) {
+        return;
+    }
 
     // Store output in recipe for later access if needed
     // For now we just log it
-    if (stdout_output && strlen(stdout_output) > 0) {
-        LOG_INFO("Command output:\n%s", stdout_output);
+    if (proc->stdout_data && strlen(proc->stdout_data) > 0) {
+        LOG_INFO("Command output:\n%s", proc->stdout_data);
     }
-    if (stderr_output && strlen(stderr_output) > 0) {
-        LOG_WARN("Command stderr:\n%s", stderr_output);
+    if (proc->stderr_data && strlen(proc->stderr_data) > 0) {
+        LOG_WARN("Command stderr:\n%s", proc->stderr_data);
     }
 
-    rebuild_free(stdout_output);
-    rebuild_free(stderr_output);
-
     // Return exit code
-    UmkaStackSlot* result_slot = umkaGetResult((UmkaStackSlot*)params, (UmkaStackSlot*)result);
-    result_slot->intVal = exit_code;
+    result_slot->intVal = proc->exit_code;
+    process_result_free(proc);
 }
 
 // FFI: rebuild_register_dep(path: str)
@@ -671,9 +878,10 @@ void umka_ffi_rebuild_depend_on_tree(void* params, void* result) {
 
     LOG_DEBUG("rebuild_depend_on_tree: %s", path);
 
-    // Hash the directory tree
+    // Hash the directory tree, sharing the scheduler's validation threads
     Hash tree_hash;
-    if (!hash_tree(path, &tree_hash)) {
+    WorkPool* pool = ctx->scheduler ? ctx->scheduler->validate_pool : NULL;
+    if (!hash_tree_parallel(path, &tree_hash, pool)) {
         LOG_ERROR("rebuild_depend_on_tree: Failed to hash tree: %s", path);
         UmkaStackSlot* result_slot = umkaGetResult((UmkaStackSlot*)params, (UmkaStackSlot*)result);
         result_slot->ptrVal = NULL;
@@ -739,3 +947,35 @@ void umka_ffi_rebuild_register_target(void* params, void* result) {
     extern void target_registry_ffi_register(const char* name, const char* function_name);
     target_registry_ffi_register(name, function_name);
 }
+
+// FFI: rebuild_set_target_class(name: str, class: str)
+// Puts a registered target in a resource class (e.g. "link")
+void umka_ffi_rebuild_set_target_class(void* params, void* result) {
+    (void)result;
+    const char* name = (const char*)umkaGetParam((UmkaStackSlot*)params, 0)->ptrVal;
+    const char* resource_class = (const char*)umkaGetParam((UmkaStackSlot*)params, 1)->ptrVal;
+
+    if (!name || !resource_class) {
+        LOG_ERROR("rebuild_set_target_class: NULL name or class");
+        return;
+    }
+
+    extern void target_registry_ffi_set_class(const char* name, const char* resource_class);
+    target_registry_ffi_set_class(name, resource_class);
+}
+
+// FFI: rebuild_set_class_limit(class: str, limit: int)
+// Caps how many recipes of a resource class run at once (--limit overrides it)
+void umka_ffi_rebuild_set_class_limit(void* params, void* result) {
+    (void)result;
+    const char* resource_class = (const char*)umkaGetParam((UmkaStackSlot*)params, 0)->ptrVal;
+    int64_t limit = umkaGetParam((UmkaStackSlot*)params, 1)->intVal;
+
+    if (!resource_class) {
+        LOG_ERROR("rebuild_set_class_limit: NULL class");
+        return;
+    }
+
+    extern void target_registry_ffi_set_class_limit(const char* resource_class, int limit);
+    target_registry_ffi_set_class_limit(resource_class, limit > INT_MAX ? INT_MAX : (int)limit);
+}
@@ -79,6 +79,25 @@ void umka_bridge_set_callbacks(const UmkaBridgeCallbacks* callbacks);
 // The caller is responsible for freeing the UMKA instance
 Umka* umka_load_script(const char* path);
 
+// Load and compile a UMKA script plus a generated fiber driver
+// Each recipe function fn_names[i] can then be started as a suspendable fiber
+// with umka_start_recipe_fiber(umka, id, i); invalid names are skipped
+// Returns UMKA instance on success, NULL on error
+Umka* umka_load_fiber_script(const char* path, const char* const* fn_names, size_t fn_count);
+
+// Free a UMKA instance returned by umka_load_script
+void umka_free_script(Umka* umka);
+
+// Create fiber fiber_id running recipe function fn_index (see umka_load_fiber_script)
+// The fiber does not run until umka_resume_recipe_fiber
+// Returns false if fn_index is unknown or the driver fails
+bool umka_start_recipe_fiber(Umka* umka, int fiber_id, int fn_index);
+
+// Run recipe fiber fiber_id until it returns or yields in depend_on()/sys()
+// Returns UMKA_FIBER_COMPLETE, UMKA_FIBER_SUSPENDED or UMKA_FIBER_ERROR
+// After an error the instance (and every fiber in it) must be discarded
+UmkaFiberStatus umka_resume_recipe_fiber(Umka* umka, int fiber_id);
+
 // Get hash of UMKA script file for cache key computation
 // Returns REBUILD_OK on success, error code on failure
 RebuildError umka_get_script_hash(const char* path, Hash* out_hash);
@@ -101,15 +120,31 @@ void umka_free_fiber(UmkaFiber fiber);
 // FFI functions registered with UMKA (called from UMKA scripts)
 // These are the actual C implementations that UMKA scripts will call
 
-// Request a dependency and get its output path
-// Yields the fiber until dependency is ready
-// Returns output directory path as string
-void umka_ffi_rebuild_depend_on(void* params, void* result);
+// Request a dependency (backs the UMKA-side rebuild_depend_on wrapper)
+// Returns true once the dependency is done; false registers the recipe as a
+// waiter and the wrapper yields the fiber until the scheduler resumes it
+void umka_ffi_rebuild_depend_request(void* params, void* result);
+
+// Request a batch of dependencies (backs rebuild_depend_on_all)
+// Registers every request before yielding, so the dependencies build in
+// parallel and the caller is resumed once, after the last one completes
+// Returns true once none of them is outstanding
+void umka_ffi_rebuild_depend_request_all(void* params, void* result);
+
+// Get the output path of a completed dependency
+// Returns output directory path as string (empty if the dependency failed)
+void umka_ffi_rebuild_depend_result(void* params, void* result);
+
+// Start a system command (backs the UMKA-side rebuild_sys wrapper)
+// Returns true if the process was started; the wrapper then yields until
+// rebuild_sys_done() reports completion
+void umka_ffi_rebuild_sys_start(void* params, void* result);
+
+// Check whether the recipe's running command has finished
+void umka_ffi_rebuild_sys_done(void* params, void* result);
 
-// Execute system command and capture output
-// Yields the fiber until command completes
-// Returns exit code
-void umka_ffi_rebuild_sys(void* params, void* result);
+// Collect the exit code (and log output) of the recipe's last command
+void umka_ffi_rebuild_sys_result(void* params, void* result);
 
 // Register a discovered dependency (e.g., from depfile parsing)
 // Does not yield, just records the dependency
@@ -0,0 +1,161 @@
+#define _GNU_SOURCE
+#include "../src/code_index.h"
+#include "../src/hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/stat.h>
+
+static const char* test_dir = "/tmp/rebuild_test_code_index";
+
+static void write_file(const char* name, const char* contents) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", test_dir, name);
+    FILE* f = fopen(path, "w");
+    assert(f != NULL);
+    fputs(contents, f);
+    fclose(f);
+}
+
+// Hash of fn_name in a build file with the given contents
+static Hash function_hash(const char* contents, const char* fn_name) {
+    write_file("BUILD.um", contents);
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/BUILD.um", test_dir);
+    CodeIndex* index = code_index_create(path, NULL, NULL);
+    assert(index != NULL);
+
+    Hash hash;
+    assert(code_index_function_hash(index, fn_name, &hash));
+    code_index_free(index);
+    return hash;
+}
+
+static const char* base_file =
+    "import \"util.um\"\n"
+    "const greeting = \"hello // not a comment\"\n"
+    "fn helper(s: str): str { return s + \"!\" }\n"
+    "fn target_a() {\n"
+    "    rebuild_log_info(helper(greeting))\n"
+    "}\n"
+    "fn target_b() {\n"
+    "    util::run(\"b\")\n"
+    "}\n";
+
+void test_code_index_edits(void) {
+    printf("Testing code_index_function_hash...\n");
+
+    char command[512];
+    snprintf(command, sizeof(command), "rm -rf %s && mkdir -p %s", test_dir, test_dir);
+    assert(system(command) == 0);
+    write_file("util.um", "fn run(s: str) {}\n");
+
+    Hash a = function_hash(base_file, "target_a");
+    Hash b = function_hash(base_file, "target_b");
+    assert(!hash_equal(&a, &b));
+
+    // Comments, blank lines, indentation and declaration order do not count
+    Hash a2 = function_hash(
+        "// Build file\n"
+        "fn target_b() {\n"
+        "        util::run(\"b\")   // run it\n"
+        "}\n"
+        "\n"
+        "import \"util.um\"\n"
+        "/* the\n   greeting */\n"
+        "const greeting = \"hello // not a comment\"\n"
+        "fn target_a() {\n"
+        "\n"
+        "    rebuild_log_info(helper(greeting))\n"
+        "}\n"
+        "fn helper(s: str): str {   return s + \"!\" }\n",
+        "target_a");
+    assert(hash_equal(&a, &a2));
+    printf("  Formatting and order ignored\n");
+
+    // Editing a function reaches its callers, and only them
+    const char* helper_edit =
+        "import \"util.um\"\n"
+        "const greeting = \"hello // not a comment\"\n"
+        "fn helper(s: str): str { return s + \"?\" }\n"
+        "fn target_a() {\n"
+        "    rebuild_log_info(helper(greeting))\n"
+        "}\n"
+        "fn target_b() {\n"
+        "    util::run(\"b\")\n"
+        "}\n";
+    a2 = function_hash(helper_edit, "target_a");
+    Hash b2 = function_hash(helper_edit, "target_b");
+    assert(!hash_equal(&a, &a2));
+    assert(hash_equal(&b, &b2));
+    printf("  Editing a callee changes only its callers\n");
+
+    // So does editing a constant, or a string's contents
+    a2 = function_hash(
+        "import \"util.um\"\n"
+        "const greeting = \"hello  // not a comment\"\n"
+        "fn helper(s: str): str { return s + \"!\" }\n"
+        "fn target_a() {\n"
+        "    rebuild_log_info(helper(greeting))\n"
+        "}\n"
+        "fn target_b() {\n"
+        "    util::run(\"b\")\n"
+        "}\n",
+        "target_a");
+    assert(!hash_equal(&a, &a2));
+    printf("  Constants and string contents count\n");
+
+    // An imported module counts for the functions that use it
+    write_file("util.um", "fn run(s: str) { printf(s) }\n");
+    a2 = function_hash(base_file, "target_a");
+    b2 = function_hash(base_file, "target_b");
+    assert(hash_equal(&a, &a2));
+    assert(!hash_equal(&b, &b2));
+    printf("  Imported module changes reach only its users\n");
+
+    printf("  PASS\n\n");
+}
+
+void test_code_index_fallback(void) {
+    printf("Testing code_index fallbacks...\n");
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/BUILD.um", test_dir);
+
+    // Unknown functions have no hash
+    write_file("BUILD.um", base_file);
+    CodeIndex* index = code_index_create(path, NULL, NULL);
+    assert(index != NULL);
+    Hash hash;
+    assert(!code_index_function_hash(index, "target_missing", &hash));
+    code_index_free(index);
+
+    // A file that does not tokenize is hashed as a whole
+    const char* broken = "fn target_a() { rebuild_log_info(\"unterminated) }\nfn target_b() {}\n";
+    Hash a = function_hash(broken, "target_a");
+    Hash b = function_hash(broken, "target_b");
+    assert(!hash_equal(&a, &b));
+    Hash b2 = function_hash("fn target_a() { rebuild_log_info(\"unterminated!) }\nfn target_b() {}\n",
+                            "target_b");
+    assert(!hash_equal(&b, &b2));
+    printf("  Unparsable file invalidates every function\n");
+
+    assert(code_index_create("/tmp/rebuild_test_code_index/missing.um", NULL, NULL) == NULL);
+
+    char command[512];
+    snprintf(command, sizeof(command), "rm -rf %s", test_dir);
+    assert(system(command) == 0);
+    printf("  PASS\n\n");
+}
+
+int main(void) {
+    printf("=== Code Index Tests ===\n\n");
+
+    test_code_index_edits();
+    test_code_index_fallback();
+
+    printf("=== All tests passed! ===\n");
+    return 0;
+}
@@ -0,0 +1,168 @@
+#define _GNU_SOURCE
+#include "../src/gc.h"
+#include "../src/objects.h"
+#include "../src/trace_pack.h"
+#include "../src/hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const char* data_dir = "/tmp/rebuild_test_gc";
+static const char* out_dir = "/tmp/rebuild_test_gc_out";
+
+// An output directory with one file of its own and one shared with the others
+static void make_output(const char* name, const char* contents) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", out_dir, name);
+    mkdir(path, 0755);
+
+    char file[600];
+    snprintf(file, sizeof(file), "%s/own.txt", path);
+    FILE* f = fopen(file, "w");
+    assert(f != NULL);
+    fputs(contents, f);
+    fclose(f);
+
+    snprintf(file, sizeof(file), "%s/shared.txt", path);
+    f = fopen(file, "w");
+    assert(f != NULL);
+    fputs("shared\n", f);
+    fclose(f);
+}
+
+static Hash store_output(Storage* s, const char* name) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", out_dir, name);
+    Hash tree;
+    assert(objects_store_tree(s, path, &tree));
+    return tree;
+}
+
+// A trace for target name whose outputs are tree, last used at used_ns
+static void save_trace(Storage* s, const char* name, const Hash* tree, uint64_t used_ns) {
+    Hash key;
+    hash_data(name, strlen(name), &key);
+    Trace* t = trace_create(&key);
+    assert(t != NULL);
+    t->output_tree_hash = *tree;
+    t->recorded_ns = used_ns;
+    assert(trace_pack_put(s->trace_pack, t));
+    trace_free(t);
+}
+
+static bool has_trace(Storage* s, const char* name) {
+    Hash key;
+    hash_data(name, strlen(name), &key);
+    Trace* t = trace_pack_get(s->trace_pack, &key);
+    trace_free(t);
+    return t != NULL;
+}
+
+static bool restores(Storage* s, const Hash* tree) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/restored", out_dir);
+    bool ok = objects_restore_tree(s, tree, path);
+    char command[600];
+    snprintf(command, sizeof(command), "rm -rf %s", path);
+    assert(system(command) == 0);
+    return ok;
+}
+
+static void make_tmp_dir(Storage* s, const char* name) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", s->tmp_dir, name);
+    assert(mkdir(path, 0755) == 0);
+}
+
+static bool tmp_dir_exists(Storage* s, const char* name) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", s->tmp_dir, name);
+    return access(path, F_OK) == 0;
+}
+
+void test_gc_collect(void) {
+    printf("Testing gc_collect...\n");
+
+    char command[512];
+    snprintf(command, sizeof(command), "rm -rf %s %s && mkdir -p %s", data_dir, out_dir, out_dir);
+    assert(system(command) == 0);
+    setenv("XDG_DATA_HOME", data_dir, 1);
+
+    Storage* s = storage_init();
+    assert(s != NULL);
+    assert(storage_use_trace_pack(s));
+
+    // Two targets built long ago, and outputs no trace refers to
+    make_output("old", "old\n");
+    make_output("new", "new\n");
+    make_output("orphan", "orphan\n");
+    Hash old_tree = store_output(s, "old");
+    Hash new_tree = store_output(s, "new");
+    Hash orphan_tree = store_output(s, "orphan");
+    save_trace(s, "old", &old_tree, 1);
+    save_trace(s, "new", &new_tree, 2);
+    snprintf(command, sizeof(command), "find %s -type f -exec touch -d '2 hours ago' {} +", s->objects_dir);
+    assert(system(command) == 0);
+
+    // ... and some that may belong to a build that is still running
+    make_output("fresh", "fresh\n");
+    Hash fresh_tree = store_output(s, "fresh");
+
+    char name[64];
+    snprintf(name, sizeof(name), "alive_100_%d", (int)getpid());
+    make_tmp_dir(s, name);
+    make_tmp_dir(s, "gone_100_2147483647");
+    make_tmp_dir(s, "unrelated");
+
+    GcStats stats;
+    assert(gc_collect(s, 0, &stats));
+    assert(stats.variants_dropped == 0);
+    assert(stats.objects_removed == 2);
+    assert(stats.tmp_dirs_removed == 1);
+    assert(stats.bytes_after < stats.bytes_before);
+    assert(!restores(s, &orphan_tree));
+    assert(restores(s, &fresh_tree));
+    assert(restores(s, &old_tree) && restores(s, &new_tree));
+    printf("  Unreferenced objects removed, recent ones kept\n");
+
+    assert(tmp_dir_exists(s, name));
+    assert(!tmp_dir_exists(s, "gone_100_2147483647"));
+    assert(tmp_dir_exists(s, "unrelated"));
+    printf("  Temporary directory of a finished process removed\n");
+    assert(!gc_due(s));
+
+    // One byte under budget: dropping the least recently used variant fits
+    uint64_t budget = stats.bytes_after - 1;
+    assert(gc_collect(s, budget, &stats));
+    assert(stats.variants_dropped == 1);
+    assert(stats.objects_removed == 2);
+    assert(stats.bytes_after <= budget);
+    assert(!has_trace(s, "old") && has_trace(s, "new"));
+    assert(!restores(s, &old_tree));
+    assert(restores(s, &new_tree));
+    printf("  Least recently used trace dropped with its own objects\n");
+
+    // Nothing left that is old enough to drop
+    assert(gc_collect(s, 1, &stats));
+    assert(stats.variants_dropped == 1);
+    assert(!has_trace(s, "new"));
+    assert(restores(s, &fresh_tree));
+    printf("  Recently stored objects survive any budget\n");
+
+    storage_free(s);
+    snprintf(command, sizeof(command), "rm -rf %s %s", data_dir, out_dir);
+    assert(system(command) == 0);
+    printf("  PASS\n\n");
+}
+
+int main(void) {
+    printf("=== Garbage Collection Tests ===\n\n");
+
+    test_gc_collect();
+
+    printf("=== All tests passed! ===\n");
+    return 0;
+}
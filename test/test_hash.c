@@ -0,0 +1,372 @@
+#define _GNU_SOURCE
+#include "../src/hash.h"
+#include "../src/hash_cache.h"
+#include "../src/hash_blake2.h"
+#include "../src/io_ring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const char* tree_dir = "/tmp/rebuild_test_hash_tree";
+
+static void write_file(const char* name, const char* contents) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", tree_dir, name);
+    FILE* f = fopen(path, "w");
+    assert(f != NULL);
+    fputs(contents, f);
+    fclose(f);
+}
+
+static void run(const char* command) {
+    char line[1024];
+    snprintf(line, sizeof(line), "cd %s && %s", tree_dir, command);
+    assert(system(line) == 0);
+}
+
+static Hash tree_hash(void) {
+    Hash hash;
+    assert(hash_tree(tree_dir, &hash));
+    return hash;
+}
+
+static void reset_tree(void) {
+    char command[512];
+    snprintf(command, sizeof(command), "rm -rf %s && mkdir -p %s", tree_dir, tree_dir);
+    assert(system(command) == 0);
+}
+
+void test_hash_tree_structure(void) {
+    printf("Testing hash_tree structure...\n");
+
+    reset_tree();
+    Hash empty = tree_hash();
+
+    // Two identical files must not cancel each other out
+    write_file("a.txt", "same\n");
+    write_file("b.txt", "same\n");
+    Hash two = tree_hash();
+    assert(!hash_equal(&empty, &two));
+    printf("  Identical files counted\n");
+
+    // Renames and swapped contents change the hash
+    write_file("b.txt", "other\n");
+    Hash before = tree_hash();
+    run("mv a.txt c.txt");
+    Hash renamed = tree_hash();
+    assert(!hash_equal(&before, &renamed));
+    run("mv c.txt a.txt && mv a.txt x && mv b.txt a.txt && mv x b.txt");
+    Hash swapped = tree_hash();
+    assert(!hash_equal(&before, &swapped));
+    printf("  Renames and swaps detected\n");
+
+    // So do moves between directories and permission bits
+    reset_tree();
+    run("mkdir sub");
+    write_file("a.txt", "same\n");
+    write_file("b.txt", "other\n");
+    Hash flat = tree_hash();
+    run("mv b.txt sub/b.txt");
+    Hash moved = tree_hash();
+    assert(!hash_equal(&flat, &moved));
+    run("chmod +x a.txt");
+    Hash exec = tree_hash();
+    assert(!hash_equal(&moved, &exec));
+    printf("  Moves and executable bits detected\n");
+
+    // A directory does not hash like the file it contains
+    reset_tree();
+    write_file("only.txt", "only\n");
+    Hash dir_hash = tree_hash();
+    char path[512];
+    snprintf(path, sizeof(path), "%s/only.txt", tree_dir);
+    Hash file_hash;
+    assert(hash_file(path, &file_hash));
+    assert(!hash_equal(&dir_hash, &file_hash));
+
+    printf("  PASS\n\n");
+}
+
+void test_hash_tree_cached(void) {
+    printf("Testing hash_tree with cached subtrees...\n");
+
+    reset_tree();
+    run("mkdir -p a/b c");
+    write_file("a/b/deep.txt", "deep 1\n");
+    write_file("a/top.txt", "top\n");
+    write_file("c/other.txt", "other\n");
+
+    // Entries changed in the last second are never cached
+    usleep(1100000);
+    Hash first = tree_hash();
+    Hash again = tree_hash();
+    assert(hash_equal(&first, &again));
+    printf("  Unchanged tree hashes the same\n");
+
+    // A change deep down (same size, so only the stat signature tells)
+    write_file("a/b/deep.txt", "deep 2\n");
+    Hash changed = tree_hash();
+    assert(!hash_equal(&first, &changed));
+    write_file("a/b/deep.txt", "deep 1\n");
+    Hash restored = tree_hash();
+    assert(hash_equal(&first, &restored));
+    printf("  Nested change seen through cached parents\n");
+
+    // Without the cache the answer is the same
+    hash_cache_close();
+    Hash uncached = tree_hash();
+    assert(hash_equal(&first, &uncached));
+    printf("  Cached and uncached hashes agree\n");
+
+    char command[512];
+    snprintf(command, sizeof(command), "rm -rf %s", tree_dir);
+    assert(system(command) == 0);
+    printf("  PASS\n\n");
+}
+
+void test_hash_tree_parallel(void) {
+    printf("Testing hash_tree_parallel...\n");
+
+    reset_tree();
+    run("for d in 1 2 3 4 5 6 7 8; do mkdir -p d$d/inner; "
+        "for f in 1 2 3 4 5 6 7 8 9 10; do echo $d $f > d$d/f$f; echo $f > d$d/inner/g$f; done; done");
+    Hash serial = tree_hash();
+
+    WorkPool* pool = work_pool_create(4);
+    assert(pool != NULL);
+    Hash parallel;
+    assert(hash_tree_parallel(tree_dir, &parallel, pool));
+    assert(hash_equal(&serial, &parallel));
+    printf("  Parallel walk matches the serial one\n");
+
+    // Symlinks are followed; pipes and dangling links are left out
+    run("ln -s d1 link && ln -s missing dangling && mkfifo pipe");
+    Hash linked;
+    assert(hash_tree_parallel(tree_dir, &linked, pool));
+    run("rm dangling pipe");
+    Hash plain = tree_hash();
+    assert(hash_equal(&linked, &plain));
+    run("rm link");
+    plain = tree_hash();
+    assert(!hash_equal(&linked, &plain) && hash_equal(&plain, &serial));
+    printf("  Links followed, special files skipped\n");
+
+    work_pool_free(pool);
+    printf("  PASS\n\n");
+}
+
+// Write size pseudo-random bytes to name, returning them
+static uint8_t* write_data(const char* name, size_t size) {
+    uint8_t* data = malloc(size);
+    assert(data != NULL);
+    unsigned seed = (unsigned)size;
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (uint8_t)rand_r(&seed);
+    }
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", tree_dir, name);
+    FILE* f = fopen(path, "wb");
+    assert(f != NULL && fwrite(data, 1, size, f) == size);
+    fclose(f);
+    return data;
+}
+
+void test_hash_file_schemes(void) {
+    printf("Testing hash_file_scheme...\n");
+
+    reset_tree();
+    size_t large_size = 3 * HASH_PARALLEL_MIN + 1000;
+    uint8_t* large = write_data("large.bin", large_size);
+    uint8_t* small = write_data("small.bin", HASH_PARALLEL_MIN - 1);
+    char large_path[512], small_path[512];
+    snprintf(large_path, sizeof(large_path), "%s/large.bin", tree_dir);
+    snprintf(small_path, sizeof(small_path), "%s/small.bin", tree_dir);
+
+    Hash blake2b_large, blake2bp_large;
+    assert(blake2b(blake2b_large.bytes, 32, large, large_size, NULL, 0) == 0);
+    HashBlake2bp state;
+    hash_blake2bp_init(&state, 32);
+    hash_blake2bp_update(&state, large, large_size);
+    hash_blake2bp_final(&state, blake2bp_large.bytes);
+
+    // Twice each, the second time from the hash cache, which must keep
+    // the schemes apart
+    usleep(1100000);
+    for (int round = 0; round < 2; round++) {
+        Hash hash;
+        assert(hash_file(large_path, &hash) && hash_equal(&hash, &blake2bp_large));
+        assert(hash_file_scheme(large_path, HASH_SCHEME_BLAKE2BP, &hash) && hash_equal(&hash, &blake2bp_large));
+        assert(hash_file_scheme(large_path, HASH_SCHEME_BLAKE2B, &hash) && hash_equal(&hash, &blake2b_large));
+    }
+    printf("  Large files hash as BLAKE2bp, or BLAKE2b for the old scheme\n");
+
+    Hash small_hash, expected;
+    assert(blake2b(expected.bytes, 32, small, HASH_PARALLEL_MIN - 1, NULL, 0) == 0);
+    assert(hash_file_scheme(small_path, HASH_SCHEME_BLAKE2B, &small_hash) && hash_equal(&small_hash, &expected));
+    assert(hash_file(small_path, &small_hash) && hash_equal(&small_hash, &expected));
+    printf("  Smaller files hash the same under both\n");
+
+    assert(!hash_file_scheme(small_path, (HashScheme)7, &small_hash));
+
+    free(large);
+    free(small);
+    printf("  PASS\n\n");
+}
+
+void test_hash_file_sizes(void) {
+    printf("Testing hash_file across read strategies...\n");
+
+    // Around one read, buffered reads and mmap
+    reset_tree();
+    static const size_t sizes[] = {
+        0, 1, 4095, 65535, 65536, 65537, 4194303, 4194304, 4194304 + 4097,
+    };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        uint8_t* data = write_data("sized.bin", sizes[i]);
+        char path[512];
+        snprintf(path, sizeof(path), "%s/sized.bin", tree_dir);
+
+        Hash expected, actual;
+        assert(blake2b(expected.bytes, 32, data, sizes[i], NULL, 0) == 0);
+        assert(hash_file_scheme(path, HASH_SCHEME_BLAKE2B, &actual));
+        assert(hash_equal(&expected, &actual));
+        free(data);
+    }
+    printf("  Single read, buffered and mapped files hash alike\n");
+
+    // Pipes are read to the end without a size to go by
+    Hash piped, expected;
+    hash_data("piped\n", 6, &expected);
+    run("mkfifo fifo && (echo piped > fifo &)");
+    char fifo[512];
+    snprintf(fifo, sizeof(fifo), "%s/fifo", tree_dir);
+    assert(hash_file(fifo, &piped));
+    assert(hash_equal(&piped, &expected));
+    printf("  Unsized files read to the end\n");
+
+    printf("  PASS\n\n");
+}
+
+// hash_files_at against hash_file_scheme, file by file
+static void check_batch(const char* const* names, size_t count, HashScheme scheme, WorkPool* pool) {
+    Hash hashes[64];
+    bool ok[64];
+    assert(count <= 64);
+    int dir_fd = open(tree_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    assert(dir_fd >= 0);
+    bool all = hash_files_at(dir_fd, names, count, scheme, NULL, pool, hashes, ok);
+    close(dir_fd);
+
+    bool expect_all = true;
+    for (size_t i = 0; i < count; i++) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", tree_dir, names[i]);
+        Hash expected;
+        bool expected_ok = hash_file_scheme(path, scheme, &expected);
+        assert(ok[i] == expected_ok);
+        assert(!ok[i] || hash_equal(&hashes[i], &expected));
+        expect_all = expect_all && expected_ok;
+    }
+    assert(all == expect_all);
+}
+
+void test_hash_files_batch(void) {
+    printf("Testing hash_files_at...\n");
+
+    // More files than the ring has slots, around every read size, with a
+    // missing file, a directory and a file too large for the ring
+    reset_tree();
+    static const size_t sizes[] = {
+        0, 1, 4095, 65535, 65536, 65537, 131072, 200001, HASH_PARALLEL_MIN + 3, 4194304 + 1,
+    };
+    const size_t size_count = sizeof(sizes) / sizeof(sizes[0]);
+    char names[40][32];
+    const char* name_list[40];
+    for (size_t i = 0; i < 40; i++) {
+        snprintf(names[i], sizeof(names[i]), "f%zu.bin", i);
+        name_list[i] = names[i];
+        if (i != 7) {
+            free(write_data(names[i], sizes[i % size_count] + i / size_count));
+        }
+    }
+    snprintf(names[13], sizeof(names[13]), "sub");
+    run("mkdir sub");
+
+    IoRing* ring = io_ring_create(4);
+    printf("  io_uring %s\n", ring != NULL ? "available" : "unavailable, testing the fallback");
+    io_ring_free(ring);
+
+    WorkPool* pool = work_pool_create(4);
+    assert(pool != NULL);
+    usleep(1100000);
+    for (int round = 0; round < 2; round++) {
+        check_batch(name_list, 40, HASH_SCHEME_BLAKE2BP, pool);
+        check_batch(name_list, 40, HASH_SCHEME_BLAKE2B, NULL);
+    }
+    printf("  Batches match hash_file_scheme, from the cache too\n");
+
+    // Small batches, and no io_uring at all
+    check_batch(name_list, 3, HASH_SCHEME_CURRENT, pool);
+    setenv("REBUILD_IO_URING", "0", 1);
+    check_batch(name_list, 40, HASH_SCHEME_CURRENT, pool);
+    unsetenv("REBUILD_IO_URING");
+    Hash none;
+    bool none_ok;
+    assert(hash_files_at(AT_FDCWD, NULL, 0, HASH_SCHEME_CURRENT, NULL, pool, &none, &none_ok));
+    printf("  Fallback without io_uring agrees\n");
+
+    // Against expected hashes: the readable files only, one of them wrong
+    const char* readable[38];
+    Hash expected[38], hashes[38];
+    bool ok[38];
+    size_t count = 0;
+    for (size_t i = 0; i < 40; i++) {
+        if (i == 7 || i == 13) continue;
+        readable[count] = name_list[i];
+        char path[256];
+        snprintf(path, sizeof(path), "%s/%s", tree_dir, name_list[i]);
+        assert(hash_file_scheme(path, HASH_SCHEME_CURRENT, &expected[count]));
+        count++;
+    }
+    int dir_fd = open(tree_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    assert(dir_fd >= 0);
+    assert(hash_files_at(dir_fd, readable, count, HASH_SCHEME_CURRENT, expected, pool, hashes, ok));
+
+    expected[5].bytes[0] ^= 1;
+    for (int ring_off = 0; ring_off < 2; ring_off++) {
+        if (ring_off) setenv("REBUILD_IO_URING", "0", 1);
+        assert(!hash_files_at(dir_fd, readable, count, HASH_SCHEME_CURRENT, expected, pool, hashes, ok));
+        for (size_t i = 0; i < count; i++) {
+            assert(!ok[i] || i == 5 || hash_equal(&hashes[i], &expected[i]));
+        }
+    }
+    unsetenv("REBUILD_IO_URING");
+
+    // One by one, nothing after the mismatch is hashed
+    expected[0].bytes[0] ^= 1;
+    assert(!hash_files_at(dir_fd, readable, 3, HASH_SCHEME_CURRENT, expected, NULL, hashes, ok));
+    assert(ok[0] && !ok[1] && !ok[2]);
+    close(dir_fd);
+    printf("  Mismatch against expected hashes stops the batch\n");
+
+    work_pool_free(pool);
+    printf("  PASS\n\n");
+}
+
+int main(void) {
+    printf("=== Hash Tests ===\n\n");
+
+    test_hash_file_schemes();
+    test_hash_file_sizes();
+    test_hash_files_batch();
+    test_hash_tree_structure();
+    test_hash_tree_parallel();
+    test_hash_tree_cached();
+
+    printf("=== All tests passed! ===\n");
+    return 0;
+}
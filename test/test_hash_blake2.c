@@ -0,0 +1,102 @@
+#define _GNU_SOURCE
+#include "../src/hash_blake2.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// The reference BLAKE2bp to check against
+#include "../vendor/blake2/blake2bp-ref.c"
+
+static uint8_t input[64 * 1024 + 777];
+
+// Feed len bytes in pieces of pseudo-random size (0 to max_piece)
+static void blake2b_in_pieces(const uint8_t* in, size_t len, size_t max_piece, uint8_t out[32]) {
+    blake2b_state state;
+    assert(blake2b_init(&state, 32) == 0);
+    size_t done = 0;
+    unsigned seed = (unsigned)len;
+    while (done < len) {
+        size_t piece = rand_r(&seed) % (max_piece + 1);
+        if (piece > len - done) piece = len - done;
+        hash_blake2b_update(&state, in + done, piece);
+        done += piece;
+    }
+    hash_blake2b_final(&state, out);
+}
+
+static void blake2bp_in_pieces(const uint8_t* in, size_t len, size_t max_piece, uint8_t out[32]) {
+    HashBlake2bp state;
+    hash_blake2bp_init(&state, 32);
+    size_t done = 0;
+    unsigned seed = (unsigned)len;
+    while (done < len) {
+        size_t piece = rand_r(&seed) % (max_piece + 1);
+        if (piece > len - done) piece = len - done;
+        hash_blake2bp_update(&state, in + done, piece);
+        done += piece;
+    }
+    hash_blake2bp_final(&state, out);
+}
+
+// Both hashes against the reference, for lengths around every block and
+// stripe boundary, in one piece and in pieces of assorted sizes
+static void check_backend(void) {
+    static const size_t pieces[] = { 1, 100, 129, 600, 1500, 70000 };
+    for (size_t len = 0; len <= sizeof(input); len += (len < 3000 ? 1 : 4099)) {
+        uint8_t expected[32], actual[32];
+
+        assert(blake2b(expected, 32, input, len, NULL, 0) == 0);
+        blake2b_in_pieces(input, len, len, actual);
+        assert(memcmp(expected, actual, 32) == 0);
+
+        assert(blake2bp(expected, 32, input, len, NULL, 0) == 0);
+        blake2bp_in_pieces(input, len, len, actual);
+        assert(memcmp(expected, actual, 32) == 0);
+
+        if (len % 7 != 0 && len < 3000) continue;
+        for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++) {
+            blake2b_in_pieces(input, len, pieces[i], actual);
+            assert(blake2b(expected, 32, input, len, NULL, 0) == 0);
+            assert(memcmp(expected, actual, 32) == 0);
+            blake2bp_in_pieces(input, len, pieces[i], actual);
+            assert(blake2bp(expected, 32, input, len, NULL, 0) == 0);
+            assert(memcmp(expected, actual, 32) == 0);
+        }
+    }
+}
+
+void test_hash_blake2_backends(void) {
+    printf("Testing hash_blake2 against the reference...\n");
+
+    unsigned seed = 23;
+    for (size_t i = 0; i < sizeof(input); i++) {
+        input[i] = (uint8_t)rand_r(&seed);
+    }
+
+    const char* best = hash_blake2_backend_name();
+    static const HashBackend backends[] = {
+        HASH_BACKEND_PORTABLE, HASH_BACKEND_SSE41, HASH_BACKEND_AVX2,
+    };
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (!hash_blake2_set_backend(backends[i])) {
+            printf("  %d not supported by this CPU\n", (int)backends[i]);
+            continue;
+        }
+        check_backend();
+        printf("  %s matches BLAKE2b and BLAKE2bp\n", hash_blake2_backend_name());
+    }
+
+    assert(hash_blake2_set_backend(HASH_BACKEND_AUTO));
+    assert(strcmp(best, hash_blake2_backend_name()) == 0);
+    printf("  PASS\n\n");
+}
+
+int main(void) {
+    printf("=== BLAKE2 Backend Tests ===\n\n");
+
+    test_hash_blake2_backends();
+
+    printf("=== All tests passed! ===\n");
+    return 0;
+}
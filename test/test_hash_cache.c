@@ -0,0 +1,182 @@
+#include "../src/hash_cache.h"
+#include "../src/hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const char* cache_dir = "/tmp/rebuild_test_hash_cache";
+
+// A key for contents last changed long ago (never racy)
+static HashCacheKey old_key(uint64_t ino) {
+    HashCacheKey key = {
+        .dev = 42,
+        .ino = ino,
+        .size = 1234,
+        .mtime_ns = 1000000000ULL * 1000000,
+        .ctime_ns = 1000000000ULL * 1000000,
+    };
+    return key;
+}
+
+void test_hash_cache_lookup_store(void) {
+    printf("Testing hash_cache_store and hash_cache_lookup...\n");
+
+    Hash stored;
+    hash_data("cached contents", 15, &stored);
+
+    HashCacheKey key = old_key(1);
+    Hash found;
+    assert(!hash_cache_lookup(&key, &found));
+
+    hash_cache_store(&key, &stored);
+    assert(hash_cache_lookup(&key, &found));
+    assert(hash_equal(&found, &stored));
+    printf("  Stored hash found again\n");
+
+    // Same inode with different contents must miss
+    HashCacheKey changed = key;
+    changed.size++;
+    assert(!hash_cache_lookup(&changed, &found));
+    changed = key;
+    changed.ctime_ns++;
+    assert(!hash_cache_lookup(&changed, &found));
+    printf("  Changed signature missed\n");
+
+    printf("  PASS\n\n");
+}
+
+void test_hash_cache_racy(void) {
+    printf("Testing hash_cache_store with a recently changed file...\n");
+
+    Hash stored;
+    hash_data("racy", 4, &stored);
+
+    HashCacheKey key = old_key(2);
+    key.ctime_ns = (uint64_t)time(NULL) * 1000000000ULL;
+    hash_cache_store(&key, &stored);
+
+    Hash found;
+    assert(!hash_cache_lookup(&key, &found));
+    printf("  Racy entry was not cached\n");
+
+    printf("  PASS\n\n");
+}
+
+void test_hash_cache_tagged(void) {
+    printf("Testing tagged entries for one inode...\n");
+
+    Hash current, older;
+    hash_data("current scheme", 14, &current);
+    hash_data("older scheme", 12, &older);
+
+    // The same file's hash under two schemes, the older one tagged
+    HashCacheKey key = old_key(3);
+    HashCacheKey tagged = key;
+    tagged.size |= (uint64_t)1 << 56;
+
+    hash_cache_store(&key, &current);
+    hash_cache_store(&tagged, &older);
+    Hash found;
+    assert(hash_cache_lookup(&key, &found));
+    assert(hash_equal(&found, &current));
+    assert(hash_cache_lookup(&tagged, &found));
+    assert(hash_equal(&found, &older));
+
+    // Storing one again leaves the other alone
+    hash_cache_store(&key, &current);
+    assert(hash_cache_lookup(&tagged, &found));
+    assert(hash_equal(&found, &older));
+    printf("  Both entries kept\n");
+
+    // New contents replace only the entry with the same tag
+    HashCacheKey changed = key;
+    changed.mtime_ns += 1000;
+    hash_cache_store(&changed, &current);
+    assert(!hash_cache_lookup(&key, &found));
+    assert(hash_cache_lookup(&changed, &found));
+    assert(hash_cache_lookup(&tagged, &found));
+    assert(hash_equal(&found, &older));
+    printf("  Changed contents replaced their own entry\n");
+
+    printf("  PASS\n\n");
+}
+
+void test_hash_cache_persistent(void) {
+    printf("Testing the persistent hash cache...\n");
+
+    mkdir(cache_dir, 0755);
+    char path[256];
+    snprintf(path, sizeof(path), "%s/hashcache", cache_dir);
+    remove(path);
+
+    assert(hash_cache_open(cache_dir));
+
+    Hash stored;
+    hash_data("persistent", 10, &stored);
+    HashCacheKey key = old_key(3);
+    hash_cache_store(&key, &stored);
+
+    // Another process (or a later build) maps the same table
+    hash_cache_close();
+    assert(hash_cache_open(cache_dir));
+
+    Hash found;
+    assert(hash_cache_lookup(&key, &found));
+    assert(hash_equal(&found, &stored));
+    printf("  Entry survived reopening the table\n");
+
+    // The in-process memo does not leak into the persistent table
+    HashCacheKey memo_key = old_key(1);
+    assert(!hash_cache_lookup(&memo_key, &found));
+
+    printf("  PASS\n\n");
+}
+
+void test_hash_file_through_cache(void) {
+    printf("Testing hash_file with the cache...\n");
+
+    const char* test_file = "/tmp/rebuild_test_hash_cache.txt";
+    FILE* f = fopen(test_file, "w");
+    assert(f != NULL);
+    fprintf(f, "first version\n");
+    fclose(f);
+
+    Hash first, expected;
+    assert(hash_file(test_file, &first));
+    hash_data("first version\n", 14, &expected);
+    assert(hash_equal(&first, &expected));
+
+    // Rewriting the file must never return the old hash
+    f = fopen(test_file, "w");
+    assert(f != NULL);
+    fprintf(f, "second version\n");
+    fclose(f);
+
+    Hash second;
+    assert(hash_file(test_file, &second));
+    hash_data("second version\n", 15, &expected);
+    assert(hash_equal(&second, &expected));
+    printf("  Rewritten file hashed afresh\n");
+
+    remove(test_file);
+    printf("  PASS\n\n");
+}
+
+int main(void) {
+    printf("=== Hash Cache Tests ===\n\n");
+
+    test_hash_cache_lookup_store();
+    test_hash_cache_racy();
+    test_hash_cache_tagged();
+    test_hash_cache_persistent();
+    test_hash_file_through_cache();
+
+    hash_cache_close();
+
+    printf("=== All tests passed! ===\n");
+    return 0;
+}
@@ -0,0 +1,260 @@
+#define _GNU_SOURCE
+#include "../src/jobserver.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const char* fifo_path = "/tmp/rebuild_test_jobserver.fifo";
+
+// Point MAKEFLAGS at a jobserver: option is "--jobserver-auth=" or
+// "--jobserver-fds=", value "R,W" or "fifo:PATH"
+static void set_makeflags(const char* option, const char* value) {
+    char flags[256];
+    snprintf(flags, sizeof(flags), "-j4 %s%s", option, value);
+    assert(setenv("MAKEFLAGS", flags, 1) == 0);
+}
+
+static void set_makeflags_fds(const char* option, int read_fd, int write_fd) {
+    char value[32];
+    snprintf(value, sizeof(value), "%d,%d", read_fd, write_fd);
+    set_makeflags(option, value);
+}
+
+// Drain a pipe without blocking; returns the number of token bytes in it
+static int drain_tokens(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    assert(flags >= 0);
+    assert(fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0);
+    int count = 0;
+    char token;
+    while (read(fd, &token, 1) == 1) {
+        count++;
+    }
+    assert(fcntl(fd, F_SETFL, flags) == 0);
+    return count;
+}
+
+static void test_jobserver_server(void) {
+    printf("Testing jobserver created without MAKEFLAGS...\n");
+    unsetenv("MAKEFLAGS");
+
+    Jobserver* js = jobserver_connect(4);
+    assert(js != NULL);
+    assert(!jobserver_is_client(js));
+
+    // Advertised to children with the pipe descriptors
+    const char* makeflags = getenv("MAKEFLAGS");
+    assert(makeflags != NULL);
+    assert(strstr(makeflags, "-j4 --jobserver-auth=") != NULL);
+
+    // -j4 means the implicit token plus three in the pipe
+    assert(jobserver_try_acquire(js));
+    assert(jobserver_try_acquire(js));
+    assert(jobserver_try_acquire(js));
+    assert(!jobserver_try_acquire(js));
+    assert(jobserver_tokens_held(js) == 3);
+
+    jobserver_release(js);
+    assert(jobserver_tokens_held(js) == 2);
+    assert(jobserver_try_acquire(js));
+    assert(!jobserver_try_acquire(js));
+
+    jobserver_free(js);
+    unsetenv("MAKEFLAGS");
+    printf("  PASS\n\n");
+}
+
+// Join a pipe jobserver through option and check tokens go back to it
+static void check_pipe_client(const char* option) {
+    int fds[2];
+    assert(pipe(fds) == 0);
+    assert(write(fds[1], "ab", 2) == 2);
+    set_makeflags_fds(option, fds[0], fds[1]);
+
+    Jobserver* js = jobserver_connect(8);
+    assert(js != NULL);
+    assert(jobserver_is_client(js));
+
+    // Only the parent's tokens, not -j8's
+    assert(jobserver_try_acquire(js));
+    assert(jobserver_try_acquire(js));
+    assert(!jobserver_try_acquire(js));
+    assert(jobserver_tokens_held(js) == 2);
+
+    jobserver_release(js);
+    assert(jobserver_tokens_held(js) == 1);
+    assert(drain_tokens(fds[0]) == 1);
+
+    // Freeing returns the token still held
+    jobserver_free(js);
+    assert(drain_tokens(fds[0]) == 1);
+
+    // The parent's pipe stays open
+    assert(fcntl(fds[0], F_GETFD) >= 0);
+    assert(fcntl(fds[1], F_GETFD) >= 0);
+    close(fds[0]);
+    close(fds[1]);
+    unsetenv("MAKEFLAGS");
+}
+
+static void test_jobserver_auth_fds(void) {
+    printf("Testing --jobserver-auth=R,W from MAKEFLAGS...\n");
+    check_pipe_client("--jobserver-auth=");
+    printf("  PASS\n\n");
+}
+
+static void test_jobserver_legacy_fds(void) {
+    printf("Testing legacy --jobserver-fds=R,W from MAKEFLAGS...\n");
+    check_pipe_client("--jobserver-fds=");
+    printf("  PASS\n\n");
+}
+
+static void test_jobserver_last_option_wins(void) {
+    printf("Testing the last jobserver option in MAKEFLAGS wins...\n");
+    int fds[2];
+    assert(pipe(fds) == 0);
+    assert(write(fds[1], "a", 1) == 1);
+
+    // A stale legacy option followed by the current one, as make writes them
+    char flags[256];
+    snprintf(flags, sizeof(flags), "-j4 --jobserver-fds=998,999 --jobserver-auth=%d,%d -- CC=cc",
+             fds[0], fds[1]);
+    assert(setenv("MAKEFLAGS", flags, 1) == 0);
+
+    Jobserver* js = jobserver_connect(4);
+    assert(js != NULL);
+    assert(jobserver_is_client(js));
+    assert(jobserver_try_acquire(js));
+    assert(!jobserver_try_acquire(js));
+
+    jobserver_free(js);
+    assert(drain_tokens(fds[0]) == 1);
+    close(fds[0]);
+    close(fds[1]);
+    unsetenv("MAKEFLAGS");
+    printf("  PASS\n\n");
+}
+
+static void test_jobserver_fifo(void) {
+    printf("Testing --jobserver-auth=fifo:PATH from MAKEFLAGS...\n");
+    unlink(fifo_path);
+    assert(mkfifo(fifo_path, 0600) == 0);
+
+    char value[256];
+    snprintf(value, sizeof(value), "fifo:%s", fifo_path);
+    set_makeflags("--jobserver-auth=", value);
+
+    Jobserver* js = jobserver_connect(4);
+    assert(js != NULL);
+    assert(jobserver_is_client(js));
+    assert(!jobserver_try_acquire(js));
+
+    // The jobserver holds a reader open, so this does not block
+    int writer = open(fifo_path, O_WRONLY | O_NONBLOCK);
+    assert(writer >= 0);
+    assert(write(writer, "ab", 2) == 2);
+
+    assert(jobserver_try_acquire(js));
+    assert(jobserver_try_acquire(js));
+    assert(!jobserver_try_acquire(js));
+
+    jobserver_release(js);
+    assert(jobserver_try_acquire(js));
+
+    jobserver_free(js);
+    close(writer);
+    unlink(fifo_path);
+    unsetenv("MAKEFLAGS");
+    printf("  PASS\n\n");
+}
+
+static void test_jobserver_unavailable(void) {
+    printf("Testing a jobserver in MAKEFLAGS that is gone...\n");
+    // Descriptors this process does not have open
+    set_makeflags_fds("--jobserver-auth=", 998, 999);
+
+    // Falls back to its own server with -j2's single extra token
+    Jobserver* js = jobserver_connect(2);
+    assert(js != NULL);
+    assert(!jobserver_is_client(js));
+    assert(jobserver_try_acquire(js));
+    assert(!jobserver_try_acquire(js));
+    jobserver_free(js);
+
+    // A missing fifo falls back the same way
+    unlink(fifo_path);
+    char value[256];
+    snprintf(value, sizeof(value), "fifo:%s", fifo_path);
+    set_makeflags("--jobserver-auth=", value);
+    js = jobserver_connect(2);
+    assert(js != NULL);
+    assert(!jobserver_is_client(js));
+    jobserver_free(js);
+
+    unsetenv("MAKEFLAGS");
+    printf("  PASS\n\n");
+}
+
+static void on_token_ready(void* user_data) {
+    (*(int*)user_data)++;
+}
+
+static void test_jobserver_wait(void) {
+    printf("Testing jobserver_wait on a uv loop...\n");
+    int fds[2];
+    assert(pipe(fds) == 0);
+    set_makeflags_fds("--jobserver-auth=", fds[0], fds[1]);
+
+    Jobserver* js = jobserver_connect(4);
+    assert(js != NULL);
+    assert(!jobserver_try_acquire(js));
+
+    uv_loop_t loop;
+    assert(uv_loop_init(&loop) == 0);
+    int ready = 0;
+    jobserver_wait(js, &loop, on_token_ready, &ready);
+
+    // Nothing to read yet
+    uv_run(&loop, UV_RUN_NOWAIT);
+    assert(ready == 0);
+
+    // Another process returns a token
+    assert(write(fds[1], "a", 1) == 1);
+    uv_run(&loop, UV_RUN_ONCE);
+    assert(ready == 1);
+    assert(jobserver_try_acquire(js));
+
+    // The watcher stops after firing
+    jobserver_release(js);
+    uv_run(&loop, UV_RUN_NOWAIT);
+    assert(ready == 1);
+
+    jobserver_free(js);
+    uv_run(&loop, UV_RUN_DEFAULT);
+    assert(uv_loop_close(&loop) == 0);
+
+    assert(drain_tokens(fds[0]) == 1);
+    close(fds[0]);
+    close(fds[1]);
+    unsetenv("MAKEFLAGS");
+    printf("  PASS\n\n");
+}
+
+int main(void) {
+    printf("=== Jobserver Tests ===\n\n");
+
+    test_jobserver_server();
+    test_jobserver_auth_fds();
+    test_jobserver_legacy_fds();
+    test_jobserver_last_option_wins();
+    test_jobserver_fifo();
+    test_jobserver_unavailable();
+    test_jobserver_wait();
+
+    printf("=== All tests passed! ===\n");
+    return 0;
+}
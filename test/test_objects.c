@@ -0,0 +1,119 @@
+#define _GNU_SOURCE
+#include "../src/objects.h"
+#include "../src/hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const char* tree_dir = "/tmp/rebuild_test_objects";
+
+static void write_file(const char* rel, const char* contents, mode_t mode) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", tree_dir, rel);
+    FILE* f = fopen(path, "w");
+    assert(f != NULL);
+    fputs(contents, f);
+    fclose(f);
+    chmod(path, mode);
+}
+
+static char* read_file(const char* rel) {
+    static char contents[256];
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", tree_dir, rel);
+    FILE* f = fopen(path, "r");
+    if (!f) return NULL;
+    size_t n = fread(contents, 1, sizeof(contents) - 1, f);
+    contents[n] = '\0';
+    fclose(f);
+    return contents;
+}
+
+static void make_tree(void) {
+    assert(system("rm -rf /tmp/rebuild_test_objects") == 0);
+    mkdir(tree_dir, 0755);
+    mkdir("/tmp/rebuild_test_objects/sub", 0755);
+    mkdir("/tmp/rebuild_test_objects/empty", 0755);
+    write_file("a.txt", "alpha\n", 0644);
+    write_file("sub/tool", "#!/bin/sh\n", 0755);
+    assert(symlink("a.txt", "/tmp/rebuild_test_objects/link") == 0);
+}
+
+void test_objects_store_restore(void) {
+    printf("Testing objects_store_tree and objects_restore_tree...\n");
+
+    Storage* s = storage_init();
+    assert(s != NULL);
+    make_tree();
+
+    Hash stored;
+    assert(objects_store_tree(s, tree_dir, &stored));
+
+    Hash hashed;
+    assert(objects_hash_tree(tree_dir, &hashed));
+    assert(hash_equal(&stored, &hashed));
+    printf("  Tree hash matches the stored manifest\n");
+
+    // A clean checkout: everything is gone
+    assert(system("rm -rf /tmp/rebuild_test_objects") == 0);
+    assert(objects_restore_tree(s, &stored, tree_dir));
+    assert(strcmp(read_file("a.txt"), "alpha\n") == 0);
+    assert(strcmp(read_file("sub/tool"), "#!/bin/sh\n") == 0);
+
+    struct stat st;
+    assert(stat("/tmp/rebuild_test_objects/sub/tool", &st) == 0 && (st.st_mode & S_IXUSR));
+    assert(stat("/tmp/rebuild_test_objects/empty", &st) == 0 && S_ISDIR(st.st_mode));
+    char target[64];
+    ssize_t len = readlink("/tmp/rebuild_test_objects/link", target, sizeof(target) - 1);
+    assert(len == 5 && strncmp(target, "a.txt", 5) == 0);
+    assert(objects_hash_tree(tree_dir, &hashed) && hash_equal(&stored, &hashed));
+    printf("  Deleted tree restored\n");
+
+    storage_free(s);
+    printf("  PASS\n\n");
+}
+
+void test_objects_restore_stale(void) {
+    printf("Testing objects_restore_tree over a changed tree...\n");
+
+    Storage* s = storage_init();
+    assert(s != NULL);
+    make_tree();
+
+    Hash stored;
+    assert(objects_store_tree(s, tree_dir, &stored));
+
+    // Edited, extra and missing entries
+    write_file("a.txt", "edited\n", 0644);
+    write_file("extra.txt", "left over\n", 0644);
+    assert(system("rm -rf /tmp/rebuild_test_objects/sub") == 0);
+
+    assert(objects_restore_tree(s, &stored, tree_dir));
+    assert(strcmp(read_file("a.txt"), "alpha\n") == 0);
+    assert(read_file("extra.txt") == NULL);
+    assert(strcmp(read_file("sub/tool"), "#!/bin/sh\n") == 0);
+    printf("  Stale tree brought back to the stored one\n");
+
+    // Unknown trees can not be restored
+    Hash unknown;
+    hash_data("no such tree", 12, &unknown);
+    assert(!objects_restore_tree(s, &unknown, tree_dir));
+    printf("  Unknown tree refused\n");
+
+    assert(system("rm -rf /tmp/rebuild_test_objects") == 0);
+    storage_free(s);
+    printf("  PASS\n\n");
+}
+
+int main(void) {
+    printf("=== Object Store Tests ===\n\n");
+
+    test_objects_store_restore();
+    test_objects_restore_stale();
+
+    printf("=== All tests passed! ===\n");
+    return 0;
+}
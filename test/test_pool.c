@@ -0,0 +1,202 @@
+#define _GNU_SOURCE
+#include "../src/pool.h"
+#include <uv.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#define BATCH_SIZE 1000
+
+typedef struct CountContext {
+    atomic_int runs[BATCH_SIZE];   // Times each index ran
+    atomic_int total;              // Tasks run
+    size_t fail_index;             // Index that returns false, or BATCH_SIZE
+    unsigned delay_us;             // Time each task takes
+} CountContext;
+
+static void count_context_init(CountContext* ctx) {
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+        atomic_init(&ctx->runs[i], 0);
+    }
+    atomic_init(&ctx->total, 0);
+    ctx->fail_index = BATCH_SIZE;
+    ctx->delay_us = 0;
+}
+
+static bool count_task(size_t index, void* user_data) {
+    CountContext* ctx = (CountContext*)user_data;
+    assert(index < BATCH_SIZE);
+    if (ctx->delay_us) usleep(ctx->delay_us);
+    atomic_fetch_add(&ctx->runs[index], 1);
+    atomic_fetch_add(&ctx->total, 1);
+    return index != ctx->fail_index;
+}
+
+static void check_each_ran_once(CountContext* ctx, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        assert(atomic_load(&ctx->runs[i]) == 1);
+    }
+    assert(atomic_load(&ctx->total) == (int)count);
+}
+
+static void test_pool_run(void) {
+    printf("Testing work_pool_run...\n");
+    WorkPool* pool = work_pool_create(4);
+    assert(pool != NULL);
+
+    static CountContext ctx;
+    count_context_init(&ctx);
+    assert(work_pool_run(pool, BATCH_SIZE, count_task, &ctx));
+    check_each_ran_once(&ctx, BATCH_SIZE);
+    printf("  Every index ran once on the pool\n");
+
+    // Small batches and no pool run inline
+    count_context_init(&ctx);
+    assert(work_pool_run(pool, 1, count_task, &ctx));
+    check_each_ran_once(&ctx, 1);
+    count_context_init(&ctx);
+    assert(work_pool_run(NULL, BATCH_SIZE, count_task, &ctx));
+    check_each_ran_once(&ctx, BATCH_SIZE);
+    count_context_init(&ctx);
+    assert(work_pool_run(pool, 0, count_task, &ctx));
+    assert(atomic_load(&ctx.total) == 0);
+    assert(!work_pool_run(pool, 4, NULL, &ctx));
+    printf("  Inline and empty batches\n");
+
+    work_pool_free(pool);
+    printf("  PASS\n\n");
+}
+
+static void test_pool_cancel(void) {
+    printf("Testing work_pool_run cancellation...\n");
+
+    // Inline, nothing after the failing index starts
+    static CountContext ctx;
+    count_context_init(&ctx);
+    ctx.fail_index = 10;
+    assert(!work_pool_run(NULL, BATCH_SIZE, count_task, &ctx));
+    check_each_ran_once(&ctx, 11);
+    assert(atomic_load(&ctx.runs[11]) == 0);
+    printf("  Inline batch stopped at the failing task\n");
+
+    // On the pool, only tasks already claimed finish
+    WorkPool* pool = work_pool_create(4);
+    assert(pool != NULL);
+    count_context_init(&ctx);
+    ctx.fail_index = 0;
+    ctx.delay_us = 1000;
+    assert(!work_pool_run(pool, BATCH_SIZE, count_task, &ctx));
+    int ran = atomic_load(&ctx.total);
+    assert(atomic_load(&ctx.runs[0]) == 1);
+    assert(ran >= 1 && ran < BATCH_SIZE / 2);
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+        assert(atomic_load(&ctx.runs[i]) <= 1);
+    }
+    printf("  Pool batch stopped after %d of %d tasks\n", ran, BATCH_SIZE);
+
+    // The pool still runs later batches
+    count_context_init(&ctx);
+    assert(work_pool_run(pool, BATCH_SIZE, count_task, &ctx));
+    check_each_ran_once(&ctx, BATCH_SIZE);
+    printf("  Pool usable after a cancelled batch\n");
+
+    work_pool_free(pool);
+    printf("  PASS\n\n");
+}
+
+#define OUTER_TASKS 8
+#define INNER_TASKS 100
+
+typedef struct NestedContext {
+    WorkPool* pool;
+    atomic_int inner_runs[OUTER_TASKS * INNER_TASKS];
+} NestedContext;
+
+typedef struct InnerContext {
+    NestedContext* nested;
+    size_t outer;
+} InnerContext;
+
+static bool inner_task(size_t index, void* user_data) {
+    InnerContext* inner = (InnerContext*)user_data;
+    atomic_fetch_add(&inner->nested->inner_runs[inner->outer * INNER_TASKS + index], 1);
+    return true;
+}
+
+// A pool task that fans out its own batch on the same pool
+static bool outer_task(size_t index, void* user_data) {
+    NestedContext* nested = (NestedContext*)user_data;
+    InnerContext inner = { nested, index };
+    return work_pool_run(nested->pool, INNER_TASKS, inner_task, &inner);
+}
+
+static void test_pool_nested(void) {
+    printf("Testing nested work_pool_run...\n");
+
+    // Fewer threads than outer tasks: every thread ends up waiting inside
+    // a nested batch, which must still finish
+    static NestedContext nested;
+    nested.pool = work_pool_create(2);
+    assert(nested.pool != NULL);
+    for (size_t i = 0; i < OUTER_TASKS * INNER_TASKS; i++) {
+        atomic_init(&nested.inner_runs[i], 0);
+    }
+
+    assert(work_pool_run(nested.pool, OUTER_TASKS, outer_task, &nested));
+    for (size_t i = 0; i < OUTER_TASKS * INNER_TASKS; i++) {
+        assert(atomic_load(&nested.inner_runs[i]) == 1);
+    }
+
+    work_pool_free(nested.pool);
+    printf("  PASS\n\n");
+}
+
+#define CALLERS 4
+
+typedef struct CallerContext {
+    WorkPool* pool;
+    CountContext counts;
+    bool ok;
+} CallerContext;
+
+static void caller_thread(void* arg) {
+    CallerContext* caller = (CallerContext*)arg;
+    caller->ok = work_pool_run(caller->pool, BATCH_SIZE, count_task, &caller->counts);
+}
+
+static void test_pool_concurrent_callers(void) {
+    printf("Testing work_pool_run from several threads at once...\n");
+    WorkPool* pool = work_pool_create(3);
+    assert(pool != NULL);
+
+    static CallerContext callers[CALLERS];
+    uv_thread_t threads[CALLERS];
+    for (int i = 0; i < CALLERS; i++) {
+        callers[i].pool = pool;
+        count_context_init(&callers[i].counts);
+        callers[i].ok = false;
+        assert(uv_thread_create(&threads[i], caller_thread, &callers[i]) == 0);
+    }
+    for (int i = 0; i < CALLERS; i++) {
+        assert(uv_thread_join(&threads[i]) == 0);
+        assert(callers[i].ok);
+        check_each_ran_once(&callers[i].counts, BATCH_SIZE);
+    }
+
+    work_pool_free(pool);
+    printf("  PASS\n\n");
+}
+
+int main(void) {
+    printf("=== Work Pool Tests ===\n\n");
+
+    test_pool_run();
+    test_pool_cancel();
+    test_pool_nested();
+    test_pool_concurrent_callers();
+
+    printf("=== All tests passed! ===\n");
+    return 0;
+}
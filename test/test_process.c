@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+#include "../src/process.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <signal.h>
+
+#define MAX_RESULTS 32
+
+// Results collected by on_process_exit, indexed by the process's slot
+typedef struct Collected {
+    ProcessResult* results[MAX_RESULTS];
+    int finished;
+} Collected;
+
+typedef struct Slot {
+    Collected* collected;
+    int index;
+} Slot;
+
+static void on_process_exit(ProcessResult* result, void* user_data) {
+    Slot* slot = (Slot*)user_data;
+    assert(result != NULL);
+    assert(slot->collected->results[slot->index] == NULL);
+    slot->collected->results[slot->index] = result;
+    slot->collected->finished++;
+}
+
+static void collected_free(Collected* collected) {
+    for (int i = 0; i < MAX_RESULTS; i++) {
+        process_result_free(collected->results[i]);
+        collected->results[i] = NULL;
+    }
+    collected->finished = 0;
+}
+
+static size_t count_char(const char* s, char c) {
+    size_t count = 0;
+    for (; *s; s++) {
+        if (*s == c) count++;
+    }
+    return count;
+}
+
+static void test_process_concurrent(void) {
+    printf("Testing concurrent processes on one loop...\n");
+    uv_loop_t loop;
+    assert(uv_loop_init(&loop) == 0);
+    ProcessManager* mgr = process_manager_create(&loop);
+    assert(mgr != NULL);
+
+    static Collected collected;
+    Slot slots[5];
+    for (int i = 0; i < 5; i++) {
+        slots[i].collected = &collected;
+        slots[i].index = i;
+    }
+
+    const char* const out_and_err[] = { "sh", "-c", "echo out; echo err >&2; exit 3", NULL };
+    const char* const quiet[] = { "true", NULL };
+    // More than a pipe buffer on both streams: both must be drained at once
+    const char* const flood[] = {
+        "sh", "-c",
+        "head -c 300000 /dev/zero | tr '\\0' e >&2; head -c 500000 /dev/zero | tr '\\0' o", NULL,
+    };
+    const char* const in_dir[] = { "pwd", NULL };
+    const char* const slow[] = { "sh", "-c", "sleep 0.2; echo late", NULL };
+
+    process_spawn(mgr, slow, NULL, on_process_exit, &slots[0]);
+    process_spawn(mgr, out_and_err, NULL, on_process_exit, &slots[1]);
+    process_spawn(mgr, quiet, NULL, on_process_exit, &slots[2]);
+    process_spawn(mgr, flood, NULL, on_process_exit, &slots[3]);
+    process_spawn(mgr, in_dir, "/tmp", on_process_exit, &slots[4]);
+    assert(collected.finished == 0);
+
+    // The loop runs until every process has been reaped and drained
+    uv_run(&loop, UV_RUN_DEFAULT);
+    assert(collected.finished == 5);
+
+    ProcessResult* r = collected.results[0];
+    assert(r->exit_code == 0 && r->term_signal == 0);
+    assert(strcmp(r->stdout_data, "late\n") == 0);
+
+    r = collected.results[1];
+    assert(r->exit_code == 3);
+    assert(strcmp(r->stdout_data, "out\n") == 0);
+    assert(strcmp(r->stderr_data, "err\n") == 0);
+
+    r = collected.results[2];
+    assert(r->exit_code == 0);
+    assert(r->stdout_data[0] == '\0' && r->stderr_data[0] == '\0');
+
+    r = collected.results[3];
+    assert(r->exit_code == 0);
+    assert(strlen(r->stdout_data) == 500000 && count_char(r->stdout_data, 'o') == 500000);
+    assert(strlen(r->stderr_data) == 300000 && count_char(r->stderr_data, 'e') == 300000);
+    printf("  Both streams drained in full\n");
+
+    r = collected.results[4];
+    assert(r->exit_code == 0);
+    assert(strcmp(r->stdout_data, "/tmp\n") == 0);
+    printf("  Output, exit codes and working directory\n");
+
+    collected_free(&collected);
+    process_manager_free(mgr);
+    assert(uv_loop_close(&loop) == 0);
+    printf("  PASS\n\n");
+}
+
+static void test_process_reaping(void) {
+    printf("Testing SIGCHLD reaping of many children...\n");
+    uv_loop_t loop;
+    assert(uv_loop_init(&loop) == 0);
+    ProcessManager* mgr = process_manager_create(&loop);
+    assert(mgr != NULL);
+
+    // Exits close together coalesce into fewer SIGCHLDs
+    static Collected collected;
+    Slot slots[MAX_RESULTS];
+    for (int i = 0; i < MAX_RESULTS; i++) {
+        slots[i].collected = &collected;
+        slots[i].index = i;
+        char script[64];
+        snprintf(script, sizeof(script), "exit %d", i);
+        const char* const args[] = { "sh", "-c", script, NULL };
+        process_spawn(mgr, args, NULL, on_process_exit, &slots[i]);
+    }
+
+    uv_run(&loop, UV_RUN_DEFAULT);
+    assert(collected.finished == MAX_RESULTS);
+    for (int i = 0; i < MAX_RESULTS; i++) {
+        assert(collected.results[i]->exit_code == i);
+    }
+
+    collected_free(&collected);
+    process_manager_free(mgr);
+    assert(uv_loop_close(&loop) == 0);
+    printf("  PASS\n\n");
+}
+
+static void test_process_signal_and_rusage(void) {
+    printf("Testing killed processes and resource usage...\n");
+    uv_loop_t loop;
+    assert(uv_loop_init(&loop) == 0);
+    ProcessManager* mgr = process_manager_create(&loop);
+    assert(mgr != NULL);
+
+    static Collected collected;
+    Slot slots[2] = { { &collected, 0 }, { &collected, 1 } };
+    const char* const killed[] = { "sh", "-c", "kill -TERM $$", NULL };
+    const char* const busy[] = {
+        "sh", "-c", "i=0; while [ $i -lt 100000 ]; do i=$((i + 1)); done", NULL,
+    };
+    process_spawn(mgr, killed, NULL, on_process_exit, &slots[0]);
+    process_spawn(mgr, busy, NULL, on_process_exit, &slots[1]);
+    uv_run(&loop, UV_RUN_DEFAULT);
+    assert(collected.finished == 2);
+
+    ProcessResult* r = collected.results[0];
+    assert(r->exit_code == -1);
+    assert(r->term_signal == SIGTERM);
+    printf("  Terminating signal reported\n");
+
+    // wait4 reports the child's own usage
+    r = collected.results[1];
+    assert(r->exit_code == 0);
+    assert(rusage_cpu_time_us(&r->usage) > 0);
+    assert(r->usage.ru_maxrss > 0);
+    assert(rusage_cpu_time_us(NULL) == 0);
+    printf("  Resource usage recorded (%llu us CPU)\n",
+           (unsigned long long)rusage_cpu_time_us(&r->usage));
+
+    collected_free(&collected);
+    process_manager_free(mgr);
+    assert(uv_loop_close(&loop) == 0);
+    printf("  PASS\n\n");
+}
+
+static void test_process_spawn_failure(void) {
+    printf("Testing a command that can not be spawned...\n");
+    uv_loop_t loop;
+    assert(uv_loop_init(&loop) == 0);
+    ProcessManager* mgr = process_manager_create(&loop);
+    assert(mgr != NULL);
+
+    static Collected collected;
+    Slot slots[3] = { { &collected, 0 }, { &collected, 1 }, { &collected, 2 } };
+    const char* const missing[] = { "/nonexistent/rebuild-test-program", NULL };
+    const char* const empty[] = { NULL };
+    const char* const fine[] = { "echo", "still works", NULL };
+
+    // Failures are reported right away, without running the loop
+    process_spawn(mgr, missing, NULL, on_process_exit, &slots[0]);
+    process_spawn(mgr, empty, NULL, on_process_exit, &slots[1]);
+    assert(collected.finished == 2);
+
+    ProcessResult* r = collected.results[0];
+    assert(r->exit_code == 127 && r->term_signal == 0);
+    assert(r->stdout_data != NULL && r->stdout_data[0] == '\0');
+    assert(strstr(r->stderr_data, "Failed to execute /nonexistent/rebuild-test-program") != NULL);
+    assert(collected.results[1]->exit_code == 127);
+    printf("  Spawn failures reported with exit code 127\n");
+
+    // The manager carries on
+    process_spawn(mgr, fine, NULL, on_process_exit, &slots[2]);
+    uv_run(&loop, UV_RUN_DEFAULT);
+    assert(collected.finished == 3);
+    assert(strcmp(collected.results[2]->stdout_data, "still works\n") == 0);
+
+    collected_free(&collected);
+    process_manager_free(mgr);
+    assert(uv_loop_close(&loop) == 0);
+    printf("  PASS\n\n");
+}
+
+int main(void) {
+    printf("=== Process Engine Tests ===\n\n");
+
+    test_process_concurrent();
+    test_process_reaping();
+    test_process_signal_and_rusage();
+    test_process_spawn_failure();
+
+    printf("=== All tests passed! ===\n");
+    return 0;
+}
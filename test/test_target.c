@@ -0,0 +1,179 @@
+#define _GNU_SOURCE
+#include "../src/target.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+static const char* const target_names[] = {
+    "all", "lib", "lib/core", "lib/util", "lib:foo", "library", "test_glob", "test_sys", "tools/gen",
+};
+
+static TargetRegistry* create_test_registry(void) {
+    TargetRegistry* registry = target_registry_create(NULL);
+    assert(registry != NULL);
+    for (size_t i = 0; i < sizeof(target_names) / sizeof(target_names[0]); i++) {
+        assert(target_registry_register(registry, target_names[i], "target_fn", NULL) == REBUILD_OK);
+    }
+    return registry;
+}
+
+// Check that pattern matches exactly the expected names, in order
+static void check_match(TargetRegistry* registry, const char* pattern,
+                        const char* const* expected, size_t expected_count) {
+    size_t count = 99;
+    char** names = target_registry_match(registry, pattern, &count);
+    assert(count == expected_count);
+    if (expected_count == 0) {
+        assert(names == NULL);
+        return;
+    }
+    assert(names != NULL);
+    for (size_t i = 0; i < count; i++) {
+        assert(strcmp(names[i], expected[i]) == 0);
+    }
+    rebuild_free(names);
+}
+
+static void test_target_is_pattern(void) {
+    printf("Testing target_is_pattern...\n");
+
+    assert(!target_is_pattern(NULL));
+    assert(!target_is_pattern(""));
+    assert(!target_is_pattern("all"));
+    assert(!target_is_pattern("lib/core"));
+    assert(!target_is_pattern("lib:foo"));
+    assert(!target_is_pattern("lib.."));
+
+    assert(target_is_pattern("test_*"));
+    assert(target_is_pattern("lib/?ore"));
+    assert(target_is_pattern("lib/[cu]*"));
+    assert(target_is_pattern("..."));
+    assert(target_is_pattern("lib/..."));
+    assert(target_is_pattern("lib:..."));
+    assert(target_is_pattern("lib..."));
+
+    printf("  PASS\n\n");
+}
+
+static void test_target_match_wildcards(void) {
+    printf("Testing target_registry_match with shell wildcards...\n");
+    TargetRegistry* registry = create_test_registry();
+
+    const char* const tests[] = { "test_glob", "test_sys" };
+    check_match(registry, "test_*", tests, 2);
+
+    const char* const lib_any[] = { "lib/core", "lib/util" };
+    check_match(registry, "lib/*", lib_any, 2);
+    check_match(registry, "lib/[cu]*", lib_any, 2);
+
+    const char* const core[] = { "lib/core" };
+    check_match(registry, "lib/?ore", core, 1);
+
+    // Matches the whole name, not a prefix
+    const char* const lib_prefix[] = { "lib", "lib/core", "lib/util", "lib:foo", "library" };
+    check_match(registry, "lib*", lib_prefix, 5);
+    check_match(registry, "ib*", NULL, 0);
+
+    check_match(registry, "nothing_*", NULL, 0);
+
+    target_registry_free(registry);
+    printf("  PASS\n\n");
+}
+
+static void test_target_match_ellipsis(void) {
+    printf("Testing target_registry_match with trailing ...\n");
+    TargetRegistry* registry = create_test_registry();
+
+    // The base target and everything under it, but not library
+    const char* const lib_tree[] = { "lib", "lib/core", "lib/util", "lib:foo" };
+    check_match(registry, "lib/...", lib_tree, 4);
+    check_match(registry, "lib:...", lib_tree, 4);
+    check_match(registry, "lib...", lib_tree, 4);
+
+    // The base need not be a target itself
+    const char* const tools[] = { "tools/gen" };
+    check_match(registry, "tools/...", tools, 1);
+
+    const char* const core[] = { "lib/core" };
+    check_match(registry, "lib/core/...", core, 1);
+
+    check_match(registry, "missing/...", NULL, 0);
+
+    // Everything, sorted
+    size_t count = 0;
+    char** names = target_registry_match(registry, "...", &count);
+    assert(names != NULL);
+    assert(count == sizeof(target_names) / sizeof(target_names[0]));
+    for (size_t i = 0; i < count; i++) {
+        assert(strcmp(names[i], target_names[i]) == 0);
+    }
+    rebuild_free(names);
+
+    target_registry_free(registry);
+    printf("  PASS\n\n");
+}
+
+static void test_target_expand(void) {
+    printf("Testing target_registry_expand...\n");
+    TargetRegistry* registry = create_test_registry();
+
+    // Patterns expand in name order, plain names pass through unchecked,
+    // and targets named twice are built once
+    const char* const args[] = { "lib/...", "not_registered", "lib/core", "test_*" };
+    const char** targets = NULL;
+    size_t count = 0;
+    assert(target_registry_expand(registry, args, 4, &targets, &count) == REBUILD_OK);
+
+    const char* const expected[] = {
+        "lib", "lib/core", "lib/util", "lib:foo", "not_registered", "test_glob", "test_sys",
+    };
+    assert(count == sizeof(expected) / sizeof(expected[0]));
+    for (size_t i = 0; i < count; i++) {
+        assert(strcmp(targets[i], expected[i]) == 0);
+    }
+    rebuild_free(targets);
+
+    // No arguments, no targets
+    targets = NULL;
+    assert(target_registry_expand(registry, NULL, 0, &targets, &count) == REBUILD_OK);
+    assert(count == 0);
+    rebuild_free(targets);
+
+    target_registry_free(registry);
+    printf("  PASS\n\n");
+}
+
+static void test_target_expand_no_match(void) {
+    printf("Testing target_registry_expand with a pattern matching nothing...\n");
+    TargetRegistry* registry = create_test_registry();
+
+    const char* const args[] = { "all", "nothing_*", "lib/..." };
+    const char** targets = NULL;
+    size_t count = 42;
+    assert(target_registry_expand(registry, args, 3, &targets, &count) == REBUILD_ERROR_PARSE);
+
+    // Outputs are left alone on failure
+    assert(targets == NULL);
+    assert(count == 42);
+
+    const char* const ellipsis[] = { "missing/..." };
+    assert(target_registry_expand(registry, ellipsis, 1, &targets, &count) == REBUILD_ERROR_PARSE);
+    assert(targets == NULL);
+
+    target_registry_free(registry);
+    printf("  PASS\n\n");
+}
+
+int main(void) {
+    printf("=== Target Tests ===\n\n");
+
+    test_target_is_pattern();
+    test_target_match_wildcards();
+    test_target_match_ellipsis();
+    test_target_expand();
+    test_target_expand_no_match();
+
+    printf("=== All tests passed! ===\n");
+    return 0;
+}
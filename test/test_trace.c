@@ -1,11 +1,18 @@
+#define _GNU_SOURCE
 #include "../src/trace.h"
 #include "../src/storage.h"
 #include "../src/hash.h"
+#include "../src/hash_cache.h"
+#include "../src/pool.h"
+#include "../src/objects.h"
+#include "../src/scheduler.h"
+#include "../src/target.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 void test_trace_create_free(void) {
     printf("Testing trace_create and trace_free...\n");
@@ -21,6 +28,8 @@ void test_trace_create_free(void) {
     assert(t->dep_hashes == NULL);
     assert(t->cpu_time_ms == 0);
     assert(t->wall_time_ms == 0);
+    assert(t->peak_rss_kb == 0);
+    assert(t->hash_scheme == HASH_SCHEME_CURRENT);
 
     trace_free(t);
     printf("  PASS\n\n");
@@ -106,6 +115,233 @@ void test_trace_validate(void) {
     printf("  PASS\n\n");
 }
 
+void test_trace_validate_hash_scheme(void) {
+    printf("Testing trace_validate with an older hash scheme...\n");
+
+    // Large enough for the schemes to differ
+    const char* test_file = "/tmp/rebuild_test_large_dep.bin";
+    FILE* f = fopen(test_file, "wb");
+    assert(f != NULL);
+    for (size_t i = 0; i < HASH_PARALLEL_MIN / 8 + 1; i++) {
+        fwrite("largedep", 1, 8, f);
+    }
+    fclose(f);
+
+    Hash request_key;
+    hash_data("test_request_scheme", 19, &request_key);
+    Trace* t = trace_create(&request_key);
+    assert(t != NULL);
+
+    // A trace recorded before BLAKE2bp still validates
+    Hash old_hash, new_hash;
+    assert(hash_file_scheme(test_file, HASH_SCHEME_BLAKE2B, &old_hash));
+    assert(hash_file(test_file, &new_hash));
+    assert(!hash_equal(&old_hash, &new_hash));
+    assert(trace_add_dependency(t, test_file, &old_hash));
+    t->hash_scheme = HASH_SCHEME_BLAKE2B;
+    assert(trace_validate(t));
+
+    // ... as long as it says how it was hashed
+    t->hash_scheme = HASH_SCHEME_CURRENT;
+    assert(!trace_validate(t));
+    printf("  Dependencies rehashed with the trace's scheme\n");
+
+    remove(test_file);
+    trace_free(t);
+    printf("  PASS\n\n");
+}
+
+// Directory signatures follow the tree as hash_tree walks it
+void test_stat_signature_tree(void) {
+    printf("Testing stat_signature_get on directories...\n");
+
+    const char* dir = "/tmp/rebuild_test_sig_tree";
+    assert(system("rm -rf /tmp/rebuild_test_sig_tree && mkdir -p /tmp/rebuild_test_sig_tree/a/b && "
+                  "echo one > /tmp/rebuild_test_sig_tree/a/b/f") == 0);
+
+    StatSignature first, again;
+    assert(stat_signature_get(dir, &first));
+    assert(stat_signature_get(dir, &again));
+    assert(memcmp(&first, &again, sizeof(first)) == 0);
+    assert(first.size != 0 && first.ctime_ns >= first.mtime_ns && first.ino != 0);
+    printf("  Unchanged tree keeps its signature\n");
+
+    // A change two levels down, and a rename, both show
+    assert(system("echo two > /tmp/rebuild_test_sig_tree/a/b/f") == 0);
+    StatSignature changed;
+    assert(stat_signature_get(dir, &changed));
+    assert(changed.size != first.size);
+    assert(system("mv /tmp/rebuild_test_sig_tree/a/b/f /tmp/rebuild_test_sig_tree/a/b/g") == 0);
+    StatSignature renamed;
+    assert(stat_signature_get(dir, &renamed));
+    assert(renamed.size != changed.size);
+    printf("  Nested changes and renames change it\n");
+
+    assert(system("rm -rf /tmp/rebuild_test_sig_tree") == 0);
+    printf("  PASS\n\n");
+}
+
+// Whether a directory's current tree hash is in the hash cache, i.e. it was
+// hashed since it last changed
+static bool tree_hashed(const char* path) {
+    struct stat st;
+    Hash signature, hash;
+    uint64_t newest_ns;
+    assert(stat(path, &st) == 0);
+    assert(hash_tree_signature(path, &signature, &newest_ns));
+    return hash_cache_lookup_tree((uint64_t)st.st_dev, (uint64_t)st.st_ino, &signature, &hash);
+}
+
+// Whether a file's current contents are in the hash cache
+static bool file_hashed(const char* path) {
+    struct stat st;
+    assert(stat(path, &st) == 0);
+    HashCacheKey key = {
+        .dev = (uint64_t)st.st_dev,
+        .ino = (uint64_t)st.st_ino,
+        .size = (uint64_t)st.st_size,
+        .mtime_ns = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + (uint64_t)st.st_mtim.tv_nsec,
+        .ctime_ns = (uint64_t)st.st_ctim.tv_sec * 1000000000ULL + (uint64_t)st.st_ctim.tv_nsec,
+    };
+    Hash hash;
+    return hash_cache_lookup(&key, &hash);
+}
+
+void test_trace_validate_stops_early(void) {
+    printf("Testing trace_validate_parallel stops at the first changed dependency...\n");
+
+    assert(system("rm -rf /tmp/rebuild_test_stop && mkdir -p /tmp/rebuild_test_stop/a "
+                  "/tmp/rebuild_test_stop/b /tmp/rebuild_test_stop/c && "
+                  "echo a > /tmp/rebuild_test_stop/a/f && echo b > /tmp/rebuild_test_stop/b/f && "
+                  "echo c > /tmp/rebuild_test_stop/c/f && echo one > /tmp/rebuild_test_stop/one.c && "
+                  "echo two > /tmp/rebuild_test_stop/two.c") == 0);
+    // Let the trees age past the racy window so hashing them is cached
+    usleep(1100000);
+
+    Hash request_key, wrong_hash;
+    hash_data("stops_early", 11, &request_key);
+    hash_data("not the tree", 12, &wrong_hash);
+
+    // Without stat signatures every tree is rehashed, in order
+    Trace* t = trace_create(&request_key);
+    assert(t != NULL);
+    assert(trace_add_dependency(t, "/tmp/rebuild_test_stop/a", &wrong_hash));
+    assert(trace_add_dependency(t, "/tmp/rebuild_test_stop/b", &wrong_hash));
+    assert(!trace_validate_parallel(t, NULL));
+    assert(tree_hashed("/tmp/rebuild_test_stop/a"));
+    assert(!tree_hashed("/tmp/rebuild_test_stop/b"));
+    trace_free(t);
+    printf("  Changed tree skipped the trees after it\n");
+
+    // Likewise a changed file stops the files after it from being read
+    t = trace_create(&request_key);
+    assert(t != NULL);
+    assert(trace_add_dependency(t, "/tmp/rebuild_test_stop/one.c", &wrong_hash));
+    assert(trace_add_dependency(t, "/tmp/rebuild_test_stop/two.c", &wrong_hash));
+    assert(!trace_validate_parallel(t, NULL));
+    assert(file_hashed("/tmp/rebuild_test_stop/one.c"));
+    assert(!file_hashed("/tmp/rebuild_test_stop/two.c"));
+    trace_free(t);
+    printf("  Changed file skipped the files after it\n");
+
+    // A missing dependency stops validation before anything is rehashed,
+    // wherever it is and however many threads check signatures
+    WorkPool* pool = work_pool_create(4);
+    assert(pool != NULL);
+    t = trace_create(&request_key);
+    assert(t != NULL);
+    assert(trace_add_dependency(t, "/tmp/rebuild_test_stop/c", &wrong_hash));
+    assert(trace_add_dependency(t, "/tmp/rebuild_test_stop/missing.h", &wrong_hash));
+    assert(!trace_validate_parallel(t, pool));
+    assert(!tree_hashed("/tmp/rebuild_test_stop/c"));
+    trace_free(t);
+    printf("  Missing dependency skipped every rehash\n");
+
+    // Without the missing file the same tree is rehashed
+    t = trace_create(&request_key);
+    assert(t != NULL);
+    assert(trace_add_dependency(t, "/tmp/rebuild_test_stop/c", &wrong_hash));
+    assert(!trace_validate_parallel(t, pool));
+    assert(tree_hashed("/tmp/rebuild_test_stop/c"));
+    trace_free(t);
+
+    work_pool_free(pool);
+    assert(system("rm -rf /tmp/rebuild_test_stop") == 0);
+    printf("  PASS\n\n");
+}
+
+void test_trace_stat_signature(void) {
+    printf("Testing trace_validate with stat signatures...\n");
+
+    Storage* storage = storage_init();
+    assert(storage != NULL);
+
+    Hash request_key;
+    hash_data("stat_signature", 14, &request_key);
+
+    const char* test_file = "/tmp/rebuild_test_sig.txt";
+    FILE* f = fopen(test_file, "w");
+    assert(f != NULL);
+    fprintf(f, "signed content\n");
+    fclose(f);
+
+    StatSignature sig;
+    assert(stat_signature_get(test_file, &sig));
+    assert(sig.size == 15);
+    assert(sig.mtime_ns != 0 && sig.ino != 0);
+
+    // Record a deliberately wrong hash: only a rehash can notice it
+    Hash wrong_hash;
+    hash_data("not the content", 15, &wrong_hash);
+
+    Trace* t = trace_create(&request_key);
+    assert(t != NULL);
+    assert(trace_add_dependency_stat(t, test_file, &wrong_hash, &sig));
+
+    // Recorded well after the last change: the signature is trusted
+    t->recorded_ns = sig.ctime_ns + 10ULL * 1000000000ULL;
+    assert(trace_validate(t));
+    printf("  Unchanged signature skipped the rehash\n");
+
+    // Signatures survive a save/load round trip
+    assert(trace_save(t, storage));
+    Trace* loaded = trace_load(&request_key, storage);
+    assert(loaded != NULL);
+    assert(loaded->recorded_ns == t->recorded_ns);
+    assert(memcmp(&loaded->dep_stats[0], &sig, sizeof(StatSignature)) == 0);
+    assert(trace_validate(loaded));
+    printf("  Signature round-tripped through storage\n");
+
+    // Recorded in the same second as the change: racy, so it is rehashed
+    t->recorded_ns = sig.mtime_ns;
+    assert(!trace_validate(t));
+    printf("  Racy signature fell back to hashing\n");
+
+    // A changed file no longer matches its signature
+    Hash file_hash;
+    assert(hash_file(test_file, &file_hash));
+    Trace* t2 = trace_create(&request_key);
+    assert(t2 != NULL);
+    assert(trace_add_dependency_stat(t2, test_file, &file_hash, &sig));
+    t2->recorded_ns = sig.ctime_ns + 10ULL * 1000000000ULL;
+    f = fopen(test_file, "w");
+    assert(f != NULL);
+    fprintf(f, "changed content, longer\n");
+    fclose(f);
+    assert(!trace_validate(t2));
+    printf("  Modified dependency invalidated the trace\n");
+
+    char* trace_path = storage_get_trace_path(storage, &request_key);
+    remove(trace_path);
+    rebuild_free(trace_path);
+    remove(test_file);
+    trace_free(loaded);
+    trace_free(t2);
+    trace_free(t);
+    storage_free(storage);
+    printf("  PASS\n\n");
+}
+
 void test_trace_save_load(void) {
     printf("Testing trace_save and trace_load...\n");
 
@@ -132,6 +368,8 @@ void test_trace_save_load(void) {
     hash_data("output tree", 11, &t1->output_tree_hash);
     t1->cpu_time_ms = 1234;
     t1->wall_time_ms = 5678;
+    t1->peak_rss_kb = 204800;
+    t1->hash_scheme = HASH_SCHEME_BLAKE2B;
 
     // Save the trace
     bool success = trace_save(t1, storage);
@@ -153,6 +391,8 @@ void test_trace_save_load(void) {
     assert(hash_equal(&t2->output_tree_hash, &t1->output_tree_hash));
     assert(t2->cpu_time_ms == 1234);
     assert(t2->wall_time_ms == 5678);
+    assert(t2->peak_rss_kb == 204800);
+    assert(t2->hash_scheme == HASH_SCHEME_BLAKE2B);
     printf("  Loaded trace matches original\n");
 
     // Clean up - remove the trace file
@@ -215,12 +455,22 @@ void test_trace_binary_format(void) {
     assert(memcmp(magic, "RBTR", 4) == 0);
     printf("  Magic bytes correct: RBTR\n");
 
-    // Check version
-    uint32_t version;
-    fread(&version, sizeof(uint32_t), 1, f);
-    assert(version == 1);
+    // Check version (little-endian on every host)
+    uint8_t header[124];  // The rest of the 128-byte header
+    fread(header, 1, sizeof(header), f);
+    uint32_t version = header[0] | header[1] << 8 | header[2] << 16 | (uint32_t)header[3] << 24;
+    assert(version == 4);
     printf("  Version correct: %u\n", version);
 
+    // Fixed header fields, then the hash array
+    assert(memcmp(header + 4, &request_key, 32) == 0);
+    assert(header[68] == 1 && header[69] == 0);
+    assert(header[76] == (999 & 0xff) && header[77] == (999 >> 8));
+    Hash stored_dep;
+    fread(&stored_dep, 1, sizeof(stored_dep), f);
+    assert(hash_equal(&stored_dep, &dep_hash));
+    printf("  Header and hash array laid out as documented\n");
+
     fclose(f);
     remove(trace_path);
     rebuild_free(trace_path);
@@ -230,6 +480,51 @@ void test_trace_binary_format(void) {
     printf("  PASS\n\n");
 }
 
+void test_trace_load_version1(void) {
+    printf("Testing trace_load with a version 1 trace...\n");
+
+    Storage* storage = storage_init();
+    assert(storage != NULL);
+
+    Hash request_key;
+    hash_data("version1_trace", 14, &request_key);
+
+    // Version 1 layout: no peak RSS after the wall time
+    char* trace_path = storage_get_trace_path(storage, &request_key);
+    FILE* f = fopen(trace_path, "wb");
+    assert(f != NULL);
+    uint32_t version = 1;
+    uint64_t dep_count = 0;
+    uint64_t cpu_time = 11;
+    uint64_t wall_time = 22;
+    Hash output_hash;
+    hash_data("output", 6, &output_hash);
+    fwrite("RBTR", 1, 4, f);
+    fwrite(&version, sizeof(version), 1, f);
+    fwrite(request_key.bytes, 1, 32, f);
+    fwrite(&dep_count, sizeof(dep_count), 1, f);
+    fwrite(output_hash.bytes, 1, 32, f);
+    fwrite(&cpu_time, sizeof(cpu_time), 1, f);
+    fwrite(&wall_time, sizeof(wall_time), 1, f);
+    fclose(f);
+
+    Trace* t = trace_load(&request_key, storage);
+    assert(t != NULL);
+    assert(t->dep_count == 0);
+    assert(hash_equal(&t->output_tree_hash, &output_hash));
+    assert(t->cpu_time_ms == 11);
+    assert(t->wall_time_ms == 22);
+    assert(t->peak_rss_kb == 0);
+    assert(t->hash_scheme == HASH_SCHEME_BLAKE2B);
+    printf("  Version 1 trace loaded without peak RSS\n");
+
+    remove(trace_path);
+    rebuild_free(trace_path);
+    trace_free(t);
+    storage_free(storage);
+    printf("  PASS\n\n");
+}
+
 void test_trace_empty(void) {
     printf("Testing trace with no dependencies...\n");
 
@@ -327,15 +622,185 @@ void test_trace_large_dependency_set(void) {
     printf("  PASS\n\n");
 }
 
+void test_trace_mapped(void) {
+    printf("Testing a mapped trace...\n");
+
+    Storage* storage = storage_init();
+    assert(storage != NULL);
+
+    Hash request_key;
+    hash_data("mapped_trace", 12, &request_key);
+
+    Trace* t1 = trace_create(&request_key);
+    assert(t1 != NULL);
+    Hash dep_hash;
+    hash_data("dep", 3, &dep_hash);
+    StatSignature sig = { .size = 1, .mtime_ns = 2, .ctime_ns = 3, .ino = 4, .dev = 5 };
+    assert(trace_add_dependency_stat(t1, "/mapped/a.h", &dep_hash, &sig));
+    assert(trace_add_dependency(t1, "/mapped/b.h", &dep_hash));
+    assert(trace_save(t1, storage));
+
+    // Loaded arrays live in the mapping
+    Trace* t2 = trace_load(&request_key, storage);
+    assert(t2 != NULL);
+    assert(t2->map != NULL);
+    assert(strcmp(t2->dep_paths[1], "/mapped/b.h") == 0);
+    assert(memcmp(&t2->dep_stats[0], &sig, sizeof(sig)) == 0);
+    printf("  Trace used in place\n");
+
+    // Adding a dependency copies the arrays out first
+    Hash new_hash;
+    hash_data("new", 3, &new_hash);
+    assert(trace_add_dependency(t2, "/mapped/c.h", &new_hash));
+    assert(t2->map == NULL);
+    assert(t2->dep_count == 3);
+    assert(strcmp(t2->dep_paths[0], "/mapped/a.h") == 0);
+    assert(hash_equal(&t2->dep_hashes[0], &dep_hash));
+    assert(hash_equal(&t2->dep_hashes[2], &new_hash));
+    assert(memcmp(&t2->dep_stats[0], &sig, sizeof(sig)) == 0);
+    printf("  Loaded trace extended after copying out\n");
+
+    // A truncated file is rejected instead of read past its end
+    char* trace_path = storage_get_trace_path(storage, &request_key);
+    assert(truncate(trace_path, 150) == 0);
+    assert(trace_load(&request_key, storage) == NULL);
+    printf("  Truncated trace rejected\n");
+
+    remove(trace_path);
+    rebuild_free(trace_path);
+    trace_free(t1);
+    trace_free(t2);
+    storage_free(storage);
+    printf("  PASS\n\n");
+}
+
+void test_trace_target_dependency(void) {
+    printf("Testing target dependencies through save and load...\n");
+
+    Storage* storage = storage_init();
+    assert(storage != NULL);
+
+    const char* test_file = "/tmp/rebuild_test_target_dep.txt";
+    FILE* f = fopen(test_file, "w");
+    assert(f != NULL);
+    fprintf(f, "file dependency\n");
+    fclose(f);
+
+    Hash request_key, file_hash, output_hash;
+    hash_data("target_dependency", 17, &request_key);
+    assert(hash_file(test_file, &file_hash));
+    hash_data("lib output tree", 15, &output_hash);
+
+    Trace* t = trace_create(&request_key);
+    assert(t != NULL);
+    assert(trace_add_dependency(t, test_file, &file_hash));
+    assert(trace_add_target_dependency(t, "lib:core", &output_hash));
+    assert(t->dep_count == 2);
+    assert(trace_dependency_target(t, 0) == NULL);
+    assert(strcmp(trace_dependency_target(t, 1), "lib:core") == 0);
+    assert(trace_dependency_target(t, 2) == NULL);
+    assert(trace_save(t, storage));
+
+    Trace* loaded = trace_load(&request_key, storage);
+    assert(loaded != NULL);
+    assert(loaded->dep_count == 2);
+    assert(trace_dependency_target(loaded, 0) == NULL);
+    assert(strcmp(loaded->dep_paths[0], test_file) == 0);
+    assert(strcmp(trace_dependency_target(loaded, 1), "lib:core") == 0);
+    assert(hash_equal(&loaded->dep_hashes[1], &output_hash));
+    printf("  Target dependency round-tripped\n");
+
+    // Validation leaves the target to the scheduler and checks the file
+    assert(trace_validate(loaded));
+    printf("  trace_validate skipped the target dependency\n");
+
+    remove(test_file);
+    trace_free(t);
+    trace_free(loaded);
+    storage_free(storage);
+    printf("  PASS\n\n");
+}
+
+void test_trace_target_cutoff(void) {
+    printf("Testing early cutoff on target output hashes...\n");
+
+    Storage* storage = storage_init();
+    assert(storage != NULL);
+    Scheduler* sched = scheduler_create(storage);
+    assert(sched != NULL);
+    sched->registry = target_registry_create(NULL);
+    assert(sched->registry != NULL);
+    assert(target_registry_register(sched->registry, "lib", "target_lib", NULL) == REBUILD_OK);
+    assert(target_registry_register(sched->registry, "app", "target_app", NULL) == REBUILD_OK);
+
+    // app's recorded outputs, and the lib output it was built from
+    assert(system("rm -rf /tmp/rebuild_test_cutoff && mkdir -p /tmp/rebuild_test_cutoff/recorded && "
+                  "echo app > /tmp/rebuild_test_cutoff/recorded/app.bin") == 0);
+    Hash app_output, lib_output, other_output;
+    assert(objects_store_tree(storage, "/tmp/rebuild_test_cutoff/recorded", &app_output));
+    hash_data("lib output v1", 13, &lib_output);
+    hash_data("lib output v2", 13, &other_output);
+
+    // A trace for app under the request key the scheduler computes: without
+    // a build file the code hash is the function name's
+    Recipe* app = scheduler_get_recipe(sched, "app");
+    assert(app != NULL);
+    assert(recipe_set_output_dir(app, "/tmp/rebuild_test_cutoff/out") == REBUILD_OK);
+    Hash code_hash;
+    hash_data("target_app", 10, &code_hash);
+    recipe_compute_request_key(app, &code_hash);
+
+    Trace* t = trace_create(&app->request_key);
+    assert(t != NULL);
+    t->output_tree_hash = app_output;
+    assert(trace_add_target_dependency(t, "lib", &lib_output));
+    assert(trace_save(t, storage));
+    trace_free(t);
+
+    // lib was rebuilt in this run
+    Recipe* lib = scheduler_get_recipe(sched, "lib");
+    assert(lib != NULL);
+    lib->state = RECIPE_COMPLETE;
+    lib->has_output_hash = true;
+
+    // Different output: app has to run again
+    lib->output_hash = other_output;
+    assert(!scheduler_check_cache(sched, app));
+    assert(app->state == RECIPE_PENDING);
+    assert(!app->has_output_hash);
+    printf("  Changed output hash invalidated the dependent\n");
+
+    // Same output as recorded: app is cut off and restored from the cache
+    lib->output_hash = lib_output;
+    assert(scheduler_check_cache(sched, app));
+    assert(app->state == RECIPE_COMPLETE);
+    assert(app->has_output_hash && hash_equal(&app->output_hash, &app_output));
+    assert(access("/tmp/rebuild_test_cutoff/out/app.bin", F_OK) == 0);
+    printf("  Unchanged output hash kept the dependent's trace valid\n");
+
+    scheduler_free(sched);
+    storage_free(storage);
+    assert(system("rm -rf /tmp/rebuild_test_cutoff") == 0);
+    printf("  PASS\n\n");
+}
+
 int main(void) {
     printf("=== Trace System Tests ===\n\n");
 
     test_trace_create_free();
     test_trace_add_dependency();
     test_trace_validate();
+    test_trace_validate_hash_scheme();
+    test_trace_stat_signature();
+    test_stat_signature_tree();
+    test_trace_validate_stops_early();
     test_trace_save_load();
     test_trace_load_nonexistent();
+    test_trace_target_dependency();
+    test_trace_target_cutoff();
     test_trace_binary_format();
+    test_trace_load_version1();
+    test_trace_mapped();
     test_trace_empty();
     test_trace_large_dependency_set();
 
@@ -0,0 +1,418 @@
+#define _GNU_SOURCE
+#include "../src/trace_pack.h"
+#include "../src/hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const char* pack_dir = "/tmp/rebuild_test_trace_pack";
+
+// Remove every file in the pack directory
+static void clear_pack_dir(void) {
+    mkdir(pack_dir, 0755);
+    DIR* d = opendir(pack_dir);
+    assert(d != NULL);
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", pack_dir, entry->d_name);
+        unlink(path);
+    }
+    closedir(d);
+}
+
+static size_t count_segments(void) {
+    size_t count = 0;
+    DIR* d = opendir(pack_dir);
+    assert(d != NULL);
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len > 4 && strcmp(entry->d_name + len - 4, ".seg") == 0) count++;
+    }
+    closedir(d);
+    return count;
+}
+
+// A trace for key n depending on two shared paths and one of its own
+static Trace* make_trace(int n) {
+    char name[64];
+    snprintf(name, sizeof(name), "key-%d", n);
+    Hash key;
+    hash_data(name, strlen(name), &key);
+
+    Trace* t = trace_create(&key);
+    assert(t != NULL);
+    Hash h;
+    hash_data("shared", 6, &h);
+    StatSignature sig = { .size = 10, .mtime_ns = 20, .ctime_ns = 30, .ino = 40, .dev = 50 };
+    assert(trace_add_dependency_stat(t, "/src/common.h", &h, &sig));
+    assert(trace_add_dependency(t, "/src/util.h", &h));
+    snprintf(name, sizeof(name), "/src/file%d.c", n);
+    hash_data(name, strlen(name), &h);
+    assert(trace_add_dependency(t, name, &h));
+    hash_data("output", 6, &t->output_tree_hash);
+    t->cpu_time_ms = (uint64_t)n;
+    t->wall_time_ms = 2 * (uint64_t)n;
+    t->peak_rss_kb = 3 * (uint64_t)n;
+    t->recorded_ns = 4 * (uint64_t)n;
+    t->hash_scheme = n % 2 ? HASH_SCHEME_BLAKE2B : HASH_SCHEME_CURRENT;
+    return t;
+}
+
+static void assert_same_trace(const Trace* a, const Trace* b) {
+    assert(hash_equal(&a->request_key, &b->request_key));
+    assert(hash_equal(&a->output_tree_hash, &b->output_tree_hash));
+    assert(a->cpu_time_ms == b->cpu_time_ms);
+    assert(a->wall_time_ms == b->wall_time_ms);
+    assert(a->peak_rss_kb == b->peak_rss_kb);
+    assert(a->recorded_ns == b->recorded_ns);
+    assert(a->hash_scheme == b->hash_scheme);
+    assert(a->dep_count == b->dep_count);
+    for (size_t i = 0; i < a->dep_count; i++) {
+        assert(strcmp(a->dep_paths[i], b->dep_paths[i]) == 0);
+        assert(hash_equal(&a->dep_hashes[i], &b->dep_hashes[i]));
+        assert(memcmp(&a->dep_stats[i], &b->dep_stats[i], sizeof(StatSignature)) == 0);
+    }
+}
+
+void test_trace_pack_put_get(void) {
+    printf("Testing trace_pack_put and trace_pack_get...\n");
+    clear_pack_dir();
+
+    TracePack* pack = trace_pack_open(pack_dir);
+    assert(pack != NULL);
+    assert(trace_pack_count(pack) == 0);
+
+    Trace* t1 = make_trace(1);
+    Trace* t2 = make_trace(2);
+    assert(trace_pack_put(pack, t1));
+    assert(trace_pack_put(pack, t2));
+    assert(trace_pack_count(pack) == 2);
+
+    Trace* loaded = trace_pack_get(pack, &t1->request_key);
+    assert(loaded != NULL);
+    assert_same_trace(t1, loaded);
+    printf("  Trace read back from the pack\n");
+
+    // Both traces use the one string record for each shared path
+    Trace* other = trace_pack_get(pack, &t2->request_key);
+    assert(other != NULL);
+    assert(loaded->dep_paths[0] == other->dep_paths[0]);
+    assert(loaded->dep_paths[2] != other->dep_paths[2]);
+    printf("  Shared paths stored once\n");
+
+    // A pack trace can still grow like any other
+    Hash h;
+    hash_data("extra", 5, &h);
+    assert(trace_add_dependency(other, "/src/extra.h", &h));
+    assert(other->dep_count == 4);
+    assert(strcmp(other->dep_paths[0], "/src/common.h") == 0);
+    trace_free(other);
+
+    Hash missing;
+    hash_data("missing", 7, &missing);
+    assert(trace_pack_get(pack, &missing) == NULL);
+    printf("  Unknown key missed\n");
+
+    trace_free(loaded);
+    trace_pack_close(pack);
+
+    // Reopening indexes the segment again
+    pack = trace_pack_open(pack_dir);
+    assert(pack != NULL);
+    assert(trace_pack_count(pack) == 2);
+    loaded = trace_pack_get(pack, &t2->request_key);
+    assert(loaded != NULL);
+    assert_same_trace(t2, loaded);
+    printf("  Traces survived reopening the pack\n");
+
+    trace_free(loaded);
+    trace_pack_close(pack);
+    trace_free(t1);
+    trace_free(t2);
+    printf("  PASS\n\n");
+}
+
+void test_trace_pack_replace(void) {
+    printf("Testing trace_pack_put over an existing key...\n");
+    clear_pack_dir();
+
+    TracePack* pack = trace_pack_open(pack_dir);
+    assert(pack != NULL);
+
+    Trace* t = make_trace(7);
+    assert(trace_pack_put(pack, t));
+    t->cpu_time_ms = 99;
+    assert(trace_pack_put(pack, t));
+    assert(trace_pack_count(pack) == 1);
+
+    Trace* loaded = trace_pack_get(pack, &t->request_key);
+    assert(loaded != NULL);
+    assert(loaded->cpu_time_ms == 99);
+    trace_free(loaded);
+    printf("  Newest trace wins\n");
+
+    trace_pack_close(pack);
+    trace_free(t);
+    printf("  PASS\n\n");
+}
+
+void test_trace_pack_variants(void) {
+    printf("Testing trace variants for one key...\n");
+    clear_pack_dir();
+
+    TracePack* pack = trace_pack_open(pack_dir);
+    assert(pack != NULL);
+
+    // Same key, different inputs: e.g. the same target on two branches
+    Trace* a = make_trace(3);
+    Trace* b = make_trace(3);
+    hash_data("branch", 6, &b->dep_hashes[2]);
+    b->cpu_time_ms = 42;
+    assert(trace_pack_put(pack, a));
+    assert(trace_pack_put(pack, b));
+    assert(trace_pack_count(pack) == 1);
+
+    Trace* variants[TRACE_PACK_VARIANTS];
+    assert(trace_pack_get_variants(pack, &a->request_key, variants, TRACE_PACK_VARIANTS) == 2);
+    assert_same_trace(b, variants[0]);
+    assert_same_trace(a, variants[1]);
+    trace_free(variants[0]);
+    trace_free(variants[1]);
+    printf("  Both variants kept, newest first\n");
+
+    // Recording the first inputs again replaces that variant only
+    a->cpu_time_ms = 77;
+    assert(trace_pack_put(pack, a));
+    assert(trace_pack_get_variants(pack, &a->request_key, variants, TRACE_PACK_VARIANTS) == 2);
+    assert_same_trace(a, variants[0]);
+    assert_same_trace(b, variants[1]);
+    trace_free(variants[0]);
+    trace_free(variants[1]);
+    printf("  Same inputs replace their variant\n");
+
+    // The oldest variant goes once the key is full
+    for (int i = 0; i < TRACE_PACK_VARIANTS; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "variant-%d", i);
+        hash_data(name, strlen(name), &b->dep_hashes[2]);
+        assert(trace_pack_put(pack, b));
+    }
+    size_t count = trace_pack_get_variants(pack, &a->request_key, variants, TRACE_PACK_VARIANTS);
+    assert(count == TRACE_PACK_VARIANTS);
+    for (size_t i = 0; i < count; i++) {
+        assert(!hash_equal(&variants[i]->dep_hashes[2], &a->dep_hashes[2]));
+        trace_free(variants[i]);
+    }
+    printf("  Oldest variant evicted\n");
+
+    trace_pack_close(pack);
+
+    // Reopening rebuilds the same variants
+    pack = trace_pack_open(pack_dir);
+    assert(pack != NULL);
+    assert(trace_pack_get_variants(pack, &a->request_key, variants, TRACE_PACK_VARIANTS) == TRACE_PACK_VARIANTS);
+    assert(hash_equal(&variants[0]->dep_hashes[2], &b->dep_hashes[2]));
+    for (size_t i = 0; i < TRACE_PACK_VARIANTS; i++) {
+        trace_free(variants[i]);
+    }
+    printf("  Variants survived reopening the pack\n");
+
+    trace_pack_close(pack);
+    trace_free(a);
+    trace_free(b);
+    printf("  PASS\n\n");
+}
+
+static bool keep_other_keys(const TracePackVariant* v, void* ctx) {
+    return !hash_equal(&v->request_key, (const Hash*)ctx);
+}
+
+// The listed variant of key, or NULL
+static const TracePackVariant* find_listed(const TracePackVariant* variants, size_t count, const Hash* key) {
+    for (size_t i = 0; i < count; i++) {
+        if (hash_equal(&variants[i].request_key, key)) return &variants[i];
+    }
+    return NULL;
+}
+
+void test_trace_pack_touch_rewrite(void) {
+    printf("Testing trace_pack_touch, trace_pack_list and trace_pack_rewrite...\n");
+    clear_pack_dir();
+
+    TracePack* pack = trace_pack_open(pack_dir);
+    assert(pack != NULL);
+    Trace* t1 = make_trace(1);
+    Trace* t2 = make_trace(2);
+    assert(trace_pack_put(pack, t1));
+    assert(trace_pack_put(pack, t2));
+
+    TracePackVariant* variants = NULL;
+    size_t count = 0;
+    assert(trace_pack_list(pack, &variants, &count) && count == 2);
+    const TracePackVariant* v1 = find_listed(variants, count, &t1->request_key);
+    assert(v1 != NULL && v1->used_ns == t1->recorded_ns);
+    assert(hash_equal(&v1->output_tree_hash, &t1->output_tree_hash));
+    assert(v1->size > 0);
+    rebuild_free(variants);
+
+    // A cache hit makes the variant recently used, also after reopening
+    Trace* hit = trace_pack_get(pack, &t1->request_key);
+    assert(hit != NULL);
+    trace_pack_touch(pack, hit);
+    trace_free(hit);
+    trace_pack_close(pack);
+
+    pack = trace_pack_open(pack_dir);
+    assert(pack != NULL);
+    assert(trace_pack_list(pack, &variants, &count) && count == 2);
+    uint64_t used_ns = find_listed(variants, count, &t1->request_key)->used_ns;
+    assert(used_ns > 1000000000ULL * 1000000000ULL);
+    assert(find_listed(variants, count, &t2->request_key)->used_ns == t2->recorded_ns);
+    rebuild_free(variants);
+    printf("  Cache hit recorded\n");
+
+    // Rewriting keeps what the filter accepts, in one new segment
+    assert(trace_pack_rewrite(pack, keep_other_keys, &t2->request_key));
+    assert(trace_pack_count(pack) == 1);
+    assert(trace_pack_get(pack, &t2->request_key) == NULL);
+    Trace* kept = trace_pack_get(pack, &t1->request_key);
+    assert(kept != NULL);
+    assert_same_trace(t1, kept);
+    trace_free(kept);
+    assert(count_segments() == 1);
+    trace_pack_close(pack);
+
+    pack = trace_pack_open(pack_dir);
+    assert(pack != NULL);
+    assert(trace_pack_list(pack, &variants, &count) && count == 1);
+    assert(hash_equal(&variants[0].request_key, &t1->request_key));
+    assert(variants[0].used_ns == used_ns);
+    rebuild_free(variants);
+    printf("  Dropped variant gone, last use kept\n");
+
+    trace_pack_close(pack);
+    trace_free(t1);
+    trace_free(t2);
+    printf("  PASS\n\n");
+}
+
+void test_trace_pack_torn_tail(void) {
+    printf("Testing a pack with a torn record...\n");
+    clear_pack_dir();
+
+    TracePack* pack = trace_pack_open(pack_dir);
+    assert(pack != NULL);
+    Trace* t1 = make_trace(1);
+    assert(trace_pack_put(pack, t1));
+    trace_pack_close(pack);
+
+    // A crash in the middle of an append leaves a partial record
+    char path[512];
+    snprintf(path, sizeof(path), "%s/00000001.seg", pack_dir);
+    FILE* f = fopen(path, "ab");
+    assert(f != NULL);
+    fwrite("\x02\x00\x00\x00\xff\x00\x00\x00garbage", 1, 15, f);
+    fclose(f);
+
+    pack = trace_pack_open(pack_dir);
+    assert(pack != NULL);
+    assert(trace_pack_count(pack) == 1);
+
+    // The next append overwrites the torn record
+    Trace* t2 = make_trace(2);
+    assert(trace_pack_put(pack, t2));
+    trace_pack_close(pack);
+
+    pack = trace_pack_open(pack_dir);
+    assert(pack != NULL);
+    assert(trace_pack_count(pack) == 2);
+    Trace* loaded = trace_pack_get(pack, &t2->request_key);
+    assert(loaded != NULL);
+    assert_same_trace(t2, loaded);
+    printf("  Torn record ignored and overwritten\n");
+
+    trace_free(loaded);
+    trace_pack_close(pack);
+    trace_free(t1);
+    trace_free(t2);
+    printf("  PASS\n\n");
+}
+
+void test_trace_pack_compact(void) {
+    printf("Testing trace_pack_compact...\n");
+    clear_pack_dir();
+
+    // Write six segments by hand: the pack only rolls over at 64 MiB
+    const char* scratch_dir = "/tmp/rebuild_test_trace_pack_segment";
+    for (int seg = 1; seg <= 6; seg++) {
+        TracePack* pack = trace_pack_open(scratch_dir);
+        assert(pack != NULL);
+        for (int i = 0; i < 3; i++) {
+            Trace* t = make_trace(i);
+            t->cpu_time_ms = (uint64_t)seg;
+            assert(trace_pack_put(pack, t));
+            trace_free(t);
+        }
+        Trace* t = make_trace(100 + seg);
+        assert(trace_pack_put(pack, t));
+        trace_free(t);
+        trace_pack_close(pack);
+
+        char from[512], to[512];
+        snprintf(from, sizeof(from), "%s/00000001.seg", scratch_dir);
+        snprintf(to, sizeof(to), "%s/%08d.seg", pack_dir, 10 + seg);
+        assert(rename(from, to) == 0);
+    }
+    assert(count_segments() == 6);
+
+    // Five sealed segments merge into one; the active one is left alone
+    assert(trace_pack_compact(pack_dir));
+    assert(count_segments() == 2);
+
+    TracePack* pack = trace_pack_open(pack_dir);
+    assert(pack != NULL);
+    assert(trace_pack_count(pack) == 3 + 6);
+    for (int i = 0; i < 3; i++) {
+        Trace* expected = make_trace(i);
+        Trace* loaded = trace_pack_get(pack, &expected->request_key);
+        assert(loaded != NULL);
+        expected->cpu_time_ms = 6;
+        assert_same_trace(expected, loaded);
+        trace_free(loaded);
+        trace_free(expected);
+    }
+    for (int seg = 1; seg <= 6; seg++) {
+        Trace* expected = make_trace(100 + seg);
+        Trace* loaded = trace_pack_get(pack, &expected->request_key);
+        assert(loaded != NULL);
+        assert_same_trace(expected, loaded);
+        trace_free(loaded);
+        trace_free(expected);
+    }
+    printf("  Merged segments keep the newest trace per key\n");
+
+    trace_pack_close(pack);
+    clear_pack_dir();
+    printf("  PASS\n\n");
+}
+
+int main(void) {
+    printf("=== Trace Pack Tests ===\n\n");
+
+    test_trace_pack_put_get();
+    test_trace_pack_replace();
+    test_trace_pack_variants();
+    test_trace_pack_touch_rewrite();
+    test_trace_pack_torn_tail();
+    test_trace_pack_compact();
+
+    printf("=== All tests passed! ===\n");
+    return 0;
+}